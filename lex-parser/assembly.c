@@ -2,12 +2,15 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <stdarg.h>
 
 #include "node.h"
 #include "utils.h"
 #include "symbol_table.c"
+#include "cfg.c"
 
 #define MAX_Labels 100
+#define ASSEMBLY_CHUNK 1024
 
 int labelCounter = 1;
 
@@ -15,20 +18,89 @@ int ifIndex = -1;
 int loopIndex = -1;
 
 int switchIndex = -1;
-int switchSkipIndex = -1; // this to jump to next case in there's no break statement
-int switchOutIndex = -1;
 
 int ifLabels[MAX_Labels];
 int loopLabels[MAX_Labels];
+bool loopHasContinueLabel[MAX_Labels]; // do-while conditions and for steps have their own label for continue
+int forStepStarts[MAX_Labels]; // per loop, where the step of a for starts
+int forBodyStarts[MAX_Labels];
 
-int switchLabels[MAX_Labels];
-int switchSkipLabels[MAX_Labels];
-int switchOutIndicies[MAX_Labels];
+int switchLabels[MAX_Labels]; // out label of every open switch
+int switchStarts[MAX_Labels]; // where its dispatch code goes
 Node* switchExpression[MAX_Labels];
-
-bool stopPushVarInSwitch = false;
+SwitchCases switchCases[MAX_Labels];
+int switchSlots[MAX_Labels]; // where the switch value is, the slot of the variable or one of its own for an expression
+bool switchSlotIsGlobal[MAX_Labels];
+int switchExpressionStart = 0;
 
 bool isFunctReturned = false;
+bool isTailCall = false; // the return already left through a tailcall or jmp, no ret after it
+
+// open && / || operators, same labels as in the quads: FALSE_LABELn false exits, LABELn end,
+// FALSE_LABELm start of the right side and LABELm true exit of an ||
+int shortIndex = -1;
+int shortLabels[MAX_Labels];
+int shortRhsLabels[MAX_Labels];
+int shortStarts[MAX_Labels];
+
+// the last && / || pushed as a value, a jf right after it takes its exits instead
+int assemblyShortLabel = -1;
+int assemblyShortStart = -1;
+int assemblyShortTail = -1;
+int assemblyShortEnd = -1;
+
+// global code is kept in front of the functions so it all runs before main
+int assemblyGlobalEnd = 0;
+int assemblyGlobalStart = 0; // global code emitted since the last function ends here
+
+int assemblyFunctionBody = -1; // first line after the enter of the current function
+int assemblyEnterLine = -1; // its enter, the frame size is only known at the end of the function
+bool assemblyHasTailLabel = false;
+
+// lines are kept in memory like the quads, so -O can rewrite the jumps before they are written
+char** assemblyLines = NULL;
+int assemblyLineCount = 0;
+int assemblyLineCapacity = 0;
+bool assemblyWritten = false;
+
+void emitAssembly(char* format, ...) {
+    char line[512];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+
+    if (assemblyLineCount == assemblyLineCapacity) {
+        assemblyLineCapacity += ASSEMBLY_CHUNK;
+        assemblyLines = (char**)realloc(assemblyLines, assemblyLineCapacity * sizeof(char*));
+        if (assemblyLines == NULL) {
+            fprintf(stderr, "Memory allocation failed\n");
+            exit(1);
+        }
+    }
+    assemblyLines[assemblyLineCount++] = strdup(line);
+}
+
+void writeAssembly() {
+    if (assemblyWritten || assemblyFileHandler.filePointer == NULL) {
+        return;
+    }
+    assemblyWritten = true;
+
+    for (int i = 0; i < assemblyLineCount; i++) {
+        fputs(assemblyLines[i], assemblyFileHandler.filePointer);
+    }
+}
+
+// moves the lines from 'from' to the end in front of index
+void moveAssemblyLinesBefore(int index, int from) {
+    int count = assemblyLineCount - from;
+    char** moved = (char**)malloc((count + 1) * sizeof(char*));
+    memcpy(moved, &assemblyLines[from], count * sizeof(char*));
+    memmove(&assemblyLines[index + count], &assemblyLines[index], (from - index) * sizeof(char*));
+    memcpy(&assemblyLines[index], moved, count * sizeof(char*));
+    free(moved);
+}
 
 void assemblyPushConst(Node* node) {
     if (node == NULL) {
@@ -51,99 +123,295 @@ void assemblyPushConst(Node* node) {
         fprintf(stderr, "Unknown data type: %s\n", node->dataType);
         return;
     }
-    fprintf(assemblyFileHandler.filePointer, "\tpush %s\n", buffer);
+    emitAssembly("\tpush %s\n", buffer);
 
 }
 
+// variables are loaded from their slot, gload / gstore for the global frame
+void assemblySlot(char* operation, int slot, bool isGlobal) {
+    emitAssembly("\t%s%s %d\n", isGlobal ? "g" : "", operation, slot);
+}
+
 void assemblyPushVar(char* name) {
     if (name == NULL) {
         fprintf(stderr, "Variable name is NULL\n");
         return;
     }
-    fprintf(assemblyFileHandler.filePointer, "\tpush %s\n", name);
+    if (isConstOperand(name)) {
+        emitAssembly("\tpush %s\n", name);
+        return;
+    }
+    int id = lookup(name);
+    assemblySlot("load", symbolTable[id].slot, symbolTable[id].isGlobalSlot);
 }
 
 void assemblyOperation(char* operation) {
-    fprintf(assemblyFileHandler.filePointer, "\t%s\n", operation);
+    emitAssembly("\t%s\n", operation);
+}
+
+// int, char and bool values are all ints to the VM
+bool isIntLikeType(char* dataType) {
+    return strcmp(dataType, "int") == 0 || strcmp(dataType, "char") == 0 || strcmp(dataType, "bool") == 0;
+}
+
+void assemblyExpressionEnd(Node* expression) {
+    if (expression != NULL) {
+        expression->assemblyEnd = assemblyLineCount;
+    }
+}
+
+// add, lt, ... for the static types of the operands: iadd, flt, sconcat, ...
+// the int side of an int and float operation gets an i2f, the left one where its code ends
+void assemblyBinaryOperation(char* operation, Node* left, Node* right) {
+    bool isFloat = strcmp(left->dataType, "float") == 0 || strcmp(right->dataType, "float") == 0;
+    if (isFloat && isIntLikeType(left->dataType)) {
+        int from = assemblyLineCount;
+        emitAssembly("\ti2f\n");
+        moveAssemblyLinesBefore(left->assemblyEnd, from);
+    }
+    if (isFloat && isIntLikeType(right->dataType)) {
+        emitAssembly("\ti2f\n");
+    }
+    if (strcmp(left->dataType, "string") == 0) {
+        emitAssembly(strcmp(operation, "add") == 0 ? "\tsconcat\n" : "\ts%s\n", operation);
+    } else {
+        emitAssembly("\t%c%s\n", isFloat ? 'f' : 'i', operation);
+    }
 }
 
 void assemblyPopVar(char* name) {
-    fprintf(assemblyFileHandler.filePointer, "\tpop %s\n", name);
-    return;
+    int id = lookup(name);
+    assemblySlot("store", symbolTable[id].slot, symbolTable[id].isGlobalSlot);
 }
 
-void assemblyUnaryMinusNot(char* name,char*oper) {
-    assemblyOperation(oper);
-    assemblyPopVar(name);
+// a call to itself in tail position stores the new args over the params, the last one is on top
+void assemblyPopParams(int funcIdx) {
+    for (int i = symbolTable[funcIdx].paramCount - 1; i >= 0; i--) {
+        assemblySlot("store", symbolTable[symbolTable[funcIdx].paramsIds[i]].slot, false);
+    }
 }
 
+// not and minus become inot / ineg or fnot / fneg, bit_not only takes ints
+void assemblyUnaryMinusNot(char* oper, Node* operand) {
+    if (strcmp(oper, "bit_not") == 0) {
+        assemblyOperation(oper);
+        return;
+    }
+    emitAssembly("\t%c%s\n", strcmp(operand->dataType, "float") == 0 ? 'f' : 'i', strcmp(oper, "not") == 0 ? "not" : "neg");
+}
+
+// adds or subtracts 1 from the value on top, x can be an int or a float
+void assemblyStepValue(char* name, char* operation) {
+    bool isFloat = strcmp(getSymbolDataType(name), "float") == 0;
+    assemblyPushVar(isFloat ? "1.000000" : "1");
+    emitAssembly("\t%c%s\n", isFloat ? 'f' : 'i', operation);
+}
+
+// ++x leaves the new value, x++ the old one
 void assemblyPrefix(char* name, char* operation) {
     assemblyPushVar(name);
-    assemblyPushVar("1");
-    assemblyOperation(operation);
+    assemblyStepValue(name, operation);
     assemblyPopVar(name);
+    assemblyPushVar(name);
 }
 
 void assemblyPostfix(char* name, char* operation) {
     assemblyPushVar(name);
-    assemblyPopVar("_temp_");
-    assemblyPrefix(name, operation);
-    assemblyPushVar("_temp_");
+    assemblyPushVar(name);
+    assemblyStepValue(name, operation);
+    assemblyPopVar(name);
+}
+
+// drops the value of an expression used as a statement
+void assemblyDiscard() {
+    emitAssembly("\tpop\n");
 }
 
 
 void assemblyPrint() {
-    fprintf(assemblyFileHandler.filePointer, "\tprint\n");
+    emitAssembly("\tprint\n");
 }
 
-void assemblyAddFunctionParams(char* name) {
-    int funcIdx = lookup(name);
-    for(int i = symbolTable[funcIdx].paramCount - 1; i >= 0; i--) {
-        fprintf(assemblyFileHandler.filePointer, "\tpop %s\n", symbolTable[symbolTable[funcIdx].paramsIds[i]].name);
+// the args pushed by the caller are the first slots of the frame, so the params need no code
+void assemblyAddFunctionParams() {
+    assemblyFunctionBody = assemblyLineCount;
+    assemblyHasTailLabel = false;
+}
+
+// moves the global declarations that came after a function in front of all the functions
+void assemblyMoveGlobalCode() {
+    if (assemblyLineCount == assemblyGlobalStart) {
+        return;
+    }
+    if (assemblyGlobalStart > assemblyGlobalEnd) {
+        moveAssemblyLinesBefore(assemblyGlobalEnd, assemblyGlobalStart);
     }
+    assemblyGlobalEnd += assemblyLineCount - assemblyGlobalStart;
+    assemblyGlobalStart = assemblyLineCount;
+}
+
+void assemblyFunctionEnd() {
+    char line[64];
+    snprintf(line, sizeof(line), "\tenter %d %d\n", symbolTable[insideFunctionIdx].paramCount, frameSlotCount);
+    free(assemblyLines[assemblyEnterLine]);
+    assemblyLines[assemblyEnterLine] = strdup(line);
+    assemblyGlobalStart = assemblyLineCount;
 }
 
 void assemblyFunctionLabel(char * name) {
-    fprintf(assemblyFileHandler.filePointer, "func_%s:\n", name);
-    fprintf(assemblyFileHandler.filePointer, "\tpop %s\n", "_call_");
+    assemblyMoveGlobalCode();
+    emitAssembly("func_%s:\n", name);
+    assemblyEnterLine = assemblyLineCount;
+    emitAssembly("\tenter\n");
 }
 
-void assemblyJumpCall() {
-    fprintf(assemblyFileHandler.filePointer, "\tjmp _call_\n");
+// retv leaves the value on top of the stack to the caller
+void assemblyReturn() {
+    emitAssembly(strcmp(symbolTable[insideFunctionIdx].dataType, "void") == 0 ? "\tret\n" : "\tretv\n");
 }
 
 void assemblyFunctionCall(char * name, int argCount) {
     int funcIdx = lookup(name);
 
-    for(int i = symbolTable[funcIdx].paramCount - 1; i >= argCount; i--) {
-        assemblyPushConst(symbolTable[symbolTable[funcIdx].paramsIds[i]].nodeValue);
+    // defaults go on top of the passed args in param order, so every param finds its arg in its slot
+    // an int default of a float param is converted like an int operand of a float operation
+    for(int i = argCount; i < symbolTable[funcIdx].paramCount; i++) {
+        Symbol* param = &symbolTable[symbolTable[funcIdx].paramsIds[i]];
+        assemblyPushConst(param->nodeValue);
+        if (strcmp(param->dataType, "float") == 0 && isIntLikeType(param->nodeValue->dataType)) {
+            emitAssembly("\ti2f\n");
+        }
     }
 
-    fprintf(assemblyFileHandler.filePointer, "\tpush %s\n", "pc");
-    fprintf(assemblyFileHandler.filePointer, "\tpush %s\n", "2");
-    fprintf(assemblyFileHandler.filePointer, "\tadd\n");
+    emitAssembly("\tcall func_%s\n", name);
+}
+
+// return f(...): f takes over our frame and returns straight to our caller,
+// a call to the function itself stores its args into the params again and jumps back to its body
+bool assemblyTailCall(char* function) {
+    char self[160];
+    snprintf(self, sizeof(self), "\tcall func_%s\n", function);
+    int call = assemblyLineCount - 1;
+    if (assemblyFunctionBody == -1 || call < assemblyFunctionBody
+        || strncmp(assemblyLines[call], "\tcall func_", 11) != 0) {
+        return false;
+    }
 
-    fprintf(assemblyFileHandler.filePointer, "\tjmp func_%s\n", name);
+    bool isSelf = strcmp(assemblyLines[call], self) == 0;
+    char callee[160];
+    snprintf(callee, sizeof(callee), "%.*s", (int)strcspn(assemblyLines[call] + 11, "\n"), assemblyLines[call] + 11);
+    free(assemblyLines[call]);
+    assemblyLineCount = call;
+
+    if (!isSelf) {
+        emitAssembly("\ttailcall %d func_%s\n", symbolTable[lookup(callee)].paramCount, callee);
+        return true;
+    }
+
+    if (!assemblyHasTailLabel) {
+        int from = assemblyLineCount;
+        emitAssembly("TAIL_%s:\n", function);
+        moveAssemblyLinesBefore(assemblyFunctionBody, from);
+        for (int i = 0; i <= switchIndex; i++) {
+            if (switchStarts[i] >= assemblyFunctionBody) {
+                switchStarts[i]++;
+            }
+        }
+        for (int i = 0; i <= loopIndex; i++) {
+            forStepStarts[i] += forStepStarts[i] >= assemblyFunctionBody;
+            forBodyStarts[i] += forBodyStarts[i] >= assemblyFunctionBody;
+        }
+        assemblyHasTailLabel = true;
+    }
+    assemblyPopParams(lookup(function));
+    emitAssembly("\tjmp TAIL_%s\n", function);
+    return true;
 }
 
-void assemblyJumpFalse(int labelNum) {
-    fprintf(assemblyFileHandler.filePointer, "\tjf FALSE_LABEL%i\n", labelNum);
+// jf to label, returns the first line that may take that jump
+int assemblyConditionJump(char* label) {
+    if (assemblyLineCount != assemblyShortEnd) {
+        int start = assemblyLineCount;
+        emitAssembly("\tjf %s\n", label);
+        return start;
+    }
+
+    // the value on the stack is the && / || just emitted: its false exits go to label instead of pushing false
+    while (assemblyLineCount > assemblyShortTail) {
+        free(assemblyLines[--assemblyLineCount]);
+    }
+    char falseJump[40];
+    snprintf(falseJump, sizeof(falseJump), "\tjf FALSE_LABEL%d\n", assemblyShortLabel);
+    for (int i = assemblyShortStart; i < assemblyLineCount; i++) {
+        if (strcmp(assemblyLines[i], falseJump) == 0) {
+            char line[512];
+            snprintf(line, sizeof(line), "\tjf %s\n", label);
+            free(assemblyLines[i]);
+            assemblyLines[i] = strdup(line);
+        }
+    }
+    assemblyShortEnd = -1;
+    return assemblyShortStart;
 }
 
 void assemblyJump(int labelNum) {
-    fprintf(assemblyFileHandler.filePointer, "\tjmp LABEL%i\n", labelNum);
+    emitAssembly("\tjmp LABEL%i\n", labelNum);
 }
 
 void assemblyFalseLabel(int labelNum) {
-    fprintf(assemblyFileHandler.filePointer, "FALSE_LABEL%i:\n", labelNum);
+    emitAssembly("FALSE_LABEL%i:\n", labelNum);
 }
 
 void assemblyLabel(int labelNum) {
-    fprintf(assemblyFileHandler.filePointer, "LABEL%i:\n", labelNum);
+    emitAssembly("LABEL%i:\n", labelNum);
+}
+
+void assemblyJumpFalse(int labelNum) {
+    char label[24];
+    sprintf(label, "FALSE_LABEL%d", labelNum);
+    assemblyConditionJump(label);
+}
+
+// && and || only evaluate their right side when the left one didn't decide the result
+void assemblyShortCircuitBegin(bool isAnd) {
+    int n = labelCounter++;
+    shortLabels[++shortIndex] = n;
+    char label[24];
+    if (isAnd) {
+        sprintf(label, "FALSE_LABEL%d", n);
+        shortStarts[shortIndex] = assemblyConditionJump(label);
+        return;
+    }
+    int m = labelCounter++;
+    shortRhsLabels[shortIndex] = m;
+    sprintf(label, "FALSE_LABEL%d", m);
+    shortStarts[shortIndex] = assemblyConditionJump(label);
+    assemblyJump(m);
+    assemblyFalseLabel(m);
+}
+
+void assemblyShortCircuitEnd(bool isAnd) {
+    int n = shortLabels[shortIndex];
+    assemblyJumpFalse(n);
+    if (!isAnd) {
+        assemblyLabel(shortRhsLabels[shortIndex]);
+    }
+
+    int tail = assemblyLineCount;
+    emitAssembly("\tpush true\n");
+    assemblyJump(n);
+    assemblyFalseLabel(n);
+    emitAssembly("\tpush false\n");
+    assemblyLabel(n);
+
+    assemblyShortLabel = n;
+    assemblyShortStart = shortStarts[shortIndex--];
+    assemblyShortTail = tail;
+    assemblyShortEnd = assemblyLineCount;
 }
 
 void assemblyJumpFalseLabel(int labelNum) {
-    fprintf(assemblyFileHandler.filePointer, "\tjmp FALSE_LABEL%i\n", labelNum);
+    emitAssembly("\tjmp FALSE_LABEL%i\n", labelNum);
 }
 
 bool assemblyIsInLoop() {
@@ -154,60 +422,167 @@ bool assemblyIsInSwitch() {
     return switchIndex != -1;
 }
 
-void assemblyLoopInit() {
+// the exit label is taken up front so break works before the condition is parsed
+void assemblyLoopInit(bool isDoWhile) {
     loopLabels[++loopIndex] = labelCounter++;
     assemblyLabel(loopLabels[loopIndex]);
+    loopLabels[++loopIndex] = labelCounter++;
+    loopHasContinueLabel[loopIndex] = isDoWhile;
+}
+
+// continue in a do-while goes to the condition, which has no label of its own
+void assemblyDoWhileCondition() {
+    assemblyLabel(loopLabels[loopIndex]);
 }
 
 void assemblyLoopBegin() {
-    loopLabels[++loopIndex] = labelCounter++;
     assemblyJumpFalse(loopLabels[loopIndex]);
 }
 
+void assemblyLoopBreak() {
+    assemblyJumpFalseLabel(loopLabels[loopIndex]);
+}
+
+void assemblyLoopContinue() {
+    if (loopHasContinueLabel[loopIndex]) {
+        assemblyJump(loopLabels[loopIndex]);
+    } else {
+        assemblyJump(loopLabels[loopIndex - 1]);
+    }
+}
+
+// the step of a for is parsed before the body but runs after it, the body is moved in front of it once parsed
+void assemblyForStepBegin() {
+    loopHasContinueLabel[loopIndex] = true;
+    forStepStarts[loopIndex] = assemblyLineCount;
+    assemblyLabel(loopLabels[loopIndex]);
+}
+
+void assemblyForStepEnd() {
+    forBodyStarts[loopIndex] = assemblyLineCount;
+}
+
+void assemblyForBodyEnd() {
+    moveAssemblyLinesBefore(forStepStarts[loopIndex], forBodyStarts[loopIndex]);
+}
+
 void assemblyLoopExit() {
     assemblyJump(loopLabels[loopIndex - 1]);
     assemblyFalseLabel(loopLabels[loopIndex]);
     loopIndex -= 2;
 }
 
+void assemblySwitchExpressionBegin() {
+    switchExpressionStart = assemblyLineCount;
+}
+
+// a variable is loaded again from its slot by every test of the dispatch, any other value is kept in a slot of its own
 void assemblySwitchBegin(Node* expression) {
     // init the out label for the switch statement
     if(strcmp(expression->type, "const")  == 0) {
         customError("Switch expression must be a variable");
     }
 
-    switchExpression[++switchOutIndex] = expression;
-    switchOutIndicies[switchOutIndex] = ++switchIndex;
+    switchExpression[++switchIndex] = expression;
+    int id = strcmp(expression->type, "var") == 0 ? lookupQuadName(expression->name) : -1;
+    if (id != -1) {
+        while (assemblyLineCount > switchExpressionStart) {
+            free(assemblyLines[--assemblyLineCount]);
+        }
+        switchSlots[switchIndex] = symbolTable[id].slot;
+        switchSlotIsGlobal[switchIndex] = symbolTable[id].isGlobalSlot;
+    } else {
+        switchSlots[switchIndex] = reserveSlot(&switchSlotIsGlobal[switchIndex]);
+        assemblySlot("store", switchSlots[switchIndex], switchSlotIsGlobal[switchIndex]);
+    }
     switchLabels[switchIndex] = labelCounter++;
-    switchSkipLabels[++switchSkipIndex] = labelCounter++;
+    switchStarts[switchIndex] = assemblyLineCount;
+    memset(&switchCases[switchIndex], 0, sizeof(SwitchCases));
+    switchCases[switchIndex].defaultLabel = -1;
 }
 
 void assemblySwitchCaseBegin(Node* expression) {
-    assemblyPushVar(switchExpression[switchOutIndex]->name);
-    assemblyPushConst(expression);
-    assemblyOperation("eq");
-    
-    switchLabels[++switchIndex] = labelCounter++;
-    assemblyJumpFalse(switchLabels[switchIndex]);
-    
-    assemblyLabel(switchSkipLabels[switchSkipIndex]);
+    char buffer[256];
+    if (strcmp(expression->dataType, "int") == 0) {
+        sprintf(buffer, "%d", expression->iValue);
+    } else if (strcmp(expression->dataType, "char") == 0) {
+        sprintf(buffer, "'%c'", expression->cValue);
+    } else {
+        sprintf(buffer, "%s", expression->bValue ? "true" : "false");
+    }
+    int label = labelCounter++;
+    addSwitchCase(&switchCases[switchIndex], expression, buffer, label);
+    assemblyLabel(label);
 }
 
-void assemblySwitchCaseEnd() {
-    switchSkipLabels[++switchSkipIndex] = labelCounter++;
-    assemblyJump(switchSkipLabels[switchSkipIndex]);
+void assemblySwitchDefault() {
+    switchCases[switchIndex].defaultLabel = labelCounter++;
+    assemblyLabel(switchCases[switchIndex].defaultLabel);
+}
+
+void assemblySwitchBreak() {
+    assemblyJump(switchLabels[switchIndex]);
+}
 
-    assemblyFalseLabel(switchLabels[switchIndex]);
+void assemblySwitchValue() {
+    assemblySlot("load", switchSlots[switchIndex], switchSlotIsGlobal[switchIndex]);
+}
+
+void assemblySwitchTree(SwitchCases* cases, int low, int high, int fallback) {
+    if (high - low + 1 <= SWITCH_LINEAR_MAX_CASES) {
+        for (int i = low; i <= high; i++) {
+            assemblySwitchValue();
+            assemblyPushVar(cases->constants[i]);
+            assemblyOperation("ine");
+            emitAssembly("\tjf LABEL%i\n", cases->labels[i]);
+        }
+        assemblyJump(fallback);
+        return;
+    }
+
+    int middle = (low + high + 1) / 2;
+    int right = labelCounter++;
+    assemblySwitchValue();
+    assemblyPushVar(cases->constants[middle]);
+    assemblyOperation("ilt");
+    emitAssembly("\tjf LABEL%i\n", right);
+
+    assemblySwitchTree(cases, low, middle - 1, fallback);
+    assemblyLabel(right);
+    assemblySwitchTree(cases, middle, high, fallback);
+}
+
+void assemblySwitchTable(SwitchCases* cases, int fallback) {
+    assemblySwitchValue();
+    if (cases->values[0] != 0) {
+        assemblyPushVar(cases->constants[0]);
+        assemblyOperation("isub");
+    }
+    int range = cases->values[cases->count - 1] - cases->values[0] + 1;
+    emitAssembly("\tjtab %d LABEL%i\n", range, fallback);
+
+    int next = 0;
+    for (int value = cases->values[0]; next < cases->count; value++) {
+        emitAssembly("\tjtarget LABEL%i\n", cases->values[next] == value ? cases->labels[next++] : fallback);
+    }
 }
 
 void assemblySwitchEnd() {
-    assemblyLabel(switchSkipLabels[switchSkipIndex]); // to consume last skip
+    SwitchCases* cases = &switchCases[switchIndex];
+    assemblyLabel(switchLabels[switchIndex]); // to get out of the switch statement
+    int fallback = cases->defaultLabel != -1 ? cases->defaultLabel : switchLabels[switchIndex];
+
+    int from = assemblyLineCount;
+    sortSwitchCases(cases);
+    if (useSwitchTable(cases, switchExpression[switchIndex]->dataType)) {
+        assemblySwitchTable(cases, fallback);
+    } else {
+        assemblySwitchTree(cases, 0, cases->count - 1, fallback);
+    }
+    moveAssemblyLinesBefore(switchStarts[switchIndex], from);
 
-    int outIndex = switchOutIndicies[switchOutIndex];
-    assemblyLabel(switchLabels[outIndex]); // to get out of the switch statement
-    switchIndex = outIndex - 1; // to get the last case label
-    switchSkipIndex = outIndex - 1; // to get the last case label
-    switchOutIndex--;
+    freeSwitchCases(cases);
+    switchIndex--;
 }
 
 void assemblyTest(Node* node) {
@@ -0,0 +1,121 @@
+import os
+import re
+import sys
+import subprocess
+import tempfile
+
+# Compares the dispatch of two builds of the VM (make bench): runs the test_TA programs and
+# generated loop kernels on both and prints the best M instructions/s of each.
+#   py bench.py <threaded exe> <switch exe> [compiler flags, e.g. --fuse or -O]
+
+RUNS = 5
+TA_DIR = "test_TA"
+OUTPUT_FILES = ("quadruples.txt", "symbol_table.txt", "syntax_errors.txt", "warnings.txt", "assembly.txt")
+VM_LINE = re.compile(r"VM: (\d+) instructions .* in ([0-9.]+) s, ([0-9.]+) M instructions/s")
+
+KERNELS = {
+    "count_loop": """
+func int main() {
+    int total = 0;
+    for (int i = 0; i < 2000000; i++) {
+        total = total + i % 7;
+    }
+    print(total);
+    return 0;
+}
+""",
+    "nested_loops": """
+func int main() {
+    int total = 0;
+    for (int i = 0; i < 1000; i++) {
+        for (int j = 0; j < 1000; j++) {
+            if (j % 3 == 0) {
+                total = total + i * j % 5;
+            } else {
+                total = total - 1;
+            }
+        }
+    }
+    print(total);
+    return 0;
+}
+""",
+    "float_sum": """
+func int main() {
+    float x = 0.0;
+    int i = 0;
+    while (i < 1000000) {
+        x = x + 0.5 * i / 1000;
+        i = i + 1;
+    }
+    print(x);
+    return 0;
+}
+""",
+    "calls": """
+func int square(int n) {
+    return n * n;
+}
+func int main() {
+    int total = 0;
+    for (int i = 0; i < 500000; i++) {
+        total = (total + square(i % 100)) % 100000;
+    }
+    print(total);
+    return 0;
+}
+""",
+}
+
+
+def ta_programs():
+    programs = []
+    for test in sorted(os.listdir(TA_DIR)):
+        folder = os.path.join(TA_DIR, test)
+        for name in sorted(os.listdir(folder)):
+            if name.endswith(".txt") and name not in OUTPUT_FILES:
+                programs.append((test + "/" + name, os.path.abspath(os.path.join(folder, name))))
+    return programs
+
+
+def best_rate(exe, flags, path, workdir):
+    best = None
+    for _ in range(RUNS):
+        result = subprocess.run([exe, *flags, "--run", path], cwd=workdir, capture_output=True, text=True)
+        match = VM_LINE.search(result.stdout)
+        if result.returncode != 0 or not match:
+            return None
+        rate = float(match.group(3))
+        best = rate if best is None else max(best, rate)
+    return best
+
+
+def main():
+    if len(sys.argv) < 3:
+        print("usage: bench.py <threaded exe> <switch exe> [compiler flags]")
+        return 1
+    threaded, switch = os.path.abspath(sys.argv[1]), os.path.abspath(sys.argv[2])
+    flags = sys.argv[3:]
+
+    with tempfile.TemporaryDirectory() as workdir:
+        programs = ta_programs()
+        for name, source in KERNELS.items():
+            path = os.path.join(workdir, name + ".txt")
+            with open(path, "w") as f:
+                f.write(source)
+            programs.append(("kernel/" + name, path))
+
+        print(f"{'program':<28}{'threaded':>12}{'switch':>12}{'speedup':>10}   (M instructions/s, best of {RUNS})")
+        for name, path in programs:
+            a = best_rate(threaded, flags, path, workdir)
+            b = best_rate(switch, flags, path, workdir)
+            if a is None or b is None:
+                print(f"{name:<28}{'failed':>12}")
+                continue
+            speedup = f"{a / b:.2f}x" if b > 0 else "-"
+            print(f"{name:<28}{a:>12.1f}{b:>12.1f}{speedup:>10}")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,457 @@
+#ifndef __BYTECODE_C__
+#define __BYTECODE_C__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "fusion.c"
+
+/*
+    Bytecode files (--bytecode writes assembly.bc). They hold the program
+    the way the VM loads it, so running one needs no parsing and no name
+    lookups:
+        header      magic "QBC", version, counts and section offsets
+        constants   kind, size and bytes of every literal
+        labels      offset and name of every label
+        code        fixed width instructions {op, a, b} of 3 int32
+        labelRefs   per instruction the label its jump or call was written with, -1 otherwise
+    Sections start 4 byte aligned, numbers are in the byte order of the
+    machine that wrote the file. The code and labelRefs are used in place
+    from the mmap'ed file, the rest is copied out.
+        .\parser.exe --run assembly.bc      runs it
+        .\parser.exe --disasm assembly.bc   prints it as it was in assembly.txt
+*/
+
+#define BYTECODE_VERSION 4
+
+bool bytecodeEnabled = false;
+bool disassembleEnabled = false;
+
+typedef struct BytecodeHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t codeCount;
+    uint32_t constantCount;
+    uint32_t globalCount;
+    uint32_t labelCount;
+    uint32_t entryStart;
+    uint32_t entryCount;
+    uint32_t constantsOffset;
+    uint32_t labelsOffset;
+    uint32_t codeOffset;
+    uint32_t labelRefsOffset;
+    uint32_t size;
+} BytecodeHeader;
+
+typedef struct BytecodeBuffer {
+    char* data;
+    uint32_t size;
+    uint32_t capacity;
+} BytecodeBuffer;
+
+bool isBytecodePath(char* path) {
+    int length = strlen(path);
+    return length > 3 && strcmp(path + length - 3, ".bc") == 0;
+}
+
+/*--------------------------------------------------------------------------*/
+/* Writer */
+/*--------------------------------------------------------------------------*/
+
+// appends the bytes and pads them to 4
+void bytecodeAppend(BytecodeBuffer* buffer, const void* data, uint32_t size) {
+    uint32_t padded = (size + 3) & ~3u;
+    while (buffer->size + padded > buffer->capacity) {
+        buffer->capacity = buffer->capacity ? buffer->capacity * 2 : 4096;
+        buffer->data = (char*)realloc(buffer->data, buffer->capacity);
+    }
+    memcpy(buffer->data + buffer->size, data, size);
+    memset(buffer->data + buffer->size + size, 0, padded - size);
+    buffer->size += padded;
+}
+
+void bytecodeAppendInt(BytecodeBuffer* buffer, uint32_t value) {
+    bytecodeAppend(buffer, &value, sizeof(value));
+}
+
+void bytecodeAppendString(BytecodeBuffer* buffer, char* text) {
+    uint32_t size = strlen(text) + 1;
+    bytecodeAppendInt(buffer, size);
+    bytecodeAppend(buffer, text, size);
+}
+
+bool writeBytecodeFile(VMProgram* program, char* path) {
+    BytecodeBuffer buffer = {NULL, 0, 0};
+    BytecodeHeader header;
+    memset(&header, 0, sizeof(header));
+    bytecodeAppend(&buffer, &header, sizeof(header));
+
+    header.constantsOffset = buffer.size;
+    for (int c = 0; c < program->constantCount; c++) {
+        Value value = program->constants[c];
+        bytecodeAppendInt(&buffer, valueType(value));
+        if (valueType(value) == 's') {
+            char small[SMALL_STRING_MAX + 1];
+            bytecodeAppendString(&buffer, (char*)stringChars(value, small));
+        } else if (valueType(value) == 'f') {
+            double f = asFloat(value);
+            bytecodeAppendInt(&buffer, sizeof(double));
+            bytecodeAppend(&buffer, &f, sizeof(double));
+        } else {
+            bytecodeAppendInt(&buffer, sizeof(int32_t));
+            bytecodeAppendInt(&buffer, asInt(value));
+        }
+    }
+    header.labelsOffset = buffer.size;
+    for (int l = 0; l < program->labelCount; l++) {
+        bytecodeAppendInt(&buffer, program->labelOffsets[l]);
+        bytecodeAppendString(&buffer, program->labelNames[l]);
+    }
+    header.codeOffset = buffer.size;
+    for (int i = 0; i < program->count; i++) {
+        int32_t instruction[3] = {program->code[i].op, program->code[i].a, program->code[i].b};
+        bytecodeAppend(&buffer, instruction, sizeof(instruction));
+    }
+    header.labelRefsOffset = buffer.size;
+    bytecodeAppend(&buffer, program->labelRefs, program->count * sizeof(int32_t));
+
+    memcpy(header.magic, "QBC", 4);
+    header.version = BYTECODE_VERSION;
+    header.codeCount = program->count;
+    header.constantCount = program->constantCount;
+    header.globalCount = program->globalCount;
+    header.labelCount = program->labelCount;
+    header.entryStart = program->entryStart;
+    header.entryCount = program->entryCount;
+    header.size = buffer.size;
+    memcpy(buffer.data, &header, sizeof(header));
+
+    FILE* file = fopen(path, "wb");
+    bool ok = file != NULL && fwrite(buffer.data, 1, buffer.size, file) == buffer.size;
+    if (file != NULL) {
+        fclose(file);
+    }
+    if (ok) {
+        printf("Bytecode: %d instructions, %d constants, %d globals, %d labels, %u bytes written to %s\n",
+               program->count, program->constantCount, program->globalCount, program->labelCount, buffer.size, path);
+    } else {
+        fprintf(stderr, "Bytecode: could not write %s\n", path);
+    }
+    free(buffer.data);
+    return ok;
+}
+
+// the assembly in memory as assembly.bc
+bool writeBytecode() {
+    VMProgram* program = loadVMProgram(assemblyLines, assemblyLineCount);
+    if (program == NULL) {
+        return false;
+    }
+    bool ok = writeBytecodeFile(program, "assembly.bc");
+    freeVMProgram(program);
+    return ok;
+}
+
+/*--------------------------------------------------------------------------*/
+/* Loader */
+/*--------------------------------------------------------------------------*/
+
+void unmapBytecode(VMProgram* program) {
+#ifdef _WIN32
+    free(program->mapping);
+#else
+    munmap(program->mapping, program->mappingSize);
+#endif
+    program->mapping = NULL;
+}
+
+// the whole file, mmap'ed where there is mmap
+char* mapBytecodeFile(char* path, size_t* size) {
+#ifdef _WIN32
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        return NULL;
+    }
+    fseek(file, 0, SEEK_END);
+    *size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    char* data = (char*)malloc(*size + 1);
+    if (fread(data, 1, *size, file) != *size) {
+        free(data);
+        data = NULL;
+    }
+    fclose(file);
+    return data;
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return NULL;
+    }
+    struct stat info;
+    char* data = NULL;
+    if (fstat(fd, &info) == 0 && info.st_size > 0) {
+        *size = info.st_size;
+        data = (char*)mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            data = NULL;
+        }
+    }
+    close(fd);
+    return data;
+#endif
+}
+
+// reads a size prefixed string at *offset and moves past it, NULL when it runs off the file
+char* readBytecodeString(char* data, uint32_t size, uint32_t* offset) {
+    uint32_t length;
+    if (*offset + 4 > size) {
+        return NULL;
+    }
+    memcpy(&length, data + *offset, 4);
+    *offset += 4;
+    if (length == 0 || length > size - *offset || data[*offset + length - 1] != '\0') {
+        return NULL;
+    }
+    char* text = strdup(data + *offset);
+    *offset += (length + 3) & ~3u;
+    return text;
+}
+
+bool readBytecodeConstants(VMProgram* program, char* data, BytecodeHeader* header) {
+    uint32_t offset = header->constantsOffset;
+    program->constants = (Value*)calloc(header->constantCount + 1, sizeof(Value));
+    for (uint32_t c = 0; c < header->constantCount; c++) {
+        uint32_t kind, size;
+        if (offset + 8 > header->size) {
+            return false;
+        }
+        memcpy(&kind, data + offset, 4);
+        if (kind == 's') {
+            offset += 4;
+            char* text = readBytecodeString(data, header->size, &offset);
+            if (text == NULL) {
+                return false;
+            }
+            program->constants[c] = internString(text);
+            free(text);
+            program->constantCount++;
+            continue;
+        }
+        memcpy(&size, data + offset + 4, 4);
+        offset += 8;
+        if (strchr("ifbc", (int)kind) == NULL || kind == 0 || offset + size > header->size
+            || size != (kind == 'f' ? sizeof(double) : sizeof(int32_t))) {
+            return false;
+        }
+        if (kind == 'f') {
+            double f;
+            memcpy(&f, data + offset, sizeof(double));
+            program->constants[c] = boxFloat(f);
+        } else {
+            int32_t i;
+            memcpy(&i, data + offset, sizeof(int32_t));
+            program->constants[c] = boxScalar((char)kind, i);
+        }
+        offset += (size + 3) & ~3u;
+        program->constantCount++;
+    }
+    return true;
+}
+
+bool readBytecodeLabels(VMProgram* program, char* data, BytecodeHeader* header) {
+    uint32_t offset = header->labelsOffset;
+    program->labelNames = (char**)calloc(header->labelCount + 1, sizeof(char*));
+    program->labelOffsets = (int*)calloc(header->labelCount + 1, sizeof(int));
+    for (uint32_t l = 0; l < header->labelCount; l++) {
+        if (offset + 4 > header->size) {
+            return false;
+        }
+        memcpy(&program->labelOffsets[l], data + offset, 4);
+        offset += 4;
+        char* name = readBytecodeString(data, header->size, &offset);
+        if (name == NULL) {
+            return false;
+        }
+        program->labelNames[program->labelCount++] = name;
+    }
+    return true;
+}
+
+// the VM trusts its operands, so every one of them is checked once here
+bool checkBytecodeCode(VMProgram* program) {
+    int frameSize = 0; // of the function the instruction is in, global code has none
+    for (int i = 0; i < program->count; i++) {
+        Instruction* in = &program->code[i];
+        bool ok = in->op >= 0 && in->op < VM_PROFILE;
+        // a superinstruction is followed by the rest of its sequence, its own operand is the first one's
+        Superinstruction* fused = ok && in->op > VM_HALT ? findSuperinstruction(in->op) : NULL;
+        Instruction first;
+        if (fused != NULL) {
+            first.op = fused->parts[0];
+            first.a = in->a;
+            first.b = in->b;
+            ok = i + fused->length <= program->count;
+            for (int p = 1; ok && p < fused->length; p++) {
+                ok = program->code[i + p].op == fused->parts[p];
+            }
+            in = &first;
+        }
+        if (ok && in->op == VM_PUSH_CONST) {
+            ok = in->a >= 0 && in->a < program->constantCount;
+        } else if (ok && (in->op == VM_LOAD || in->op == VM_STORE)) {
+            ok = in->a >= 0 && in->a < frameSize;
+        } else if (ok && (in->op == VM_GLOAD || in->op == VM_GSTORE)) {
+            ok = in->a >= 0 && in->a < program->globalCount;
+        } else if (ok && in->op == VM_ENTER) {
+            ok = in->a >= 0 && in->a <= in->b && in->b < VM_STACK_SIZE;
+            frameSize = in->b;
+        } else if (ok && (in->op == VM_CALL || in->op == VM_TAILCALL)) {
+            // calls go to an enter that takes as many args as a tail call moves
+            ok = in->a >= 0 && in->a < program->count && program->code[in->a].op == VM_ENTER
+                 && (in->op == VM_CALL || program->code[in->a].a == in->b);
+        } else if (ok && (in->op == VM_JMP || in->op == VM_JF || in->op == VM_JTARGET)) {
+            ok = in->a >= 0 && in->a < program->count;
+        } else if (ok && in->op == VM_JTAB) {
+            ok = in->a >= 0 && in->a < program->count - i && in->b >= 0 && in->b < program->count;
+            for (int t = 1; ok && t <= in->a; t++) {
+                ok = program->code[i + t].op == VM_JTARGET;
+            }
+        }
+        int ref = program->labelRefs[i];
+        ok = ok && ref >= -1 && ref < program->labelCount;
+        if (!ok) {
+            fprintf(stderr, "Bytecode: bad instruction %d\n", i);
+            return false;
+        }
+    }
+    return program->count > 0 && program->code[program->count - 1].op == VM_HALT;
+}
+
+bool isBytecodeSection(BytecodeHeader* header, uint32_t offset, uint64_t size) {
+    return offset % 4 == 0 && offset >= sizeof(BytecodeHeader) && offset + size <= header->size;
+}
+
+VMProgram* loadBytecodeFile(char* path) {
+    size_t size = 0;
+    char* data = mapBytecodeFile(path, &size);
+    if (data == NULL) {
+        fprintf(stderr, "Bytecode: could not read %s\n", path);
+        return NULL;
+    }
+    VMProgram* program = (VMProgram*)calloc(1, sizeof(VMProgram));
+    program->mapping = data;
+    program->mappingSize = size;
+
+    BytecodeHeader header;
+    bool ok = size >= sizeof(header);
+    if (ok) {
+        memcpy(&header, data, sizeof(header));
+        ok = memcmp(header.magic, "QBC", 4) == 0 && header.size == size;
+    }
+    if (ok && header.version != BYTECODE_VERSION) {
+        fprintf(stderr, "Bytecode: %s is version %u, this VM reads version %d\n", path, header.version, BYTECODE_VERSION);
+        freeVMProgram(program);
+        return NULL;
+    }
+    ok = ok && isBytecodeSection(&header, header.codeOffset, (uint64_t)header.codeCount * sizeof(Instruction))
+         && isBytecodeSection(&header, header.labelRefsOffset, (uint64_t)header.codeCount * sizeof(int32_t))
+         && isBytecodeSection(&header, header.constantsOffset, 0)
+         && isBytecodeSection(&header, header.labelsOffset, 0)
+         && header.entryStart + header.entryCount <= header.codeCount;
+    ok = ok && readBytecodeConstants(program, data, &header) && readBytecodeLabels(program, data, &header);
+    if (ok) {
+        program->code = (Instruction*)(data + header.codeOffset);
+        program->labelRefs = (int*)(data + header.labelRefsOffset);
+        program->count = header.codeCount;
+        program->entryStart = header.entryStart;
+        program->entryCount = header.entryCount;
+        program->globalCount = header.globalCount;
+        ok = header.globalCount < VM_STACK_SIZE && checkBytecodeCode(program);
+    }
+    if (!ok) {
+        fprintf(stderr, "Bytecode: %s is not a valid bytecode file\n", path);
+        freeVMProgram(program);
+        return NULL;
+    }
+    return program;
+}
+
+/*--------------------------------------------------------------------------*/
+/* Disassembler */
+/*--------------------------------------------------------------------------*/
+
+void disassembleConstant(Value value, FILE* out) {
+    switch (valueType(value)) {
+        case 'f': fprintf(out, "%f", asFloat(value)); break;
+        case 'b': fprintf(out, "%s", asInt(value) ? "true" : "false"); break;
+        case 'c': fprintf(out, "'%c'", asInt(value)); break;
+        case 's': {
+            char small[SMALL_STRING_MAX + 1];
+            fprintf(out, "\"%s\"", stringChars(value, small));
+            break;
+        }
+        default: fprintf(out, "%d", asInt(value)); break;
+    }
+}
+
+// the same text as assembly.txt, without the call to main the loader adds
+void disassembleBytecode(VMProgram* program, FILE* out) {
+    int label = 0;
+    for (int pc = 0; pc < program->count; pc++) {
+        while (label < program->labelCount && program->labelOffsets[label] == pc) {
+            fprintf(out, "%s:\n", program->labelNames[label++]);
+        }
+        Instruction* in = &program->code[pc];
+        if ((pc >= program->entryStart && pc < program->entryStart + program->entryCount)
+            || pc == program->count - 1) {
+            continue;
+        }
+        char* labelName = program->labelRefs[pc] >= 0 ? program->labelNames[program->labelRefs[pc]] : "?";
+        int op = vmBaseOp(in->op); // a superinstruction is printed as the sequence it stands for
+        switch (op) {
+            case VM_PUSH_CONST:
+                fprintf(out, "\tpush ");
+                disassembleConstant(program->constants[in->a], out);
+                fprintf(out, "\n");
+                break;
+            case VM_DROP: fprintf(out, "\tpop\n"); break;
+            case VM_LOAD: case VM_STORE: case VM_GLOAD: case VM_GSTORE:
+                fprintf(out, "\t%s %d\n", vmOpNames[op], in->a);
+                break;
+            case VM_ENTER: fprintf(out, "\tenter %d %d\n", in->a, in->b); break;
+            case VM_TAILCALL: fprintf(out, "\ttailcall %d %s\n", in->b, labelName); break;
+            case VM_JMP: case VM_JF: case VM_JTARGET: case VM_CALL:
+                fprintf(out, "\t%s %s\n", vmOpNames[op], labelName);
+                break;
+            case VM_JTAB: fprintf(out, "\tjtab %d %s\n", in->a, labelName); break;
+            default: fprintf(out, "\t%s\n", vmOpNames[op]); break;
+        }
+    }
+}
+
+// --run and --disasm on a .bc file instead of a source file
+bool runBytecodeFile(char* path, bool run, bool disassemble) {
+    VMProgram* program = loadBytecodeFile(path);
+    if (program == NULL) {
+        return false;
+    }
+    if (disassemble) {
+        disassembleBytecode(program, stdout);
+    }
+    if (!run) {
+        freeVMProgram(program);
+        return true;
+    }
+    return runVMProgramTimed(program);
+}
+
+#endif
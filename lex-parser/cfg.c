@@ -0,0 +1,423 @@
+#ifndef __CFG_C__
+#define __CFG_C__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <ctype.h>
+
+/*
+    Control flow graph over the in-memory quads.
+    A region is a run of quads owned by the same function (or global code),
+    each region gets its own graph.
+*/
+
+typedef struct BasicBlock {
+    int start; // first quad of the block
+    int end; // one past the last quad
+    int* succs; // for conditional jumps succs[0] is the jump target
+    int succCount;
+    int* preds;
+    int predCount;
+    int idom; // immediate dominator, -1 for the entry and unreachable blocks
+} BasicBlock;
+
+typedef struct CFG {
+    int start; // first quad of the region
+    int end; // one past the last quad of the region
+    BasicBlock* blocks;
+    int blockCount;
+    int* blockOf; // quad index - start -> block
+    int* order; // reachable blocks in reverse post order
+    int orderCount;
+    bool valid; // false when a jump target can't be resolved inside the region
+} CFG;
+
+/*--------------------------------------------------------------------------*/
+/* Quad classification */
+/*--------------------------------------------------------------------------*/
+
+bool isTempName(char* name) {
+    return strncmp(name, "0t", 2) == 0;
+}
+
+bool isConstOperand(char* operand) {
+    if (strcmp(operand, "true") == 0 || strcmp(operand, "false") == 0) {
+        return true;
+    }
+    if (operand[0] == '\'' || operand[0] == '"') {
+        return true;
+    }
+    if (isTempName(operand)) {
+        return false;
+    }
+    return isdigit(operand[0]) || (operand[0] == '-' && isdigit(operand[1]));
+}
+
+bool isVarOperand(char* operand) {
+    return strcmp(operand, "_") != 0 && !isConstOperand(operand);
+}
+
+// ops that compute a value into the result field
+bool isValueQuad(Quad* quad) {
+    const char* ops[] = {
+        "assign", "add", "sub", "mul", "div", "mod",
+        "lt", "gt", "ge", "le", "eq", "ne", "and", "or", "not", "minus",
+        "bit_not", "bit_and", "bit_or", "xor", "shl", "shr", NULL
+    };
+    for (int i = 0; ops[i] != NULL; i++) {
+        if (strcmp(quad->op, ops[i]) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool isCallQuad(Quad* quad) {
+    return strcmp(quad->op, "jmp") == 0 && strncmp(quad->result, "func_", 5) == 0;
+}
+
+bool isReturnQuad(Quad* quad) {
+    return strcmp(quad->op, "return") == 0
+        || (strcmp(quad->op, "jmp") == 0 && strcmp(quad->arg1, "_call_") == 0);
+}
+
+bool isJumpQuad(Quad* quad) {
+    return strcmp(quad->op, "jmp") == 0 && !isCallQuad(quad) && !isReturnQuad(quad);
+}
+
+bool isCondJumpQuad(Quad* quad) {
+    return strcmp(quad->op, "if_false") == 0 || strcmp(quad->op, "jf") == 0;
+}
+
+// jtab index count default is followed by count jtarget quads holding the case labels,
+// the graph sees them as a chain of conditional jumps
+bool isTableJumpQuad(Quad* quad) {
+    return strcmp(quad->op, "jtab") == 0 || strcmp(quad->op, "jtarget") == 0;
+}
+
+bool isLabelQuad(Quad* quad) {
+    return strcmp(quad->op, "label") == 0;
+}
+
+bool endsBlock(Quad* quad) {
+    return isJumpQuad(quad) || isCondJumpQuad(quad) || isTableJumpQuad(quad) || isReturnQuad(quad);
+}
+
+// name written by the quad, NULL if it doesn't write one
+char* quadDef(Quad* quad) {
+    if (isValueQuad(quad)) {
+        return quad->result;
+    }
+    if (strcmp(quad->op, "pop_param") == 0) {
+        return quad->arg1;
+    }
+    if (isCallQuad(quad)) {
+        return "@ret";
+    }
+    return NULL;
+}
+
+// fills the names read by the quad, returns how many
+int quadUses(Quad* quad, char** uses) {
+    int count = 0;
+    if (isValueQuad(quad)) {
+        if (isVarOperand(quad->arg1)) uses[count++] = quad->arg1;
+        if (isVarOperand(quad->arg2)) uses[count++] = quad->arg2;
+    } else if (isCondJumpQuad(quad) || strcmp(quad->op, "print") == 0 || strcmp(quad->op, "jtab") == 0
+               || strcmp(quad->op, "push") == 0 || strcmp(quad->op, "push_const") == 0) {
+        if (isVarOperand(quad->arg1)) uses[count++] = quad->arg1;
+    } else if (strcmp(quad->op, "return") == 0) {
+        if (isVarOperand(quad->result)) uses[count++] = quad->result;
+    }
+    return count;
+}
+
+bool sameFunction(char* a, char* b) {
+    if (a == NULL || b == NULL) {
+        return a == b;
+    }
+    return strcmp(a, b) == 0;
+}
+
+// one past the last quad of the region starting at start
+int regionEnd(int start) {
+    int end = start + 1;
+    while (end < quadCount && sameFunction(quadList[end].function, quadList[start].function)
+           && strcmp(quadList[end].op, "func_label") != 0) {
+        end++;
+    }
+    return end;
+}
+
+/*--------------------------------------------------------------------------*/
+/* Graph construction */
+/*--------------------------------------------------------------------------*/
+
+void addEdge(CFG* cfg, int from, int to) {
+    BasicBlock* source = &cfg->blocks[from];
+    for (int i = 0; i < source->succCount; i++) {
+        if (source->succs[i] == to) {
+            return;
+        }
+    }
+    source->succs = (int*)realloc(source->succs, (source->succCount + 1) * sizeof(int));
+    source->succs[source->succCount++] = to;
+
+    BasicBlock* target = &cfg->blocks[to];
+    target->preds = (int*)realloc(target->preds, (target->predCount + 1) * sizeof(int));
+    target->preds[target->predCount++] = from;
+}
+
+int findLabelBlock(CFG* cfg, char* label) {
+    for (int b = 0; b < cfg->blockCount; b++) {
+        for (int i = cfg->blocks[b].start; i < cfg->blocks[b].end && isLabelQuad(&quadList[i]); i++) {
+            if (strcmp(quadList[i].result, label) == 0) {
+                return b;
+            }
+        }
+    }
+    return -1;
+}
+
+void computeReversePostOrder(CFG* cfg) {
+    int* stack = (int*)malloc(cfg->blockCount * sizeof(int));
+    int* nextSucc = (int*)calloc(cfg->blockCount, sizeof(int));
+    bool* visited = (bool*)calloc(cfg->blockCount, sizeof(bool));
+    int* postOrder = (int*)malloc(cfg->blockCount * sizeof(int));
+    int postCount = 0;
+    int top = 0;
+
+    stack[top++] = 0;
+    visited[0] = true;
+    while (top > 0) {
+        int b = stack[top - 1];
+        if (nextSucc[b] < cfg->blocks[b].succCount) {
+            int s = cfg->blocks[b].succs[nextSucc[b]++];
+            if (!visited[s]) {
+                visited[s] = true;
+                stack[top++] = s;
+            }
+        } else {
+            postOrder[postCount++] = b;
+            top--;
+        }
+    }
+
+    cfg->order = (int*)malloc(postCount * sizeof(int));
+    cfg->orderCount = postCount;
+    for (int i = 0; i < postCount; i++) {
+        cfg->order[i] = postOrder[postCount - 1 - i];
+    }
+
+    free(stack);
+    free(nextSucc);
+    free(visited);
+    free(postOrder);
+}
+
+// Cooper, Harvey and Kennedy "A Simple, Fast Dominance Algorithm"
+void computeDominators(CFG* cfg) {
+    int* rpoIndex = (int*)malloc(cfg->blockCount * sizeof(int));
+    for (int b = 0; b < cfg->blockCount; b++) {
+        rpoIndex[b] = -1;
+        cfg->blocks[b].idom = -1;
+    }
+    for (int i = 0; i < cfg->orderCount; i++) {
+        rpoIndex[cfg->order[i]] = i;
+    }
+
+    cfg->blocks[0].idom = 0;
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (int i = 1; i < cfg->orderCount; i++) {
+            int b = cfg->order[i];
+            int newIdom = -1;
+            for (int p = 0; p < cfg->blocks[b].predCount; p++) {
+                int pred = cfg->blocks[b].preds[p];
+                if (cfg->blocks[pred].idom == -1) {
+                    continue;
+                }
+                if (newIdom == -1) {
+                    newIdom = pred;
+                    continue;
+                }
+                int x = pred;
+                int y = newIdom;
+                while (x != y) {
+                    while (rpoIndex[x] > rpoIndex[y]) x = cfg->blocks[x].idom;
+                    while (rpoIndex[y] > rpoIndex[x]) y = cfg->blocks[y].idom;
+                }
+                newIdom = x;
+            }
+            if (newIdom != -1 && cfg->blocks[b].idom != newIdom) {
+                cfg->blocks[b].idom = newIdom;
+                changed = true;
+            }
+        }
+    }
+    cfg->blocks[0].idom = -1;
+    free(rpoIndex);
+}
+
+bool dominates(CFG* cfg, int a, int b) {
+    while (b != -1) {
+        if (a == b) {
+            return true;
+        }
+        b = cfg->blocks[b].idom;
+    }
+    return false;
+}
+
+/*--------------------------------------------------------------------------*/
+/* Natural loops */
+/*--------------------------------------------------------------------------*/
+
+typedef struct Loop {
+    int header;
+    bool* body; // per block
+    int blockCount;
+} Loop;
+
+// natural loops of the back edges, loops sharing a header are merged into one
+int findNaturalLoops(CFG* cfg, Loop** loops) {
+    int loopCount = 0;
+    *loops = NULL;
+    int* stack = (int*)malloc(cfg->blockCount * sizeof(int));
+
+    for (int i = 0; i < cfg->orderCount; i++) {
+        int header = cfg->order[i];
+        Loop* loop = NULL;
+        BasicBlock* block = &cfg->blocks[header];
+
+        for (int p = 0; p < block->predCount; p++) {
+            int tail = block->preds[p];
+            if (!dominates(cfg, header, tail)) {
+                continue;
+            }
+            if (loop == NULL) {
+                *loops = (Loop*)realloc(*loops, (loopCount + 1) * sizeof(Loop));
+                loop = &(*loops)[loopCount++];
+                loop->header = header;
+                loop->body = (bool*)calloc(cfg->blockCount, sizeof(bool));
+                loop->body[header] = true;
+                loop->blockCount = 1;
+            }
+
+            // everything reaching the back edge without passing the header
+            int top = 0;
+            if (!loop->body[tail]) {
+                loop->body[tail] = true;
+                loop->blockCount++;
+                stack[top++] = tail;
+            }
+            while (top > 0) {
+                BasicBlock* current = &cfg->blocks[stack[--top]];
+                for (int q = 0; q < current->predCount; q++) {
+                    int pred = current->preds[q];
+                    if (!loop->body[pred] && cfg->blocks[pred].idom != -1) {
+                        loop->body[pred] = true;
+                        loop->blockCount++;
+                        stack[top++] = pred;
+                    }
+                }
+            }
+        }
+    }
+
+    free(stack);
+    return loopCount;
+}
+
+void freeLoops(Loop* loops, int loopCount) {
+    for (int l = 0; l < loopCount; l++) {
+        free(loops[l].body);
+    }
+    free(loops);
+}
+
+CFG* buildCFG(int start, int end) {
+    CFG* cfg = (CFG*)calloc(1, sizeof(CFG));
+    cfg->start = start;
+    cfg->end = end;
+    cfg->valid = true;
+    cfg->blockOf = (int*)malloc((end - start) * sizeof(int));
+
+    bool* isLeader = (bool*)calloc(end - start + 1, sizeof(bool));
+    isLeader[0] = true;
+    for (int i = start; i < end; i++) {
+        if (isLabelQuad(&quadList[i]) && (i == start || !isLabelQuad(&quadList[i - 1]))) {
+            isLeader[i - start] = true;
+        }
+        if (endsBlock(&quadList[i])) {
+            isLeader[i - start + 1] = true;
+        }
+    }
+
+    for (int i = start; i < end; i++) {
+        if (isLeader[i - start]) {
+            cfg->blockCount++;
+        }
+    }
+    cfg->blocks = (BasicBlock*)calloc(cfg->blockCount, sizeof(BasicBlock));
+
+    int b = -1;
+    for (int i = start; i < end; i++) {
+        if (isLeader[i - start]) {
+            b++;
+            cfg->blocks[b].start = i;
+        }
+        cfg->blocks[b].end = i + 1;
+        cfg->blockOf[i - start] = b;
+    }
+    free(isLeader);
+
+    // a label defined twice would make every jump to it ambiguous
+    for (int i = start; i < end; i++) {
+        if (isLabelQuad(&quadList[i]) && findLabelBlock(cfg, quadList[i].result) != cfg->blockOf[i - start]) {
+            cfg->valid = false;
+        }
+    }
+
+    for (b = 0; b < cfg->blockCount; b++) {
+        Quad* last = &quadList[cfg->blocks[b].end - 1];
+        bool fallsThrough = !isJumpQuad(last) && !isReturnQuad(last);
+        if (strcmp(last->op, "jtarget") == 0) {
+            int next = cfg->blocks[b].end;
+            fallsThrough = next < end && strcmp(quadList[next].op, "jtarget") == 0;
+        }
+
+        if (isJumpQuad(last) || isCondJumpQuad(last) || isTableJumpQuad(last)) {
+            int target = findLabelBlock(cfg, last->result);
+            if (target == -1) {
+                printf("CFG: label %s is not defined in its region\n", last->result);
+                cfg->valid = false;
+            } else {
+                addEdge(cfg, b, target);
+            }
+        }
+        if (fallsThrough && b + 1 < cfg->blockCount) {
+            addEdge(cfg, b, b + 1);
+        }
+    }
+
+    computeReversePostOrder(cfg);
+    computeDominators(cfg);
+    return cfg;
+}
+
+void freeCFG(CFG* cfg) {
+    for (int b = 0; b < cfg->blockCount; b++) {
+        free(cfg->blocks[b].succs);
+        free(cfg->blocks[b].preds);
+    }
+    free(cfg->blocks);
+    free(cfg->blockOf);
+    free(cfg->order);
+    free(cfg);
+}
+
+#endif
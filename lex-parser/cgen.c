@@ -0,0 +1,538 @@
+#ifndef __CGEN_C__
+#define __CGEN_C__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdarg.h>
+
+#include "x86.c"
+
+/*
+    C backend (--c). Writes the quads as portable C to program.c, so an
+    optimizing C compiler does the instruction selection:
+        gcc -O2 program.c -o program -lm
+    Every function of the program becomes a static C function taking its
+    params in declaration order, defaults are already pushed at the call
+    sites. Variables are v_<name> with the type of their symbol, globals
+    g_<name>. Temps and @ret change type from store to store, so each type
+    they hold gets its own C variable (t3_i, t3_f, ret_s). Args are copied
+    into a<depth>_<type> when pushed, labels become goto targets.
+    ints wrap like the VM, division by zero exits with 1.
+*/
+
+bool cEnabled = false;
+int cStatements = 0;
+
+typedef struct CFrame {
+    NameTable types; // temps, @ret and variables without a single symbol type
+    NameTable locals; // C name -> type, declared at the top of the function
+    NameTable params; // C names of the params, not declared again
+    char returnType;
+    int pushDepth;
+    char* body;
+    int bodyLength;
+    int bodyCapacity;
+} CFrame;
+
+NameTable cGlobals; // C name -> type
+
+void emitC(char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    vfprintf(cFileHandler.filePointer, format, args);
+    va_end(args);
+}
+
+// the body is written after the declarations it needs, so it is kept until the function ends
+void appendC(CFrame* frame, char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(NULL, 0, format, args);
+    va_end(args);
+    while (frame->bodyLength + length + 1 > frame->bodyCapacity) {
+        frame->bodyCapacity = frame->bodyCapacity ? frame->bodyCapacity * 2 : 1024;
+        frame->body = (char*)realloc(frame->body, frame->bodyCapacity);
+    }
+    va_start(args, format);
+    vsprintf(frame->body + frame->bodyLength, format, args);
+    va_end(args);
+    frame->bodyLength += length;
+    cStatements += format[0] == '\t';
+}
+
+char* cTypeName(char type) {
+    switch (type) {
+        case 'f': return "double";
+        case 's': return "char*";
+        case 'v': return "void";
+        default: return "int";
+    }
+}
+
+char* cZero(char type) {
+    switch (type) {
+        case 'f': return "0.0";
+        case 's': return "\"\"";
+        default: return "0";
+    }
+}
+
+// names copied by the inliner are <name>.<n>, the dot becomes "__"
+void cIdentifier(char* name, char* out) {
+    for (; *name; name++) {
+        if (*name == '.') {
+            *out++ = '_';
+            *out++ = '_';
+        } else {
+            *out++ = *name;
+        }
+    }
+    *out = '\0';
+}
+
+void cLabel(char* label, char* out) {
+    strcpy(out, "L_");
+    cIdentifier(label, out + 2);
+}
+
+// the C variable holding the name while it has the given type
+void cName(CFrame* frame, char* name, char type, char* out) {
+    char identifier[300];
+    cIdentifier(name, identifier);
+    if (isX86Global(name)) {
+        sprintf(out, "g_%s", identifier);
+        if (findName(&cGlobals, out) == -1) {
+            char declared = x86DeclaredType(name);
+            putName(&cGlobals, out, declared ? declared : 'i');
+        }
+        return;
+    }
+    char declared = x86DeclaredType(name);
+    if (declared) {
+        sprintf(out, "v_%s", identifier);
+        type = declared;
+    } else if (strcmp(name, "@ret") == 0) {
+        sprintf(out, "ret_%c", type);
+    } else if (isTempName(name)) {
+        sprintf(out, "t%s_%c", name + 2, type);
+    } else {
+        sprintf(out, "v_%s_%c", identifier, type);
+    }
+    if (findName(&frame->locals, out) == -1) {
+        putName(&frame->locals, out, type);
+    }
+}
+
+// an operand as a C expression
+void cOperand(CFrame* frame, char* name, char* out) {
+    ConstValue constant;
+    if (parseConstValue(name, &constant)) {
+        if (constant.kind == 'b') {
+            sprintf(out, "%d", constant.iValue);
+        } else {
+            strcpy(out, name);
+        }
+        freeConstValue(&constant);
+        return;
+    }
+    cName(frame, name, quadOperandType(&frame->types, name), out);
+}
+
+// the variable a result of the given type goes to, temps take the type
+void cResult(CFrame* frame, char* name, char type, char* out) {
+    if (!x86DeclaredType(name)) {
+        putName(&frame->types, name, type);
+    }
+    cName(frame, name, type, out);
+}
+
+/*--------------------------------------------------------------------------*/
+/* Quads */
+/*--------------------------------------------------------------------------*/
+
+char* cOperator(int op) {
+    const char* operators[] = {"+", "-", "*", "/", "%", "<", ">", "<=", ">=", "==", "!=", "&&", "||"};
+    if (op >= VM_ADD && op <= VM_OR) {
+        return (char*)operators[op - VM_ADD];
+    }
+    switch (op) {
+        case VM_BIT_AND: return "&";
+        case VM_BIT_OR: return "|";
+        case VM_XOR: return "^";
+        case VM_SHL: return "<<";
+        default: return ">>";
+    }
+}
+
+void cBinary(CFrame* frame, Quad* quad, int op) {
+    char left = quadOperandType(&frame->types, quad->arg1);
+    char right = quadOperandType(&frame->types, quad->arg2);
+    bool compare = op >= VM_LT && op <= VM_NE;
+    char a[300], b[300], r[300];
+    cOperand(frame, quad->arg1, a);
+    cOperand(frame, quad->arg2, b);
+
+    if (left == 's' || right == 's') {
+        cResult(frame, quad->result, op == VM_ADD ? 's' : 'b', r);
+        if (op == VM_ADD) {
+            appendC(frame, "\t%s = rt_concat(%s, %s);\n", r, a, b);
+        } else {
+            appendC(frame, "\t%s = strcmp(%s, %s) %s 0;\n", r, a, b, cOperator(op));
+        }
+        return;
+    }
+
+    if ((left == 'f' || right == 'f') && op <= VM_NE) {
+        cResult(frame, quad->result, compare ? 'b' : 'f', r);
+        if (op == VM_MOD) {
+            appendC(frame, "\t%s = fmod(%s, %s);\n", r, a, b);
+        } else {
+            appendC(frame, "\t%s = %s %s %s;\n", r, a, cOperator(op), b);
+        }
+        return;
+    }
+
+    bool logical = compare || op == VM_AND || op == VM_OR;
+    cResult(frame, quad->result, logical ? 'b' : 'i', r);
+    switch (op) {
+        case VM_ADD:
+        case VM_SUB:
+        case VM_MUL:
+            // through unsigned so overflow wraps instead of being undefined
+            appendC(frame, "\t%s = (int)((unsigned)%s %s (unsigned)%s);\n", r, a, cOperator(op), b);
+            break;
+        case VM_DIV: appendC(frame, "\t%s = rt_div(%s, %s);\n", r, a, b); break;
+        case VM_MOD: appendC(frame, "\t%s = rt_mod(%s, %s);\n", r, a, b); break;
+        case VM_SHL: appendC(frame, "\t%s = (int)((unsigned)%s << (%s & 31));\n", r, a, b); break;
+        case VM_SHR: appendC(frame, "\t%s = %s >> (%s & 31);\n", r, a, b); break;
+        default: appendC(frame, "\t%s = %s %s %s;\n", r, a, cOperator(op), b); break;
+    }
+}
+
+void cUnary(CFrame* frame, Quad* quad) {
+    char type = quadOperandType(&frame->types, quad->arg1);
+    char a[300], r[300];
+    cOperand(frame, quad->arg1, a);
+    if (strcmp(quad->op, "not") == 0) {
+        cResult(frame, quad->result, 'b', r);
+        appendC(frame, "\t%s = !%s;\n", r, a);
+    } else if (strcmp(quad->op, "minus") == 0 && type == 'f') {
+        cResult(frame, quad->result, 'f', r);
+        appendC(frame, "\t%s = -(%s);\n", r, a);
+    } else if (strcmp(quad->op, "minus") == 0) {
+        cResult(frame, quad->result, 'i', r);
+        appendC(frame, "\t%s = (int)(0u - (unsigned)%s);\n", r, a);
+    } else {
+        cResult(frame, quad->result, 'i', r);
+        appendC(frame, "\t%s = ~%s;\n", r, a);
+    }
+}
+
+void cPrint(CFrame* frame, char* operand) {
+    char a[300];
+    cOperand(frame, operand, a);
+    switch (quadOperandType(&frame->types, operand)) {
+        case 'f': appendC(frame, "\trt_print_float(%s);\n", a); break;
+        case 'b': appendC(frame, "\trt_print_bool(%s);\n", a); break;
+        case 'c': appendC(frame, "\trt_print_char(%s);\n", a); break;
+        case 's': appendC(frame, "\trt_print_string(%s);\n", a); break;
+        default: appendC(frame, "\trt_print_int(%s);\n", a); break;
+    }
+}
+
+void cJumpTable(CFrame* frame, int index) {
+    Quad* quad = &quadList[index];
+    int count = atoi(quad->arg2);
+    char a[300], label[310];
+    cOperand(frame, quad->arg1, a);
+    appendC(frame, "\tswitch (%s) {\n", a);
+    for (int t = 1; t <= count && index + t < quadCount; t++) {
+        cLabel(quadList[index + t].result, label);
+        appendC(frame, "\t\tcase %d: goto %s;\n", t - 1, label);
+    }
+    cLabel(quad->result, label);
+    appendC(frame, "\t\tdefault: goto %s;\n", label);
+    appendC(frame, "\t}\n");
+}
+
+void cCall(CFrame* frame, Quad* quad) {
+    X86Callee* callee = findX86Callee(quad->result);
+    int paramCount = callee != NULL ? callee->paramCount : 0;
+    char returnType = callee != NULL ? callee->returnType : 'i';
+    int first = frame->pushDepth - paramCount;
+    if (first < 0) {
+        first = 0;
+    }
+
+    char call[1200];
+    int length = sprintf(call, "f_%s(", quad->result + 5);
+    for (int p = 0; p < paramCount && length < 1100; p++) {
+        length += sprintf(call + length, "%sa%d_%c", p > 0 ? ", " : "", first + p, callee->paramTypes[p]);
+    }
+    strcat(call, ")");
+    frame->pushDepth = first;
+
+    if (returnType == 'v') {
+        appendC(frame, "\t%s;\n", call);
+        return;
+    }
+    char r[300];
+    cResult(frame, "@ret", returnType, r);
+    appendC(frame, "\t%s = %s;\n", r, call);
+}
+
+void cQuad(CFrame* frame, int index, char* pushTypes) {
+    Quad* quad = &quadList[index];
+    int op = vmOpByName(quad->op);
+    char a[300], r[300], label[310];
+
+    if (op >= VM_ADD && op <= VM_SHR && op != VM_NOT && op != VM_MINUS && op != VM_BIT_NOT) {
+        cBinary(frame, quad, op);
+    } else if (op == VM_NOT || op == VM_MINUS || op == VM_BIT_NOT) {
+        cUnary(frame, quad);
+    } else if (strcmp(quad->op, "assign") == 0) {
+        cOperand(frame, quad->arg1, a);
+        cResult(frame, quad->result, quadOperandType(&frame->types, quad->arg1), r);
+        appendC(frame, "\t%s = %s;\n", r, a);
+    } else if (isCondJumpQuad(quad)) {
+        cOperand(frame, quad->arg1, a);
+        cLabel(quad->result, label);
+        appendC(frame, "\tif (!%s) goto %s;\n", a, label);
+    } else if (isCallQuad(quad)) {
+        cCall(frame, quad);
+    } else if (isJumpQuad(quad)) {
+        cLabel(quad->result, label);
+        appendC(frame, "\tgoto %s;\n", label);
+    } else if (isLabelQuad(quad)) {
+        cLabel(quad->result, label);
+        appendC(frame, "%s:;\n", label);
+    } else if (strcmp(quad->op, "return") == 0) {
+        if (frame->returnType == 'v') {
+            appendC(frame, "\treturn;\n");
+        } else if (strcmp(quad->result, "_") != 0) {
+            cOperand(frame, quad->result, a);
+            appendC(frame, "\treturn %s;\n", a);
+        } else {
+            appendC(frame, "\treturn %s;\n", cZero(frame->returnType));
+        }
+    } else if (strcmp(quad->op, "push") == 0 || strcmp(quad->op, "push_const") == 0) {
+        char type = pushTypes[index] ? pushTypes[index] : quadOperandType(&frame->types, quad->arg1);
+        char arg[32];
+        sprintf(arg, "a%d_%c", frame->pushDepth++, type);
+        if (findName(&frame->locals, arg) == -1) {
+            putName(&frame->locals, arg, type);
+        }
+        cOperand(frame, quad->arg1, a);
+        appendC(frame, "\t%s = %s;\n", arg, a);
+    } else if (strcmp(quad->op, "print") == 0) {
+        cPrint(frame, quad->arg1);
+    } else if (strcmp(quad->op, "jtab") == 0) {
+        cJumpTable(frame, index);
+    }
+    // pop_param is the C param list, jtarget is part of the switch, func_label and nop emit nothing
+}
+
+/*--------------------------------------------------------------------------*/
+/* Functions */
+/*--------------------------------------------------------------------------*/
+
+void initCFrame(CFrame* frame, char returnType) {
+    initNameTable(&frame->types);
+    initNameTable(&frame->locals);
+    initNameTable(&frame->params);
+    frame->returnType = returnType;
+    frame->pushDepth = 0;
+    frame->body = NULL;
+    frame->bodyLength = 0;
+    frame->bodyCapacity = 0;
+}
+
+void freeCFrame(CFrame* frame) {
+    freeNameTable(&frame->types);
+    freeNameTable(&frame->locals);
+    freeNameTable(&frame->params);
+    free(frame->body);
+}
+
+// "static int f_fib(int v_n)", params come in declaration order, the last is popped first
+void cSignature(CFrame* frame, int start, X86Callee* callee, char* out) {
+    int length = sprintf(out, "static %s f_%s(", cTypeName(callee->returnType), quadList[start].arg1);
+    if (callee->paramCount == 0) {
+        strcpy(out + length, "void)");
+        return;
+    }
+    char name[300];
+    for (int p = 0; p < callee->paramCount && length < 1000; p++) {
+        char* param = quadList[start + callee->paramCount - p].arg1;
+        char type = callee->paramTypes[p];
+        cResult(frame, param, type, name);
+        putName(&frame->params, name, p);
+        length += sprintf(out + length, "%s%s %s", p > 0 ? ", " : "", cTypeName(type), name);
+    }
+    strcpy(out + length, ")");
+}
+
+// declarations of everything the body used, then the body
+void cFunctionBody(CFrame* frame) {
+    emitC(" {\n");
+    for (int i = 0; i < frame->locals.capacity; i++) {
+        char* name = frame->locals.keys[i];
+        if (name != NULL && findName(&frame->params, name) == -1) {
+            char type = (char)frame->locals.values[i];
+            emitC("\t%s %s = %s;\n", cTypeName(type), name, cZero(type));
+        }
+    }
+    if (frame->body != NULL) {
+        emitC("%s", frame->body);
+    }
+    if (frame->returnType != 'v') {
+        emitC("\treturn %s;\n", cZero(frame->returnType));
+    }
+    emitC("}\n\n");
+}
+
+void cFunction(int start, int end, char* pushTypes) {
+    char name[300];
+    snprintf(name, sizeof(name), "func_%s", quadList[start].arg1);
+    X86Callee* callee = findX86Callee(name);
+
+    CFrame frame;
+    initCFrame(&frame, callee->returnType);
+    char signature[1200];
+    cSignature(&frame, start, callee, signature);
+    typeX86Pushes(start, end, pushTypes);
+    for (int i = start + 1; i < end; i++) {
+        cQuad(&frame, i, pushTypes);
+    }
+    emitC("%s", signature);
+    cFunctionBody(&frame);
+    freeCFrame(&frame);
+}
+
+// global code runs before f_main, main's params are 0
+void cMain(char* pushTypes) {
+    CFrame frame;
+    initCFrame(&frame, 'v');
+    for (int start = 0; start < quadCount; start = regionEnd(start)) {
+        if (quadList[start].function == NULL) {
+            typeX86Pushes(start, regionEnd(start), pushTypes);
+        }
+    }
+    for (int i = 0; i < quadCount; i++) {
+        if (quadList[i].function == NULL) {
+            cQuad(&frame, i, pushTypes);
+        }
+    }
+    emitC("static void globals(void)");
+    cFunctionBody(&frame);
+    freeCFrame(&frame);
+
+    X86Callee* callee = findX86Callee("func_main");
+    emitC("int main(void) {\n");
+    emitC("\tglobals();\n");
+    emitC("\tf_main(");
+    for (int p = 0; p < callee->paramCount; p++) {
+        emitC("%s%s", p > 0 ? ", " : "", cZero(callee->paramTypes[p]));
+    }
+    emitC(");\n");
+    emitC("\treturn 0;\n");
+    emitC("}\n");
+}
+
+void cRuntime() {
+    emitC("#include <stdio.h>\n");
+    emitC("#include <stdlib.h>\n");
+    emitC("#include <string.h>\n");
+    emitC("#include <math.h>\n\n");
+    emitC("static void rt_print_int(int value) { printf(\"%%d\\n\", value); }\n");
+    emitC("static void rt_print_float(double value) { printf(\"%%g\\n\", value); }\n");
+    emitC("static void rt_print_char(int value) { printf(\"%%c\\n\", value); }\n");
+    emitC("static void rt_print_bool(int value) { puts(value ? \"true\" : \"false\"); }\n");
+    emitC("static void rt_print_string(const char* value) { puts(value); }\n\n");
+    emitC("static char* rt_concat(const char* left, const char* right) {\n");
+    emitC("\tsize_t leftLength = strlen(left), rightLength = strlen(right);\n");
+    emitC("\tchar* result = (char*)malloc(leftLength + rightLength + 1);\n");
+    emitC("\tmemcpy(result, left, leftLength);\n");
+    emitC("\tmemcpy(result + leftLength, right, rightLength + 1);\n");
+    emitC("\treturn result;\n");
+    emitC("}\n\n");
+    emitC("static void rt_div_zero(void) {\n");
+    emitC("\tfputs(\"Runtime error: division by zero\\n\", stderr);\n");
+    emitC("\texit(1);\n");
+    emitC("}\n\n");
+    emitC("static int rt_div(int left, int right) {\n");
+    emitC("\tif (right == 0) rt_div_zero();\n");
+    emitC("\tif (right == -1) return (int)(0u - (unsigned)left); /* INT_MIN / -1 wraps */\n");
+    emitC("\treturn left / right;\n");
+    emitC("}\n\n");
+    emitC("static int rt_mod(int left, int right) {\n");
+    emitC("\tif (right == 0) rt_div_zero();\n");
+    emitC("\tif (right == -1) return 0;\n");
+    emitC("\treturn left %% right;\n");
+    emitC("}\n\n");
+}
+
+void writeC() {
+    setFilePath(&cFileHandler, "program.c");
+    initNameTable(&cGlobals);
+    collectX86Callees();
+    if (findX86Callee("func_main") == NULL) {
+        fprintf(stderr, "C: the program has no main function\n");
+        freeX86Callees();
+        freeNameTable(&cGlobals);
+        return;
+    }
+
+    // globals need no frame, they are collected up front to be declared first
+    char* pushTypes = (char*)calloc(quadCount + 1, 1);
+    char name[300];
+    for (int i = 0; i < quadCount; i++) {
+        char* operands[] = {quadList[i].arg1, quadList[i].arg2, quadList[i].result};
+        for (int o = 0; o < 3; o++) {
+            if (isX86Global(operands[o])) {
+                cName(NULL, operands[o], 'i', name);
+            }
+        }
+    }
+
+    cRuntime();
+    for (int i = 0; i < cGlobals.capacity; i++) {
+        if (cGlobals.keys[i] != NULL) {
+            char type = (char)cGlobals.values[i];
+            emitC("static %s %s = %s;\n", cTypeName(type), cGlobals.keys[i], cZero(type));
+        }
+    }
+    emitC("\n");
+
+    // prototypes, so calls can come before the function
+    for (int start = 0; start < quadCount; start = regionEnd(start)) {
+        if (strcmp(quadList[start].op, "func_label") == 0) {
+            snprintf(name, sizeof(name), "func_%s", quadList[start].arg1);
+            char signature[1200];
+            CFrame frame;
+            initCFrame(&frame, 'v');
+            cSignature(&frame, start, findX86Callee(name), signature);
+            emitC("%s;\n", signature);
+            freeCFrame(&frame);
+        }
+    }
+    emitC("\n");
+
+    int functions = 0;
+    for (int start = 0; start < quadCount; start = regionEnd(start)) {
+        if (strcmp(quadList[start].op, "func_label") == 0) {
+            cFunction(start, regionEnd(start), pushTypes);
+            functions++;
+        }
+    }
+    cMain(pushTypes);
+    printf("C: %d functions, %d statements written to program.c\n", functions, cStatements);
+
+    free(pushTypes);
+    freeX86Callees();
+    freeNameTable(&cGlobals);
+}
+
+#endif
@@ -0,0 +1,261 @@
+#ifndef __FOLDING_C__
+#define __FOLDING_C__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <math.h>
+
+/*
+    Compile time values of quad operands, written back in the same format
+    nodeTypeToString uses. Floats are doubles like the VM's, a folded one is
+    written with all its digits so it reads back as the value it was
+*/
+typedef struct ConstValue {
+    char kind; // 'i' int, 'f' float, 'b' bool, 'c' char, 's' string
+    int iValue; // int, bool and char values
+    double fValue;
+    char* sValue;
+} ConstValue;
+
+bool parseConstValue(char* operand, ConstValue* value) {
+    memset(value, 0, sizeof(ConstValue));
+    if (!isConstOperand(operand)) {
+        return false;
+    }
+    if (strcmp(operand, "true") == 0 || strcmp(operand, "false") == 0) {
+        value->kind = 'b';
+        value->iValue = operand[0] == 't';
+    } else if (operand[0] == '\'') {
+        value->kind = 'c';
+        value->iValue = operand[1];
+    } else if (operand[0] == '"') {
+        value->kind = 's';
+        value->sValue = strdup(operand + 1);
+        value->sValue[strlen(value->sValue) - 1] = '\0';
+    } else if (strchr(operand, '.') != NULL || strchr(operand, 'e') != NULL) {
+        value->kind = 'f';
+        value->fValue = atof(operand);
+    } else {
+        value->kind = 'i';
+        value->iValue = atoi(operand);
+    }
+    return true;
+}
+
+char* formatConstValue(ConstValue* value) {
+    int size = value->kind == 's' ? strlen(value->sValue) + 3 : 64;
+    char* str = (char*)malloc(size);
+    switch (value->kind) {
+        case 'i': sprintf(str, "%d", value->iValue); break;
+        case 'f':
+            sprintf(str, "%.17g", value->fValue);
+            if (strpbrk(str, ".e") == NULL) {
+                strcat(str, ".0"); // still a float operand
+            }
+            break;
+        case 'b': sprintf(str, "%s", value->iValue ? "true" : "false"); break;
+        case 'c': sprintf(str, "'%c'", value->iValue); break;
+        default: sprintf(str, "\"%s\"", value->sValue); break;
+    }
+    return str;
+}
+
+void freeConstValue(ConstValue* value) {
+    free(value->sValue);
+    value->sValue = NULL;
+}
+
+bool sameConstValue(ConstValue* a, ConstValue* b) {
+    if (a->kind != b->kind) {
+        return false;
+    }
+    if (a->kind == 's') {
+        return strcmp(a->sValue, b->sValue) == 0;
+    }
+    if (a->kind == 'f') {
+        return a->fValue == b->fValue;
+    }
+    return a->iValue == b->iValue;
+}
+
+bool constTruth(ConstValue* value) {
+    if (value->kind == 'f') {
+        return value->fValue != 0;
+    }
+    if (value->kind == 's') {
+        return true;
+    }
+    return value->iValue != 0;
+}
+
+double constAsFloat(ConstValue* value) {
+    return value->kind == 'f' ? value->fValue : (double)value->iValue;
+}
+
+void setBoolValue(ConstValue* result, bool b) {
+    result->kind = 'b';
+    result->iValue = b;
+}
+
+// converts value to the declared type of the variable receiving it
+bool coerceConstValue(ConstValue* value, char* dataType) {
+    if (dataType == NULL) {
+        return false;
+    }
+    if (value->kind == 's' || strcmp(dataType, "string") == 0) {
+        return value->kind == 's' && strcmp(dataType, "string") == 0;
+    }
+
+    if (strcmp(dataType, "float") == 0) {
+        value->fValue = constAsFloat(value);
+        value->kind = 'f';
+    } else if (strcmp(dataType, "bool") == 0) {
+        value->iValue = constTruth(value);
+        value->kind = 'b';
+    } else {
+        if (value->kind == 'f') {
+            value->iValue = (int)value->fValue;
+        }
+        if (strcmp(dataType, "char") == 0) {
+            value->iValue = (char)value->iValue;
+            value->kind = 'c';
+        } else if (strcmp(dataType, "int") == 0) {
+            value->kind = 'i';
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+// evaluates op on constant operands, false when it can't be done at compile time
+bool foldOperation(char* op, ConstValue* a, ConstValue* b, ConstValue* result) {
+    memset(result, 0, sizeof(ConstValue));
+
+    if (strcmp(op, "assign") == 0) {
+        *result = *a;
+        if (a->kind == 's') {
+            result->sValue = strdup(a->sValue);
+        }
+        return true;
+    }
+    if (strcmp(op, "not") == 0) {
+        setBoolValue(result, !constTruth(a));
+        return true;
+    }
+    if (a->kind == 's' && strcmp(op, "minus") == 0) {
+        return false;
+    }
+    if (strcmp(op, "minus") == 0) {
+        if (a->kind == 'f') {
+            result->kind = 'f';
+            result->fValue = -a->fValue;
+        } else {
+            result->kind = 'i';
+            result->iValue = (int)(0u - (unsigned int)a->iValue);
+        }
+        return true;
+    }
+    if (strcmp(op, "bit_not") == 0) {
+        if (a->kind == 'f' || a->kind == 's') {
+            return false;
+        }
+        result->kind = 'i';
+        result->iValue = ~a->iValue;
+        return true;
+    }
+
+    if (b == NULL) {
+        return false;
+    }
+
+    if (a->kind == 's' || b->kind == 's') {
+        if (a->kind != 's' || b->kind != 's') {
+            return false;
+        }
+        if (strcmp(op, "add") == 0) {
+            result->kind = 's';
+            result->sValue = (char*)malloc(strlen(a->sValue) + strlen(b->sValue) + 1);
+            strcpy(result->sValue, a->sValue);
+            strcat(result->sValue, b->sValue);
+            return true;
+        }
+        if (strcmp(op, "eq") == 0 || strcmp(op, "ne") == 0) {
+            bool equal = strcmp(a->sValue, b->sValue) == 0;
+            setBoolValue(result, strcmp(op, "eq") == 0 ? equal : !equal);
+            return true;
+        }
+        return false;
+    }
+
+    if (strcmp(op, "and") == 0) {
+        setBoolValue(result, constTruth(a) && constTruth(b));
+        return true;
+    }
+    if (strcmp(op, "or") == 0) {
+        setBoolValue(result, constTruth(a) || constTruth(b));
+        return true;
+    }
+
+    bool isFloat = a->kind == 'f' || b->kind == 'f';
+    const char* comparisons[] = {"lt", "gt", "ge", "le", "eq", "ne", NULL};
+    for (int i = 0; comparisons[i] != NULL; i++) {
+        if (strcmp(op, comparisons[i]) != 0) {
+            continue;
+        }
+        double x = constAsFloat(a);
+        double y = constAsFloat(b);
+        int cmp = isFloat ? (x < y ? -1 : x > y ? 1 : 0)
+                          : (a->iValue < b->iValue ? -1 : a->iValue > b->iValue ? 1 : 0);
+        switch (i) {
+            case 0: setBoolValue(result, cmp < 0); break;
+            case 1: setBoolValue(result, cmp > 0); break;
+            case 2: setBoolValue(result, cmp >= 0); break;
+            case 3: setBoolValue(result, cmp <= 0); break;
+            case 4: setBoolValue(result, cmp == 0); break;
+            default: setBoolValue(result, cmp != 0); break;
+        }
+        return true;
+    }
+
+    if (isFloat) {
+        double x = constAsFloat(a);
+        double y = constAsFloat(b);
+        result->kind = 'f';
+        if (strcmp(op, "add") == 0) result->fValue = x + y;
+        else if (strcmp(op, "sub") == 0) result->fValue = x - y;
+        else if (strcmp(op, "mul") == 0) result->fValue = x * y;
+        else if (strcmp(op, "div") == 0 && y != 0) result->fValue = x / y;
+        else return false;
+        return isfinite(result->fValue); // inf and nan have no operand text
+    }
+
+    // int, char and bool operands, wrapping like the target would
+    unsigned int x = (unsigned int)a->iValue;
+    unsigned int y = (unsigned int)b->iValue;
+    result->kind = 'i';
+    if (strcmp(op, "add") == 0) result->iValue = (int)(x + y);
+    else if (strcmp(op, "sub") == 0) result->iValue = (int)(x - y);
+    else if (strcmp(op, "mul") == 0) result->iValue = (int)(x * y);
+    else if (strcmp(op, "bit_and") == 0) result->iValue = (int)(x & y);
+    else if (strcmp(op, "bit_or") == 0) result->iValue = (int)(x | y);
+    else if (strcmp(op, "xor") == 0) result->iValue = (int)(x ^ y);
+    else if (strcmp(op, "div") == 0 || strcmp(op, "mod") == 0) {
+        if (b->iValue == 0 || (a->iValue == -2147483647 - 1 && b->iValue == -1)) {
+            return false;
+        }
+        result->iValue = strcmp(op, "div") == 0 ? a->iValue / b->iValue : a->iValue % b->iValue;
+    } else if (strcmp(op, "shl") == 0 || strcmp(op, "shr") == 0) {
+        if (b->iValue < 0 || b->iValue > 31) {
+            return false;
+        }
+        result->iValue = strcmp(op, "shl") == 0 ? (int)(x << y) : a->iValue >> b->iValue;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+#endif
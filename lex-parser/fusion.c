@@ -0,0 +1,199 @@
+#ifndef __FUSION_C__
+#define __FUSION_C__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "vm.c"
+
+/*
+    Superinstructions (--fuse). After loading, sequences the compiler emits
+    all the time are run by the VM in one dispatch:
+        load a, load b, iadd, store c       add3            c = a + b
+        load a, push k, iadd/isub, store c  add/sub_const   c = a + k, i++ and i = i - 1
+        load a, push k, ilt ..., jf L       jge_const ...   loop and if tests against a constant
+        load a, load b, ilt ..., jf L       jge ...         the same against a variable
+        push k, store a                     set_const       initializations
+        load a, load b                      load2
+    The set was picked by counting the op sequences of the assembly of the
+    tests. Only the op of the first instruction is replaced, the others
+    stay where they are and hold the operands, so no jump target moves and
+    a jump into the middle of a sequence still runs the plain instructions.
+    The report lists what was fused and the most frequent sequences left,
+    weighted by the dispatches fusing them would save.
+*/
+
+#define FUSION_MAX_LENGTH 4
+#define FUSION_CANDIDATES 3
+
+typedef struct Superinstruction {
+    int op;
+    int length;
+    int parts[FUSION_MAX_LENGTH];
+} Superinstruction;
+
+Superinstruction superinstructions[] = {
+    {VM_ADD3, 4, {VM_LOAD, VM_LOAD, VM_IADD, VM_STORE}},
+    {VM_ADD_CONST, 4, {VM_LOAD, VM_PUSH_CONST, VM_IADD, VM_STORE}},
+    {VM_SUB_CONST, 4, {VM_LOAD, VM_PUSH_CONST, VM_ISUB, VM_STORE}},
+    {VM_JGE_CONST, 4, {VM_LOAD, VM_PUSH_CONST, VM_ILT, VM_JF}},
+    {VM_JLE_CONST, 4, {VM_LOAD, VM_PUSH_CONST, VM_IGT, VM_JF}},
+    {VM_JGT_CONST, 4, {VM_LOAD, VM_PUSH_CONST, VM_ILE, VM_JF}},
+    {VM_JLT_CONST, 4, {VM_LOAD, VM_PUSH_CONST, VM_IGE, VM_JF}},
+    {VM_JNE_CONST, 4, {VM_LOAD, VM_PUSH_CONST, VM_IEQ, VM_JF}},
+    {VM_JEQ_CONST, 4, {VM_LOAD, VM_PUSH_CONST, VM_INE, VM_JF}},
+    {VM_JGE, 4, {VM_LOAD, VM_LOAD, VM_ILT, VM_JF}},
+    {VM_JLE, 4, {VM_LOAD, VM_LOAD, VM_IGT, VM_JF}},
+    {VM_JGT, 4, {VM_LOAD, VM_LOAD, VM_ILE, VM_JF}},
+    {VM_JLT, 4, {VM_LOAD, VM_LOAD, VM_IGE, VM_JF}},
+    {VM_JNE, 4, {VM_LOAD, VM_LOAD, VM_IEQ, VM_JF}},
+    {VM_JEQ, 4, {VM_LOAD, VM_LOAD, VM_INE, VM_JF}},
+    {VM_SET_CONST, 2, {VM_PUSH_CONST, VM_STORE}},
+    {VM_LOAD2, 2, {VM_LOAD, VM_LOAD}},
+};
+
+#define SUPERINSTRUCTION_COUNT ((int)(sizeof(superinstructions) / sizeof(superinstructions[0])))
+
+Superinstruction* findSuperinstruction(int op) {
+    for (int s = 0; s < SUPERINSTRUCTION_COUNT; s++) {
+        if (superinstructions[s].op == op) {
+            return &superinstructions[s];
+        }
+    }
+    return NULL;
+}
+
+// the op the instruction had before fusion
+int vmBaseOp(int op) {
+    Superinstruction* fused = op > VM_HALT ? findSuperinstruction(op) : NULL;
+    return fused != NULL ? fused->parts[0] : op;
+}
+
+bool matchesSuperinstruction(VMProgram* program, int pc, Superinstruction* fused) {
+    if (pc + fused->length > program->count) {
+        return false;
+    }
+    for (int p = 0; p < fused->length; p++) {
+        if (program->code[pc + p].op != fused->parts[p]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// no sequence goes on after an instruction that doesn't fall through
+bool endsSequence(int op) {
+    return op == VM_JMP || op == VM_JF || op == VM_JTAB || op == VM_RET || op == VM_RETV
+           || op == VM_TAILCALL || op == VM_HALT;
+}
+
+// the most frequent op sequences left after fusion, by the dispatches they would save
+void reportFusionCandidates(VMProgram* program, bool* covered) {
+    NameTable counts;
+    initNameTable(&counts);
+    for (int pc = 0; pc < program->count; pc++) {
+        char sequence[128] = "";
+        for (int length = 1; length <= FUSION_MAX_LENGTH && pc + length <= program->count; length++) {
+            int op = program->code[pc + length - 1].op;
+            if (covered[pc + length - 1] || op == VM_JTARGET) {
+                break;
+            }
+            if (length > 1) {
+                strcat(sequence, " ");
+            }
+            strcat(sequence, vmOpNames[op]);
+            if (length > 1) {
+                int count = findName(&counts, sequence);
+                putName(&counts, sequence, count == -1 ? 1 : count + 1);
+            }
+            if (endsSequence(op)) {
+                break;
+            }
+        }
+    }
+
+    printf("Fusion candidates:");
+    bool any = false;
+    for (int c = 0; c < FUSION_CANDIDATES; c++) {
+        int best = -1;
+        int bestSaved = 0;
+        for (int k = 0; k < counts.capacity; k++) {
+            if (counts.keys[k] == NULL || counts.values[k] < 0) {
+                continue;
+            }
+            int parts = 1;
+            for (char* space = strchr(counts.keys[k], ' '); space != NULL; space = strchr(space + 1, ' ')) {
+                parts++;
+            }
+            int saved = counts.values[k] * (parts - 1);
+            if (saved > bestSaved) {
+                best = k;
+                bestSaved = saved;
+            }
+        }
+        if (best == -1) {
+            break;
+        }
+        printf("%s %s x%d", any ? "," : "", counts.keys[best], counts.values[best]);
+        counts.values[best] = -1;
+        any = true;
+    }
+    printf("%s\n", any ? "" : " none");
+    freeNameTable(&counts);
+}
+
+// picks the superinstructions saving the most dispatches, from the end back: i++ is load, load, push, iadd,
+// store, and taking load2 at its start would leave the add_const after it unfused
+void fuseVMProgram(VMProgram* program) {
+    int* saved = (int*)calloc(program->count + 1, sizeof(int)); // dispatches saved from pc to the end
+    int* choice = (int*)malloc((program->count + 1) * sizeof(int)); // superinstruction starting at pc or -1
+    for (int pc = program->count - 1; pc >= 0; pc--) {
+        saved[pc] = saved[pc + 1];
+        choice[pc] = -1;
+        for (int s = 0; s < SUPERINSTRUCTION_COUNT; s++) {
+            Superinstruction* fused = &superinstructions[s];
+            if (matchesSuperinstruction(program, pc, fused)
+                && fused->length - 1 + saved[pc + fused->length] > saved[pc]) {
+                saved[pc] = fused->length - 1 + saved[pc + fused->length];
+                choice[pc] = s;
+            }
+        }
+    }
+
+    int uses[VM_OP_COUNT] = {0};
+    int fusedCount = 0;
+    int coveredCount = 0;
+    bool* covered = (bool*)calloc(program->count + 1, sizeof(bool));
+    for (int pc = 0; pc < program->count; pc++) {
+        if (choice[pc] == -1) {
+            continue;
+        }
+        Superinstruction* fused = &superinstructions[choice[pc]];
+        program->code[pc].op = fused->op;
+        for (int p = 0; p < fused->length; p++) {
+            covered[pc + p] = true;
+        }
+        uses[fused->op]++;
+        fusedCount++;
+        coveredCount += fused->length;
+        pc += fused->length - 1;
+    }
+    free(saved);
+    free(choice);
+
+    printf("Fusion: %d superinstructions cover %d of %d instructions", fusedCount, coveredCount, program->count);
+    bool first = true;
+    for (int op = VM_HALT + 1; op < VM_OP_COUNT; op++) {
+        if (uses[op] > 0) {
+            printf("%s%s %d", first ? " (" : ", ", vmOpNames[op], uses[op]);
+            first = false;
+        }
+    }
+    printf("%s\n", first ? "" : ")");
+    reportFusionCandidates(program, covered);
+    free(covered);
+}
+
+#endif
@@ -0,0 +1,217 @@
+#ifndef __INLINE_C__
+#define __INLINE_C__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "cfg.c"
+
+/*
+    Inlining of small leaf functions (no calls in their body).
+    The pushes of a call, defaults included, are matched to the params by
+    replaying the argument stack, and become assigns to the param copies.
+    The call is replaced by a copy of the body where every local, param,
+    temp and label gets a .<copy> suffix and return stores into @ret and
+    jumps to the end of the copy. The copies are numbered on from the
+    .<n> of the declarations' quad names, so a copy never takes one.
+*/
+
+#define INLINE_MAX_QUADS 16 // bodies this small are inlined at every call
+#define INLINE_SINGLE_CALL_MAX_QUADS 200 // up to this size when there is only one call
+#define INLINE_MAX_GROWTH 4 // the program may grow to this many times its size
+
+int inlinedCalls = 0;
+
+typedef struct InlineCandidate {
+    char* name; // func_<name>, as used by the call
+    char** params; // in declaration order
+    int paramCount;
+    Quad* body; // copy of the quads after the pop_params
+    int bodyCount;
+    int callSites;
+    bool isLeaf;
+} InlineCandidate;
+
+int findInlineCandidate(InlineCandidate* candidates, int count, char* target) {
+    for (int c = 0; c < count; c++) {
+        if (strcmp(candidates[c].name, target) == 0) {
+            return c;
+        }
+    }
+    return -1;
+}
+
+int collectInlineCandidates(InlineCandidate** candidates) {
+    int count = 0;
+    *candidates = NULL;
+    for (int i = 0; i < quadCount; i++) {
+        if (strcmp(quadList[i].op, "func_label") != 0) {
+            continue;
+        }
+        *candidates = (InlineCandidate*)realloc(*candidates, (count + 1) * sizeof(InlineCandidate));
+        InlineCandidate* candidate = &(*candidates)[count++];
+        memset(candidate, 0, sizeof(InlineCandidate));
+        candidate->name = (char*)malloc(strlen(quadList[i].arg1) + 6);
+        sprintf(candidate->name, "func_%s", quadList[i].arg1);
+        candidate->isLeaf = true;
+
+        int end = regionEnd(i);
+        int bodyStart = i + 1;
+        while (bodyStart < end && strcmp(quadList[bodyStart].op, "pop_param") == 0) {
+            bodyStart++;
+        }
+        // the last param is popped first
+        candidate->paramCount = bodyStart - i - 1;
+        candidate->params = (char**)malloc((candidate->paramCount + 1) * sizeof(char*));
+        for (int p = 0; p < candidate->paramCount; p++) {
+            candidate->params[p] = strdup(quadList[bodyStart - 1 - p].arg1);
+        }
+
+        candidate->bodyCount = end - bodyStart;
+        candidate->body = (Quad*)malloc((candidate->bodyCount + 1) * sizeof(Quad));
+        for (int b = bodyStart; b < end; b++) {
+            Quad* copy = &candidate->body[b - bodyStart];
+            copy->op = strdup(quadList[b].op);
+            copy->arg1 = strdup(quadList[b].arg1);
+            copy->arg2 = strdup(quadList[b].arg2);
+            copy->result = strdup(quadList[b].result);
+            copy->function = NULL;
+            if (isCallQuad(&quadList[b])) {
+                candidate->isLeaf = false;
+            }
+        }
+    }
+
+    for (int i = 0; i < quadCount; i++) {
+        if (isCallQuad(&quadList[i])) {
+            int c = findInlineCandidate(*candidates, count, quadList[i].result);
+            if (c != -1) {
+                (*candidates)[c].callSites++;
+            }
+        }
+    }
+    return count;
+}
+
+void freeInlineCandidates(InlineCandidate* candidates, int count) {
+    for (int c = 0; c < count; c++) {
+        for (int p = 0; p < candidates[c].paramCount; p++) {
+            free(candidates[c].params[p]);
+        }
+        for (int b = 0; b < candidates[c].bodyCount; b++) {
+            free(candidates[c].body[b].op);
+            free(candidates[c].body[b].arg1);
+            free(candidates[c].body[b].arg2);
+            free(candidates[c].body[b].result);
+        }
+        free(candidates[c].params);
+        free(candidates[c].body);
+        free(candidates[c].name);
+    }
+    free(candidates);
+}
+
+bool shouldInline(InlineCandidate* candidate) {
+    if (!candidate->isLeaf) {
+        return false;
+    }
+    return candidate->bodyCount <= INLINE_MAX_QUADS
+        || (candidate->callSites == 1 && candidate->bodyCount <= INLINE_SINGLE_CALL_MAX_QUADS);
+}
+
+// name of the copy of a callee operand, constants, globals and @ret are shared
+char* inlineName(char* name, int copy) {
+    if (!isVarOperand(name) || strcmp(name, "@ret") == 0 || isGlobalSymbol(name)) {
+        return strdup(name);
+    }
+    char* renamed = (char*)malloc(strlen(name) + 16);
+    sprintf(renamed, "%s.%d", name, copy);
+    return renamed;
+}
+
+char* inlineLabel(char* label, int copy) {
+    char* renamed = (char*)malloc(strlen(label) + 16);
+    sprintf(renamed, "%s.%d", label, copy);
+    return renamed;
+}
+
+// replaces the call at index, returns how many quads were added
+int inlineCall(InlineCandidate* candidate, int* pushes, int index) {
+    int copy = ++quadNameCounter;
+    for (int p = 0; p < candidate->paramCount; p++) {
+        Quad* push = &quadList[pushes[p]];
+        char* value = strdup(push->arg1);
+        char* param = inlineName(candidate->params[p], copy);
+        setQuad(pushes[p], "assign", value, NULL, param);
+        free(value);
+        free(param);
+    }
+
+    char endLabel[32];
+    snprintf(endLabel, sizeof(endLabel), "INLINE_END%d", copy);
+    setQuad(index, "label", NULL, NULL, endLabel);
+
+    int at = index;
+    for (int b = 0; b < candidate->bodyCount; b++) {
+        Quad* quad = &candidate->body[b];
+        if (isReturnQuad(quad)) {
+            if (strcmp(quad->op, "return") == 0 && strcmp(quad->result, "_") != 0) {
+                char* value = inlineName(quad->result, copy);
+                insertQuad(at++, "assign", value, NULL, "@ret");
+                free(value);
+            }
+            insertQuad(at++, "jmp", NULL, NULL, endLabel);
+            continue;
+        }
+
+        bool hasLabel = isLabelQuad(quad) || isJumpQuad(quad) || isCondJumpQuad(quad) || isTableJumpQuad(quad);
+        char* arg1 = inlineName(quad->arg1, copy);
+        char* arg2 = inlineName(quad->arg2, copy);
+        char* result = hasLabel ? inlineLabel(quad->result, copy) : inlineName(quad->result, copy);
+        insertQuad(at++, quad->op, arg1, arg2, result);
+        free(arg1);
+        free(arg2);
+        free(result);
+    }
+    inlinedCalls++;
+    return at - index;
+}
+
+void inlineFunctions() {
+    InlineCandidate* candidates;
+    int candidateCount = collectInlineCandidates(&candidates);
+    int limit = quadCount * INLINE_MAX_GROWTH;
+
+    // pending pushes, each call takes the last paramCount of them
+    int* pushes = (int*)malloc((quadCount + 1) * sizeof(int));
+    int pushCount = 0;
+
+    for (int i = 0; i < quadCount; i++) {
+        Quad* quad = &quadList[i];
+        if (strcmp(quad->op, "func_label") == 0) {
+            pushCount = 0;
+        } else if (strcmp(quad->op, "push") == 0 || strcmp(quad->op, "push_const") == 0) {
+            pushes[pushCount++] = i;
+        } else if (isCallQuad(quad)) {
+            int c = findInlineCandidate(candidates, candidateCount, quad->result);
+            int params = c == -1 ? 0 : candidates[c].paramCount;
+            if (c == -1 || pushCount < params) {
+                pushCount = 0;
+                continue;
+            }
+            pushCount -= params;
+            if (!shouldInline(&candidates[c]) || quadCount + candidates[c].bodyCount > limit
+                || sameFunction(quad->function, candidates[c].name + 5)) {
+                continue;
+            }
+            i += inlineCall(&candidates[c], &pushes[pushCount], i);
+        }
+    }
+
+    free(pushes);
+    freeInlineCandidates(candidates, candidateCount);
+}
+
+#endif
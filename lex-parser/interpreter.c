@@ -0,0 +1,614 @@
+#ifndef __INTERPRETER_C__
+#define __INTERPRETER_C__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include "cfg.c"
+#include "folding.c"
+#include "vm.c"
+
+/*
+    Quad interpreter (--interpret). Runs the quads in memory without going
+    through the stack assembly. At load time labels become instruction
+    indexes, calls become function indexes and every operand an index
+    into the frame of its function or into the statics (globals, @ret and
+    constants), so no name is compared while running.
+    Calls get a real frame, recursion works. main's params start as 0. With -O the quads from before
+    the passes are interpreted too and both outputs have to be the same,
+    which makes it an oracle for the optimizer.
+    It is also the register engine of --run (--engine register): one
+    instruction per quad, its operands registers of the frame or statics,
+    where the stack VM needs about three instructions for the same quad.
+*/
+
+#define INTERPRETER_STACK_SIZE (1 << 20)
+#define INTERPRETER_MAX_CALLS (1 << 16)
+
+bool interpretEnabled = false;
+bool registerEngineEnabled = false;
+
+typedef enum QuadOp {
+    QI_BINARY, QI_NOT, QI_MINUS, QI_BIT_NOT, QI_ASSIGN,
+    QI_IF_FALSE, QI_JMP, QI_JTAB, QI_CALL, QI_RETURN,
+    QI_PUSH, QI_POP_PARAM, QI_PRINT, QI_NOP, QI_HALT,
+    // add to ne get their own instruction, in the order of the VMOps, with a fast path for two ints
+    QI_ADD, QI_SUB, QI_MUL, QI_DIV, QI_MOD, QI_LT, QI_GT, QI_LE, QI_GE, QI_EQ, QI_NE
+} QuadOp;
+
+typedef struct QuadOperand {
+    bool local; // in the frame, otherwise in the statics
+    int index;
+} QuadOperand;
+
+typedef struct QuadInstruction {
+    int op;
+    int binary; // QI_BINARY: the VMOp
+    QuadOperand a, b, r;
+    int target; // jump target, called function or jtab entry count
+    int fallback; // jtab: target when the index is out of range
+    int quad; // position in the quads, for errors
+} QuadInstruction;
+
+typedef struct QuadFunction {
+    char* name;
+    int entry;
+    int slotCount;
+    NameTable slots;
+} QuadFunction;
+
+typedef struct QuadProgram {
+    QuadInstruction* code;
+    int count;
+    Value* statics; // globals, @ret and the constants
+    int staticCount;
+    NameTable staticNames;
+    QuadFunction* functions;
+    int functionCount;
+    int retSlot;
+} QuadProgram;
+
+typedef struct QuadOutput {
+    char* text;
+    int length;
+    int capacity;
+} QuadOutput;
+
+/*--------------------------------------------------------------------------*/
+/* Loader */
+/*--------------------------------------------------------------------------*/
+
+int quadStatic(QuadProgram* program, Value value) {
+    program->statics = (Value*)realloc(program->statics, (program->staticCount + 1) * sizeof(Value));
+    program->statics[program->staticCount] = value;
+    return program->staticCount++;
+}
+
+int findQuadFunction(QuadProgram* program, char* name) {
+    for (int f = 0; f < program->functionCount; f++) {
+        if (strcmp(program->functions[f].name, name) == 0) {
+            return f;
+        }
+    }
+    return -1;
+}
+
+QuadOperand resolveQuadOperand(QuadProgram* program, QuadFunction* function, char* name) {
+    QuadOperand operand = {false, 0};
+    ConstValue constant;
+    if (strcmp(name, "_") == 0) {
+        return operand;
+    }
+    if (strcmp(name, "@ret") == 0) {
+        operand.index = program->retSlot;
+    } else if (isConstOperand(name) && (operand.index = findName(&program->staticNames, name)) != -1) {
+        // each literal gets one slot
+    } else if (parseConstValue(name, &constant)) {
+        operand.index = quadStatic(program, constantValue(constant));
+        putName(&program->staticNames, name, operand.index);
+    } else if (function == NULL || isGlobalSymbol(name)) {
+        operand.index = findName(&program->staticNames, name);
+        if (operand.index == -1) {
+            operand.index = quadStatic(program, boxInt(0));
+            putName(&program->staticNames, name, operand.index);
+        }
+    } else {
+        operand.local = true;
+        operand.index = findName(&function->slots, name);
+        if (operand.index == -1) {
+            operand.index = function->slotCount++;
+            putName(&function->slots, name, operand.index);
+        }
+    }
+    return operand;
+}
+
+void freeQuadProgram(QuadProgram* program) {
+    for (int f = 0; f < program->functionCount; f++) {
+        free(program->functions[f].name);
+        freeNameTable(&program->functions[f].slots);
+    }
+    freeNameTable(&program->staticNames);
+    free(program->functions);
+    free(program->statics);
+    free(program->code);
+    free(program);
+}
+
+int quadOpByName(char* name, int* binary) {
+    const char* names[] = {"not", "minus", "bit_not", "assign", "if_false", "jf", "print", "push", "push_const",
+                           "pop_param", "return", "jtab", "label", "func_label", "jtarget", "nop", NULL};
+    const int ops[] = {QI_NOT, QI_MINUS, QI_BIT_NOT, QI_ASSIGN, QI_IF_FALSE, QI_IF_FALSE, QI_PRINT, QI_PUSH, QI_PUSH,
+                       QI_POP_PARAM, QI_RETURN, QI_JTAB, QI_NOP, QI_NOP, QI_NOP, QI_NOP};
+    for (int n = 0; names[n] != NULL; n++) {
+        if (strcmp(names[n], name) == 0) {
+            return ops[n];
+        }
+    }
+    *binary = vmOpByName(name);
+    if (*binary >= VM_ADD && *binary <= VM_NE) {
+        return QI_ADD + *binary - VM_ADD;
+    }
+    return *binary == -1 || *binary > VM_SHR ? -1 : QI_BINARY;
+}
+
+// main is called without arguments, its params start as 0
+int mainQuadParamCount(Quad* quads, int count) {
+    for (int i = 0; i < count; i++) {
+        if (strcmp(quads[i].op, "func_label") == 0 && strcmp(quads[i].arg1, "main") == 0) {
+            int params = 0;
+            while (i + 1 + params < count && strcmp(quads[i + 1 + params].op, "pop_param") == 0) {
+                params++;
+            }
+            return params;
+        }
+    }
+    return 0;
+}
+
+// global code first, then a call to main, then the functions each ending in a return
+QuadProgram* loadQuadProgram(Quad* quads, int count) {
+    QuadProgram* program = (QuadProgram*)calloc(1, sizeof(QuadProgram));
+    initNameTable(&program->staticNames);
+    Value zero = boxInt(0);
+    program->retSlot = quadStatic(program, zero);
+    int mainParams = mainQuadParamCount(quads, count);
+    int zeroSlot = quadStatic(program, zero);
+
+    int* order = (int*)malloc((count + 1) * sizeof(int));
+    int orderCount = 0;
+    for (int pass = 0; pass < 2; pass++) {
+        for (int i = 0; i < count; i++) {
+            if ((quads[i].function == NULL) == (pass == 0)) {
+                order[orderCount++] = i;
+            }
+            if (pass == 1 && strcmp(quads[i].op, "func_label") == 0) {
+                program->functions = (QuadFunction*)realloc(program->functions,
+                                                            (program->functionCount + 1) * sizeof(QuadFunction));
+                QuadFunction* function = &program->functions[program->functionCount++];
+                function->name = (char*)malloc(strlen(quads[i].arg1) + 6);
+                sprintf(function->name, "func_%s", quads[i].arg1);
+                function->slotCount = 0;
+                initNameTable(&function->slots);
+            }
+        }
+    }
+
+    // labels first, their index is where the instruction after them will be
+    NameTable labels;
+    initNameTable(&labels);
+    int at = 0;
+    int function = -1;
+    for (int n = 0; n < orderCount; n++) {
+        Quad* quad = &quads[order[n]];
+        if (quad->function != NULL && (n == 0 || quads[order[n - 1]].function == NULL)) {
+            at += mainParams + 2;
+        }
+        if (strcmp(quad->op, "func_label") == 0) {
+            at += function != -1;
+            function++;
+            program->functions[function].entry = at;
+        } else if (strcmp(quad->op, "label") == 0) {
+            putName(&labels, quad->result, at);
+        } else if (strcmp(quad->op, "nop") != 0) {
+            at++;
+        }
+    }
+    if (orderCount == 0 || quads[order[orderCount - 1]].function == NULL) {
+        at += mainParams + 2;
+    }
+    program->code = (QuadInstruction*)calloc(at + 2, sizeof(QuadInstruction));
+
+    bool ok = true;
+    bool hasMain = findQuadFunction(program, "func_main") != -1;
+    if (!hasMain) {
+        fprintf(stderr, "Interpreter: the program has no main function\n");
+        ok = false;
+    }
+    function = -1;
+    for (int n = 0; n <= orderCount && ok; n++) {
+        Quad* quad = n < orderCount ? &quads[order[n]] : NULL;
+        bool globalEnd = (quad == NULL || quad->function != NULL) && (n == 0 || quads[order[n - 1]].function == NULL);
+        if (globalEnd) {
+            for (int p = 0; p < mainParams; p++) {
+                QuadInstruction* push = &program->code[program->count++];
+                push->op = QI_PUSH;
+                push->a.index = zeroSlot;
+            }
+            QuadInstruction* call = &program->code[program->count++];
+            call->op = QI_CALL;
+            call->target = findQuadFunction(program, "func_main");
+            program->code[program->count++].op = QI_HALT;
+        }
+        if (quad == NULL) {
+            break;
+        }
+        if (strcmp(quad->op, "func_label") == 0) {
+            if (function != -1) {
+                program->code[program->count++].op = QI_RETURN;
+            }
+            function++;
+            continue;
+        }
+        if (strcmp(quad->op, "label") == 0 || strcmp(quad->op, "nop") == 0) {
+            continue;
+        }
+
+        QuadFunction* owner = quad->function != NULL ? &program->functions[function] : NULL;
+        QuadInstruction* in = &program->code[program->count++];
+        in->quad = order[n];
+        in->op = quadOpByName(quad->op, &in->binary);
+        if (isCallQuad(quad)) {
+            in->op = QI_CALL;
+            in->target = findQuadFunction(program, quad->result);
+        } else if (strcmp(quad->op, "jmp") == 0) {
+            in->op = QI_JMP;
+            in->target = findName(&labels, quad->result);
+        } else if (in->op == QI_IF_FALSE || in->op == QI_JTAB) {
+            in->target = in->op == QI_JTAB ? atoi(quad->arg2) : findName(&labels, quad->result);
+            in->fallback = in->op == QI_JTAB ? findName(&labels, quad->result) : 0;
+            in->a = resolveQuadOperand(program, owner, quad->arg1);
+        } else if (strcmp(quad->op, "jtarget") == 0) {
+            in->op = QI_JMP;
+            in->target = findName(&labels, quad->result);
+        } else if (in->op == QI_POP_PARAM) {
+            in->r = resolveQuadOperand(program, owner, quad->arg1);
+        } else if (in->op != -1) {
+            in->a = resolveQuadOperand(program, owner, in->op == QI_RETURN ? quad->result : quad->arg1);
+            in->b = resolveQuadOperand(program, owner, quad->arg2);
+            in->r = resolveQuadOperand(program, owner, quad->result);
+        }
+
+        if (in->op == -1) {
+            fprintf(stderr, "Interpreter: unknown quad %s\n", quad->op);
+            ok = false;
+        } else if (in->target == -1 || in->fallback == -1) {
+            fprintf(stderr, "Interpreter: undefined label or function %s\n", quad->result);
+            ok = false;
+        } else if (in->op == QI_RETURN && strcmp(quad->result, "_") == 0) {
+            in->a.index = -1;
+        }
+    }
+    if (ok && function != -1) {
+        program->code[program->count++].op = QI_RETURN;
+    }
+    program->code[program->count].op = QI_HALT;
+
+    free(order);
+    freeNameTable(&labels);
+    if (!ok) {
+        freeQuadProgram(program);
+        return NULL;
+    }
+    return program;
+}
+
+/*--------------------------------------------------------------------------*/
+/* Execution */
+/*--------------------------------------------------------------------------*/
+
+void appendOutput(QuadOutput* output, Value value) {
+    bool isString = valueType(value) == 's';
+    char small[SMALL_STRING_MAX + 1];
+    char* text = isString ? (char*)stringChars(value, small) : valueAsString(value);
+    int length = strlen(text);
+    if (output->length + length + 2 > output->capacity) {
+        output->capacity = (output->length + length + 2) * 2;
+        output->text = (char*)realloc(output->text, output->capacity);
+    }
+    memcpy(output->text + output->length, text, length);
+    output->length += length;
+    output->text[output->length++] = '\n';
+    output->text[output->length] = '\0';
+    if (!isString) {
+        free(text);
+    }
+}
+
+bool quadError(QuadProgram* program, Quad* quads, int pc, char* message) {
+    int quad = program->code[pc].quad;
+    fprintf(stderr, "Runtime error: %s (quad %d, %s)\n", message, quad + 1, quads[quad].op);
+    return false;
+}
+
+typedef struct QuadCall {
+    int returnPc;
+    Value* base;
+} QuadCall;
+
+#define QUAD_VALUE(o) ((o).local ? base : statics)[(o).index]
+// anything but two ints, and a division by zero or -1, goes to the general binary operation
+#define QUAD_INT_OP(box, expression) { \
+        Value a = QUAD_VALUE(in->a); \
+        Value b = QUAD_VALUE(in->b); \
+        if (!isIntValue(a) || !isIntValue(b)) { \
+            goto binary; \
+        } \
+        int x = asInt(a); \
+        int y = asInt(b); \
+        QUAD_VALUE(in->r) = box(expression); \
+        pc++; \
+        break; \
+    }
+
+// prints to stdout when output is NULL
+bool runQuadProgram(QuadProgram* program, Quad* quads, QuadOutput* output, long long* executed) {
+    Value* stack = (Value*)malloc(INTERPRETER_STACK_SIZE * sizeof(Value));
+    Value* stackEnd = stack + INTERPRETER_STACK_SIZE;
+    Value* args = (Value*)malloc(INTERPRETER_STACK_SIZE * sizeof(Value));
+    int argCount = 0;
+    QuadCall* calls = (QuadCall*)malloc(INTERPRETER_MAX_CALLS * sizeof(QuadCall));
+    int callCount = 0;
+    Value* base = stack;
+    Value* top = stack; // first free frame slot
+    Value* statics = program->statics;
+    QuadInstruction* code = program->code;
+    long long steps = 0;
+    bool ok = true;
+    bool running = true;
+    int pc = 0;
+
+    while (running && ok) {
+        QuadInstruction* in = &code[pc];
+        steps++;
+        switch (in->op) {
+            case QI_ADD: QUAD_INT_OP(boxInt, (int)((unsigned)x + (unsigned)y));
+            case QI_SUB: QUAD_INT_OP(boxInt, (int)((unsigned)x - (unsigned)y));
+            case QI_MUL: QUAD_INT_OP(boxInt, (int)((unsigned)x * (unsigned)y));
+            case QI_DIV: case QI_MOD: {
+                Value a = QUAD_VALUE(in->a);
+                Value b = QUAD_VALUE(in->b);
+                if (!isIntValue(a) || !isIntValue(b) || asInt(b) == 0 || asInt(b) == -1) {
+                    goto binary; // INT_MIN / -1 traps, binaryOperation wraps it
+                }
+                QUAD_VALUE(in->r) = boxInt(in->op == QI_DIV ? asInt(a) / asInt(b) : asInt(a) % asInt(b));
+                pc++;
+                break;
+            }
+            case QI_LT: QUAD_INT_OP(boxBool, x < y);
+            case QI_GT: QUAD_INT_OP(boxBool, x > y);
+            case QI_LE: QUAD_INT_OP(boxBool, x <= y);
+            case QI_GE: QUAD_INT_OP(boxBool, x >= y);
+            case QI_EQ: QUAD_INT_OP(boxBool, x == y);
+            case QI_NE: QUAD_INT_OP(boxBool, x != y);
+            case QI_BINARY:
+            binary: {
+                Value* r = &QUAD_VALUE(in->r);
+                char* error = binaryOperation(in->binary, QUAD_VALUE(in->a), QUAD_VALUE(in->b), r);
+                if (error != NULL) {
+                    ok = quadError(program, quads, pc, error);
+                    break;
+                }
+                if (stringCollectionDue()) {
+                    Value* roots[] = {stack, top, args, args + argCount, statics, statics + program->staticCount};
+                    collectStrings(roots, 3);
+                }
+                pc++;
+                break;
+            }
+            case QI_NOT: {
+                QUAD_VALUE(in->r) = boxBool(!isTruthy(QUAD_VALUE(in->a)));
+                pc++;
+                break;
+            }
+            case QI_MINUS:
+            case QI_BIT_NOT: {
+                Value value = QUAD_VALUE(in->a);
+                Value* r = &QUAD_VALUE(in->r);
+                if (valueType(value) == 's' || (!isBoxed(value) && in->op == QI_BIT_NOT)) {
+                    ok = quadError(program, quads, pc, "bad operand");
+                    break;
+                }
+                if (!isBoxed(value)) {
+                    *r = boxFloat(-asFloat(value));
+                } else {
+                    *r = boxInt(in->op == QI_MINUS ? -asInt(value) : ~asInt(value));
+                }
+                pc++;
+                break;
+            }
+            case QI_ASSIGN:
+                QUAD_VALUE(in->r) = QUAD_VALUE(in->a);
+                pc++;
+                break;
+            case QI_IF_FALSE:
+                pc = isTruthy(QUAD_VALUE(in->a)) ? pc + 1 : in->target;
+                break;
+            case QI_JMP:
+                pc = in->target;
+                break;
+            case QI_JTAB: {
+                Value index = QUAD_VALUE(in->a);
+                pc = isBoxed(index) && asInt(index) >= 0 && asInt(index) < in->target
+                   ? code[pc + 1 + asInt(index)].target : in->fallback;
+                break;
+            }
+            case QI_CALL: {
+                QuadFunction* function = &program->functions[in->target];
+                if (callCount == INTERPRETER_MAX_CALLS || stackEnd - top < function->slotCount) {
+                    ok = quadError(program, quads, pc, "call stack overflow");
+                    break;
+                }
+                calls[callCount].returnPc = pc + 1;
+                calls[callCount].base = base;
+                callCount++;
+                base = top;
+                top += function->slotCount;
+                for (Value* slot = base; slot < top; slot++) {
+                    *slot = boxInt(0);
+                }
+                pc = function->entry;
+                break;
+            }
+            case QI_RETURN:
+                if (in->a.index != -1) {
+                    statics[program->retSlot] = QUAD_VALUE(in->a);
+                }
+                if (callCount == 0) {
+                    running = false;
+                    break;
+                }
+                callCount--;
+                top = base;
+                base = calls[callCount].base;
+                pc = calls[callCount].returnPc;
+                break;
+            case QI_PUSH:
+                if (argCount == INTERPRETER_STACK_SIZE) {
+                    ok = quadError(program, quads, pc, "too many pushed arguments");
+                    break;
+                }
+                args[argCount++] = QUAD_VALUE(in->a);
+                pc++;
+                break;
+            case QI_POP_PARAM:
+                if (argCount == 0) {
+                    ok = quadError(program, quads, pc, "missing argument");
+                    break;
+                }
+                QUAD_VALUE(in->r) = args[--argCount];
+                pc++;
+                break;
+            case QI_PRINT:
+                if (output != NULL) {
+                    appendOutput(output, QUAD_VALUE(in->a));
+                } else {
+                    printValue(QUAD_VALUE(in->a));
+                }
+                pc++;
+                break;
+            case QI_NOP:
+                pc++;
+                break;
+            case QI_HALT:
+                running = false;
+                break;
+        }
+    }
+
+    releaseStrings();
+    free(calls);
+    free(args);
+    free(stack);
+    *executed = steps;
+    return ok;
+}
+
+// runs the quads into output, false on a load or runtime error
+bool interpretQuads(Quad* quads, int count, QuadOutput* output, long long* executed, double* seconds) {
+    QuadProgram* program = loadQuadProgram(quads, count);
+    *executed = 0;
+    *seconds = 0;
+    if (program == NULL) {
+        return false;
+    }
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    bool ok = runQuadProgram(program, quads, output, executed);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    *seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    freeQuadProgram(program);
+    return ok;
+}
+
+// --run --engine register: runs quadList instead of the assembly, printing as it goes
+bool runQuadEngine() {
+    QuadProgram* program = loadQuadProgram(quadList, quadCount);
+    if (program == NULL) {
+        return false;
+    }
+    struct timespec start, end;
+    long long executed = 0;
+    printf("---- run ----\n");
+    fflush(stdout);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    bool ok = runQuadProgram(program, quadList, NULL, &executed);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    fflush(stdout);
+
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("---- end ----\n");
+    printf("Register VM: %lld instructions (%d loaded) in %.3f s, %.1f M instructions/s\n",
+           executed, program->count, seconds, seconds > 0 ? executed / seconds / 1e6 : 0.0);
+    if (stringHeap.concatenations > 0) {
+        reportStrings();
+    }
+    freeQuadProgram(program);
+    return ok;
+}
+
+Quad* copyQuads(Quad* quads, int count) {
+    Quad* copy = (Quad*)malloc((count + 1) * sizeof(Quad));
+    for (int i = 0; i < count; i++) {
+        copy[i].op = strdup(quads[i].op);
+        copy[i].arg1 = strdup(quads[i].arg1);
+        copy[i].arg2 = strdup(quads[i].arg2);
+        copy[i].result = strdup(quads[i].result);
+        copy[i].function = quads[i].function ? strdup(quads[i].function) : NULL;
+    }
+    return copy;
+}
+
+void freeQuads(Quad* quads, int count) {
+    for (int i = 0; i < count; i++) {
+        free(quads[i].op);
+        free(quads[i].arg1);
+        free(quads[i].arg2);
+        free(quads[i].result);
+        free(quads[i].function);
+    }
+    free(quads);
+}
+
+// runs quadList, and the quads from before the optimizer when given to check they print the same
+bool runQuadInterpreter(Quad* original, int originalCount) {
+    QuadOutput output = {NULL, 0, 0};
+    long long executed;
+    double seconds;
+    bool ok = interpretQuads(quadList, quadCount, &output, &executed, &seconds);
+    printf("---- interpret ----\n%s---- end ----\n", output.text ? output.text : "");
+    printf("Interpreter: %lld quads in %.3f s, %.1f M quads/s\n",
+           executed, seconds, seconds > 0 ? executed / seconds / 1e6 : 0.0);
+
+    if (original != NULL) {
+        QuadOutput expected = {NULL, 0, 0};
+        long long originalExecuted;
+        double originalSeconds;
+        bool originalOk = interpretQuads(original, originalCount, &expected, &originalExecuted, &originalSeconds);
+        bool same = originalOk == ok && strcmp(output.text ? output.text : "", expected.text ? expected.text : "") == 0;
+        printf("Interpreter: unoptimized quads ran %lld quads, %s\n", originalExecuted,
+               same ? "same output" : "different output");
+        if (!same) {
+            fprintf(stderr, "Optimized quads print something else than the unoptimized ones\n");
+            ok = false;
+        }
+        free(expected.text);
+    }
+    free(output.text);
+    return ok;
+}
+
+#endif
@@ -0,0 +1,869 @@
+#ifndef __JIT_C__
+#define __JIT_C__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdarg.h>
+
+#include "fusion.c"
+
+#if defined(__x86_64__) && defined(__linux__)
+#define JIT_SUPPORTED
+#include <sys/mman.h>
+#endif
+
+/*
+    Baseline JIT (--jit, x86-64 Linux). Every function counts its calls
+    and the backward jumps taken in it. Once the count reaches
+    JIT_THRESHOLD, its instructions are translated one by one from fixed
+    templates into machine code in an mmap'ed buffer. The machine code
+    works on the VM's own stack and frames, with
+        rbx  sp            r12  fp          r13  constants
+        r14  globals       r15  the JitState
+    so the interpreter and the machine code can hand the running function
+    to each other at any instruction boundary. The machine code returns to
+    the interpreter with the pc to go on at on call, ret, retv, tailcall,
+    halt and a division by zero or by -1. The interpreter runs that
+    instruction and goes back to the machine code at function starts, at
+    the instruction after a call and at the target of a backward jump.
+    Before compiling, the stack depth of every instruction is worked out
+    from the start of the function. A function whose depths don't agree,
+    or that would pop below its frame, stays interpreted, so the machine
+    code needs no stack checks. It is entered only when sp is where that
+    depth says and the stack has room for the deepest point.
+    Every op stores its result boxed, as the whole 8 byte value, so the
+    load that reads it next gets it from one store (a load over parts of
+    two stores stalls the store forwarding). An int comparison followed by
+    its jf becomes a cmp and a jcc.
+*/
+
+#ifndef JIT_THRESHOLD
+#define JIT_THRESHOLD 100 // -DJIT_THRESHOLD=1 compiles every function the first time it runs
+#endif
+
+int jitCompiledFunctions = 0;
+int jitRefusedFunctions = 0;
+int jitCodeBytes = 0;
+
+typedef struct JitState {
+    Value* sp;
+    Value* fp;
+    Value* constants;
+    Value* globals;
+    long long steps; // instructions run by the machine code
+} JitState;
+
+typedef int (*JitCode)(JitState* state, void* target);
+
+typedef struct JitFunction {
+    int start; // first instruction after the enter
+    int end;
+    int frameSize;
+    int hotness;
+    bool refused;
+    int maxDepth;
+    int* depths; // per instruction from start, -1 when not reached
+    unsigned char* code;
+    size_t codeSize;
+} JitFunction;
+
+typedef struct VMJit {
+    VMProgram* program;
+    JitFunction* functions;
+    int functionCount;
+    int* functionOf; // per instruction, the function it is in or -1
+    void** native; // per instruction, its machine code once compiled
+    JitState state;
+} VMJit;
+
+/*--------------------------------------------------------------------------*/
+/* Helpers called from the machine code, sp is the stack pointer at the call */
+/*--------------------------------------------------------------------------*/
+
+void jitPrint(Value* sp) {
+    printValue(sp[-1]);
+}
+
+void jitConcat(Value* sp) {
+    sp[-2] = concatStrings(sp[-2], sp[-1]);
+    if (stringCollectionDue()) {
+        collectVMStrings(sp - 1);
+    }
+}
+
+// jf on a string, sp is already past it
+int jitStringTruth(Value* sp) {
+    return stringLength(*sp) != 0;
+}
+
+void jitStringCompare(Value* sp, int op) {
+    int order = compareStrings(sp[-2], sp[-1]);
+    bool results[] = {order < 0, order > 0, order <= 0, order >= 0, order == 0, order != 0};
+    sp[-2] = boxBool(results[op - VM_SLT]);
+}
+
+void jitFmod(Value* sp) {
+    sp[-2] = boxFloat(fmod(asFloat(sp[-2]), asFloat(sp[-1])));
+}
+
+/*--------------------------------------------------------------------------*/
+/* Stack depths */
+/*--------------------------------------------------------------------------*/
+
+// 1 when the function returns a value, 0 when it doesn't, -1 when that can't be told from its code
+int jitReturnsValue(VMJit* jit, int function, int calls) {
+    JitFunction* f = &jit->functions[function];
+    int result = -1;
+    bool mixed = false;
+    for (int pc = f->start; pc < f->end; pc++) {
+        int op = vmBaseOp(jit->program->code[pc].op);
+        int returns = op == VM_RETV ? 1 : op == VM_RET ? 0 : -1;
+        if (op == VM_TAILCALL && calls < 8 && jit->functionOf[jit->program->code[pc].a + 1] != function) {
+            returns = jitReturnsValue(jit, jit->functionOf[jit->program->code[pc].a + 1], calls + 1);
+            mixed = mixed || returns == -1;
+        }
+        if (returns != -1) {
+            mixed = mixed || (result != -1 && result != returns);
+            result = returns;
+        }
+    }
+    return mixed ? -1 : result;
+}
+
+// what the instruction pops and pushes, false when it leaves the function (or the machine code)
+bool jitStackEffect(VMJit* jit, int pc, int* pops, int* pushes) {
+    Instruction* in = &jit->program->code[pc];
+    int op = vmBaseOp(in->op);
+    *pops = 0;
+    *pushes = 0;
+    switch (op) {
+        case VM_PUSH_CONST: case VM_LOAD: case VM_GLOAD:
+            *pushes = 1;
+            return true;
+        case VM_STORE: case VM_GSTORE: case VM_DROP: case VM_PRINT: case VM_JF: case VM_JTAB:
+            *pops = 1;
+            return true;
+        case VM_I2F: case VM_INOT: case VM_FNOT: case VM_INEG: case VM_FNEG: case VM_BIT_NOT:
+            *pops = 1;
+            *pushes = 1;
+            return true;
+        case VM_JMP: case VM_JTARGET:
+            return true;
+        case VM_CALL: {
+            int callee = jit->functionOf[in->a + 1];
+            int returns = callee == -1 ? -1 : jitReturnsValue(jit, callee, 0);
+            *pops = jit->program->code[in->a].a;
+            *pushes = returns;
+            return returns != -1;
+        }
+        case VM_RETV:
+            *pops = 1;
+            return false;
+        case VM_TAILCALL:
+            *pops = in->b;
+            return false;
+        case VM_RET: case VM_HALT: case VM_ENTER:
+            return false;
+    }
+    if ((op >= VM_BIT_AND && op <= VM_SHR) || (op >= VM_IADD && op <= VM_SCONCAT)) {
+        *pops = 2;
+        *pushes = 1;
+        return true;
+    }
+    *pops = 1 << 20; // anything else can't be compiled
+    return false;
+}
+
+bool jitSetDepth(JitFunction* f, int pc, int depth, int* work, int* workCount) {
+    if (pc < f->start || pc >= f->end) {
+        return true; // leaves the function, the machine code hands it to the interpreter
+    }
+    int* known = &f->depths[pc - f->start];
+    if (*known == -1) {
+        *known = depth;
+        work[(*workCount)++] = pc;
+        return true;
+    }
+    return *known == depth;
+}
+
+// fills depths and maxDepth, false when the function can't be compiled
+bool jitComputeDepths(VMJit* jit, JitFunction* f) {
+    int length = f->end - f->start;
+    f->depths = (int*)malloc((length + 1) * sizeof(int));
+    for (int i = 0; i < length; i++) {
+        f->depths[i] = -1;
+    }
+    int* work = (int*)malloc((length + 1) * sizeof(int));
+    int workCount = 0;
+    bool ok = length > 0 && jitSetDepth(f, f->start, 0, work, &workCount);
+    f->maxDepth = 0;
+    while (ok && workCount > 0) {
+        int pc = work[--workCount];
+        int depth = f->depths[pc - f->start];
+        int pops, pushes;
+        bool next = jitStackEffect(jit, pc, &pops, &pushes);
+        if (pops > depth) {
+            ok = false;
+            break;
+        }
+        int after = depth - pops + (pushes > 0 ? pushes : 0);
+        f->maxDepth = after > f->maxDepth ? after : f->maxDepth;
+        Instruction* in = &jit->program->code[pc];
+        int op = vmBaseOp(in->op);
+        if (op == VM_JMP || op == VM_JF) {
+            ok = jitSetDepth(f, in->a, after, work, &workCount);
+        } else if (op == VM_JTAB) {
+            ok = jitSetDepth(f, in->b, after, work, &workCount);
+            for (int t = 1; ok && t <= in->a; t++) {
+                ok = jitSetDepth(f, jit->program->code[pc + t].a, after, work, &workCount);
+            }
+        }
+        if (ok && next && op != VM_JMP && op != VM_JTAB) {
+            ok = jitSetDepth(f, pc + 1, after, work, &workCount);
+        }
+    }
+    free(work);
+    return ok;
+}
+
+#ifdef JIT_SUPPORTED
+
+/*--------------------------------------------------------------------------*/
+/* x86-64 encoding */
+/*--------------------------------------------------------------------------*/
+
+enum { RAX = 0, RCX = 1, RDX = 2, RBX = 3, RSI = 6, RDI = 7, R12 = 12, R13 = 13, R14 = 14, R15 = 15 };
+
+#define JIT_SP RBX
+#define JIT_FP R12
+#define JIT_CONSTANTS R13
+#define JIT_GLOBALS R14
+#define JIT_STATE R15
+#define JIT_VALUE ((int)sizeof(Value))
+#define JIT_TOP(n) (-(n) * JIT_VALUE) // sp[-n]
+
+typedef struct JitBuffer {
+    unsigned char* bytes;
+    int size;
+    int capacity;
+} JitBuffer;
+
+typedef struct JitFixup {
+    int at; // the rel32 to patch
+    int pc; // the instruction it jumps to
+} JitFixup;
+
+typedef struct JitEmitter {
+    JitBuffer buffer;
+    JitFixup* fixups;
+    int fixupCount;
+    int epilogue;
+    int blockLeft; // of the instructions counted at the block start, the ones from the one being compiled on
+} JitEmitter;
+
+void jitByte(JitBuffer* buffer, int byte) {
+    if (buffer->size == buffer->capacity) {
+        buffer->capacity = buffer->capacity ? buffer->capacity * 2 : 4096;
+        buffer->bytes = (unsigned char*)realloc(buffer->bytes, buffer->capacity);
+    }
+    buffer->bytes[buffer->size++] = (unsigned char)byte;
+}
+
+void jitBytes(JitBuffer* buffer, int count, ...) {
+    va_list bytes;
+    va_start(bytes, count);
+    for (int i = 0; i < count; i++) {
+        jitByte(buffer, va_arg(bytes, int));
+    }
+    va_end(bytes);
+}
+
+void jitInt32(JitBuffer* buffer, int value) {
+    for (int i = 0; i < 4; i++) {
+        jitByte(buffer, (value >> (8 * i)) & 0xFF);
+    }
+}
+
+void jitInt64(JitBuffer* buffer, long long value) {
+    for (int i = 0; i < 8; i++) {
+        jitByte(buffer, (int)((value >> (8 * i)) & 0xFF));
+    }
+}
+
+// an instruction with a [base + disp32] operand: prefix (0 for none), REX.W, one or two opcode bytes, the reg field
+void jitMem(JitBuffer* buffer, int prefix, bool wide, int opcode, int reg, int base, int disp) {
+    if (prefix) {
+        jitByte(buffer, prefix);
+    }
+    int rex = 0x40 | (wide << 3) | ((reg >> 3) << 2) | (base >> 3);
+    if (rex != 0x40) {
+        jitByte(buffer, rex);
+    }
+    if (opcode > 0xFF) {
+        jitByte(buffer, opcode >> 8);
+    }
+    jitByte(buffer, opcode & 0xFF);
+    jitByte(buffer, 0x80 | ((reg & 7) << 3) | (base & 7));
+    if ((base & 7) == 4) {
+        jitByte(buffer, 0x24); // r12 needs a SIB byte
+    }
+    jitInt32(buffer, disp);
+}
+
+void jitMoveSp(JitBuffer* buffer, int values) {
+    jitBytes(buffer, 3, 0x48, 0x83, values > 0 ? 0xC3 : 0xEB); // add/sub rbx, imm8
+    jitByte(buffer, abs(values) * JIT_VALUE);
+}
+
+// eax, zero extended in rax, boxed with the tag and stored as the whole value
+void jitStoreBoxed(JitBuffer* buffer, int tag, int disp) {
+    jitBytes(buffer, 2, 0x48, 0xB9); // mov rcx, the tag
+    jitInt64(buffer, (long long)boxTagged(tag, 0));
+    jitBytes(buffer, 3, 0x48, 0x09, 0xC8); // or rax, rcx
+    jitMem(buffer, 0, true, 0x89, RAX, JIT_SP, disp);
+}
+
+void jitCopy(JitBuffer* buffer, int toBase, int to, int fromBase, int from) {
+    jitMem(buffer, 0, true, 0x8B, RAX, fromBase, from);
+    jitMem(buffer, 0, true, 0x89, RAX, toBase, to);
+}
+
+// ZF set when rax holds a boxed value, clear for a float, rcx is clobbered
+void jitTestBoxed(JitBuffer* buffer) {
+    jitBytes(buffer, 3, 0x48, 0x89, 0xC1); // mov rcx, rax
+    jitBytes(buffer, 4, 0x48, 0xC1, 0xE9, 50); // shr rcx, 50
+    jitBytes(buffer, 2, 0x81, 0xF9); // cmp ecx, the top 14 bits of VALUE_BOXED
+    jitInt32(buffer, (int)(VALUE_BOXED >> 50));
+}
+
+// setcc al then movzx eax, al
+void jitSetFlag(JitBuffer* buffer, int setcc) {
+    jitBytes(buffer, 6, 0x0F, setcc, 0xC0, 0x0F, 0xB6, 0xC0);
+}
+
+// jmp or jcc rel32 to an instruction, patched once every instruction has its address
+void jitJumpTo(JitEmitter* emitter, int condition, int pc) {
+    if (condition) {
+        jitBytes(&emitter->buffer, 2, 0x0F, condition);
+    } else {
+        jitByte(&emitter->buffer, 0xE9);
+    }
+    emitter->fixups = (JitFixup*)realloc(emitter->fixups, (emitter->fixupCount + 1) * sizeof(JitFixup));
+    emitter->fixups[emitter->fixupCount].at = emitter->buffer.size;
+    emitter->fixups[emitter->fixupCount].pc = pc;
+    emitter->fixupCount++;
+    jitInt32(&emitter->buffer, 0);
+}
+
+// a forward jcc/jmp rel32 inside a template, returns where to patch
+int jitJumpForward(JitBuffer* buffer, int condition) {
+    if (condition) {
+        jitBytes(buffer, 2, 0x0F, condition);
+    } else {
+        jitByte(buffer, 0xE9);
+    }
+    jitInt32(buffer, 0);
+    return buffer->size - 4;
+}
+
+void jitPatchHere(JitBuffer* buffer, int at) {
+    int rel = buffer->size - (at + 4);
+    memcpy(buffer->bytes + at, &rel, 4);
+}
+
+// back to the interpreter, which goes on at pc
+void jitExit(JitEmitter* emitter, int pc) {
+    jitByte(&emitter->buffer, 0xB8); // mov eax, pc
+    jitInt32(&emitter->buffer, pc);
+    jitByte(&emitter->buffer, 0xE9);
+    jitInt32(&emitter->buffer, emitter->epilogue - (emitter->buffer.size + 4));
+}
+
+void jitCallHelper(JitBuffer* buffer, void* helper) {
+    jitBytes(buffer, 3, 0x48, 0x89, 0xDF); // mov rdi, rbx
+    jitBytes(buffer, 2, 0x48, 0xB8); // mov rax, helper
+    jitInt64(buffer, (long long)(size_t)helper);
+    jitBytes(buffer, 2, 0xFF, 0xD0); // call rax
+}
+
+/*--------------------------------------------------------------------------*/
+/* Templates */
+/*--------------------------------------------------------------------------*/
+
+void jitIntOperation(JitBuffer* buffer, int opcode) {
+    jitMem(buffer, 0, false, 0x8B, RAX, JIT_SP, JIT_TOP(2)); // mov eax, x
+    jitMem(buffer, 0, false, opcode, RAX, JIT_SP, JIT_TOP(1)); // op eax, y
+    jitStoreBoxed(buffer, VALUE_INT, JIT_TOP(2));
+    jitMoveSp(buffer, -1);
+}
+
+void jitIntCompare(JitBuffer* buffer, int setcc) {
+    jitMem(buffer, 0, false, 0x8B, RAX, JIT_SP, JIT_TOP(2));
+    jitMem(buffer, 0, false, 0x3B, RAX, JIT_SP, JIT_TOP(1)); // cmp eax, y
+    jitSetFlag(buffer, setcc);
+    jitStoreBoxed(buffer, VALUE_BOOL, JIT_TOP(2));
+    jitMoveSp(buffer, -1);
+}
+
+// an int comparison followed by its jf: compare and jump when false, the bool is never written
+void jitCompareAndJump(JitEmitter* emitter, int op, int target) {
+    JitBuffer* buffer = &emitter->buffer;
+    int whenFalse[] = {0x8D, 0x8E, 0x8F, 0x8C, 0x85, 0x84}; // jge jle jg jl jne je for ilt .. ine
+    jitMoveSp(buffer, -2); // before the cmp, sub sets the flags too
+    jitMem(buffer, 0, false, 0x8B, RAX, JIT_SP, JIT_TOP(0));
+    jitMem(buffer, 0, false, 0x3B, RAX, JIT_SP, JIT_TOP(-1));
+    jitJumpTo(emitter, whenFalse[op - VM_ILT], target);
+}
+
+void jitFloatOperation(JitBuffer* buffer, int opcode) {
+    jitMem(buffer, 0xF2, false, 0x0F10, 0, JIT_SP, JIT_TOP(2)); // movsd xmm0, x
+    jitMem(buffer, 0xF2, false, opcode, 0, JIT_SP, JIT_TOP(1)); // op xmm0, y
+    // no boxFloat: from canonical inputs the hardware only gives its default NaN or an input NaN back
+    jitMem(buffer, 0xF2, false, 0x0F11, 0, JIT_SP, JIT_TOP(2));
+    jitMoveSp(buffer, -1);
+}
+
+// ucomisd sets the flags the way an unsigned compare would, NaN compares as unordered (ZF, PF and CF set)
+void jitFloatCompare(JitBuffer* buffer, int op) {
+    bool swap = op == VM_FLT || op == VM_FLE; // x < y is y > x, seta is false for NaN
+    jitMem(buffer, 0xF2, false, 0x0F10, 0, JIT_SP, JIT_TOP(swap ? 1 : 2));
+    jitMem(buffer, 0x66, false, 0x0F2E, 0, JIT_SP, JIT_TOP(swap ? 2 : 1)); // ucomisd xmm0, other
+    switch (op) {
+        case VM_FLT: case VM_FGT: jitBytes(buffer, 3, 0x0F, 0x97, 0xC0); break; // seta al
+        case VM_FLE: case VM_FGE: jitBytes(buffer, 3, 0x0F, 0x93, 0xC0); break; // setae al
+        case VM_FEQ: jitBytes(buffer, 8, 0x0F, 0x94, 0xC0, 0x0F, 0x9B, 0xC1, 0x20, 0xC8); break; // sete, setnp, and
+        default: jitBytes(buffer, 8, 0x0F, 0x95, 0xC0, 0x0F, 0x9A, 0xC1, 0x08, 0xC8); break; // setne, setp, or
+    }
+    jitBytes(buffer, 3, 0x0F, 0xB6, 0xC0);
+    jitStoreBoxed(buffer, VALUE_BOOL, JIT_TOP(2));
+    jitMoveSp(buffer, -1);
+}
+
+bool isComparisonOp(int op) {
+    return (op >= VM_ILT && op <= VM_INE) || (op >= VM_FLT && op <= VM_FNE) || (op >= VM_SLT && op <= VM_SNE)
+           || op == VM_INOT || op == VM_FNOT;
+}
+
+// jf: an int, bool or char is false at 0, a float at 0.0 or -0.0, a string when empty
+void jitJumpIfFalse(JitEmitter* emitter, int target, bool isBool) {
+    JitBuffer* buffer = &emitter->buffer;
+    jitMoveSp(buffer, -1);
+    if (isBool) {
+        jitMem(buffer, 0, false, 0x83, 7, JIT_SP, 0); // cmp dword [rbx], 0
+        jitByte(buffer, 0);
+        jitJumpTo(emitter, 0x84, target);
+        return;
+    }
+    jitMem(buffer, 0, true, 0x8B, RAX, JIT_SP, 0);
+    jitTestBoxed(buffer);
+    int toFloat = jitJumpForward(buffer, 0x85);
+    jitBytes(buffer, 3, 0x48, 0x89, 0xC1); // mov rcx, rax
+    jitBytes(buffer, 4, 0x48, 0xC1, 0xE9, VALUE_TAG_SHIFT); // shr rcx, 48
+    jitBytes(buffer, 3, 0x83, 0xE1, 3); // and ecx, 3
+    jitBytes(buffer, 3, 0x83, 0xF9, VALUE_STRING); // cmp ecx, the string tag
+    int toString = jitJumpForward(buffer, 0x84);
+    jitBytes(buffer, 2, 0x85, 0xC0); // test eax, eax
+    jitJumpTo(emitter, 0x84, target);
+    int done = jitJumpForward(buffer, 0);
+
+    jitPatchHere(buffer, toFloat);
+    jitBytes(buffer, 3, 0x48, 0xD1, 0xE0); // shl rax, 1: zero only for 0.0 and -0.0, NaN is true
+    jitJumpTo(emitter, 0x84, target);
+    int floatDone = jitJumpForward(buffer, 0);
+
+    jitPatchHere(buffer, toString);
+    jitCallHelper(buffer, (void*)jitStringTruth);
+    jitBytes(buffer, 2, 0x85, 0xC0); // test eax, eax
+    jitJumpTo(emitter, 0x84, target);
+
+    jitPatchHere(buffer, done);
+    jitPatchHere(buffer, floatDone);
+}
+
+// the machine code of one instruction, false when it has none and hands over to the interpreter
+bool jitInstruction(JitEmitter* emitter, VMProgram* program, int pc, bool afterComparison) {
+    JitBuffer* buffer = &emitter->buffer;
+    Instruction* in = &program->code[pc];
+    int op = vmBaseOp(in->op);
+    switch (op) {
+        case VM_PUSH_CONST: case VM_LOAD: case VM_GLOAD: {
+            int base = op == VM_PUSH_CONST ? JIT_CONSTANTS : op == VM_LOAD ? JIT_FP : JIT_GLOBALS;
+            jitCopy(buffer, JIT_SP, 0, base, in->a * JIT_VALUE);
+            jitMoveSp(buffer, 1);
+            return true;
+        }
+        case VM_STORE: case VM_GSTORE:
+            jitMoveSp(buffer, -1);
+            jitCopy(buffer, op == VM_STORE ? JIT_FP : JIT_GLOBALS, in->a * JIT_VALUE, JIT_SP, 0);
+            return true;
+        case VM_DROP:
+            jitMoveSp(buffer, -1);
+            return true;
+        case VM_IADD: jitIntOperation(buffer, 0x03); return true;
+        case VM_ISUB: jitIntOperation(buffer, 0x2B); return true;
+        case VM_IMUL: jitIntOperation(buffer, 0x0FAF); return true;
+        case VM_BIT_AND: jitIntOperation(buffer, 0x23); return true;
+        case VM_BIT_OR: jitIntOperation(buffer, 0x0B); return true;
+        case VM_XOR: jitIntOperation(buffer, 0x33); return true;
+        case VM_IDIV: case VM_IMOD: {
+            jitMem(buffer, 0, false, 0x8B, RCX, JIT_SP, JIT_TOP(1)); // mov ecx, y
+            // 0 and -1 are the divisors with ecx + 1 <= 1 unsigned, idiv traps on both (INT_MIN / -1)
+            jitBytes(buffer, 3, 0x8D, 0x41, 0x01); // lea eax, [rcx + 1]
+            jitBytes(buffer, 3, 0x83, 0xF8, 0x01); // cmp eax, 1
+            int divisible = jitJumpForward(buffer, 0x87); // ja
+            jitMem(buffer, 0, true, 0x81, 0, JIT_STATE, offsetof(JitState, steps)); // the rest of the block never runs
+            jitInt32(buffer, -emitter->blockLeft);
+            jitExit(emitter, pc); // the interpreter reports the division by zero and wraps INT_MIN / -1
+            jitPatchHere(buffer, divisible);
+            jitMem(buffer, 0, false, 0x8B, RAX, JIT_SP, JIT_TOP(2));
+            jitBytes(buffer, 3, 0x99, 0xF7, 0xF9); // cdq, idiv ecx
+            if (op == VM_IMOD) {
+                jitBytes(buffer, 2, 0x89, 0xD0); // mov eax, edx
+            }
+            jitStoreBoxed(buffer, VALUE_INT, JIT_TOP(2));
+            jitMoveSp(buffer, -1);
+            return true;
+        }
+        case VM_SHL: case VM_SHR:
+            jitMem(buffer, 0, false, 0x8B, RCX, JIT_SP, JIT_TOP(1));
+            jitMem(buffer, 0, false, 0x8B, RAX, JIT_SP, JIT_TOP(2));
+            jitBytes(buffer, 2, 0xD3, op == VM_SHL ? 0xE0 : 0xF8); // shl/sar eax, cl
+            jitStoreBoxed(buffer, VALUE_INT, JIT_TOP(2));
+            jitMoveSp(buffer, -1);
+            return true;
+        case VM_ILT: jitIntCompare(buffer, 0x9C); return true;
+        case VM_IGT: jitIntCompare(buffer, 0x9F); return true;
+        case VM_ILE: jitIntCompare(buffer, 0x9E); return true;
+        case VM_IGE: jitIntCompare(buffer, 0x9D); return true;
+        case VM_IEQ: jitIntCompare(buffer, 0x94); return true;
+        case VM_INE: jitIntCompare(buffer, 0x95); return true;
+        case VM_FADD: jitFloatOperation(buffer, 0x0F58); return true;
+        case VM_FSUB: jitFloatOperation(buffer, 0x0F5C); return true;
+        case VM_FMUL: jitFloatOperation(buffer, 0x0F59); return true;
+        case VM_FDIV: jitFloatOperation(buffer, 0x0F5E); return true;
+        case VM_FMOD:
+            jitCallHelper(buffer, (void*)jitFmod);
+            jitMoveSp(buffer, -1);
+            return true;
+        case VM_FLT: case VM_FGT: case VM_FLE: case VM_FGE: case VM_FEQ: case VM_FNE:
+            jitFloatCompare(buffer, op);
+            return true;
+        case VM_SLT: case VM_SGT: case VM_SLE: case VM_SGE: case VM_SEQ: case VM_SNE:
+            jitByte(buffer, 0xBE); // mov esi, op
+            jitInt32(buffer, op);
+            jitCallHelper(buffer, (void*)jitStringCompare);
+            jitMoveSp(buffer, -1);
+            return true;
+        case VM_SCONCAT:
+            jitCallHelper(buffer, (void*)jitConcat);
+            jitMoveSp(buffer, -1);
+            return true;
+        case VM_I2F:
+            jitMem(buffer, 0xF2, false, 0x0F2A, 0, JIT_SP, JIT_TOP(1)); // cvtsi2sd xmm0, dword
+            jitMem(buffer, 0xF2, false, 0x0F11, 0, JIT_SP, JIT_TOP(1));
+            return true;
+        case VM_INOT:
+            jitMem(buffer, 0, false, 0x8B, RAX, JIT_SP, JIT_TOP(1));
+            jitBytes(buffer, 2, 0x85, 0xC0); // test eax, eax
+            jitSetFlag(buffer, 0x94);
+            jitStoreBoxed(buffer, VALUE_BOOL, JIT_TOP(1));
+            return true;
+        case VM_FNOT:
+            jitMem(buffer, 0, true, 0x8B, RAX, JIT_SP, JIT_TOP(1));
+            jitBytes(buffer, 3, 0x48, 0xD1, 0xE0); // shl rax, 1: zero only for 0.0 and -0.0
+            jitSetFlag(buffer, 0x94);
+            jitStoreBoxed(buffer, VALUE_BOOL, JIT_TOP(1));
+            return true;
+        case VM_INEG: case VM_BIT_NOT:
+            jitMem(buffer, 0, false, 0x8B, RAX, JIT_SP, JIT_TOP(1));
+            jitBytes(buffer, 2, 0xF7, op == VM_INEG ? 0xD8 : 0xD0); // neg/not eax
+            jitStoreBoxed(buffer, VALUE_INT, JIT_TOP(1));
+            return true;
+        case VM_FNEG:
+            jitMem(buffer, 0, true, 0x0FBA, 7, JIT_SP, JIT_TOP(1)); // btc qword, 63
+            jitByte(buffer, 63);
+            return true;
+        case VM_PRINT:
+            jitCallHelper(buffer, (void*)jitPrint);
+            jitMoveSp(buffer, -1);
+            return true;
+        case VM_JMP:
+            jitJumpTo(emitter, 0, in->a);
+            return true;
+        case VM_JF:
+            jitJumpIfFalse(emitter, in->a, afterComparison);
+            return true;
+        case VM_JTAB: {
+            // the tables are short, a compare per entry
+            jitMoveSp(buffer, -1);
+            jitMem(buffer, 0, true, 0x8B, RAX, JIT_SP, 0);
+            jitTestBoxed(buffer);
+            jitJumpTo(emitter, 0x85, in->b); // a float goes to the fallback
+            for (int t = 0; t < in->a; t++) {
+                jitByte(buffer, 0x3D); // cmp eax, t
+                jitInt32(buffer, t);
+                jitJumpTo(emitter, 0x84, program->code[pc + 1 + t].a);
+            }
+            jitJumpTo(emitter, 0, in->b);
+            return true;
+        }
+        case VM_JTARGET:
+            return true;
+    }
+    return false;
+}
+
+/*--------------------------------------------------------------------------*/
+/* Compiler */
+/*--------------------------------------------------------------------------*/
+
+// the code starts with the entry from C: save the registers it uses, load the VM state, jump to target
+void jitPrologue(JitEmitter* emitter) {
+    JitBuffer* buffer = &emitter->buffer;
+    jitBytes(buffer, 10, 0x53, 0x55, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x41, 0x57); // push rbx rbp r12-r15
+    jitBytes(buffer, 4, 0x48, 0x83, 0xEC, 0x08); // sub rsp, 8: calls from here see rsp 16 byte aligned
+    jitBytes(buffer, 3, 0x49, 0x89, 0xFF); // mov r15, rdi
+    jitMem(buffer, 0, true, 0x8B, JIT_SP, JIT_STATE, offsetof(JitState, sp));
+    jitMem(buffer, 0, true, 0x8B, JIT_FP, JIT_STATE, offsetof(JitState, fp));
+    jitMem(buffer, 0, true, 0x8B, JIT_CONSTANTS, JIT_STATE, offsetof(JitState, constants));
+    jitMem(buffer, 0, true, 0x8B, JIT_GLOBALS, JIT_STATE, offsetof(JitState, globals));
+    jitBytes(buffer, 2, 0xFF, 0xE6); // jmp rsi
+
+    emitter->epilogue = buffer->size;
+    jitMem(buffer, 0, true, 0x89, JIT_SP, JIT_STATE, offsetof(JitState, sp));
+    jitBytes(buffer, 4, 0x48, 0x83, 0xC4, 0x08);
+    jitBytes(buffer, 11, 0x41, 0x5F, 0x41, 0x5E, 0x41, 0x5D, 0x41, 0x5C, 0x5D, 0x5B, 0xC3); // pop r15-r12 rbp rbx, ret
+}
+
+// an instruction where control can arrive from elsewhere than the one before it
+bool isJitBlockStart(VMProgram* program, JitFunction* f, bool* targets, int pc) {
+    if (pc == f->start || targets[pc - f->start]) {
+        return true;
+    }
+    int before = vmBaseOp(program->code[pc - 1].op);
+    return before == VM_JF || before == VM_JMP || before == VM_JTAB || before == VM_CALL;
+}
+
+bool compileJitFunction(VMJit* jit, JitFunction* f) {
+    VMProgram* program = jit->program;
+    if (!jitComputeDepths(jit, f)) {
+        return false;
+    }
+    int length = f->end - f->start;
+    bool* targets = (bool*)calloc(length + 1, sizeof(bool));
+    for (int pc = f->start; pc < f->end; pc++) {
+        int op = vmBaseOp(program->code[pc].op);
+        if (f->depths[pc - f->start] == -1) {
+            continue;
+        }
+        if (op == VM_JMP || op == VM_JF || op == VM_JTAB) {
+            int target = op == VM_JTAB ? program->code[pc].b : program->code[pc].a;
+            if (target >= f->start && target < f->end) {
+                targets[target - f->start] = true;
+            }
+        }
+        for (int t = 1; op == VM_JTAB && t <= program->code[pc].a; t++) {
+            int target = program->code[pc + t].a;
+            if (target >= f->start && target < f->end) {
+                targets[target - f->start] = true;
+            }
+        }
+    }
+
+    JitEmitter emitter = {{NULL, 0, 0}, NULL, 0, 0, 0};
+    jitPrologue(&emitter);
+    int* offsets = (int*)malloc((length + 1) * sizeof(int));
+    int pendingExit = -1; // the instruction the code falls through to when it isn't compiled
+    for (int pc = f->start; pc < f->end; pc++) {
+        offsets[pc - f->start] = -1;
+        if (f->depths[pc - f->start] == -1) {
+            continue;
+        }
+        offsets[pc - f->start] = emitter.buffer.size;
+        if (isJitBlockStart(program, f, targets, pc)) {
+            // the instructions up to the next block start, the interpreter counts the one it is handed
+            int count = 0;
+            for (int next = pc; next < f->end && (next == pc || !isJitBlockStart(program, f, targets, next)); next++) {
+                int pops, pushes;
+                int op = vmBaseOp(program->code[next].op);
+                if (!jitStackEffect(jit, next, &pops, &pushes) && op != VM_CALL) {
+                    break;
+                }
+                count += op != VM_CALL;
+            }
+            if (count > 0) {
+                jitMem(&emitter.buffer, 0, true, 0x81, 0, JIT_STATE, offsetof(JitState, steps)); // add qword steps, count
+                jitInt32(&emitter.buffer, count);
+            }
+            emitter.blockLeft = count;
+        }
+        int op = vmBaseOp(program->code[pc].op);
+        int before = pc > f->start ? vmBaseOp(program->code[pc - 1].op) : -1;
+        bool afterComparison = !targets[pc - f->start] && pc > f->start && isComparisonOp(before);
+        if (op >= VM_ILT && op <= VM_INE && pc + 1 < f->end && vmBaseOp(program->code[pc + 1].op) == VM_JF
+            && !targets[pc + 1 - f->start]) {
+            jitCompareAndJump(&emitter, op, program->code[pc + 1].a);
+            emitter.blockLeft--;
+            pc++;
+            offsets[pc - f->start] = -1; // the jf isn't a block start, nothing enters there
+        } else if (!jitInstruction(&emitter, program, pc, afterComparison)) {
+            jitExit(&emitter, pc);
+            continue;
+        }
+        emitter.blockLeft--;
+        if (pc + 1 == f->end) {
+            int op = vmBaseOp(program->code[pc].op);
+            if (op != VM_JMP && op != VM_JTAB) {
+                pendingExit = pc + 1;
+            }
+        }
+    }
+    if (pendingExit != -1) {
+        jitExit(&emitter, pendingExit);
+    }
+    // jumps out of the function, or to code never reached from its start, go through the interpreter
+    int fixupCount = emitter.fixupCount;
+    for (int x = 0; x < fixupCount; x++) {
+        int pc = emitter.fixups[x].pc;
+        int offset = pc >= f->start && pc < f->end ? offsets[pc - f->start] : -1;
+        if (offset == -1) {
+            offset = emitter.buffer.size;
+            jitExit(&emitter, pc);
+        }
+        int rel = offset - (emitter.fixups[x].at + 4);
+        memcpy(emitter.buffer.bytes + emitter.fixups[x].at, &rel, 4);
+    }
+
+    f->codeSize = emitter.buffer.size;
+    void* code = mmap(NULL, f->codeSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    bool ok = code != MAP_FAILED;
+    if (ok) {
+        memcpy(code, emitter.buffer.bytes, f->codeSize);
+        ok = mprotect(code, f->codeSize, PROT_READ | PROT_EXEC) == 0;
+        if (!ok) {
+            munmap(code, f->codeSize);
+        }
+    }
+    if (ok) {
+        f->code = (unsigned char*)code;
+        for (int pc = f->start; pc < f->end; pc++) {
+            if (offsets[pc - f->start] != -1) {
+                jit->native[pc] = f->code + offsets[pc - f->start];
+            }
+        }
+        jitCodeBytes += f->codeSize;
+    }
+    free(offsets);
+    free(targets);
+    free(emitter.buffer.bytes);
+    free(emitter.fixups);
+    return ok;
+}
+
+#endif
+
+/*--------------------------------------------------------------------------*/
+/* Interpreter side */
+/*--------------------------------------------------------------------------*/
+
+// NULL when there is no JIT for this machine, the program then runs interpreted
+VMJit* createVMJit(VMProgram* program) {
+#ifdef JIT_SUPPORTED
+    VMJit* jit = (VMJit*)calloc(1, sizeof(VMJit));
+    jit->program = program;
+    jit->functionOf = (int*)malloc((program->count + 1) * sizeof(int));
+    jit->native = (void**)calloc(program->count + 1, sizeof(void*));
+    int function = -1;
+    for (int pc = 0; pc < program->count; pc++) {
+        bool isEntry = pc >= program->entryStart && pc < program->entryStart + program->entryCount;
+        if (program->code[pc].op == VM_ENTER) {
+            jit->functions = (JitFunction*)realloc(jit->functions, (jit->functionCount + 1) * sizeof(JitFunction));
+            JitFunction* f = &jit->functions[jit->functionCount];
+            memset(f, 0, sizeof(JitFunction));
+            f->start = pc + 1;
+            f->frameSize = program->code[pc].b;
+            function = jit->functionCount++;
+        } else if (isEntry || pc == program->count - 1) {
+            function = -1;
+        }
+        jit->functionOf[pc] = function;
+        if (function != -1) {
+            jit->functions[function].end = pc + 1;
+        }
+    }
+    for (int f = 0; f < jit->functionCount; f++) {
+        jit->functionOf[jit->functions[f].start - 1] = -1; // the enter itself is run by the interpreter
+    }
+    jit->state.constants = program->constants;
+    return jit;
+#else
+    fprintf(stderr, "JIT: not available on this machine, running interpreted\n");
+    return NULL;
+#endif
+}
+
+// true when the machine code can take over at pc: counts the function hot, compiles it when it gets there
+bool jitCanEnter(VMJit* jit, int pc, Value* sp, Value* fp, Value* stackEnd) {
+#ifdef JIT_SUPPORTED
+    int function = jit->functionOf[pc];
+    if (function == -1) {
+        return false;
+    }
+    JitFunction* f = &jit->functions[function];
+    if (f->code == NULL) {
+        if (f->refused || ++f->hotness < JIT_THRESHOLD) {
+            return false;
+        }
+        if (!compileJitFunction(jit, f)) {
+            f->refused = true;
+            jitRefusedFunctions++;
+            return false;
+        }
+        jitCompiledFunctions++;
+    }
+    int depth = f->depths[pc - f->start];
+    return jit->native[pc] != NULL && sp - fp == f->frameSize + depth && stackEnd - sp >= f->maxDepth;
+#else
+    return false;
+#endif
+}
+
+// runs the machine code from pc, returns the instruction the interpreter goes on with
+int jitRun(VMJit* jit, int pc, Value** sp, Value* fp, Value* globals, long long* steps) {
+    JitFunction* f = &jit->functions[jit->functionOf[pc]];
+    jit->state.sp = *sp;
+    jit->state.fp = fp;
+    jit->state.globals = globals;
+    jit->state.steps = 0;
+    int next = ((JitCode)(void*)f->code)(&jit->state, jit->native[pc]);
+    *sp = jit->state.sp;
+    *steps += jit->state.steps;
+    return next;
+}
+
+void reportVMJit(long long executed, long long native) {
+    printf("JIT: %d functions compiled (%d bytes), %d left interpreted, %lld of %lld instructions native (%.1f%%)\n",
+           jitCompiledFunctions, jitCodeBytes, jitRefusedFunctions, native, executed,
+           executed > 0 ? 100.0 * native / executed : 0.0);
+}
+
+void freeVMJit(VMJit* jit) {
+    for (int f = 0; f < jit->functionCount; f++) {
+#ifdef JIT_SUPPORTED
+        if (jit->functions[f].code != NULL) {
+            munmap(jit->functions[f].code, jit->functions[f].codeSize);
+        }
+#endif
+        free(jit->functions[f].depths);
+    }
+    free(jit->functions);
+    free(jit->functionOf);
+    free(jit->native);
+    free(jit);
+}
+
+#endif
@@ -0,0 +1,257 @@
+#ifndef __JUMPS_C__
+#define __JUMPS_C__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "cfg.c"
+
+/*
+    Jump threading and label cleanup, shared by the quads and the assembly.
+    Both streams are first turned into flow items, the pass works on those
+    and the changes are written back to the stream:
+        - runs of labels are merged into the first one
+        - jumps to a label followed by another jmp go to the final target
+        - jmp to the label right after it is removed
+        - code after a jmp is unreachable until the next label
+        - labels nobody jumps to are removed
+*/
+
+#define FLOW_OTHER 'o'
+#define FLOW_LABEL 'l'
+#define FLOW_JUMP 'j'
+#define FLOW_COND_JUMP 'c'
+#define FLOW_RETURN 'r'
+#define FLOW_ENTRY 'f' // function label, only reached by calls
+#define FLOW_DELETED 'n'
+
+int threadedJumps = 0;
+int threadRemovedQuads = 0;
+int threadRemovedLines = 0;
+
+typedef struct FlowItem {
+    char kind;
+    char* label; // label defined or jumped to
+    char* target; // new jump target, NULL when unchanged
+} FlowItem;
+
+char* flowTarget(FlowItem* item) {
+    return item->target ? item->target : item->label;
+}
+
+// index of the first item after index that is not deleted
+int nextFlowItem(FlowItem* items, int count, int index) {
+    index++;
+    while (index < count && items[index].kind == FLOW_DELETED) {
+        index++;
+    }
+    return index;
+}
+
+// returns how many items were deleted
+int threadFlowItems(FlowItem* items, int count) {
+    int removed = 0;
+    bool changed = true;
+    while (changed) {
+        changed = false;
+
+        // label -> the first label of its run
+        NameTable labels;
+        initNameTable(&labels);
+        int runHead = -1;
+        for (int i = 0; i < count; i++) {
+            if (items[i].kind == FLOW_DELETED) {
+                continue;
+            }
+            if (items[i].kind != FLOW_LABEL) {
+                runHead = -1;
+                continue;
+            }
+            if (runHead == -1) {
+                runHead = i;
+            }
+            putName(&labels, items[i].label, runHead);
+        }
+
+        for (int i = 0; i < count; i++) {
+            if (items[i].kind != FLOW_JUMP && items[i].kind != FLOW_COND_JUMP) {
+                continue;
+            }
+            int target = findName(&labels, flowTarget(&items[i]));
+            if (target == -1) {
+                continue;
+            }
+            for (int steps = 0; steps < count; steps++) {
+                int next = target;
+                while (next < count && (items[next].kind == FLOW_LABEL || items[next].kind == FLOW_DELETED)) {
+                    next++;
+                }
+                if (next == count || items[next].kind != FLOW_JUMP) {
+                    break;
+                }
+                int final = findName(&labels, flowTarget(&items[next]));
+                if (final == -1 || final == target) {
+                    break;
+                }
+                target = final;
+            }
+            if (strcmp(items[target].label, flowTarget(&items[i])) != 0) {
+                items[i].target = items[target].label;
+                threadedJumps++;
+                changed = true;
+            }
+        }
+
+        for (int i = 0; i < count; i++) {
+            if (items[i].kind != FLOW_JUMP) {
+                continue;
+            }
+            // a jmp to a label right after it
+            int target = findName(&labels, flowTarget(&items[i]));
+            int next = nextFlowItem(items, count, i);
+            if (target != -1 && next < count && findName(&labels, items[next].label) == target
+                && items[next].kind == FLOW_LABEL) {
+                items[i].kind = FLOW_DELETED;
+                removed++;
+                changed = true;
+                continue;
+            }
+            // nothing falls into the code after a jmp
+            while (next < count && (items[next].kind == FLOW_OTHER || items[next].kind == FLOW_JUMP
+                                    || items[next].kind == FLOW_COND_JUMP)) {
+                items[next].kind = FLOW_DELETED;
+                removed++;
+                changed = true;
+                next = nextFlowItem(items, count, next);
+            }
+        }
+
+        // only the first label of a run and labels that are jumped to are kept
+        NameTable used;
+        initNameTable(&used);
+        for (int i = 0; i < count; i++) {
+            if (items[i].kind == FLOW_JUMP || items[i].kind == FLOW_COND_JUMP) {
+                int target = findName(&labels, flowTarget(&items[i]));
+                putName(&used, target == -1 ? flowTarget(&items[i]) : items[target].label, i);
+            }
+        }
+        for (int i = 0; i < count; i++) {
+            if (items[i].kind == FLOW_LABEL && findName(&used, items[i].label) == -1) {
+                items[i].kind = FLOW_DELETED;
+                removed++;
+                changed = true;
+            }
+        }
+        for (int i = 0; i < count; i++) {
+            int target = items[i].kind == FLOW_JUMP || items[i].kind == FLOW_COND_JUMP
+                       ? findName(&labels, flowTarget(&items[i])) : -1;
+            if (target != -1 && strcmp(items[target].label, flowTarget(&items[i])) != 0) {
+                items[i].target = items[target].label;
+            }
+        }
+        freeNameTable(&used);
+        freeNameTable(&labels);
+    }
+    return removed;
+}
+
+/*--------------------------------------------------------------------------*/
+/* Quads */
+/*--------------------------------------------------------------------------*/
+
+void threadQuadJumps(int start, int end) {
+    int count = end - start;
+    FlowItem* items = (FlowItem*)calloc(count + 1, sizeof(FlowItem));
+    for (int i = start; i < end; i++) {
+        Quad* quad = &quadList[i];
+        FlowItem* item = &items[i - start];
+        item->label = quad->result;
+        if (isQuadDeleted(i)) item->kind = FLOW_DELETED;
+        else if (isLabelQuad(quad)) item->kind = FLOW_LABEL;
+        else if (isJumpQuad(quad)) item->kind = FLOW_JUMP;
+        else if (isCondJumpQuad(quad) || isTableJumpQuad(quad)) item->kind = FLOW_COND_JUMP;
+        else if (isReturnQuad(quad)) item->kind = FLOW_RETURN;
+        else if (strcmp(quad->op, "func_label") == 0) item->kind = FLOW_ENTRY;
+        else item->kind = FLOW_OTHER;
+    }
+
+    threadRemovedQuads += threadFlowItems(items, count);
+
+    // targets point at label quads, so retarget before anything is deleted
+    for (int i = start; i < end; i++) {
+        FlowItem* item = &items[i - start];
+        if (item->target != NULL && item->kind != FLOW_DELETED) {
+            Quad* quad = &quadList[i];
+            char* op = strdup(quad->op);
+            char* arg1 = strdup(quad->arg1);
+            char* arg2 = strdup(quad->arg2);
+            setQuad(i, op, arg1, arg2, item->target);
+            free(op);
+            free(arg1);
+            free(arg2);
+        }
+    }
+    for (int i = start; i < end; i++) {
+        if (items[i - start].kind == FLOW_DELETED && !isQuadDeleted(i)) {
+            deleteQuad(i);
+        }
+    }
+    free(items);
+}
+
+/*--------------------------------------------------------------------------*/
+/* Assembly */
+/*--------------------------------------------------------------------------*/
+
+void threadAssemblyJumps() {
+    FlowItem* items = (FlowItem*)calloc(assemblyLineCount + 1, sizeof(FlowItem));
+    for (int i = 0; i < assemblyLineCount; i++) {
+        char* line = assemblyLines[i];
+        int length = strlen(line);
+        FlowItem* item = &items[i];
+        item->kind = FLOW_OTHER;
+
+        if (length > 1 && line[0] != '\t' && line[length - 2] == ':') {
+            item->label = strndup(line, length - 2);
+            item->kind = strncmp(line, "func_", 5) == 0 ? FLOW_ENTRY : FLOW_LABEL;
+        } else if (strncmp(line, "\tjmp ", 5) == 0 || strncmp(line, "\tjf ", 4) == 0
+                   || strncmp(line, "\tjtab ", 6) == 0 || strncmp(line, "\tjtarget ", 9) == 0) {
+            // the label is always the last operand
+            bool isJump = line[2] == 'm';
+            char* label = strrchr(line, ' ') + 1;
+            item->label = strndup(label, length - (label - line) - 1);
+            item->kind = isJump ? FLOW_JUMP : FLOW_COND_JUMP;
+        } else if (strncmp(line, "\tret", 4) == 0 || strncmp(line, "\ttailcall ", 10) == 0) {
+            item->kind = FLOW_RETURN; // calls come back, these don't
+        }
+    }
+
+    threadRemovedLines += threadFlowItems(items, assemblyLineCount);
+
+    int count = 0;
+    for (int i = 0; i < assemblyLineCount; i++) {
+        FlowItem* item = &items[i];
+        if (item->kind == FLOW_DELETED) {
+            free(assemblyLines[i]);
+            continue;
+        }
+        if (item->target != NULL) {
+            char line[512];
+            int prefix = strrchr(assemblyLines[i], ' ') - assemblyLines[i] + 1;
+            snprintf(line, sizeof(line), "%.*s%s\n", prefix, assemblyLines[i], item->target);
+            free(assemblyLines[i]);
+            assemblyLines[i] = strdup(line);
+        }
+        assemblyLines[count++] = assemblyLines[i];
+    }
+
+    for (int i = 0; i < assemblyLineCount; i++) {
+        free(items[i].label);
+    }
+    free(items);
+    assemblyLineCount = count;
+}
+
+#endif
@@ -0,0 +1,248 @@
+#ifndef __LICM_C__
+#define __LICM_C__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "cfg.c"
+#include "liveness.c"
+#include "folding.c"
+
+/*
+    Loop invariant code motion. Value quads whose operands don't change
+    inside a natural loop are moved in front of the loop header label,
+    which is the preheader when the only way into the loop is falling
+    through from the block before it. Quads with side effects (print,
+    calls, params) and divisions that could trap are never moved.
+*/
+
+#define MAX_LICM_ROUNDS 1000
+
+int licmHoisted = 0;
+
+typedef struct LoopDefs {
+    NameTable slots; // name -> slot
+    int* count; // per slot, defs inside the loop
+    int* quad; // per slot, the last def inside the loop
+    int slotCount;
+} LoopDefs;
+
+void collectLoopDefs(CFG* cfg, Loop* loop, LoopDefs* defs) {
+    initNameTable(&defs->slots);
+    defs->count = NULL;
+    defs->quad = NULL;
+    defs->slotCount = 0;
+
+    for (int b = 0; b < cfg->blockCount; b++) {
+        if (!loop->body[b]) {
+            continue;
+        }
+        for (int i = cfg->blocks[b].start; i < cfg->blocks[b].end; i++) {
+            char* def = quadDef(&quadList[i]);
+            if (def == NULL) {
+                continue;
+            }
+            int slot = findName(&defs->slots, def);
+            if (slot == -1) {
+                slot = defs->slotCount++;
+                putName(&defs->slots, def, slot);
+                defs->count = (int*)realloc(defs->count, defs->slotCount * sizeof(int));
+                defs->quad = (int*)realloc(defs->quad, defs->slotCount * sizeof(int));
+                defs->count[slot] = 0;
+            }
+            defs->count[slot]++;
+            defs->quad[slot] = i;
+        }
+    }
+}
+
+void freeLoopDefs(LoopDefs* defs) {
+    freeNameTable(&defs->slots);
+    free(defs->count);
+    free(defs->quad);
+}
+
+bool hasLoopCall(CFG* cfg, Loop* loop) {
+    for (int b = 0; b < cfg->blockCount; b++) {
+        if (!loop->body[b]) {
+            continue;
+        }
+        for (int i = cfg->blocks[b].start; i < cfg->blocks[b].end; i++) {
+            if (isCallQuad(&quadList[i])) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+bool isInvariantOperand(CFG* cfg, LoopDefs* defs, bool* invariant, bool hasCall, char* operand) {
+    if (!isVarOperand(operand)) {
+        return true;
+    }
+    int slot = findName(&defs->slots, operand);
+    if (slot == -1) {
+        // functions called in the loop may write globals
+        return !(hasCall && isGlobalSymbol(operand));
+    }
+    return defs->count[slot] == 1 && invariant[defs->quad[slot] - cfg->start];
+}
+
+bool mayTrap(Quad* quad) {
+    if (strcmp(quad->op, "div") != 0 && strcmp(quad->op, "mod") != 0) {
+        return false;
+    }
+    ConstValue divisor;
+    if (!parseConstValue(quad->arg2, &divisor)) {
+        return true;
+    }
+    bool trap = divisor.kind == 's' || constAsFloat(&divisor) == 0 || divisor.kind == 'f';
+    freeConstValue(&divisor);
+    return trap;
+}
+
+// false when the value computed by the quad is still needed after leaving the loop on a path it doesn't dominate
+bool isSafeAtExits(CFG* cfg, Liveness* live, Loop* loop, int block, int var) {
+    for (int b = 0; b < cfg->blockCount; b++) {
+        if (!loop->body[b]) {
+            continue;
+        }
+        for (int s = 0; s < cfg->blocks[b].succCount; s++) {
+            int exit = cfg->blocks[b].succs[s];
+            if (!loop->body[exit] && testLiveBit(live->liveIn[exit], var) && !dominates(cfg, block, b)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// the block falling through into the header, -1 when the loop can be entered any other way
+int loopPreheader(CFG* cfg, Loop* loop) {
+    BasicBlock* header = &cfg->blocks[loop->header];
+    int preheader = -1;
+    for (int p = 0; p < header->predCount; p++) {
+        int pred = header->preds[p];
+        if (loop->body[pred]) {
+            continue;
+        }
+        if (preheader != -1 || pred != loop->header - 1) {
+            return -1;
+        }
+        preheader = pred;
+    }
+    if (preheader == -1) {
+        return -1;
+    }
+    // a jump into the header would skip whatever is placed in front of its label
+    Quad* last = &quadList[cfg->blocks[preheader].end - 1];
+    if (isJumpQuad(last) || isTableJumpQuad(last)) {
+        return -1;
+    }
+    return preheader;
+}
+
+// moves the invariant quads of the loop in front of its header, returns how many were moved
+int hoistFromLoop(CFG* cfg, Liveness* live, Loop* loop) {
+    if (loopPreheader(cfg, loop) == -1) {
+        return 0;
+    }
+
+    LoopDefs defs;
+    collectLoopDefs(cfg, loop, &defs);
+    bool hasCall = hasLoopCall(cfg, loop);
+    bool* invariant = (bool*)calloc(cfg->end - cfg->start, sizeof(bool));
+    int* order = (int*)malloc((cfg->end - cfg->start) * sizeof(int));
+    int count = 0;
+
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (int b = 0; b < cfg->blockCount; b++) {
+            if (!loop->body[b]) {
+                continue;
+            }
+            for (int i = cfg->blocks[b].start; i < cfg->blocks[b].end; i++) {
+                Quad* quad = &quadList[i];
+                if (invariant[i - cfg->start] || !isValueQuad(quad) || mayTrap(quad)) {
+                    continue;
+                }
+                int var = liveVar(live, quad->result);
+                int slot = findName(&defs.slots, quad->result);
+                if (var == -1 || defs.count[slot] != 1 || testLiveBit(live->liveIn[loop->header], var)) {
+                    continue;
+                }
+                if (!isInvariantOperand(cfg, &defs, invariant, hasCall, quad->arg1)
+                    || !isInvariantOperand(cfg, &defs, invariant, hasCall, quad->arg2)
+                    || !isSafeAtExits(cfg, live, loop, b, var)) {
+                    continue;
+                }
+                invariant[i - cfg->start] = true;
+                order[count++] = i;
+                changed = true;
+            }
+        }
+    }
+
+    Quad* moved = (Quad*)malloc((count + 1) * sizeof(Quad));
+    for (int n = 0; n < count; n++) {
+        Quad* quad = &quadList[order[n]];
+        moved[n].op = strdup(quad->op);
+        moved[n].arg1 = strdup(quad->arg1);
+        moved[n].arg2 = strdup(quad->arg2);
+        moved[n].result = strdup(quad->result);
+        deleteQuad(order[n]);
+    }
+    int at = cfg->blocks[loop->header].start;
+    for (int n = 0; n < count; n++) {
+        insertQuad(at + n, moved[n].op, moved[n].arg1, moved[n].arg2, moved[n].result);
+        free(moved[n].op);
+        free(moved[n].arg1);
+        free(moved[n].arg2);
+        free(moved[n].result);
+    }
+
+    free(moved);
+    free(order);
+    free(invariant);
+    freeLoopDefs(&defs);
+    return count;
+}
+
+// hoists invariant code out of the loops of a region, returns the new region end
+int hoistLoopInvariants(int start, int end) {
+    for (int round = 0; round < MAX_LICM_ROUNDS; round++) {
+        CFG* cfg = buildCFG(start, end);
+        if (!cfg->valid) {
+            freeCFG(cfg);
+            break;
+        }
+        Loop* loops;
+        int loopCount = findNaturalLoops(cfg, &loops);
+        Liveness* live = computeLiveness(cfg);
+
+        // inner loops first, their code can move out further in the next round
+        int hoisted = 0;
+        for (int size = 1; size <= cfg->blockCount && hoisted == 0; size++) {
+            for (int l = 0; l < loopCount && hoisted == 0; l++) {
+                if (loops[l].blockCount == size) {
+                    hoisted = hoistFromLoop(cfg, live, &loops[l]);
+                }
+            }
+        }
+
+        freeLiveness(live);
+        freeLoops(loops, loopCount);
+        freeCFG(cfg);
+        if (hoisted == 0) {
+            break;
+        }
+        licmHoisted += hoisted;
+        end += hoisted;
+    }
+    return end;
+}
+
+#endif
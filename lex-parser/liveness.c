@@ -0,0 +1,193 @@
+#ifndef __LIVENESS_C__
+#define __LIVENESS_C__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "cfg.c"
+
+/*
+    Live variable analysis over a region's CFG and the live interval of
+    every local, param and temp (globals and @ret live in memory / the
+    return register and are not tracked).
+    Intervals have no holes: [start, end] are quad indexes.
+*/
+
+typedef unsigned long long LiveWord;
+
+typedef struct Liveness {
+    CFG* cfg;
+    NameTable vars;
+    char** varNames;
+    int varCount;
+    int words; // LiveWords per set
+    LiveWord** liveIn; // per block
+    LiveWord** liveOut;
+    int* intervalStart; // per var, -1 when the var never appears
+    int* intervalEnd;
+} Liveness;
+
+bool isTrackedVar(char* name) {
+    return isVarOperand(name) && strcmp(name, "@ret") != 0 && !isGlobalSymbol(name);
+}
+
+int liveVar(Liveness* live, char* name) {
+    if (!isVarOperand(name)) {
+        return -1;
+    }
+    return findName(&live->vars, name);
+}
+
+void setLiveBit(LiveWord* set, int bit) {
+    set[bit / 64] |= 1ULL << (bit % 64);
+}
+
+void clearLiveBit(LiveWord* set, int bit) {
+    set[bit / 64] &= ~(1ULL << (bit % 64));
+}
+
+bool testLiveBit(LiveWord* set, int bit) {
+    return (set[bit / 64] >> (bit % 64)) & 1;
+}
+
+void extendInterval(Liveness* live, int var, int position) {
+    if (live->intervalStart[var] == -1 || position < live->intervalStart[var]) {
+        live->intervalStart[var] = position;
+    }
+    if (position > live->intervalEnd[var]) {
+        live->intervalEnd[var] = position;
+    }
+}
+
+Liveness* computeLiveness(CFG* cfg) {
+    Liveness* live = (Liveness*)calloc(1, sizeof(Liveness));
+    live->cfg = cfg;
+    initNameTable(&live->vars);
+
+    for (int i = cfg->start; i < cfg->end; i++) {
+        char* names[3];
+        int count = quadUses(&quadList[i], names);
+        char* def = quadDef(&quadList[i]);
+        if (def != NULL) {
+            names[count++] = def;
+        }
+        for (int n = 0; n < count; n++) {
+            if (!isTrackedVar(names[n]) || findName(&live->vars, names[n]) != -1) {
+                continue;
+            }
+            putName(&live->vars, names[n], live->varCount);
+            live->varNames = (char**)realloc(live->varNames, (live->varCount + 1) * sizeof(char*));
+            live->varNames[live->varCount++] = strdup(names[n]);
+        }
+    }
+
+    int blockCount = cfg->blockCount;
+    live->words = live->varCount / 64 + 1;
+    LiveWord** gen = (LiveWord**)malloc(blockCount * sizeof(LiveWord*));
+    LiveWord** kill = (LiveWord**)malloc(blockCount * sizeof(LiveWord*));
+    live->liveIn = (LiveWord**)malloc(blockCount * sizeof(LiveWord*));
+    live->liveOut = (LiveWord**)malloc(blockCount * sizeof(LiveWord*));
+    for (int b = 0; b < blockCount; b++) {
+        gen[b] = (LiveWord*)calloc(live->words, sizeof(LiveWord));
+        kill[b] = (LiveWord*)calloc(live->words, sizeof(LiveWord));
+        live->liveIn[b] = (LiveWord*)calloc(live->words, sizeof(LiveWord));
+        live->liveOut[b] = (LiveWord*)calloc(live->words, sizeof(LiveWord));
+
+        for (int i = cfg->blocks[b].start; i < cfg->blocks[b].end; i++) {
+            char* uses[3];
+            int count = quadUses(&quadList[i], uses);
+            for (int u = 0; u < count; u++) {
+                int v = liveVar(live, uses[u]);
+                if (v != -1 && !testLiveBit(kill[b], v)) {
+                    setLiveBit(gen[b], v);
+                }
+            }
+            char* def = quadDef(&quadList[i]);
+            int v = def ? liveVar(live, def) : -1;
+            if (v != -1) {
+                setLiveBit(kill[b], v);
+            }
+        }
+    }
+
+    // backward dataflow, visiting blocks from the end converges quickly
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (int b = blockCount - 1; b >= 0; b--) {
+            for (int w = 0; w < live->words; w++) {
+                LiveWord out = 0;
+                for (int s = 0; s < cfg->blocks[b].succCount; s++) {
+                    out |= live->liveIn[cfg->blocks[b].succs[s]][w];
+                }
+                LiveWord in = gen[b][w] | (out & ~kill[b][w]);
+                if (out != live->liveOut[b][w] || in != live->liveIn[b][w]) {
+                    live->liveOut[b][w] = out;
+                    live->liveIn[b][w] = in;
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    live->intervalStart = (int*)malloc(live->varCount * sizeof(int));
+    live->intervalEnd = (int*)malloc(live->varCount * sizeof(int));
+    for (int v = 0; v < live->varCount; v++) {
+        live->intervalStart[v] = -1;
+        live->intervalEnd[v] = -1;
+    }
+    for (int b = 0; b < blockCount; b++) {
+        for (int v = 0; v < live->varCount; v++) {
+            if (testLiveBit(live->liveIn[b], v)) {
+                extendInterval(live, v, cfg->blocks[b].start);
+            }
+            if (testLiveBit(live->liveOut[b], v)) {
+                extendInterval(live, v, cfg->blocks[b].end - 1);
+            }
+        }
+        for (int i = cfg->blocks[b].start; i < cfg->blocks[b].end; i++) {
+            char* uses[3];
+            int count = quadUses(&quadList[i], uses);
+            for (int u = 0; u < count; u++) {
+                int v = liveVar(live, uses[u]);
+                if (v != -1) {
+                    extendInterval(live, v, i);
+                }
+            }
+            char* def = quadDef(&quadList[i]);
+            int v = def ? liveVar(live, def) : -1;
+            if (v != -1) {
+                extendInterval(live, v, i);
+            }
+        }
+    }
+
+    for (int b = 0; b < blockCount; b++) {
+        free(gen[b]);
+        free(kill[b]);
+    }
+    free(gen);
+    free(kill);
+    return live;
+}
+
+void freeLiveness(Liveness* live) {
+    for (int b = 0; b < live->cfg->blockCount; b++) {
+        free(live->liveIn[b]);
+        free(live->liveOut[b]);
+    }
+    for (int v = 0; v < live->varCount; v++) {
+        free(live->varNames[v]);
+    }
+    freeNameTable(&live->vars);
+    free(live->varNames);
+    free(live->liveIn);
+    free(live->liveOut);
+    free(live->intervalStart);
+    free(live->intervalEnd);
+    free(live);
+}
+
+#endif
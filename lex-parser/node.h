@@ -11,6 +11,7 @@ typedef struct Node {
     char *type;
     char *dataType;
     char *name;
+    int assemblyEnd;     /* first assembly line after the code of the expression */
 } Node;
 
 #endif
\ No newline at end of file
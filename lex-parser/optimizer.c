@@ -0,0 +1,52 @@
+#ifndef __OPTIMIZER_C__
+#define __OPTIMIZER_C__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "cfg.c"
+#include "inline.c"
+#include "ssa.c"
+#include "folding.c"
+#include "sccp.c"
+#include "licm.c"
+#include "strength.c"
+#include "jumps.c"
+
+/*
+    Passes over the in-memory quads, run after a successful parse when the
+    compiler is called with -O
+*/
+
+bool optimizeEnabled = false;
+
+void optimizeQuads() {
+    int before = quadCount;
+    inlineFunctions();
+
+    int start = 0;
+    while (start < quadCount) {
+        int end = regionEnd(start);
+        propagateConstants(start, end);
+        end = hoistLoopInvariants(start, end);
+        end = reduceStrength(start, end);
+        threadQuadJumps(start, end);
+        start = end;
+    }
+    compactQuads();
+    threadAssemblyJumps();
+
+    printf("Optimizer: %d quads -> %d quads\n", before, quadCount);
+    printf("Inlining: %d calls inlined\n", inlinedCalls);
+    printf("SCCP: %d branches folded, %d constants propagated, %d quads removed\n",
+           sccpFoldedBranches, sccpPropagated, sccpRemovedQuads);
+    printf("LICM: %d quads hoisted out of loops\n", licmHoisted);
+    printf("Strength reduction: %d operations turned into shifts/masks, %d induction variable multiplications turned into additions\n",
+           strengthReducedOps, strengthReducedInductions);
+    printf("Jump threading: %d jumps threaded, %d quads and %d assembly lines removed\n",
+           threadedJumps, threadRemovedQuads, threadRemovedLines);
+}
+
+#endif
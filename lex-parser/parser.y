@@ -8,6 +8,17 @@
     #include "symbol_table.c"
     #include "quadruples.c"
     #include "assembly.c"
+    #include "optimizer.c"
+    #include "regalloc.c"
+    #include "temps.c"
+    #include "vm.c"
+    #include "fusion.c"
+    #include "jit.c"
+    #include "profile.c"
+    #include "interpreter.c"
+    #include "x86.c"
+    #include "cgen.c"
+    #include "bytecode.c"
     #include "checkers.c"
     #include "utils.h"
 
@@ -82,7 +93,7 @@
 /*--------------------------------------------------------------------------*/
 
 program:
-    declare_list { checkMain(); }
+    declare_list { checkMain(); assemblyMoveGlobalCode(); }
     | /* NULL */ { checkMain(); }
 
 /*--------------------------------------------------------------------------*/
@@ -106,14 +117,19 @@ statement_list:
 
 statement:
     var_declare SEMICOLON {}
-    | expression SEMICOLON {  }
+    | expression SEMICOLON { if (strcmp($1->dataType, "void") != 0) assemblyDiscard(); }
     | PRINT '(' expression ')' SEMICOLON { assemblyPrint(); quadPrint($3); }
     | if_statement {}
     | for_statement {}
     | while_statement {}
     | do_while_statement {}
     | SEMICOLON   {  }  /* empty statment */
-    | return_statement { isFunctReturned = true; assemblyJumpCall("_call_"); /*quadJumpCall("_call_");*/   }
+    | return_statement {
+        isFunctReturned = true;
+        if (!isTailCall) {
+            assemblyReturn(); /*quadJumpCall("_call_");*/
+        }
+    }
     | BREAK SEMICOLON {
         if (!assemblyIsInLoop() && !assemblyIsInSwitch()) {
             yyerror("break statement not in loop or switch case");
@@ -124,19 +140,17 @@ statement:
         }
 
         if(isInSwitch) {
-            int outIndex = switchOutIndicies[switchOutIndex];
-            assemblyJump(switchLabels[outIndex]);
-            quadJump(switchLabels[outIndex]);
+            assemblySwitchBreak();
+            quadSwitchBreak();
         } else {
-            printf("HELLLLLP\n");
-            assemblyJumpFalseLabel(loopLabels[loopIndex]);
-            quadJumpFalseLabel(loopLabels[loopIndex]);
+            assemblyLoopBreak();
+            quadLoopBreak();
         }
     }
     | CONTINUE SEMICOLON {
     if (assemblyIsInLoop()) {
-        assemblyJump(loopLabels[loopIndex]);
-        quadJump(quadLoopLabels[quadLoopIndex]);
+        assemblyLoopContinue();
+        quadLoopContinue();
     } else {
         yyerror("continue statement not in loop");
     }}    
@@ -148,10 +162,10 @@ statement:
 switch_body :
 switch_body_expression '{' case_list '}' { assemblySwitchEnd(); quadSwitchEnd();}
 
-switch_body_expression : switch_start_body_expression expression ')' { stopPushVarInSwitch = false; $$=$2; checkSwitchValues($2); assemblySwitchBegin($2); quadSwitchBegin($2);} 
+switch_body_expression : switch_start_body_expression expression ')' { $$=$2; checkSwitchValues($2); assemblySwitchBegin($2); quadSwitchBegin($2);} 
 
 switch_start_body_expression: 
-    '(' { stopPushVarInSwitch = true; } 
+    '(' { assemblySwitchExpressionBegin(); } 
     ;
 
 if_statement:
@@ -184,19 +198,19 @@ else_block:
     
 for_statement:
     FOR '('
-    for_loop_init SEMICOLON { assemblyLoopInit(); quadLoopInit(); } 
-    for_begin  SEMICOLON 
+    for_loop_init SEMICOLON { assemblyLoopInit(false); quadLoopInit(false); } 
+    for_begin  SEMICOLON { assemblyForStepBegin(); quadForStepBegin(); }
     for_loop_expression 
-    ')' 
-    block_structure 
+    ')' { assemblyForStepEnd(); quadForStepEnd(); }
+    block_structure { assemblyForBodyEnd(); quadForBodyEnd(); }
     loop_exit {}
     ;
 
 while_statement:
     WHILE
     { 
-        assemblyLoopInit();
-        quadLoopInit();   
+        assemblyLoopInit(false);
+        quadLoopInit(false);   
     } 
     while_begin
     block_structure 
@@ -205,12 +219,12 @@ while_statement:
 
 do_while_statement:
     DO
-        { assemblyLoopInit();
+        { assemblyLoopInit(true);
          printf("DO WHILE\n");
-          quadLoopInit();
+          quadLoopInit(true);
         } 
     block_structure 
-    WHILE while_begin
+    WHILE { assemblyDoWhileCondition(); quadDoWhileCondition(); } while_begin
     SEMICOLON 
     loop_exit {}
     ;
@@ -237,10 +251,8 @@ case_list:
     } ':' block_structure { 
         $$ = createNode($3->dataType, "case_list"); 
         checkSwitchValues($3);
-        assemblySwitchCaseEnd(); 
-        quadSwitchCaseEnd();
     }
-    | case_list DEFAULT ':' block_structure {
+    | case_list DEFAULT ':' { assemblySwitchDefault(); quadSwitchDefault(); } block_structure {
         $$ = createNode("default", "case_list");  
     }
     |  {}
@@ -282,7 +294,7 @@ for_loop_init:
 
 for_loop_expression:
     assign_expression {  }
-    | unary_operations {  }
+    | unary_operations { assemblyDiscard(); }
     ;
 
 return_statement:
@@ -290,11 +302,19 @@ return_statement:
         printf("Node type %s\n", $2->dataType);
         validateReturnType($2->dataType, yylineno); 
         markFunctionReturnType(yylineno); 
-        $$ = quadReturn($2);
+        // a call result returned as is is a tail call
+        isTailCall = false;
+        if (strcmp($2->type, "@ret") == 0 && insideFunctionIdx >= 0) {
+            isTailCall = assemblyTailCall(symbolTable[insideFunctionIdx].name);
+            $$ = quadTailCall(symbolTable[insideFunctionIdx].name, $2);
+        } else {
+            $$ = quadReturn($2);
+        }
     }
     | RETURN SEMICOLON { 
         validateReturnType("void", yylineno); 
         markFunctionReturnType(yylineno);
+        isTailCall = false;
         $$ = quadReturn(NULL);
     }
     ;
@@ -313,16 +333,17 @@ function_declare:
     }
     '(' params ')' 
     { 
-        assemblyAddFunctionParams($3); 
+        assemblyAddFunctionParams(); 
         quadAddFunctionParams($3); 
     } 
     block_structure   
     { 
         checkLastFunctionReturnType(yylineno); 
         if(!isFunctReturned) {
-            assemblyJumpCall("_call_");
+            assemblyReturn();
             /*quadJumpCall("_call_");*/
         }
+        assemblyFunctionEnd();
         insideFunctionIdx = -1;
     }
     ;
@@ -377,50 +398,52 @@ assign_expression:
     ;
 
 expression:
-    const_value { assemblyPushConst($1);}
-    | VARIABLE { checkInitialized($1, yylineno);$$ = createVarNode(getSymbolDataType($1), "var", $1); setVarUsed($1); if(!stopPushVarInSwitch) assemblyPushVar($1); }
-    | operation_expressions {}
+    const_value { assemblyPushConst($1); assemblyExpressionEnd($1); }
+    | VARIABLE { checkInitialized($1, yylineno);$$ = createVarNode(getSymbolDataType($1), "var", quadNameOf($1)); quadVarRead($$); setVarUsed($1); assemblyPushVar($1); assemblyExpressionEnd($$); }
+    | operation_expressions { assemblyExpressionEnd($1); }
 ;    
 
 operation_expressions:
     NOT expression %prec LOGICAL_NOT { 
         $$ = checkUnaryOperationTypes($2); 
-        assemblyUnaryMinusNot($2->name, "not"); 
+        assemblyUnaryMinusNot("not", $2); 
         Node* n = quadUnaryOperationNotMinus($2, "not");
         printf("dataType: %s\n", n->dataType);
         $$ = n;
     }
     | SUB expression %prec UMINUS { 
         $$ = checkUnaryOperationTypes($2); 
-        assemblyUnaryMinusNot($2->name, "minus");
+        assemblyUnaryMinusNot("minus", $2);
         $$ = quadUnaryOperationNotMinus($2, "minus");
     }
     | BITWISE_NOT expression %prec BITWISE_NOT { 
-        $$ = checkUnaryOperationTypes($2); 
-        assemblyUnaryMinusNot($2->name, "bit_not"); 
+        $$ = checkUnaryBitwiseOperationTypes($2); 
+        assemblyUnaryMinusNot("bit_not", $2); 
         $$ = quadUnaryOperationNotMinus($2,"bit_not");
     }
-    |expression ADD expression         { $$ = checkArithmitcExpressionTypes($1, $3,"add"); assemblyOperation("add"); $$ = quadOperation("add", $1, $3); }
-    | expression SUB expression         { $$ = checkArithmitcExpressionTypes($1, $3,"sub"); assemblyOperation("sub"); $$ = quadOperation("sub", $1, $3); }
-    | expression MUL expression         { $$ = checkArithmitcExpressionTypes($1, $3,"mul"); assemblyOperation("mul"); $$ = quadOperation("mul", $1, $3); }
-    | expression DIV expression         { $$ = checkArithmitcExpressionTypes($1, $3,"div"); assemblyOperation("div"); $$ = quadOperation("div", $1, $3); }
-    | expression MOD expression         { $$ = checkArithmitcExpressionTypes($1, $3,"mod"); assemblyOperation("mod"); $$ = quadOperation("mod", $1, $3); }
-
-    | expression LT expression          { $$= checkComparisonExpressionTypes($1, $3); assemblyOperation("lt"); $$ = quadOperation("lt", $1, $3); }
-    | expression GT expression          { $$= checkComparisonExpressionTypes($1, $3); assemblyOperation("gt"); $$ = quadOperation("gt", $1, $3); }
-    | expression GE expression          { $$= checkComparisonExpressionTypes($1, $3); assemblyOperation("ge"); $$ = quadOperation("ge", $1, $3); }
-    | expression LE expression          { $$= checkComparisonExpressionTypes($1, $3); assemblyOperation("le"); $$ = quadOperation("le", $1, $3); }
-    | expression EQ expression          { $$ = checkComparisonExpressionTypes($1, $3); assemblyOperation("eq"); $$ = quadOperation("eq", $1, $3); }
-    | expression NE expression          { $$= checkComparisonExpressionTypes($1, $3); assemblyOperation("ne"); $$ = quadOperation("ne", $1, $3); }
-
-    | expression BITWISE_OR expression  { $$= checkBitwiseExpressionTypes($1, $3); assemblyOperation("add");  $$ = quadOperation("bit_or", $1, $3); }
+    |expression ADD expression         { $$ = checkArithmitcExpressionTypes($1, $3,"add"); assemblyBinaryOperation("add", $1, $3); $$ = quadOperation("add", $1, $3); }
+    | expression SUB expression         { $$ = checkArithmitcExpressionTypes($1, $3,"sub"); assemblyBinaryOperation("sub", $1, $3); $$ = quadOperation("sub", $1, $3); }
+    | expression MUL expression         { $$ = checkArithmitcExpressionTypes($1, $3,"mul"); assemblyBinaryOperation("mul", $1, $3); $$ = quadOperation("mul", $1, $3); }
+    | expression DIV expression         { $$ = checkArithmitcExpressionTypes($1, $3,"div"); assemblyBinaryOperation("div", $1, $3); $$ = quadOperation("div", $1, $3); }
+    | expression MOD expression         { $$ = checkArithmitcExpressionTypes($1, $3,"mod"); assemblyBinaryOperation("mod", $1, $3); $$ = quadOperation("mod", $1, $3); }
+
+    | expression LT expression          { $$= checkComparisonExpressionTypes($1, $3); assemblyBinaryOperation("lt", $1, $3); $$ = quadOperation("lt", $1, $3); }
+    | expression GT expression          { $$= checkComparisonExpressionTypes($1, $3); assemblyBinaryOperation("gt", $1, $3); $$ = quadOperation("gt", $1, $3); }
+    | expression GE expression          { $$= checkComparisonExpressionTypes($1, $3); assemblyBinaryOperation("ge", $1, $3); $$ = quadOperation("ge", $1, $3); }
+    | expression LE expression          { $$= checkComparisonExpressionTypes($1, $3); assemblyBinaryOperation("le", $1, $3); $$ = quadOperation("le", $1, $3); }
+    | expression EQ expression          { $$ = checkComparisonExpressionTypes($1, $3); assemblyBinaryOperation("eq", $1, $3); $$ = quadOperation("eq", $1, $3); }
+    | expression NE expression          { $$= checkComparisonExpressionTypes($1, $3); assemblyBinaryOperation("ne", $1, $3); $$ = quadOperation("ne", $1, $3); }
+
+    | expression BITWISE_OR expression  { $$= checkBitwiseExpressionTypes($1, $3); assemblyOperation("bit_or");  $$ = quadOperation("bit_or", $1, $3); }
     | expression BITWISE_XOR expression { $$= checkBitwiseExpressionTypes($1, $3); assemblyOperation("xor"); $$ = quadOperation("xor", $1, $3); }
     | expression BITWISE_AND expression { $$= checkBitwiseExpressionTypes($1, $3); assemblyOperation("bit_and");  $$ = quadOperation("bit_and", $1, $3); }
     | expression SHIFT_LEFT expression { $$= checkBitwiseExpressionTypes($1, $3); assemblyOperation("shl"); $$ = quadOperation("shl", $1, $3); }
     | expression SHIFT_RIGHT expression { $$= checkBitwiseExpressionTypes($1, $3); assemblyOperation("shr"); $$ = quadOperation("shr", $1, $3); }
 
-    | expression AND expression         { $$= checkComparisonExpressionTypes($1, $3); assemblyOperation("and"); $$ = quadOperation("and", $1, $3); }
-    | expression OR expression          { $$= checkComparisonExpressionTypes($1, $3); assemblyOperation("or"); $$ = quadOperation("or", $1, $3); }
+    | expression AND { assemblyShortCircuitBegin(true); quadShortCircuitBegin($1, true); }
+      expression                        { $$= checkComparisonExpressionTypes($1, $4); assemblyShortCircuitEnd(true); $$ = quadShortCircuitEnd($4, true); }
+    | expression OR { assemblyShortCircuitBegin(false); quadShortCircuitBegin($1, false); }
+      expression                        { $$= checkComparisonExpressionTypes($1, $4); assemblyShortCircuitEnd(false); $$ = quadShortCircuitEnd($4, false); }
     | '(' expression ')'          {$$ = $2; }
     |function_call
     | unary_operations
@@ -583,12 +606,55 @@ void yywarn(char *s, int line) {
 }
 
 int main(int argc, char *argv[]) {
+    char* inputPath = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-O") == 0) {
+            optimizeEnabled = true;
+        } else if (strcmp(argv[i], "-R") == 0) {
+            allocateRegistersEnabled = true;
+        } else if (strcmp(argv[i], "--run") == 0) {
+            runEnabled = true;
+        } else if (strcmp(argv[i], "--fuse") == 0) {
+            fusionEnabled = true;
+        } else if (strcmp(argv[i], "--jit") == 0) {
+            jitEnabled = true;
+        } else if (strcmp(argv[i], "--profile") == 0) {
+            profileEnabled = true;
+        } else if (strcmp(argv[i], "--engine") == 0 && i + 1 < argc) {
+            char* engine = argv[++i];
+            if (strcmp(engine, "register") == 0) {
+                registerEngineEnabled = true;
+            } else if (strcmp(engine, "stack") != 0) {
+                fprintf(stderr, "Unknown engine %s, it is stack or register\n", engine);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--interpret") == 0) {
+            interpretEnabled = true;
+        } else if (strcmp(argv[i], "--x86") == 0) {
+            x86Enabled = true;
+        } else if (strcmp(argv[i], "--c") == 0) {
+            cEnabled = true;
+        } else if (strcmp(argv[i], "--bytecode") == 0) {
+            bytecodeEnabled = true;
+        } else if (strcmp(argv[i], "--disasm") == 0) {
+            disassembleEnabled = true;
+        } else {
+            inputPath = argv[i];
+        }
+    }
+
+    // a bytecode file is run or disassembled as it is, nothing is compiled
+    if (inputPath != NULL && isBytecodePath(inputPath)) {
+        return runBytecodeFile(inputPath, runEnabled, disassembleEnabled) ? 0 : 1;
+    }
+
     setFiles();
-    
+    atexit(writeQuads); // keep the quads emitted so far when parsing stops early
+    atexit(writeAssembly);
 
     initSymbolTable();
-    if (argc > 1) {
-        FILE *file = fopen(argv[1], "r");
+    if (inputPath != NULL) {
+        FILE *file = fopen(inputPath, "r");
         if (!file) {
             perror("Could not open file");
             return 1;
@@ -596,10 +662,50 @@ int main(int argc, char *argv[]) {
         yyin = file;
     }
     int result = yyparse();
-    if (argc > 1) {
+    if (inputPath != NULL) {
         fclose(yyin);
     }
 
+    // the interpreter checks the optimized quads against these
+    Quad* originalQuads = NULL;
+    int originalQuadCount = quadCount;
+    if (!isError && result == 0 && optimizeEnabled && interpretEnabled) {
+        originalQuads = copyQuads(quadList, quadCount);
+    }
+    if (!isError && result == 0 && optimizeEnabled) {
+        optimizeQuads();
+    }
+    if (!isError && result == 0 && allocateRegistersEnabled) {
+        allocateRegisters();
+    }
+    if (!isError && result == 0 && optimizeEnabled) {
+        recycleTemps();
+    }
+    writeQuads();
+    writeAssembly();
+    if (!isError && result == 0 && bytecodeEnabled && !writeBytecode()) {
+        result = 1;
+    }
+    if (!isError && result == 0 && x86Enabled) {
+        writeX86();
+    }
+    if (!isError && result == 0 && cEnabled) {
+        writeC();
+    }
+    if (!isError && result == 0 && interpretEnabled && !runQuadInterpreter(originalQuads, originalQuadCount)) {
+        result = 1;
+    }
+    if (!isError && result == 0 && runEnabled) {
+        // with --bytecode the program runs from the file just written, the register engine runs the quads
+        bool ran = registerEngineEnabled ? runQuadEngine()
+                 : bytecodeEnabled ? runBytecodeFile("assembly.bc", true, false) : runAssembly();
+        if (!ran) {
+            result = 1;
+        }
+    }
+    if (originalQuads != NULL) {
+        freeQuads(originalQuads, originalQuadCount);
+    }
     cleanUpFiles();
     printSymbolTable();
     cleanupSymbolTableSnapshot();
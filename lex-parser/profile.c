@@ -0,0 +1,368 @@
+#ifndef __PROFILE_C__
+#define __PROFILE_C__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include "fusion.c"
+
+/*
+    Profiler (--profile). The VM runs every instruction through the
+    profile handler first: the threaded code points all instructions at
+    it and keeps the real handlers aside, the switch loop dispatches on a
+    copy of the code where every op is profile. Without --profile neither
+    is built, so the normal dispatch does no extra work.
+    The handler counts the op and looks at the instruction before it:
+        call / tailcall     entered the function whose label is at pc
+        ret / retv          back in the caller
+        jump to pc <= it    one trip of the loop at that label
+    Calls build a tree with one node per call path, each node counts the
+    instructions run in its function on that path (a superinstruction
+    counts as the ones it stands for) and the time between the calls and
+    returns around them. A function's exclusive figures add up its nodes,
+    its inclusive ones the subtrees of the nodes it isn't already on the
+    stack above. The tree is written to profile.folded as collapsed
+    stacks weighted by instructions, for flamegraph.pl and the tools that
+    read its format. A stack deeper than PROFILE_FOLDED_DEPTH keeps its
+    outermost frames and its own function around a (deeper) frame, so deep
+    recursion doesn't write lines as long as the recursion for every depth.
+    The JIT is off while profiling.
+*/
+
+#define PROFILE_FOLDED_DEPTH 128
+
+typedef struct ProfileNode {
+    int function; // 0 is the global code
+    int parent;
+    int firstChild;
+    int nextSibling;
+    bool recursive; // the function is on the stack under this call already
+    int depth; // frames from the global code, which is 1
+    int folded; // the deepest of its frames written to profile.folded before a (deeper)
+    long long calls;
+    long long instructions; // in the function itself
+    double seconds;
+    long long totalInstructions; // with the callees, filled by the report
+    double totalSeconds;
+} ProfileNode;
+
+typedef struct VMProfile {
+    VMProgram* program;
+    long long ops[VM_OP_COUNT]; // dispatches
+    int lengths[VM_OP_COUNT]; // instructions per dispatch
+    long long* trips; // per instruction, the backward jumps to it
+    int* functionAt; // per instruction, the function whose label is there or 0
+    char** functionNames;
+    int functionCount;
+    int* active; // per function, its calls on the stack
+    ProfileNode* nodes;
+    int nodeCount;
+    int nodeCapacity;
+    int current;
+    int lastOp;
+    int lastPc;
+    double lastEvent;
+} VMProfile;
+
+double profileNow() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+int profileNode(VMProfile* profile, int parent, int function) {
+    if (profile->nodeCount == profile->nodeCapacity) {
+        profile->nodeCapacity *= 2;
+        profile->nodes = (ProfileNode*)realloc(profile->nodes, profile->nodeCapacity * sizeof(ProfileNode));
+    }
+    int index = profile->nodeCount++;
+    ProfileNode* node = &profile->nodes[index];
+    memset(node, 0, sizeof(ProfileNode));
+    node->function = function;
+    node->parent = parent;
+    node->firstChild = -1;
+    node->nextSibling = -1;
+    node->recursive = function != 0 && profile->active[function] > 0;
+    node->depth = parent != -1 ? profile->nodes[parent].depth + 1 : 1;
+    node->folded = node->depth < PROFILE_FOLDED_DEPTH ? index : profile->nodes[parent].folded;
+    if (parent != -1) {
+        node->nextSibling = profile->nodes[parent].firstChild;
+        profile->nodes[parent].firstChild = index;
+    }
+    return index;
+}
+
+VMProfile* createVMProfile(VMProgram* program) {
+    VMProfile* profile = (VMProfile*)calloc(1, sizeof(VMProfile));
+    profile->program = program;
+    for (int op = 0; op < VM_OP_COUNT; op++) {
+        Superinstruction* fused = op > VM_HALT ? findSuperinstruction(op) : NULL;
+        profile->lengths[op] = fused != NULL ? fused->length : 1;
+    }
+    profile->trips = (long long*)calloc(program->count + 1, sizeof(long long));
+    profile->functionAt = (int*)calloc(program->count + 1, sizeof(int));
+    profile->functionNames = (char**)malloc((program->labelCount + 1) * sizeof(char*));
+    profile->functionNames[profile->functionCount++] = "(global)";
+    for (int l = 0; l < program->labelCount; l++) {
+        if (strncmp(program->labelNames[l], "func_", 5) == 0) {
+            profile->functionAt[program->labelOffsets[l]] = profile->functionCount;
+            profile->functionNames[profile->functionCount++] = program->labelNames[l] + 5;
+        }
+    }
+    profile->active = (int*)calloc(profile->functionCount, sizeof(int));
+    profile->nodeCapacity = 64;
+    profile->nodes = (ProfileNode*)malloc(profile->nodeCapacity * sizeof(ProfileNode));
+    profile->current = profileNode(profile, -1, 0);
+    profile->nodes[0].calls = 1;
+    profile->lastOp = -1;
+    profile->lastPc = -1;
+    profile->lastEvent = profileNow();
+    return profile;
+}
+
+// the time since the last call or return goes to the function that ran it
+void profileClock(VMProfile* profile) {
+    double now = profileNow();
+    profile->nodes[profile->current].seconds += now - profile->lastEvent;
+    profile->lastEvent = now;
+}
+
+void profileCall(VMProfile* profile, int pc, bool tail) {
+    profileClock(profile);
+    int parent = profile->current;
+    if (tail && parent != 0) {
+        profile->active[profile->nodes[parent].function]--;
+        parent = profile->nodes[parent].parent;
+    }
+    int function = profile->functionAt[pc];
+    int child = profile->nodes[parent].firstChild;
+    while (child != -1 && profile->nodes[child].function != function) {
+        child = profile->nodes[child].nextSibling;
+    }
+    profile->current = child != -1 ? child : profileNode(profile, parent, function);
+    profile->nodes[profile->current].calls++;
+    profile->active[function]++;
+}
+
+void profileReturn(VMProfile* profile) {
+    profileClock(profile);
+    ProfileNode* node = &profile->nodes[profile->current];
+    if (node->parent != -1) {
+        profile->active[node->function]--;
+        profile->current = node->parent;
+    }
+}
+
+static inline bool isProfiledJump(int op) {
+    return op == VM_JMP || op == VM_JF || op == VM_JTAB || (op >= VM_JLT_CONST && op <= VM_JNE);
+}
+
+// called before the instruction at pc runs
+static inline void profileInstruction(VMProfile* profile, int pc) {
+    int op = profile->program->code[pc].op;
+    int last = profile->lastOp;
+    if (last == VM_CALL || last == VM_TAILCALL) {
+        profileCall(profile, pc, last == VM_TAILCALL);
+    } else if (last == VM_RET || last == VM_RETV) {
+        profileReturn(profile);
+    } else if (pc <= profile->lastPc && isProfiledJump(last)) {
+        profile->trips[pc]++;
+    }
+    profile->ops[op]++;
+    profile->nodes[profile->current].instructions += profile->lengths[op];
+    profile->lastOp = op;
+    profile->lastPc = pc;
+}
+
+// the end of the run, stopped by halt or an error
+void finishVMProfile(VMProfile* profile) {
+    profileClock(profile);
+}
+
+void writeProfileFrames(VMProfile* profile, FILE* out, int index) {
+    ProfileNode* node = &profile->nodes[index];
+    if (node->parent != -1) {
+        writeProfileFrames(profile, out, node->parent);
+        fputc(';', out);
+    }
+    fputs(profile->functionNames[node->function], out);
+}
+
+void writeProfileStack(VMProfile* profile, FILE* out, int index) {
+    ProfileNode* node = &profile->nodes[index];
+    if (node->depth <= PROFILE_FOLDED_DEPTH) {
+        writeProfileFrames(profile, out, index);
+        return;
+    }
+    writeProfileFrames(profile, out, node->folded);
+    fprintf(out, ";(deeper);%s", profile->functionNames[node->function]);
+}
+
+// one line per call path that ran instructions itself: the functions from the outermost, then the count
+void writeProfileFolded(VMProfile* profile, char* path) {
+    FILE* out = fopen(path, "w");
+    if (out == NULL) {
+        perror("Could not write the profile");
+        return;
+    }
+    for (int n = 0; n < profile->nodeCount; n++) {
+        if (profile->nodes[n].instructions > 0) {
+            writeProfileStack(profile, out, n);
+            fprintf(out, " %lld\n", profile->nodes[n].instructions);
+        }
+    }
+    fclose(out);
+}
+
+typedef struct ProfileRow {
+    int index;
+    long long count;
+    long long inclusive;
+    double inclusiveSeconds;
+    long long exclusive;
+    double exclusiveSeconds;
+    long long calls;
+} ProfileRow;
+
+int compareProfileRows(const void* a, const void* b) {
+    long long x = ((ProfileRow*)a)->count;
+    long long y = ((ProfileRow*)b)->count;
+    return x < y ? 1 : x > y ? -1 : ((ProfileRow*)a)->index - ((ProfileRow*)b)->index;
+}
+
+// the function a loop label is in: the global code ends with the call to main, then the last function label before it
+int profileFunctionOf(VMProfile* profile, int pc) {
+    VMProgram* program = profile->program;
+    if (pc < program->entryStart + program->entryCount) {
+        return 0;
+    }
+    for (; pc >= 0; pc--) {
+        if (profile->functionAt[pc] != 0) {
+            return profile->functionAt[pc];
+        }
+    }
+    return 0;
+}
+
+// several labels can name the same instruction, the first one stands for the loop
+bool isFirstLabelAt(VMProgram* program, int label) {
+    for (int l = 0; l < label; l++) {
+        if (program->labelOffsets[l] == program->labelOffsets[label]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void reportVMProfile(VMProfile* profile, long long executed) {
+    VMProgram* program = profile->program;
+    ProfileNode* nodes = profile->nodes;
+    // a child always comes after its parent, so the subtrees add up backwards
+    for (int n = 0; n < profile->nodeCount; n++) {
+        nodes[n].totalInstructions = nodes[n].instructions;
+        nodes[n].totalSeconds = nodes[n].seconds;
+    }
+    for (int n = profile->nodeCount - 1; n > 0; n--) {
+        nodes[nodes[n].parent].totalInstructions += nodes[n].totalInstructions;
+        nodes[nodes[n].parent].totalSeconds += nodes[n].totalSeconds;
+    }
+
+    int rowCount = VM_OP_COUNT > profile->functionCount ? VM_OP_COUNT : profile->functionCount;
+    rowCount = rowCount > program->labelCount ? rowCount : program->labelCount;
+    ProfileRow* rows = (ProfileRow*)calloc(rowCount + 1, sizeof(ProfileRow));
+
+    printf("Profile: %lld instructions in %.3f s, %d functions, %d call paths, stacks written to profile.folded\n",
+           executed, nodes[0].totalSeconds, profile->functionCount - 1, profile->nodeCount);
+    // names longer than the default column widen it for every table
+    int width = 12;
+    for (int f = 0; f < profile->functionCount; f++) {
+        int length = (int)strlen(profile->functionNames[f]);
+        width = length > width ? length : width;
+    }
+    for (int l = 0; l < program->labelCount; l++) {
+        int pc = program->labelOffsets[l];
+        int length = (int)strlen(program->labelNames[l]);
+        if (pc >= 0 && pc < program->count && profile->trips[pc] > 0 && length > width) {
+            width = length;
+        }
+    }
+    int count = 0;
+    long long dispatches = 0;
+    for (int op = 0; op < VM_OP_COUNT; op++) {
+        if (profile->ops[op] > 0) {
+            rows[count].index = op;
+            rows[count++].count = profile->ops[op];
+            dispatches += profile->ops[op];
+        }
+    }
+    qsort(rows, count, sizeof(ProfileRow), compareProfileRows);
+    printf("  %-*s %12s %7s\n", width, "op", "dispatches", "%");
+    for (int r = 0; r < count; r++) {
+        printf("  %-*s %12lld %6.2f%%\n", width, vmOpNames[rows[r].index], rows[r].count, 100.0 * rows[r].count / dispatches);
+    }
+
+    memset(rows, 0, (rowCount + 1) * sizeof(ProfileRow));
+    for (int f = 0; f < profile->functionCount; f++) {
+        rows[f].index = f;
+    }
+    for (int n = 0; n < profile->nodeCount; n++) {
+        ProfileRow* row = &rows[nodes[n].function];
+        row->exclusive += nodes[n].instructions;
+        row->exclusiveSeconds += nodes[n].seconds;
+        row->calls += nodes[n].calls;
+        if (!nodes[n].recursive) {
+            row->inclusive += nodes[n].totalInstructions;
+            row->inclusiveSeconds += nodes[n].totalSeconds;
+        }
+    }
+    for (int f = 0; f < profile->functionCount; f++) {
+        rows[f].count = rows[f].inclusive;
+    }
+    qsort(rows, profile->functionCount, sizeof(ProfileRow), compareProfileRows);
+    printf("  %-*s %12s %7s %10s %12s %7s %10s %10s\n", width,
+           "function", "inclusive", "%", "ms", "exclusive", "%", "ms", "calls");
+    for (int r = 0; r < profile->functionCount; r++) {
+        ProfileRow* row = &rows[r];
+        if (row->calls == 0) {
+            continue;
+        }
+        printf("  %-*s %12lld %6.2f%% %10.3f %12lld %6.2f%% %10.3f %10lld\n", width,
+               profile->functionNames[row->index], row->inclusive, executed > 0 ? 100.0 * row->inclusive / executed : 0.0,
+               row->inclusiveSeconds * 1e3, row->exclusive, executed > 0 ? 100.0 * row->exclusive / executed : 0.0,
+               row->exclusiveSeconds * 1e3, row->calls);
+    }
+
+    count = 0;
+    for (int l = 0; l < program->labelCount; l++) {
+        int pc = program->labelOffsets[l];
+        if (pc >= 0 && pc < program->count && profile->trips[pc] > 0 && isFirstLabelAt(program, l)) {
+            rows[count].index = l;
+            rows[count++].count = profile->trips[pc];
+        }
+    }
+    qsort(rows, count, sizeof(ProfileRow), compareProfileRows);
+    if (count > 0) {
+        printf("  %-*s %12s  %s\n", width, "loop", "trips", "in");
+    }
+    for (int r = 0; r < count; r++) {
+        int pc = program->labelOffsets[rows[r].index];
+        printf("  %-*s %12lld  %s\n", width, program->labelNames[rows[r].index], rows[r].count,
+               profile->functionNames[profileFunctionOf(profile, pc)]);
+    }
+    free(rows);
+    writeProfileFolded(profile, "profile.folded");
+}
+
+void freeVMProfile(VMProfile* profile) {
+    free(profile->trips);
+    free(profile->functionAt);
+    free(profile->functionNames);
+    free(profile->active);
+    free(profile->nodes);
+    free(profile);
+}
+
+#endif
@@ -8,6 +8,24 @@
 #include "symbol_table.c"
 
 #define MAX_LABELS 100
+#define QUAD_CHUNK 1024
+
+/*
+    Quads are kept in memory until the parse is done so the optimizer
+    can rewrite them before they are written to quadruples.txt
+*/
+typedef struct Quad {
+    char* op;
+    char* arg1;
+    char* arg2;
+    char* result;
+    char* function; // owning function, NULL for global code
+} Quad;
+
+Quad* quadList = NULL;
+int quadCount = 0;
+int quadCapacity = 0;
+bool quadsWritten = false;
 
 static int tempCounter = 0;
 static int quadLabelCounter = 1;
@@ -16,16 +34,34 @@ static int quadLoopIndex = -1;
 
 int quadIfIndex = -1;
 int quadSwitchIndex = -1;
-int quadSwitchSkipIndex = -1;
-int quadSwitchOutIndex = -1;
 
 int quadIfLabels[MAX_LABELS];
 int quadLoopLabels[MAX_LABELS];
+bool quadLoopHasContinueLabel[MAX_LABELS]; // do-while conditions and for steps have their own label for continue
+int quadForStepStarts[MAX_LABELS];
+int quadForBodyStarts[MAX_LABELS];
 
-int quadSwitchLabels[MAX_LABELS];
-int quadSwitchSkipLabels[MAX_LABELS];
-int quadSwitchOutIndicies[MAX_LABELS];
+int quadSwitchLabels[MAX_LABELS]; // out label of every open switch
+int quadSwitchStarts[MAX_LABELS]; // where its dispatch code goes
 Node* quadSwitchExpression[MAX_LABELS];
+SwitchCases quadSwitchCases[MAX_LABELS];
+
+// open && / || operators, FALSE_LABELn takes their false exits and LABELn is their end,
+// an || also has FALSE_LABELm where its right side starts and LABELm for its true exit
+int quadShortIndex = -1;
+int quadShortLabels[MAX_LABELS];
+int quadShortRhsLabels[MAX_LABELS];
+int quadShortStarts[MAX_LABELS]; // first quad that can jump to FALSE_LABELn
+
+// the last && / || turned into a value, a condition right after it jumps on its exits instead
+char* quadShortTemp = NULL;
+int quadShortLabel = -1;
+int quadShortStart = -1;
+int quadShortTail = -1; // where the quads storing true/false start
+int quadShortEnd = -1;
+
+int quadFunctionBody = -1; // first quad after the pop_params of the current function
+bool quadHasTailLabel = false;
 
 char* newTemp() {
     char* temp = (char*)malloc(10 * sizeof(char));
@@ -63,11 +99,83 @@ char* nodeTypeToString(Node* node) {
 }
 
 void printQuad(char* op, char* arg1, char* arg2, char* result) {
-    fprintf(quadFileHandler.filePointer, "%-12s\t%-12s\t%-12s\t%-12s\n", 
-            op ? op : "_", 
-            arg1 ? arg1 : "_", 
-            arg2 ? arg2 : "_", 
-            result ? result : "_");
+    if (quadCount == quadCapacity) {
+        quadCapacity += QUAD_CHUNK;
+        quadList = (Quad*)realloc(quadList, quadCapacity * sizeof(Quad));
+        if (quadList == NULL) {
+            fprintf(stderr, "Memory allocation failed\n");
+            exit(1);
+        }
+    }
+
+    Quad* quad = &quadList[quadCount++];
+    quad->op = strdup(op ? op : "_");
+    quad->arg1 = strdup(arg1 ? arg1 : "_");
+    quad->arg2 = strdup(arg2 ? arg2 : "_");
+    quad->result = strdup(result ? result : "_");
+    quad->function = insideFunctionIdx >= 0 ? strdup(symbolTable[insideFunctionIdx].name) : NULL;
+}
+
+void setQuad(int index, char* op, char* arg1, char* arg2, char* result) {
+    Quad* quad = &quadList[index];
+    free(quad->op);
+    free(quad->arg1);
+    free(quad->arg2);
+    free(quad->result);
+    quad->op = strdup(op ? op : "_");
+    quad->arg1 = strdup(arg1 ? arg1 : "_");
+    quad->arg2 = strdup(arg2 ? arg2 : "_");
+    quad->result = strdup(result ? result : "_");
+}
+
+void deleteQuad(int index) {
+    setQuad(index, "nop", NULL, NULL, NULL);
+}
+
+// inserts a quad before index, owned by the same function as the quad it is placed before
+void insertQuad(int index, char* op, char* arg1, char* arg2, char* result) {
+    char* function = index < quadCount ? quadList[index].function : quadList[index - 1].function;
+    function = function ? strdup(function) : NULL;
+
+    printQuad(op, arg1, arg2, result);
+    Quad quad = quadList[quadCount - 1];
+    memmove(&quadList[index + 1], &quadList[index], (quadCount - 1 - index) * sizeof(Quad));
+    free(quad.function);
+    quad.function = function;
+    quadList[index] = quad;
+}
+
+bool isQuadDeleted(int index) {
+    return strcmp(quadList[index].op, "nop") == 0;
+}
+
+// drops quads removed by the optimizer passes
+void compactQuads() {
+    int count = 0;
+    for (int i = 0; i < quadCount; i++) {
+        if (isQuadDeleted(i)) {
+            free(quadList[i].op);
+            free(quadList[i].arg1);
+            free(quadList[i].arg2);
+            free(quadList[i].result);
+            free(quadList[i].function);
+            continue;
+        }
+        quadList[count++] = quadList[i];
+    }
+    quadCount = count;
+}
+
+void writeQuads() {
+    if (quadsWritten || quadFileHandler.filePointer == NULL) {
+        return;
+    }
+    quadsWritten = true;
+
+    for (int i = 0; i < quadCount; i++) {
+        fprintf(quadFileHandler.filePointer, "%-12s\t%-12s\t%-12s\t%-12s\n", 
+                quadList[i].op, quadList[i].arg1, quadList[i].arg2, quadList[i].result);
+    }
 }
 
 bool quadIsInLoop() {
@@ -75,7 +183,7 @@ bool quadIsInLoop() {
 }
 
 void quadJumpFalseLabel(int labelNum) {
-    char labelName[20];
+    char labelName[24];
     sprintf(labelName, "FALSE_LABEL%d", labelNum);
     printQuad("jmp", NULL, NULL, labelName);
 }
@@ -101,13 +209,54 @@ bool isLogicalOperation(const char* operation) {
            strcmp(operation, "not") == 0;
 }
 
+// a quad after index that can change the operand before the operation reads it:
+// a call changes @ret and the globals, an assignment or ++ / -- in the right operand changes its var
+bool quadOperandChangedAfter(char* operand, int index) {
+    bool isRet = strcmp(operand, "@ret") == 0;
+    bool isGlobal = !isRet && isGlobalSymbol(operand);
+    for (int i = index; i < quadCount; i++) {
+        bool isCall = strcmp(quadList[i].op, "jmp") == 0 && strncmp(quadList[i].result, "func_", 5) == 0;
+        if (isCall && (isRet || isGlobal)) {
+            return true;
+        }
+        if (!isRet && strcmp(quadList[i].op, "jmp") != 0 && strcmp(quadList[i].result, operand) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// the left operand is saved to a temp where it was read when the right operand changed it,
+// so it has the value the stack VM pushed before evaluating the right side
+char* quadLeftOperand(Node* left) {
+    char* operand = nodeTypeToString(left);
+    bool isRead = strcmp(operand, "@ret") == 0 || strcmp(left->type, "var") == 0;
+    if (!isRead || !quadOperandChangedAfter(operand, left->iValue)) {
+        return operand;
+    }
+    char* saved = newTemp();
+    insertQuad(left->iValue, "assign", operand, NULL, saved);
+    free(operand);
+    if (quadShortStart >= left->iValue) {
+        quadShortStart++;
+        quadShortTail++;
+        quadShortEnd++;
+    }
+    return saved;
+}
+
+// a var operand remembers where it was read, like a call result remembers its call
+void quadVarRead(Node* var) {
+    var->iValue = quadCount;
+}
+
 Node* quadOperation(char* operation, Node* left, Node* right) {
     printf("quadOperation: %s\n", operation);
     if (left == NULL || (right == NULL && strcmp(operation, "not") != 0)) {
         fprintf(stderr, "Error: Null operand in quadOperation\n");
         return NULL;
     }
-    char* arg1 = nodeTypeToString(left);
+    char* arg1 = quadLeftOperand(left);
     char* arg2 = strcmp(operation, "not") == 0 ? NULL : nodeTypeToString(right);
     char* temp = newTemp();
     
@@ -121,6 +270,8 @@ Node* quadOperation(char* operation, Node* left, Node* right) {
     char* dataType;
     if (isLogicalOperation(operation)) {
         dataType = "bool"; 
+    } else if (strcmp(left->dataType, "float") == 0 || strcmp(right->dataType, "float") == 0) {
+        dataType = "float"; // an int and a float give a float, as in checkArithmitcExpressionTypes
     } else {
         dataType = left->dataType;
     }
@@ -133,36 +284,36 @@ Node* quadOperation(char* operation, Node* left, Node* right) {
 
 void quadAssign(char* var, Node* expr) {
     char* arg1 = nodeTypeToString(expr);
-    printQuad("assign", arg1, NULL, var);
+    printQuad("assign", arg1, NULL, quadNameOf(var));
     free(arg1);
 }
 
 Node* quadUnaryOperationNotMinus(Node* node,char*oper) {
+    // constants and call results have no name, stringify them like binary operands
+    char* arg1 = quadLeftOperand(node);
     char* temp = newTemp();
-    bool isReturnFromFunction = strcmp(node->type, "@ret") == 0;
-    
-    char* varName = isReturnFromFunction ? "@ret" : node->name;
     char* dataType = node->dataType;
-    char* type = isReturnFromFunction ? "var" : node->type;
 
-    printQuad(oper, varName, "_", temp);
-    Node* retNode = createNode(dataType, type);
+    printQuad(oper, arg1, "_", temp);
+    free(arg1);
+    Node* retNode = createNode(dataType, temp);
     retNode->name = temp;
     return retNode;
 }
 
 Node* quadUnaryOperation(char* varName, char* op, bool isPrefix) {
     char* temp = newTemp();
+    char* var = quadNameOf(varName);
 
     if (isPrefix) {
-        printQuad(op, varName, "1", varName);
+        printQuad(op, var, "1", var);
         
-        Node* node = createNode(getSymbolDataType(varName), varName);
-        node->name = strdup(varName);
+        Node* node = createNode(getSymbolDataType(varName), var);
+        node->name = strdup(var);
         return node;
     } else {
-        printQuad("assign", varName, NULL, temp);
-        printQuad(op, varName, "1", varName);
+        printQuad("assign", var, NULL, temp);
+        printQuad(op, var, "1", var);
 
         Node* node = createNode(getSymbolDataType(varName), temp);
         node->name = temp;
@@ -187,12 +338,45 @@ Node* quadPrefixDecrement(char* varName) {
 }
 
 
-void quadJumpIfFalse(Node* cond, int labelNum) {
-    char labelName[20];
-    sprintf(labelName, "FALSE_LABEL%d", labelNum);
+// jumps to label when cond is false, returns the first quad that may take that jump
+int quadConditionJump(Node* cond, char* label) {
     char* condStr = nodeTypeToString(cond);
-    printQuad("if_false", condStr, NULL, labelName);
+    if (quadShortTemp == NULL || quadCount != quadShortEnd || strcmp(condStr, quadShortTemp) != 0) {
+        int start = quadCount;
+        printQuad("if_false", condStr, NULL, label);
+        free(condStr);
+        return start;
+    }
     free(condStr);
+
+    // cond is the && / || just emitted: drop the quads storing its value and send its false exits to label
+    while (quadCount > quadShortTail) {
+        quadCount--;
+        free(quadList[quadCount].op);
+        free(quadList[quadCount].arg1);
+        free(quadList[quadCount].arg2);
+        free(quadList[quadCount].result);
+        free(quadList[quadCount].function);
+    }
+    char falseLabel[24];
+    sprintf(falseLabel, "FALSE_LABEL%d", quadShortLabel);
+    for (int i = quadShortStart; i < quadCount; i++) {
+        if (strcmp(quadList[i].op, "if_false") == 0 && strcmp(quadList[i].result, falseLabel) == 0) {
+            free(quadList[i].result);
+            quadList[i].result = strdup(label);
+        }
+    }
+
+    free(quadShortTemp);
+    quadShortTemp = NULL;
+    quadShortEnd = -1;
+    return quadShortStart;
+}
+
+void quadJumpIfFalse(Node* cond, int labelNum) {
+    char labelName[24];
+    sprintf(labelName, "FALSE_LABEL%d", labelNum);
+    quadConditionJump(cond, labelName);
 }
 
 void quadJump(int labelNum) {
@@ -202,7 +386,7 @@ void quadJump(int labelNum) {
 }
 
 void quadFalseLabel(int labelNum) {
-    char labelName[20];
+    char labelName[24];
     sprintf(labelName, "FALSE_LABEL%d", labelNum);
     printQuad("label", NULL, NULL, labelName);
 }
@@ -213,13 +397,61 @@ void quadLabel(int labelNum) {
     printQuad("label", NULL, NULL, labelName);
 }
 
+// after the left side of && / ||: && leaves when it is false, || goes to its true exit when it is true
+void quadShortCircuitBegin(Node* left, bool isAnd) {
+    int n = quadLabelCounter++;
+    quadShortLabels[++quadShortIndex] = n;
+    char labelName[24];
+    if (isAnd) {
+        sprintf(labelName, "FALSE_LABEL%d", n);
+        quadShortStarts[quadShortIndex] = quadConditionJump(left, labelName);
+        return;
+    }
+    int m = quadLabelCounter++;
+    quadShortRhsLabels[quadShortIndex] = m;
+    sprintf(labelName, "FALSE_LABEL%d", m);
+    quadShortStarts[quadShortIndex] = quadConditionJump(left, labelName);
+    quadJump(m);
+    quadFalseLabel(m);
+}
+
+// the right side decides the rest, the result is only stored in a temp when something reads it as a value
+Node* quadShortCircuitEnd(Node* right, bool isAnd) {
+    int n = quadShortLabels[quadShortIndex];
+    quadJumpIfFalse(right, n);
+    if (!isAnd) {
+        quadLabel(quadShortRhsLabels[quadShortIndex]);
+    }
+
+    char* temp = newTemp();
+    int tail = quadCount;
+    printQuad("assign", "true", NULL, temp);
+    quadJump(n);
+    quadFalseLabel(n);
+    printQuad("assign", "false", NULL, temp);
+    quadLabel(n);
+
+    free(quadShortTemp);
+    quadShortTemp = strdup(temp);
+    quadShortLabel = n;
+    quadShortStart = quadShortStarts[quadShortIndex--];
+    quadShortTail = tail;
+    quadShortEnd = quadCount;
+
+    Node* result = createNode("bool", temp);
+    result->name = temp;
+    return result;
+}
+
 void quadAddFunctionParams(char* name) {
     int funcIdx = lookup(name);
     printf("Quad: Function %s has %d parameters\n", name, symbolTable[funcIdx].paramCount);
     for (int i = symbolTable[funcIdx].paramCount - 1; i >= 0; i--) {
-        char* paramName = symbolTable[symbolTable[funcIdx].paramsIds[i]].name;
+        char* paramName = symbolTable[symbolTable[funcIdx].paramsIds[i]].quadName;
         printQuad("pop_param", paramName, "_", "_");
     }
+    quadFunctionBody = quadCount;
+    quadHasTailLabel = false;
 }
 
 void quadFunctionLabel(char* name) {
@@ -240,7 +472,8 @@ void quadPush(Node* node) {
 Node* quadFunctionCall(char *name, int argCount) {
     int funcIdx = lookup(name);
 
-    for (int i = symbolTable[funcIdx].paramCount - 1; i >= argCount; i--) {
+    // defaults go on top of the passed args in param order, the callee pops the last param first
+    for (int i = argCount; i < symbolTable[funcIdx].paramCount; i++) {
         char tempStr[32];
         char* value = nodeTypeToString(symbolTable[symbolTable[funcIdx].paramsIds[i]].nodeValue);
         snprintf(tempStr, sizeof(tempStr), "%s", value);
@@ -253,20 +486,40 @@ Node* quadFunctionCall(char *name, int argCount) {
 
     Node* retNode = createNode(symbolTable[funcIdx].dataType, "@ret"); // the @ret can be changed
     retNode->name = strdup("@ret");
+    retNode->iValue = quadCount; // where to save it when another call follows
     return retNode;
 }
 
-void quadLoopInit() {
+// the exit label is taken up front so break works before the condition is parsed
+void quadLoopInit(bool isDoWhile) {
     printf("quadLoopInit: %d\n", quadLoopIndex);
     quadLoopLabels[++quadLoopIndex] = quadLabelCounter++;
     quadLabel(quadLoopLabels[quadLoopIndex]);
+    quadLoopLabels[++quadLoopIndex] = quadLabelCounter++;
+    quadLoopHasContinueLabel[quadLoopIndex] = isDoWhile;
+}
+
+// continue in a do-while goes to the condition, which has no label of its own
+void quadDoWhileCondition() {
+    quadLabel(quadLoopLabels[quadLoopIndex]);
 }
 
 void quadLoopBegin(Node* condition) {
-    quadLoopLabels[++quadLoopIndex] = quadLabelCounter++;
     quadJumpIfFalse(condition, quadLoopLabels[quadLoopIndex]);
 }
 
+void quadLoopBreak() {
+    quadJumpFalseLabel(quadLoopLabels[quadLoopIndex]);
+}
+
+void quadLoopContinue() {
+    if (quadLoopHasContinueLabel[quadLoopIndex]) {
+        quadJump(quadLoopLabels[quadLoopIndex]);
+    } else {
+        quadJump(quadLoopLabels[quadLoopIndex - 1]);
+    }
+}
+
 void quadLoopExit() {
     quadJump(quadLoopLabels[quadLoopIndex - 1]);
     quadFalseLabel(quadLoopLabels[quadLoopIndex]);
@@ -278,57 +531,143 @@ void quadSwitchBegin(Node* expression) {
         customError("Switch expression must be a variable");
     }
 
-    quadSwitchExpression[++quadSwitchOutIndex] = expression;
-    quadSwitchOutIndicies[quadSwitchOutIndex] = ++quadSwitchIndex;
+    quadSwitchExpression[++quadSwitchIndex] = expression;
     quadSwitchLabels[quadSwitchIndex] = quadLabelCounter++;
-    quadSwitchSkipLabels[++quadSwitchSkipIndex] = quadLabelCounter++;;
+    quadSwitchStarts[quadSwitchIndex] = quadCount;
+    memset(&quadSwitchCases[quadSwitchIndex], 0, sizeof(SwitchCases));
+    quadSwitchCases[quadSwitchIndex].defaultLabel = -1;
 }
 
+// cases are laid out in order so a case without break falls into the next one
 void quadSwitchCaseBegin(Node* expression) {
-    char constValue[32];
-
     char* value = nodeTypeToString(expression);
-    snprintf(constValue, sizeof(constValue), "%s", value);
+    int label = quadLabelCounter++;
+    addSwitchCase(&quadSwitchCases[quadSwitchIndex], expression, value, label);
+    free(value);
 
-    char* temp = newTemp();
-    printQuad("eq", quadSwitchExpression[quadSwitchOutIndex]->name, constValue, temp);
+    char caseLabel[32];
+    snprintf(caseLabel, sizeof(caseLabel), "Label%d", label);
+    printQuad("label", "_", "_", caseLabel);
+}
 
-    quadSwitchLabels[++quadSwitchIndex] = quadLabelCounter++;
-    char falseLabel[32];
-    snprintf(falseLabel, sizeof(falseLabel), "Label%d", quadSwitchLabels[quadSwitchIndex]);
-    printQuad("jf", temp, "_", falseLabel);
+void quadSwitchDefault() {
+    int label = quadLabelCounter++;
+    quadSwitchCases[quadSwitchIndex].defaultLabel = label;
 
-    char skipLabel[32];
-    snprintf(skipLabel, sizeof(skipLabel), "Label%d", quadSwitchSkipLabels[quadSwitchSkipIndex]);
-    printQuad("label", "_", "_", skipLabel);
+    char defaultLabel[32];
+    snprintf(defaultLabel, sizeof(defaultLabel), "Label%d", label);
+    printQuad("label", "_", "_", defaultLabel);
 }
 
-void quadSwitchCaseEnd() {
-    quadSwitchSkipLabels[++quadSwitchSkipIndex] = quadLabelCounter++;
+void quadSwitchBreak() {
+    char outLabel[32];
+    snprintf(outLabel, sizeof(outLabel), "Label%d", quadSwitchLabels[quadSwitchIndex]);
+    printQuad("jmp", "_", "_", outLabel);
+}
+
+// moves the quads from 'from' to the end in front of index
+void moveQuadsBefore(int index, int from) {
+    int count = quadCount - from;
+    Quad* moved = (Quad*)malloc((count + 1) * sizeof(Quad));
+    memcpy(moved, &quadList[from], count * sizeof(Quad));
+    memmove(&quadList[index + count], &quadList[index], (from - index) * sizeof(Quad));
+    memcpy(&quadList[index], moved, count * sizeof(Quad));
+    free(moved);
+}
 
-    char skipLabel[32];
-    snprintf(skipLabel, sizeof(skipLabel), "Label%d", quadSwitchSkipLabels[quadSwitchSkipIndex]);
-    printQuad("jmp", "_", "_", skipLabel);
+// the step of a for runs after the body, same as in the assembly
+void quadForStepBegin() {
+    quadLoopHasContinueLabel[quadLoopIndex] = true;
+    quadForStepStarts[quadLoopIndex] = quadCount;
+    quadLabel(quadLoopLabels[quadLoopIndex]);
+}
 
-    char falseLabel[32];
-    snprintf(falseLabel, sizeof(falseLabel), "Label%d", quadSwitchLabels[quadSwitchIndex]);
-    printQuad("label", "_", "_", falseLabel);
+void quadForStepEnd() {
+    quadForBodyStarts[quadLoopIndex] = quadCount;
 }
 
-void quadSwitchEnd() {
-    char skipLabel[32];
-    snprintf(skipLabel, sizeof(skipLabel), "Label%d", quadSwitchSkipLabels[quadSwitchSkipIndex]);
-    printQuad("label", "_", "_", skipLabel);
+void quadForBodyEnd() {
+    moveQuadsBefore(quadForStepStarts[quadLoopIndex], quadForBodyStarts[quadLoopIndex]);
+}
 
-    int outIndex = quadSwitchOutIndicies[quadSwitchOutIndex];
+// balanced compare tree over the sorted cases, a few cases are just compared one by one
+void quadSwitchTree(char* var, SwitchCases* cases, int low, int high, char* fallback) {
+    char label[32];
+    if (high - low + 1 <= SWITCH_LINEAR_MAX_CASES) {
+        for (int i = low; i <= high; i++) {
+            char* temp = newTemp();
+            printQuad("ne", var, cases->constants[i], temp);
+            snprintf(label, sizeof(label), "Label%d", cases->labels[i]);
+            printQuad("jf", temp, "_", label);
+            free(temp);
+        }
+        printQuad("jmp", "_", "_", fallback);
+        return;
+    }
+
+    int middle = (low + high + 1) / 2;
+    char* temp = newTemp();
+    printQuad("lt", var, cases->constants[middle], temp);
+    int right = quadLabelCounter++;
+    snprintf(label, sizeof(label), "Label%d", right);
+    printQuad("jf", temp, "_", label);
+    free(temp);
+
+    quadSwitchTree(var, cases, low, middle - 1, fallback);
+    printQuad("label", "_", "_", label);
+    quadSwitchTree(var, cases, middle, high, fallback);
+}
+
+// jtab jumps to the jtarget at position index, or to the fallback when index is out of range
+void quadSwitchTable(char* var, SwitchCases* cases, char* fallback) {
+    char* index = var;
+    if (cases->values[0] != 0) {
+        index = newTemp();
+        printQuad("sub", var, cases->constants[0], index);
+    }
+    int range = cases->values[cases->count - 1] - cases->values[0] + 1;
+    char count[16];
+    snprintf(count, sizeof(count), "%d", range);
+    printQuad("jtab", index, count, fallback);
+
+    int next = 0;
+    for (int value = cases->values[0]; next < cases->count; value++) {
+        char label[32];
+        if (cases->values[next] == value) {
+            snprintf(label, sizeof(label), "Label%d", cases->labels[next++]);
+        } else {
+            snprintf(label, sizeof(label), "%s", fallback);
+        }
+        printQuad("jtarget", "_", "_", label);
+    }
+    if (index != var) {
+        free(index);
+    }
+}
 
+// the dispatch is generated once all the cases are known and moved in front of them
+void quadSwitchEnd() {
+    SwitchCases* cases = &quadSwitchCases[quadSwitchIndex];
     char outLabel[32];
-    snprintf(outLabel, sizeof(outLabel), "Label%d", quadSwitchLabels[outIndex]);
+    snprintf(outLabel, sizeof(outLabel), "Label%d", quadSwitchLabels[quadSwitchIndex]);
     printQuad("label", "_", "_", outLabel);
 
-    quadSwitchIndex = outIndex - 1;
-    quadSwitchSkipIndex = outIndex - 1;
-    quadSwitchOutIndex--;
+    char fallback[32];
+    snprintf(fallback, sizeof(fallback), "Label%d",
+             cases->defaultLabel != -1 ? cases->defaultLabel : quadSwitchLabels[quadSwitchIndex]);
+
+    int from = quadCount;
+    char* var = quadSwitchExpression[quadSwitchIndex]->name;
+    sortSwitchCases(cases);
+    if (useSwitchTable(cases, quadSwitchExpression[quadSwitchIndex]->dataType)) {
+        quadSwitchTable(var, cases, fallback);
+    } else {
+        quadSwitchTree(var, cases, 0, cases->count - 1, fallback);
+    }
+    moveQuadsBefore(quadSwitchStarts[quadSwitchIndex], from);
+
+    freeSwitchCases(cases);
+    quadSwitchIndex--;
 }
 
 Node* quadReturn(Node* node) {
@@ -344,4 +683,88 @@ Node* quadReturn(Node* node) {
         node->name = strdup("@ret");
         return node;
     }
-}
\ No newline at end of file
+}
+
+// the label self tail calls jump back to, put after the pop_params the first time it is needed
+void quadTailLabel(char* label) {
+    if (quadHasTailLabel) {
+        return;
+    }
+    int from = quadCount;
+    printQuad("label", "_", "_", label);
+    moveQuadsBefore(quadFunctionBody, from);
+    for (int i = 0; i <= quadSwitchIndex; i++) {
+        if (quadSwitchStarts[i] >= quadFunctionBody) {
+            quadSwitchStarts[i]++;
+        }
+    }
+    for (int i = 0; i <= quadLoopIndex; i++) {
+        quadForStepStarts[i] += quadForStepStarts[i] >= quadFunctionBody;
+        quadForBodyStarts[i] += quadForBodyStarts[i] >= quadFunctionBody;
+    }
+    quadHasTailLabel = true;
+}
+
+// return f(...) where f is the function itself becomes a loop: the args are copied into
+// temps first, since they can read the params, then into the params, and the body starts over
+Node* quadTailCall(char* function, Node* node) {
+    char target[128];
+    snprintf(target, sizeof(target), "func_%s", function);
+    Quad* call = &quadList[quadCount - 1];
+    if (quadFunctionBody == -1 || quadCount - 1 < quadFunctionBody
+        || strcmp(call->op, "jmp") != 0 || strcmp(call->result, target) != 0) {
+        return quadReturn(node);
+    }
+
+    char label[128];
+    snprintf(label, sizeof(label), "TAIL_%s", function);
+    quadTailLabel(label);
+
+    // replays the args stack to find the pushes of this call, nested calls take theirs before it
+    int* pushes = (int*)malloc(quadCount * sizeof(int));
+    int pushCount = 0;
+    for (int i = quadFunctionBody; i < quadCount - 1; i++) {
+        Quad* quad = &quadList[i];
+        if (strcmp(quad->op, "push") == 0 || strcmp(quad->op, "push_const") == 0) {
+            pushes[pushCount++] = i;
+        } else if (strcmp(quad->op, "jmp") == 0 && strncmp(quad->result, "func_", 5) == 0) {
+            pushCount -= symbolTable[lookup(quad->result + 5)].paramCount;
+            pushCount = pushCount < 0 ? 0 : pushCount;
+        }
+    }
+
+    int funcIdx = lookup(function);
+    int paramCount = symbolTable[funcIdx].paramCount;
+    if (pushCount < paramCount) {
+        free(pushes);
+        return quadReturn(node);
+    }
+
+    char** temps = (char**)malloc((paramCount + 1) * sizeof(char*));
+    for (int p = 0; p < paramCount; p++) {
+        int push = pushes[pushCount - paramCount + p];
+        char* value = strdup(quadList[push].arg1);
+        temps[p] = newTemp();
+        setQuad(push, "assign", value, NULL, temps[p]);
+        free(value);
+    }
+
+    // the call itself is the last quad
+    quadCount--;
+    free(quadList[quadCount].op);
+    free(quadList[quadCount].arg1);
+    free(quadList[quadCount].arg2);
+    free(quadList[quadCount].result);
+    free(quadList[quadCount].function);
+
+    for (int p = 0; p < paramCount; p++) {
+        printQuad("assign", temps[p], "_", symbolTable[symbolTable[funcIdx].paramsIds[p]].quadName);
+        free(temps[p]);
+    }
+    printQuad("jmp", "_", "_", label);
+
+    free(temps);
+    free(pushes);
+    node->name = strdup("@ret");
+    return node;
+}
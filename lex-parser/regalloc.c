@@ -0,0 +1,293 @@
+#ifndef __REGALLOC_C__
+#define __REGALLOC_C__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdarg.h>
+
+#include "cfg.c"
+#include "liveness.c"
+
+/*
+    Linear scan register allocation (Poletto & Sarkar) over the quads.
+    Every function gets its own register window, so values stay in their
+    registers across calls. Spilled variables go to frame slots [sN] and
+    globals stay in memory; both are reached through the scratch registers.
+
+    The register form is written to registers.txt:
+        add r2, r0, 1       three-address op on registers and immediates
+        load r6, [s0]       spill slot / global reads and writes
+        arg r1 / call func_f / param r0 / ret r2
+*/
+
+#define REGISTER_COUNT 8
+#define SCRATCH_REGISTERS 2 // the last registers, never allocated
+#define ALLOCATABLE_REGISTERS (REGISTER_COUNT - SCRATCH_REGISTERS)
+
+bool allocateRegistersEnabled = false;
+
+int registerInstructionCount = 0;
+int registerMemoryCount = 0; // loads and stores
+int registerOperationCount = 0; // value computing instructions
+int registerSpillCount = 0;
+
+typedef struct RegisterAllocation {
+    Liveness* live;
+    int* location; // per var: register, or ~slot when spilled
+    int slotCount;
+    int maxLive;
+} RegisterAllocation;
+
+void sortByIntervalStart(Liveness* live, int* order, int count) {
+    // insertion sort keeps it stable, vars are mostly created in order already
+    for (int i = 1; i < count; i++) {
+        int v = order[i];
+        int j = i - 1;
+        while (j >= 0 && live->intervalStart[order[j]] > live->intervalStart[v]) {
+            order[j + 1] = order[j];
+            j--;
+        }
+        order[j + 1] = v;
+    }
+}
+
+RegisterAllocation* linearScan(Liveness* live, int registerCount) {
+    RegisterAllocation* allocation = (RegisterAllocation*)calloc(1, sizeof(RegisterAllocation));
+    allocation->live = live;
+    allocation->location = (int*)malloc((live->varCount + 1) * sizeof(int));
+
+    int* order = (int*)malloc((live->varCount + 1) * sizeof(int));
+    int count = 0;
+    for (int v = 0; v < live->varCount; v++) {
+        if (live->intervalStart[v] != -1) {
+            order[count++] = v;
+        }
+    }
+    sortByIntervalStart(live, order, count);
+
+    int* active = (int*)malloc((registerCount + 1) * sizeof(int)); // sorted by interval end
+    int activeCount = 0;
+    bool* busy = (bool*)calloc(registerCount, sizeof(bool));
+
+    for (int n = 0; n < count; n++) {
+        int v = order[n];
+
+        // expire intervals that ended before this one starts
+        int kept = 0;
+        for (int a = 0; a < activeCount; a++) {
+            if (live->intervalEnd[active[a]] < live->intervalStart[v]) {
+                busy[allocation->location[active[a]]] = false;
+            } else {
+                active[kept++] = active[a];
+            }
+        }
+        activeCount = kept;
+
+        int victim = v;
+        if (activeCount == registerCount) {
+            int last = active[activeCount - 1];
+            if (live->intervalEnd[last] > live->intervalEnd[v]) {
+                allocation->location[v] = allocation->location[last];
+                activeCount--;
+                victim = last;
+            }
+            allocation->location[victim] = ~allocation->slotCount++;
+            registerSpillCount++;
+            if (victim == v) {
+                continue;
+            }
+        } else {
+            int reg = 0;
+            while (busy[reg]) {
+                reg++;
+            }
+            busy[reg] = true;
+            allocation->location[v] = reg;
+        }
+
+        int a = activeCount++;
+        while (a > 0 && live->intervalEnd[active[a - 1]] > live->intervalEnd[v]) {
+            active[a] = active[a - 1];
+            a--;
+        }
+        active[a] = v;
+        if (activeCount > allocation->maxLive) {
+            allocation->maxLive = activeCount;
+        }
+    }
+
+    free(order);
+    free(active);
+    free(busy);
+    return allocation;
+}
+
+void emitRegisterLine(char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    vfprintf(registerFileHandler.filePointer, format, args);
+    va_end(args);
+    registerInstructionCount++;
+}
+
+// text of an operand that is read, memory values are loaded into the scratch register first
+void readRegisterOperand(RegisterAllocation* allocation, char* name, int scratch, char* buffer) {
+    if (isConstOperand(name)) {
+        strcpy(buffer, name);
+        return;
+    }
+    if (strcmp(name, "@ret") == 0) {
+        strcpy(buffer, "rv");
+        return;
+    }
+    int v = allocation ? liveVar(allocation->live, name) : -1;
+    if (v != -1 && allocation->location[v] >= 0) {
+        sprintf(buffer, "r%d", allocation->location[v]);
+        return;
+    }
+    sprintf(buffer, "r%d", ALLOCATABLE_REGISTERS + scratch);
+    if (v != -1) {
+        emitRegisterLine("\tload %s, [s%d]\n", buffer, ~allocation->location[v]);
+    } else {
+        emitRegisterLine("\tload %s, %s\n", buffer, name);
+    }
+    registerMemoryCount++;
+}
+
+// register a result is computed into, storeBack tells if it has to be written to memory after
+bool writeRegisterOperand(RegisterAllocation* allocation, char* name, char* buffer) {
+    if (strcmp(name, "@ret") == 0) { // an inlined return, read back from rv like a call's
+        strcpy(buffer, "rv");
+        return false;
+    }
+    int v = allocation ? liveVar(allocation->live, name) : -1;
+    if (v != -1 && allocation->location[v] >= 0) {
+        sprintf(buffer, "r%d", allocation->location[v]);
+        return false;
+    }
+    sprintf(buffer, "r%d", ALLOCATABLE_REGISTERS);
+    return true;
+}
+
+void storeRegisterOperand(RegisterAllocation* allocation, char* name, char* buffer) {
+    int v = allocation ? liveVar(allocation->live, name) : -1;
+    if (v != -1) {
+        emitRegisterLine("\tstore [s%d], %s\n", ~allocation->location[v], buffer);
+    } else {
+        emitRegisterLine("\tstore %s, %s\n", name, buffer);
+    }
+    registerMemoryCount++;
+}
+
+void emitRegisterQuad(RegisterAllocation* allocation, Quad* quad) {
+    char a[256], b[256], d[256];
+
+    if (isQuadDeleted(quad - quadList)) {
+        return;
+    }
+    if (strcmp(quad->op, "func_label") == 0) {
+        fprintf(registerFileHandler.filePointer, "func_%s:\n", quad->arg1);
+        emitRegisterLine("\tenter %d\n", allocation ? allocation->slotCount : 0);
+        return;
+    }
+    if (isLabelQuad(quad)) {
+        fprintf(registerFileHandler.filePointer, "%s:\n", quad->result);
+        return;
+    }
+    if (isValueQuad(quad)) {
+        readRegisterOperand(allocation, quad->arg1, 0, a);
+        bool binary = strcmp(quad->arg2, "_") != 0;
+        if (binary) {
+            readRegisterOperand(allocation, quad->arg2, 1, b);
+        }
+        bool storeBack = writeRegisterOperand(allocation, quad->result, d);
+        char* op = strcmp(quad->op, "assign") == 0 ? "mov" : quad->op;
+        if (binary) {
+            emitRegisterLine("\t%s %s, %s, %s\n", op, d, a, b);
+        } else {
+            emitRegisterLine("\t%s %s, %s\n", op, d, a);
+        }
+        registerOperationCount++;
+        if (storeBack) {
+            storeRegisterOperand(allocation, quad->result, d);
+        }
+        return;
+    }
+    if (isCondJumpQuad(quad)) {
+        readRegisterOperand(allocation, quad->arg1, 0, a);
+        emitRegisterLine("\tjf %s, %s\n", a, quad->result);
+    } else if (isCallQuad(quad)) {
+        emitRegisterLine("\tcall %s\n", quad->result);
+    } else if (isReturnQuad(quad)) {
+        if (isVarOperand(quad->result) || isConstOperand(quad->result)) {
+            readRegisterOperand(allocation, quad->result, 0, a);
+            emitRegisterLine("\tret %s\n", a);
+        } else {
+            emitRegisterLine("\tret\n");
+        }
+    } else if (isJumpQuad(quad)) {
+        emitRegisterLine("\tjmp %s\n", quad->result);
+    } else if (strcmp(quad->op, "jtab") == 0) {
+        readRegisterOperand(allocation, quad->arg1, 0, a);
+        emitRegisterLine("\tjtab %s, %s, %s\n", a, quad->arg2, quad->result);
+    } else if (strcmp(quad->op, "jtarget") == 0) {
+        emitRegisterLine("\tjtarget %s\n", quad->result);
+    } else if (strcmp(quad->op, "push") == 0 || strcmp(quad->op, "push_const") == 0) {
+        readRegisterOperand(allocation, quad->arg1, 0, a);
+        emitRegisterLine("\targ %s\n", a);
+    } else if (strcmp(quad->op, "pop_param") == 0) {
+        bool storeBack = writeRegisterOperand(allocation, quad->arg1, d);
+        emitRegisterLine("\tparam %s\n", d);
+        if (storeBack) {
+            storeRegisterOperand(allocation, quad->arg1, d);
+        }
+    } else if (strcmp(quad->op, "print") == 0) {
+        readRegisterOperand(allocation, quad->arg1, 0, a);
+        emitRegisterLine("\tprint %s\n", a);
+    } else {
+        emitRegisterLine("\t%s %s, %s, %s\n", quad->op, quad->arg1, quad->arg2, quad->result);
+    }
+}
+
+void allocateRegisters() {
+    setFilePath(&registerFileHandler, "registers.txt");
+
+    int start = 0;
+    while (start < quadCount) {
+        int end = regionEnd(start);
+        CFG* cfg = buildCFG(start, end);
+        Liveness* live = computeLiveness(cfg);
+        RegisterAllocation* allocation = NULL;
+
+        // without a usable CFG every variable stays in memory
+        if (cfg->valid) {
+            allocation = linearScan(live, ALLOCATABLE_REGISTERS);
+            printf("Registers: %s uses %d of %d registers, %d spill slots\n",
+                   quadList[start].function ? quadList[start].function : "global code",
+                   allocation->maxLive, ALLOCATABLE_REGISTERS, allocation->slotCount);
+        }
+
+        for (int i = start; i < end; i++) {
+            emitRegisterQuad(allocation, &quadList[i]);
+        }
+        if (quadList[start].function != NULL && !isReturnQuad(&quadList[end - 1])) {
+            emitRegisterLine("\tret\n");
+        }
+
+        if (allocation != NULL) {
+            free(allocation->location);
+            free(allocation);
+        }
+        freeLiveness(live);
+        freeCFG(cfg);
+        start = end;
+    }
+
+    printf("Register allocation: %d instructions, %d spills, %d loads/stores for %d operations (%.2f per operation, the stack code needs 3)\n",
+           registerInstructionCount, registerSpillCount, registerMemoryCount, registerOperationCount,
+           registerOperationCount ? (double)registerMemoryCount / registerOperationCount : 0.0);
+}
+
+#endif
@@ -0,0 +1,441 @@
+#ifndef __SCCP_C__
+#define __SCCP_C__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "cfg.c"
+#include "ssa.c"
+#include "folding.c"
+
+/*
+    Sparse conditional constant propagation (Wegman & Zadeck) over the SSA form.
+    Blocks that are never marked executable are removed together with the
+    if_false / jf / jmp quads that lead to them.
+*/
+
+#define LATTICE_TOP 0
+#define LATTICE_CONST 1
+#define LATTICE_BOTTOM 2
+
+typedef struct SCCPState {
+    SSAForm* ssa;
+    int* state; // per version
+    ConstValue* value; // per version, valid when state is LATTICE_CONST
+    bool** edgeExecutable; // per block, per successor
+    bool* visited;
+    int** useSites; // per version: quad index, or ~block for phis
+    int* useCount;
+
+    int* flowFrom;
+    int* flowTo;
+    int flowCount;
+    int flowCapacity;
+    int* ssaList;
+    int ssaCount;
+    int ssaCapacity;
+} SCCPState;
+
+int sccpFoldedBranches = 0;
+int sccpRemovedQuads = 0;
+int sccpPropagated = 0;
+
+void addUseSite(SCCPState* sccp, int version, int site) {
+    if (version < 0) {
+        return;
+    }
+    sccp->useSites[version] = (int*)realloc(sccp->useSites[version], (sccp->useCount[version] + 1) * sizeof(int));
+    sccp->useSites[version][sccp->useCount[version]++] = site;
+}
+
+void markEdgeExecutable(SCCPState* sccp, int from, int succIndex) {
+    if (sccp->edgeExecutable[from][succIndex]) {
+        return;
+    }
+    sccp->edgeExecutable[from][succIndex] = true;
+    if (sccp->flowCount == sccp->flowCapacity) {
+        sccp->flowCapacity = sccp->flowCapacity ? sccp->flowCapacity * 2 : 64;
+        sccp->flowFrom = (int*)realloc(sccp->flowFrom, sccp->flowCapacity * sizeof(int));
+        sccp->flowTo = (int*)realloc(sccp->flowTo, sccp->flowCapacity * sizeof(int));
+    }
+    sccp->flowFrom[sccp->flowCount] = from;
+    sccp->flowTo[sccp->flowCount++] = sccp->ssa->cfg->blocks[from].succs[succIndex];
+}
+
+void lowerLattice(SCCPState* sccp, int version, int state, ConstValue* value) {
+    int old = sccp->state[version];
+    if (old == LATTICE_BOTTOM || state == LATTICE_TOP) {
+        return;
+    }
+    if (old == LATTICE_CONST) {
+        if (state == LATTICE_CONST && sameConstValue(&sccp->value[version], value)) {
+            return;
+        }
+        state = LATTICE_BOTTOM;
+    }
+
+    sccp->state[version] = state;
+    if (state == LATTICE_CONST) {
+        sccp->value[version] = *value;
+        if (value->kind == 's') {
+            sccp->value[version].sValue = strdup(value->sValue);
+        }
+    }
+    if (sccp->ssaCount == sccp->ssaCapacity) {
+        sccp->ssaCapacity = sccp->ssaCapacity ? sccp->ssaCapacity * 2 : 64;
+        sccp->ssaList = (int*)realloc(sccp->ssaList, sccp->ssaCapacity * sizeof(int));
+    }
+    sccp->ssaList[sccp->ssaCount++] = version;
+}
+
+// lattice value of one quad operand
+int operandLattice(SCCPState* sccp, char* operand, int version, ConstValue* value) {
+    if (parseConstValue(operand, value)) {
+        return LATTICE_CONST;
+    }
+    if (version < 0) {
+        return LATTICE_BOTTOM;
+    }
+    if (sccp->state[version] == LATTICE_CONST) {
+        *value = sccp->value[version];
+    }
+    return sccp->state[version];
+}
+
+void visitPhis(SCCPState* sccp, int b) {
+    CFG* cfg = sccp->ssa->cfg;
+    for (Phi* phi = sccp->ssa->phis[b]; phi != NULL; phi = phi->next) {
+        int state = LATTICE_TOP;
+        ConstValue value;
+        for (int p = 0; p < cfg->blocks[b].predCount && state != LATTICE_BOTTOM; p++) {
+            int pred = cfg->blocks[b].preds[p];
+            int s = 0;
+            while (cfg->blocks[pred].succs[s] != b) {
+                s++;
+            }
+            if (!sccp->edgeExecutable[pred][s] || phi->args[p] < 0) {
+                continue;
+            }
+            int arg = phi->args[p];
+            if (sccp->state[arg] == LATTICE_BOTTOM) {
+                state = LATTICE_BOTTOM;
+            } else if (sccp->state[arg] == LATTICE_CONST) {
+                if (state == LATTICE_TOP) {
+                    state = LATTICE_CONST;
+                    value = sccp->value[arg];
+                } else if (!sameConstValue(&value, &sccp->value[arg])) {
+                    state = LATTICE_BOTTOM;
+                }
+            }
+        }
+        lowerLattice(sccp, phi->dest, state, &value);
+    }
+}
+
+void visitQuad(SCCPState* sccp, int i) {
+    SSAForm* ssa = sccp->ssa;
+    CFG* cfg = ssa->cfg;
+    Quad* quad = &quadList[i];
+    int offset = i - cfg->start;
+    int b = cfg->blockOf[offset];
+
+    if (isCondJumpQuad(quad) && i == cfg->blocks[b].end - 1) {
+        ConstValue cond;
+        int state = operandLattice(sccp, quad->arg1, ssa->uses[offset][SSA_ARG1], &cond);
+        if (state == LATTICE_TOP) {
+            return;
+        }
+        if (state == LATTICE_BOTTOM || cfg->blocks[b].succCount == 1) {
+            for (int s = 0; s < cfg->blocks[b].succCount; s++) {
+                markEdgeExecutable(sccp, b, s);
+            }
+        } else {
+            // succs[0] is the jump target, taken when the condition is false
+            markEdgeExecutable(sccp, b, constTruth(&cond) ? 1 : 0);
+        }
+        return;
+    }
+
+    int def = ssa->defs[offset];
+    if (def < 0) {
+        return;
+    }
+    if (!isValueQuad(quad)) {
+        lowerLattice(sccp, def, LATTICE_BOTTOM, NULL);
+        return;
+    }
+
+    ConstValue a, b2, result;
+    int stateA = operandLattice(sccp, quad->arg1, ssa->uses[offset][SSA_ARG1], &a);
+    int stateB = strcmp(quad->arg2, "_") == 0 ? LATTICE_CONST
+                 : operandLattice(sccp, quad->arg2, ssa->uses[offset][SSA_ARG2], &b2);
+    if (stateA == LATTICE_BOTTOM || stateB == LATTICE_BOTTOM) {
+        lowerLattice(sccp, def, LATTICE_BOTTOM, NULL);
+        return;
+    }
+    if (stateA == LATTICE_TOP || stateB == LATTICE_TOP) {
+        return;
+    }
+
+    bool folded = foldOperation(quad->op, &a, strcmp(quad->arg2, "_") == 0 ? NULL : &b2, &result);
+    if (folded && !isTempName(quad->result) && strcmp(quad->result, "@ret") != 0) {
+        folded = coerceConstValue(&result, getSymbolTypeByName(quad->result));
+    }
+    lowerLattice(sccp, def, folded ? LATTICE_CONST : LATTICE_BOTTOM, &result);
+    if (folded) {
+        freeConstValue(&result);
+    }
+}
+
+void visitBlock(SCCPState* sccp, int b) {
+    CFG* cfg = sccp->ssa->cfg;
+    visitPhis(sccp, b);
+    if (sccp->visited[b]) {
+        return;
+    }
+    sccp->visited[b] = true;
+
+    for (int i = cfg->blocks[b].start; i < cfg->blocks[b].end; i++) {
+        visitQuad(sccp, i);
+    }
+    if (!isCondJumpQuad(&quadList[cfg->blocks[b].end - 1])) {
+        for (int s = 0; s < cfg->blocks[b].succCount; s++) {
+            markEdgeExecutable(sccp, b, s);
+        }
+    }
+}
+
+void solveSCCP(SCCPState* sccp) {
+    CFG* cfg = sccp->ssa->cfg;
+    visitBlock(sccp, 0);
+    while (sccp->flowCount > 0 || sccp->ssaCount > 0) {
+        while (sccp->flowCount > 0) {
+            sccp->flowCount--;
+            visitBlock(sccp, sccp->flowTo[sccp->flowCount]);
+        }
+        while (sccp->ssaCount > 0) {
+            int version = sccp->ssaList[--sccp->ssaCount];
+            for (int u = 0; u < sccp->useCount[version]; u++) {
+                int site = sccp->useSites[version][u];
+                if (site < 0) {
+                    if (sccp->visited[~site]) {
+                        visitPhis(sccp, ~site);
+                    }
+                } else if (sccp->visited[cfg->blockOf[site - cfg->start]]) {
+                    visitQuad(sccp, site);
+                }
+            }
+        }
+    }
+}
+
+void rewriteSCCP(SCCPState* sccp) {
+    SSAForm* ssa = sccp->ssa;
+    CFG* cfg = ssa->cfg;
+
+    for (int b = 0; b < cfg->blockCount; b++) {
+        if (!sccp->visited[b]) {
+            for (int i = cfg->blocks[b].start; i < cfg->blocks[b].end; i++) {
+                if (!isQuadDeleted(i)) {
+                    deleteQuad(i);
+                    sccpRemovedQuads++;
+                }
+            }
+            continue;
+        }
+
+        for (int i = cfg->blocks[b].start; i < cfg->blocks[b].end; i++) {
+            Quad* quad = &quadList[i];
+            int offset = i - cfg->start;
+
+            if (isCondJumpQuad(quad) && i == cfg->blocks[b].end - 1) {
+                int cond = ssa->uses[offset][SSA_ARG1];
+                ConstValue value;
+                bool known = parseConstValue(quad->arg1, &value);
+                if (!known && cond >= 0 && sccp->state[cond] == LATTICE_CONST) {
+                    value = sccp->value[cond];
+                    known = true;
+                }
+                if (!known) {
+                    continue;
+                }
+                sccpFoldedBranches++;
+                if (constTruth(&value) || cfg->blocks[b].succCount == 1) {
+                    deleteQuad(i);
+                } else {
+                    char* label = strdup(quad->result);
+                    setQuad(i, "jmp", NULL, NULL, label);
+                    free(label);
+                }
+                continue;
+            }
+
+            int def = ssa->defs[offset];
+            if (isValueQuad(quad) && def >= 0 && sccp->state[def] == LATTICE_CONST) {
+                bool alreadyConst = strcmp(quad->op, "assign") == 0 && isConstOperand(quad->arg1);
+                if (!alreadyConst) {
+                    char* constant = formatConstValue(&sccp->value[def]);
+                    char* result = strdup(quad->result);
+                    setQuad(i, "assign", constant, NULL, result);
+                    free(constant);
+                    free(result);
+                    sccpPropagated++;
+                }
+                continue;
+            }
+
+            for (int slot = 0; slot < 3; slot++) {
+                int version = ssa->uses[offset][slot];
+                if (version < 0 || sccp->state[version] != LATTICE_CONST) {
+                    continue;
+                }
+                char* constant = formatConstValue(&sccp->value[version]);
+                char* fields[3] = {strdup(quad->arg1), strdup(quad->arg2), strdup(quad->result)};
+                free(fields[slot]);
+                fields[slot] = constant;
+                char* op = strdup(quad->op);
+                setQuad(i, op, fields[0], fields[1], fields[2]);
+                free(op);
+                free(fields[0]);
+                free(fields[1]);
+                free(fields[2]);
+                sccpPropagated++;
+            }
+        }
+    }
+}
+
+// temps are written once and never outlive their function, drop the unread ones
+void removeDeadTemps(int start, int end) {
+    NameTable readCount;
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        initNameTable(&readCount);
+        for (int i = start; i < end; i++) {
+            char* uses[3];
+            int count = quadUses(&quadList[i], uses);
+            for (int u = 0; u < count; u++) {
+                putName(&readCount, uses[u], findName(&readCount, uses[u]) + 2);
+            }
+        }
+        for (int i = start; i < end; i++) {
+            Quad* quad = &quadList[i];
+            if (isValueQuad(quad) && isTempName(quad->result) && findName(&readCount, quad->result) == -1) {
+                deleteQuad(i);
+                sccpRemovedQuads++;
+                changed = true;
+            }
+        }
+        freeNameTable(&readCount);
+    }
+}
+
+// folded branches leave jumps to the very next label and labels nobody jumps to
+void removeDeadJumps(int start, int end) {
+    for (int i = start; i < end; i++) {
+        if (isQuadDeleted(i) || !isJumpQuad(&quadList[i])) {
+            continue;
+        }
+        for (int next = i + 1; next < end; next++) {
+            if (isQuadDeleted(next)) {
+                continue;
+            }
+            if (!isLabelQuad(&quadList[next])) {
+                break;
+            }
+            if (strcmp(quadList[next].result, quadList[i].result) == 0) {
+                deleteQuad(i);
+                sccpRemovedQuads++;
+                break;
+            }
+        }
+    }
+
+    NameTable targets;
+    initNameTable(&targets);
+    for (int i = start; i < end; i++) {
+        if (!isQuadDeleted(i) && (isJumpQuad(&quadList[i]) || isCondJumpQuad(&quadList[i])
+                                  || isTableJumpQuad(&quadList[i]))) {
+            putName(&targets, quadList[i].result, i);
+        }
+    }
+    for (int i = start; i < end; i++) {
+        if (!isQuadDeleted(i) && isLabelQuad(&quadList[i]) && findName(&targets, quadList[i].result) == -1) {
+            deleteQuad(i);
+            sccpRemovedQuads++;
+        }
+    }
+    freeNameTable(&targets);
+}
+
+void propagateConstants(int start, int end) {
+    CFG* cfg = buildCFG(start, end);
+    if (!cfg->valid) {
+        printf("SCCP: skipping quads %d..%d, unresolved jumps\n", start, end - 1);
+        freeCFG(cfg);
+        return;
+    }
+
+    SSAForm* ssa = buildSSA(cfg);
+    SCCPState sccp;
+    memset(&sccp, 0, sizeof(SCCPState));
+    sccp.ssa = ssa;
+    sccp.state = (int*)calloc(ssa->versionCount, sizeof(int));
+    sccp.value = (ConstValue*)calloc(ssa->versionCount, sizeof(ConstValue));
+    sccp.useSites = (int**)calloc(ssa->versionCount, sizeof(int*));
+    sccp.useCount = (int*)calloc(ssa->versionCount, sizeof(int));
+    sccp.visited = (bool*)calloc(cfg->blockCount, sizeof(bool));
+    sccp.edgeExecutable = (bool**)malloc(cfg->blockCount * sizeof(bool*));
+    for (int b = 0; b < cfg->blockCount; b++) {
+        sccp.edgeExecutable[b] = (bool*)calloc(cfg->blocks[b].succCount + 1, sizeof(bool));
+    }
+
+    // values coming into the region are unknown
+    for (int v = 0; v < ssa->varCount; v++) {
+        sccp.state[v] = LATTICE_BOTTOM;
+    }
+
+    for (int i = start; i < end; i++) {
+        for (int slot = 0; slot < 3; slot++) {
+            addUseSite(&sccp, ssa->uses[i - start][slot], i);
+        }
+    }
+    for (int b = 0; b < cfg->blockCount; b++) {
+        for (Phi* phi = ssa->phis[b]; phi != NULL; phi = phi->next) {
+            for (int p = 0; p < cfg->blocks[b].predCount; p++) {
+                addUseSite(&sccp, phi->args[p], ~b);
+            }
+        }
+    }
+
+    solveSCCP(&sccp);
+    rewriteSCCP(&sccp);
+    removeDeadTemps(start, end);
+    removeDeadJumps(start, end);
+
+    for (int v = 0; v < ssa->versionCount; v++) {
+        if (sccp.state[v] == LATTICE_CONST) {
+            freeConstValue(&sccp.value[v]);
+        }
+        free(sccp.useSites[v]);
+    }
+    for (int b = 0; b < cfg->blockCount; b++) {
+        free(sccp.edgeExecutable[b]);
+    }
+    free(sccp.state);
+    free(sccp.value);
+    free(sccp.useSites);
+    free(sccp.useCount);
+    free(sccp.visited);
+    free(sccp.edgeExecutable);
+    free(sccp.flowFrom);
+    free(sccp.flowTo);
+    free(sccp.ssaList);
+    freeSSA(ssa);
+    freeCFG(cfg);
+}
+
+#endif
@@ -0,0 +1,388 @@
+#ifndef __SSA_C__
+#define __SSA_C__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "cfg.c"
+
+/*
+    SSA form of a region, kept on the side instead of renaming the quads.
+    Every local, temp and @ret gets versions; globals are left out since any
+    call can change them.
+    Versions 0 .. varCount-1 are the values the variables have on entry.
+*/
+
+#define SSA_ARG1 0
+#define SSA_ARG2 1
+#define SSA_RESULT 2
+
+typedef struct Phi {
+    int var;
+    int dest;
+    int* args; // one version per predecessor of the block, -1 for unreachable ones
+    struct Phi* next;
+} Phi;
+
+typedef struct SSAForm {
+    CFG* cfg;
+    NameTable vars;
+    char** varNames;
+    int varCount;
+
+    int (*uses)[3]; // quad index - start -> version read from arg1, arg2, result
+    int* defs; // quad index - start -> version written, -1 if none
+    Phi** phis; // phis at the top of every block
+
+    int versionCount;
+    int versionCapacity;
+    int* versionVar;
+    int* versionQuad; // defining quad, -1 for phis and entry values
+    Phi** versionPhi;
+} SSAForm;
+
+// which quad fields hold values read by the quad
+void quadUseSlots(Quad* quad, bool slots[3]) {
+    slots[SSA_ARG1] = slots[SSA_ARG2] = slots[SSA_RESULT] = false;
+    if (isValueQuad(quad)) {
+        slots[SSA_ARG1] = slots[SSA_ARG2] = true;
+    } else if (isCondJumpQuad(quad) || strcmp(quad->op, "print") == 0 || strcmp(quad->op, "jtab") == 0
+               || strcmp(quad->op, "push") == 0 || strcmp(quad->op, "push_const") == 0) {
+        slots[SSA_ARG1] = true;
+    } else if (strcmp(quad->op, "return") == 0) {
+        slots[SSA_RESULT] = true;
+    }
+}
+
+char* quadSlot(Quad* quad, int slot) {
+    if (slot == SSA_ARG1) return quad->arg1;
+    if (slot == SSA_ARG2) return quad->arg2;
+    return quad->result;
+}
+
+int ssaVar(SSAForm* ssa, char* name) {
+    if (!isVarOperand(name)) {
+        return -1;
+    }
+    return findName(&ssa->vars, name);
+}
+
+int newVersion(SSAForm* ssa, int var, int quad, Phi* phi) {
+    if (ssa->versionCount == ssa->versionCapacity) {
+        ssa->versionCapacity = ssa->versionCapacity ? ssa->versionCapacity * 2 : 64;
+        ssa->versionVar = (int*)realloc(ssa->versionVar, ssa->versionCapacity * sizeof(int));
+        ssa->versionQuad = (int*)realloc(ssa->versionQuad, ssa->versionCapacity * sizeof(int));
+        ssa->versionPhi = (Phi**)realloc(ssa->versionPhi, ssa->versionCapacity * sizeof(Phi*));
+    }
+    ssa->versionVar[ssa->versionCount] = var;
+    ssa->versionQuad[ssa->versionCount] = quad;
+    ssa->versionPhi[ssa->versionCount] = phi;
+    return ssa->versionCount++;
+}
+
+void collectSSAVars(SSAForm* ssa) {
+    CFG* cfg = ssa->cfg;
+    initNameTable(&ssa->vars);
+    ssa->varNames = NULL;
+    ssa->varCount = 0;
+
+    for (int i = cfg->start; i < cfg->end; i++) {
+        char* names[3];
+        int count = quadUses(&quadList[i], names);
+        char* def = quadDef(&quadList[i]);
+        if (def != NULL) {
+            names[count++] = def;
+        }
+        for (int n = 0; n < count; n++) {
+            if (isGlobalSymbol(names[n]) || findName(&ssa->vars, names[n]) != -1) {
+                continue;
+            }
+            putName(&ssa->vars, names[n], ssa->varCount);
+            ssa->varNames = (char**)realloc(ssa->varNames, (ssa->varCount + 1) * sizeof(char*));
+            ssa->varNames[ssa->varCount++] = names[n];
+        }
+    }
+}
+
+void insertPhis(SSAForm* ssa) {
+    CFG* cfg = ssa->cfg;
+    int blockCount = cfg->blockCount;
+
+    // dominance frontiers
+    int** frontier = (int**)calloc(blockCount, sizeof(int*));
+    int* frontierCount = (int*)calloc(blockCount, sizeof(int));
+    for (int i = 0; i < cfg->orderCount; i++) {
+        int b = cfg->order[i];
+        if (cfg->blocks[b].predCount < 2) {
+            continue;
+        }
+        for (int p = 0; p < cfg->blocks[b].predCount; p++) {
+            int runner = cfg->blocks[b].preds[p];
+            if (runner != 0 && cfg->blocks[runner].idom == -1) {
+                continue; // unreachable predecessor
+            }
+            while (runner != -1 && runner != cfg->blocks[b].idom) {
+                bool present = false;
+                for (int f = 0; f < frontierCount[runner]; f++) {
+                    present = present || frontier[runner][f] == b;
+                }
+                if (!present) {
+                    frontier[runner] = (int*)realloc(frontier[runner], (frontierCount[runner] + 1) * sizeof(int));
+                    frontier[runner][frontierCount[runner]++] = b;
+                }
+                runner = cfg->blocks[runner].idom;
+            }
+        }
+    }
+
+    // only variables live across blocks need phis (semi-pruned form)
+    bool* crossesBlocks = (bool*)calloc(ssa->varCount, sizeof(bool));
+    bool** definedIn = (bool**)malloc(ssa->varCount * sizeof(bool*));
+    for (int v = 0; v < ssa->varCount; v++) {
+        definedIn[v] = (bool*)calloc(blockCount, sizeof(bool));
+    }
+    bool* definedHere = (bool*)calloc(ssa->varCount, sizeof(bool));
+    for (int b = 0; b < blockCount; b++) {
+        memset(definedHere, 0, ssa->varCount * sizeof(bool));
+        for (int i = cfg->blocks[b].start; i < cfg->blocks[b].end; i++) {
+            char* uses[3];
+            int count = quadUses(&quadList[i], uses);
+            for (int u = 0; u < count; u++) {
+                int v = ssaVar(ssa, uses[u]);
+                if (v != -1 && !definedHere[v]) {
+                    crossesBlocks[v] = true;
+                }
+            }
+            char* def = quadDef(&quadList[i]);
+            int v = def ? ssaVar(ssa, def) : -1;
+            if (v != -1) {
+                definedHere[v] = true;
+                definedIn[v][b] = true;
+            }
+        }
+    }
+
+    int* worklist = (int*)malloc(blockCount * sizeof(int));
+    bool* hasPhi = (bool*)malloc(blockCount * sizeof(bool));
+    bool* queued = (bool*)malloc(blockCount * sizeof(bool));
+    for (int v = 0; v < ssa->varCount; v++) {
+        if (!crossesBlocks[v]) {
+            continue;
+        }
+        int top = 0;
+        memset(hasPhi, 0, blockCount * sizeof(bool));
+        memset(queued, 0, blockCount * sizeof(bool));
+        for (int b = 0; b < blockCount; b++) {
+            if (definedIn[v][b]) {
+                worklist[top++] = b;
+                queued[b] = true;
+            }
+        }
+        while (top > 0) {
+            int d = worklist[--top];
+            for (int f = 0; f < frontierCount[d]; f++) {
+                int y = frontier[d][f];
+                if (hasPhi[y]) {
+                    continue;
+                }
+                hasPhi[y] = true;
+                Phi* phi = (Phi*)calloc(1, sizeof(Phi));
+                phi->var = v;
+                phi->dest = -1;
+                phi->args = (int*)malloc(cfg->blocks[y].predCount * sizeof(int));
+                for (int p = 0; p < cfg->blocks[y].predCount; p++) {
+                    phi->args[p] = -1;
+                }
+                phi->next = ssa->phis[y];
+                ssa->phis[y] = phi;
+                if (!queued[y]) {
+                    queued[y] = true;
+                    worklist[top++] = y;
+                }
+            }
+        }
+    }
+
+    for (int b = 0; b < blockCount; b++) {
+        free(frontier[b]);
+    }
+    for (int v = 0; v < ssa->varCount; v++) {
+        free(definedIn[v]);
+    }
+    free(frontier);
+    free(frontierCount);
+    free(crossesBlocks);
+    free(definedIn);
+    free(definedHere);
+    free(worklist);
+    free(hasPhi);
+    free(queued);
+}
+
+void renameSSAVars(SSAForm* ssa) {
+    CFG* cfg = ssa->cfg;
+    int blockCount = cfg->blockCount;
+
+    // dominator tree children
+    int** children = (int**)calloc(blockCount, sizeof(int*));
+    int* childCount = (int*)calloc(blockCount, sizeof(int));
+    for (int i = 0; i < cfg->orderCount; i++) {
+        int b = cfg->order[i];
+        int parent = cfg->blocks[b].idom;
+        if (parent == -1) {
+            continue;
+        }
+        children[parent] = (int*)realloc(children[parent], (childCount[parent] + 1) * sizeof(int));
+        children[parent][childCount[parent]++] = b;
+    }
+
+    // one version stack per variable, entry values at the bottom
+    int** stacks = (int**)malloc(ssa->varCount * sizeof(int*));
+    int* stackSize = (int*)malloc(ssa->varCount * sizeof(int));
+    int* stackCapacity = (int*)malloc(ssa->varCount * sizeof(int));
+    for (int v = 0; v < ssa->varCount; v++) {
+        stackCapacity[v] = 8;
+        stacks[v] = (int*)malloc(stackCapacity[v] * sizeof(int));
+        stacks[v][0] = v;
+        stackSize[v] = 1;
+    }
+
+    // pushed variables, undone when the walk leaves the block
+    int* pushLog = NULL;
+    int pushCount = 0;
+    int pushCapacity = 0;
+
+    // walk stack: block, or ~block once its children are done
+    int* walk = (int*)malloc((2 * blockCount + 1) * sizeof(int));
+    int* logMark = (int*)malloc(blockCount * sizeof(int));
+    int top = 0;
+    walk[top++] = 0;
+
+    while (top > 0) {
+        int item = walk[--top];
+        if (item < 0) {
+            int b = ~item;
+            while (pushCount > logMark[b]) {
+                stackSize[pushLog[--pushCount]]--;
+            }
+            continue;
+        }
+
+        int b = item;
+        logMark[b] = pushCount;
+
+        #define PUSH_VERSION(var, version) do { \
+            if (stackSize[var] == stackCapacity[var]) { \
+                stackCapacity[var] *= 2; \
+                stacks[var] = (int*)realloc(stacks[var], stackCapacity[var] * sizeof(int)); \
+            } \
+            stacks[var][stackSize[var]++] = version; \
+            if (pushCount == pushCapacity) { \
+                pushCapacity = pushCapacity ? pushCapacity * 2 : 64; \
+                pushLog = (int*)realloc(pushLog, pushCapacity * sizeof(int)); \
+            } \
+            pushLog[pushCount++] = var; \
+        } while (0)
+
+        for (Phi* phi = ssa->phis[b]; phi != NULL; phi = phi->next) {
+            phi->dest = newVersion(ssa, phi->var, -1, phi);
+            PUSH_VERSION(phi->var, phi->dest);
+        }
+
+        for (int i = cfg->blocks[b].start; i < cfg->blocks[b].end; i++) {
+            Quad* quad = &quadList[i];
+            bool slots[3];
+            quadUseSlots(quad, slots);
+            for (int slot = 0; slot < 3; slot++) {
+                int v = slots[slot] ? ssaVar(ssa, quadSlot(quad, slot)) : -1;
+                ssa->uses[i - cfg->start][slot] = v == -1 ? -1 : stacks[v][stackSize[v] - 1];
+            }
+
+            char* def = quadDef(quad);
+            int v = def ? ssaVar(ssa, def) : -1;
+            if (v != -1) {
+                int version = newVersion(ssa, v, i, NULL);
+                ssa->defs[i - cfg->start] = version;
+                PUSH_VERSION(v, version);
+            }
+        }
+        #undef PUSH_VERSION
+
+        for (int s = 0; s < cfg->blocks[b].succCount; s++) {
+            int succ = cfg->blocks[b].succs[s];
+            int predIndex = 0;
+            while (cfg->blocks[succ].preds[predIndex] != b) {
+                predIndex++;
+            }
+            for (Phi* phi = ssa->phis[succ]; phi != NULL; phi = phi->next) {
+                phi->args[predIndex] = stacks[phi->var][stackSize[phi->var] - 1];
+            }
+        }
+
+        walk[top++] = ~b;
+        for (int c = 0; c < childCount[b]; c++) {
+            walk[top++] = children[b][c];
+        }
+    }
+
+    for (int b = 0; b < blockCount; b++) {
+        free(children[b]);
+    }
+    for (int v = 0; v < ssa->varCount; v++) {
+        free(stacks[v]);
+    }
+    free(children);
+    free(childCount);
+    free(stacks);
+    free(stackSize);
+    free(stackCapacity);
+    free(pushLog);
+    free(walk);
+    free(logMark);
+}
+
+SSAForm* buildSSA(CFG* cfg) {
+    SSAForm* ssa = (SSAForm*)calloc(1, sizeof(SSAForm));
+    ssa->cfg = cfg;
+    int size = cfg->end - cfg->start;
+    ssa->uses = malloc(size * sizeof(*ssa->uses));
+    ssa->defs = (int*)malloc(size * sizeof(int));
+    for (int i = 0; i < size; i++) {
+        ssa->uses[i][SSA_ARG1] = ssa->uses[i][SSA_ARG2] = ssa->uses[i][SSA_RESULT] = -1;
+        ssa->defs[i] = -1;
+    }
+    ssa->phis = (Phi**)calloc(cfg->blockCount, sizeof(Phi*));
+
+    collectSSAVars(ssa);
+    for (int v = 0; v < ssa->varCount; v++) {
+        newVersion(ssa, v, -1, NULL);
+    }
+    insertPhis(ssa);
+    renameSSAVars(ssa);
+    return ssa;
+}
+
+void freeSSA(SSAForm* ssa) {
+    for (int b = 0; b < ssa->cfg->blockCount; b++) {
+        Phi* phi = ssa->phis[b];
+        while (phi != NULL) {
+            Phi* next = phi->next;
+            free(phi->args);
+            free(phi);
+            phi = next;
+        }
+    }
+    freeNameTable(&ssa->vars);
+    free(ssa->varNames);
+    free(ssa->uses);
+    free(ssa->defs);
+    free(ssa->phis);
+    free(ssa->versionVar);
+    free(ssa->versionQuad);
+    free(ssa->versionPhi);
+    free(ssa);
+}
+
+#endif
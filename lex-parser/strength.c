@@ -0,0 +1,386 @@
+#ifndef __STRENGTH_C__
+#define __STRENGTH_C__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "cfg.c"
+#include "folding.c"
+#include "licm.c"
+
+/*
+    Strength reduction for int arithmetic.
+    mul/div/mod by a power of two become shl/shr/bit_and (div and mod only
+    when the dividend can't be negative), and multiplications of a basic
+    induction variable i (only changed by i = i +- k inside the loop) by a
+    loop constant c are replaced by a new variable kept equal to i * c with
+    an add next to every update of i.
+*/
+
+#define TYPE_UNKNOWN 0
+#define TYPE_INT 1
+#define TYPE_FLOAT 2
+#define TYPE_BOOL 3
+#define TYPE_CHAR 4
+#define TYPE_STRING 5
+
+int strengthReducedOps = 0;
+int strengthReducedInductions = 0;
+
+int typeCode(char* dataType) {
+    if (dataType == NULL) return TYPE_UNKNOWN;
+    if (strcmp(dataType, "int") == 0) return TYPE_INT;
+    if (strcmp(dataType, "float") == 0) return TYPE_FLOAT;
+    if (strcmp(dataType, "bool") == 0) return TYPE_BOOL;
+    if (strcmp(dataType, "char") == 0) return TYPE_CHAR;
+    if (strcmp(dataType, "string") == 0) return TYPE_STRING;
+    return TYPE_UNKNOWN;
+}
+
+// type of an operand, temps take the type of the quad defining them
+int operandType(NameTable* tempTypes, char* operand) {
+    ConstValue value;
+    if (parseConstValue(operand, &value)) {
+        freeConstValue(&value);
+        switch (value.kind) {
+            case 'i': return TYPE_INT;
+            case 'f': return TYPE_FLOAT;
+            case 'b': return TYPE_BOOL;
+            case 'c': return TYPE_CHAR;
+            default: return TYPE_STRING;
+        }
+    }
+    if (isTempName(operand)) {
+        int type = findName(tempTypes, operand);
+        return type == -1 ? TYPE_UNKNOWN : type;
+    }
+    if (strcmp(operand, "@ret") == 0) {
+        return TYPE_UNKNOWN;
+    }
+    return typeCode(getSymbolTypeByName(operand));
+}
+
+int resultType(NameTable* tempTypes, Quad* quad) {
+    const char* boolOps[] = {"lt", "gt", "ge", "le", "eq", "ne", "and", "or", "not", NULL};
+    for (int i = 0; boolOps[i] != NULL; i++) {
+        if (strcmp(quad->op, boolOps[i]) == 0) {
+            return TYPE_BOOL;
+        }
+    }
+    int a = operandType(tempTypes, quad->arg1);
+    if (strcmp(quad->arg2, "_") == 0) {
+        return a;
+    }
+    int b = operandType(tempTypes, quad->arg2);
+    return a == b ? a : TYPE_UNKNOWN;
+}
+
+void collectTempTypes(int start, int end, NameTable* tempTypes) {
+    initNameTable(tempTypes);
+    for (int i = start; i < end; i++) {
+        Quad* quad = &quadList[i];
+        if (isValueQuad(quad) && isTempName(quad->result)) {
+            int previous = findName(tempTypes, quad->result);
+            int type = resultType(tempTypes, quad);
+            putName(tempTypes, quad->result, previous == -1 || previous == type ? type : TYPE_UNKNOWN);
+        }
+    }
+}
+
+// log2 of a positive int constant that is a power of two, -1 otherwise
+int powerOfTwo(char* operand) {
+    ConstValue value;
+    if (!parseConstValue(operand, &value) || value.kind != 'i') {
+        freeConstValue(&value);
+        return -1;
+    }
+    if (value.iValue <= 0 || (value.iValue & (value.iValue - 1)) != 0) {
+        return -1;
+    }
+    int shift = 0;
+    while ((1 << shift) != value.iValue) {
+        shift++;
+    }
+    return shift;
+}
+
+// positive int constant step of an update i = i + k / i = i - k, 0 when it isn't one
+int inductionStep(Quad* quad, char* var) {
+    ConstValue step;
+    int sign = 0;
+    if (strcmp(quad->op, "add") == 0 && strcmp(quad->arg1, var) == 0 && parseConstValue(quad->arg2, &step)) {
+        sign = 1;
+    } else if (strcmp(quad->op, "add") == 0 && strcmp(quad->arg2, var) == 0 && parseConstValue(quad->arg1, &step)) {
+        sign = 1;
+    } else if (strcmp(quad->op, "sub") == 0 && strcmp(quad->arg1, var) == 0 && parseConstValue(quad->arg2, &step)) {
+        sign = -1;
+    } else {
+        return 0;
+    }
+    freeConstValue(&step);
+    return step.kind == 'i' && step.iValue > 0 ? sign * step.iValue : 0;
+}
+
+// the update of var done by the def at index, directly or through the temp assigned to it
+int inductionUpdate(int start, int index, char* var) {
+    Quad* quad = &quadList[index];
+    if (strcmp(quad->op, "assign") != 0 || !isTempName(quad->arg1)) {
+        return inductionStep(quad, var);
+    }
+    for (int i = index - 1; i >= start; i--) {
+        if (isValueQuad(&quadList[i]) && strcmp(quadList[i].result, quad->arg1) == 0) {
+            return inductionStep(&quadList[i], var);
+        }
+        if (isLabelQuad(&quadList[i]) || endsBlock(&quadList[i])) {
+            break;
+        }
+    }
+    return 0;
+}
+
+// every write of the int var in the region keeps it >= 0 (a constant or an increment)
+bool isNonNegativeVar(int start, int end, char* var) {
+    if (!isVarOperand(var) || isGlobalSymbol(var) || typeCode(getSymbolTypeByName(var)) != TYPE_INT) {
+        return false;
+    }
+    for (int i = start; i < end; i++) {
+        char* def = quadDef(&quadList[i]);
+        if (def == NULL || strcmp(def, var) != 0) {
+            continue;
+        }
+        ConstValue value;
+        if (strcmp(quadList[i].op, "assign") == 0 && parseConstValue(quadList[i].arg1, &value)) {
+            freeConstValue(&value);
+            if (value.kind != 'i' || value.iValue < 0) {
+                return false;
+            }
+        } else if (inductionUpdate(start, i, var) <= 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool isNonNegativeOperand(int start, int end, char* operand) {
+    ConstValue value;
+    if (parseConstValue(operand, &value)) {
+        freeConstValue(&value);
+        return value.kind == 'i' && value.iValue >= 0;
+    }
+    return isNonNegativeVar(start, end, operand);
+}
+
+void reduceOperators(int start, int end) {
+    NameTable tempTypes;
+    collectTempTypes(start, end, &tempTypes);
+
+    for (int i = start; i < end; i++) {
+        Quad* quad = &quadList[i];
+        if (strcmp(quad->op, "mul") != 0 && strcmp(quad->op, "div") != 0 && strcmp(quad->op, "mod") != 0) {
+            continue;
+        }
+        if (operandType(&tempTypes, quad->arg1) != TYPE_INT || operandType(&tempTypes, quad->arg2) != TYPE_INT) {
+            continue;
+        }
+
+        char operand[64];
+        int shift = powerOfTwo(quad->arg2);
+        if (strcmp(quad->op, "mul") == 0) {
+            char* other = quad->arg1;
+            if (shift == -1) {
+                shift = powerOfTwo(quad->arg1);
+                other = quad->arg2;
+            }
+            if (shift <= 0) {
+                continue;
+            }
+            sprintf(operand, "%d", shift);
+            char* value = strdup(other);
+            char* result = strdup(quad->result);
+            setQuad(i, "shl", value, operand, result);
+            free(value);
+            free(result);
+        } else {
+            if (shift == -1 || !isNonNegativeOperand(start, end, quad->arg1)) {
+                continue;
+            }
+            bool isDiv = strcmp(quad->op, "div") == 0;
+            if (isDiv && shift == 0) {
+                continue;
+            }
+            sprintf(operand, "%d", isDiv ? shift : (1 << shift) - 1);
+            char* value = strdup(quad->arg1);
+            char* result = strdup(quad->result);
+            setQuad(i, isDiv ? "shr" : "bit_and", value, operand, result);
+            free(value);
+            free(result);
+        }
+        strengthReducedOps++;
+    }
+    freeNameTable(&tempTypes);
+}
+
+typedef struct Insertion {
+    int at;
+    char* op;
+    char* arg1;
+    char* arg2;
+    char* result;
+} Insertion;
+
+void addInsertion(Insertion* list, int* count, int at, char* op, char* arg1, char* arg2, char* result) {
+    list[*count].at = at;
+    list[*count].op = strdup(op);
+    list[*count].arg1 = strdup(arg1);
+    list[*count].arg2 = strdup(arg2);
+    list[*count].result = strdup(result);
+    (*count)++;
+}
+
+// rewrites one multiplication by an induction variable of the loop, returns how many quads were added
+int reduceLoopInduction(CFG* cfg, Loop* loop, NameTable* tempTypes) {
+    if (loopPreheader(cfg, loop) == -1) {
+        return 0;
+    }
+
+    LoopDefs defs;
+    collectLoopDefs(cfg, loop, &defs);
+    bool hasCall = hasLoopCall(cfg, loop);
+
+    int mulIndex = -1;
+    char* var = NULL;
+    char* factor = NULL;
+    for (int b = 0; b < cfg->blockCount && mulIndex == -1; b++) {
+        if (!loop->body[b]) {
+            continue;
+        }
+        for (int i = cfg->blocks[b].start; i < cfg->blocks[b].end && mulIndex == -1; i++) {
+            Quad* quad = &quadList[i];
+            if (strcmp(quad->op, "mul") != 0 || resultType(tempTypes, quad) != TYPE_INT) {
+                continue;
+            }
+            for (int side = 0; side < 2 && mulIndex == -1; side++) {
+                char* candidate = side == 0 ? quad->arg1 : quad->arg2;
+                char* other = side == 0 ? quad->arg2 : quad->arg1;
+                int slot = findName(&defs.slots, candidate);
+                if (slot == -1 || isGlobalSymbol(candidate) || isTempName(candidate)) {
+                    continue;
+                }
+                // the factor must not change inside the loop
+                if (isVarOperand(other) && (findName(&defs.slots, other) != -1 || (hasCall && isGlobalSymbol(other)))) {
+                    continue;
+                }
+                bool basic = true;
+                for (int j = cfg->start; j < cfg->end && basic; j++) {
+                    char* def = quadDef(&quadList[j]);
+                    if (def != NULL && strcmp(def, candidate) == 0 && loop->body[cfg->blockOf[j - cfg->start]]) {
+                        basic = inductionUpdate(cfg->start, j, candidate) != 0;
+                    }
+                }
+                if (basic) {
+                    mulIndex = i;
+                    var = candidate;
+                    factor = other;
+                }
+            }
+        }
+    }
+    if (mulIndex == -1) {
+        freeLoopDefs(&defs);
+        return 0;
+    }
+
+    // product = var * factor before the loop, product += step * factor after every update of var
+    char* product = newTemp();
+    Insertion* insertions = (Insertion*)malloc((2 * (cfg->end - cfg->start) + 2) * sizeof(Insertion));
+    int count = 0;
+    int header = cfg->blocks[loop->header].start;
+    addInsertion(insertions, &count, header, "mul", var, factor, product);
+
+    for (int j = cfg->start; j < cfg->end; j++) {
+        char* def = quadDef(&quadList[j]);
+        if (def == NULL || strcmp(def, var) != 0 || !loop->body[cfg->blockOf[j - cfg->start]]) {
+            continue;
+        }
+        int step = inductionUpdate(cfg->start, j, var);
+        char stepText[64];
+        char* increment = stepText;
+        ConstValue value;
+        if (parseConstValue(factor, &value)) {
+            value.iValue = (int)((unsigned int)value.iValue * (unsigned int)(step < 0 ? -step : step));
+            sprintf(stepText, "%d", value.iValue);
+        } else if (step == 1 || step == -1) {
+            increment = factor;
+        } else {
+            increment = newTemp();
+            sprintf(stepText, "%d", step < 0 ? -step : step);
+            addInsertion(insertions, &count, header, "mul", factor, stepText, increment);
+        }
+        addInsertion(insertions, &count, j + 1, step < 0 ? "sub" : "add", product, increment, product);
+        if (increment != stepText && increment != factor) {
+            free(increment);
+        }
+    }
+
+    char* result = strdup(quadList[mulIndex].result);
+    setQuad(mulIndex, "assign", product, NULL, result);
+    free(result);
+    free(product);
+
+    // stable sort by position, then insert back to front so the recorded positions stay valid
+    for (int n = 1; n < count; n++) {
+        Insertion insertion = insertions[n];
+        int m = n - 1;
+        while (m >= 0 && insertions[m].at > insertion.at) {
+            insertions[m + 1] = insertions[m];
+            m--;
+        }
+        insertions[m + 1] = insertion;
+    }
+    for (int n = count - 1; n >= 0; n--) {
+        insertQuad(insertions[n].at, insertions[n].op, insertions[n].arg1, insertions[n].arg2, insertions[n].result);
+        free(insertions[n].op);
+        free(insertions[n].arg1);
+        free(insertions[n].arg2);
+        free(insertions[n].result);
+    }
+    free(insertions);
+    freeLoopDefs(&defs);
+    strengthReducedInductions++;
+    return count;
+}
+
+// returns the new region end
+int reduceStrength(int start, int end) {
+    for (int round = 0; round < MAX_LICM_ROUNDS; round++) {
+        CFG* cfg = buildCFG(start, end);
+        if (!cfg->valid) {
+            freeCFG(cfg);
+            break;
+        }
+        Loop* loops;
+        int loopCount = findNaturalLoops(cfg, &loops);
+        NameTable tempTypes;
+        collectTempTypes(start, end, &tempTypes);
+
+        int added = 0;
+        for (int l = 0; l < loopCount && added == 0; l++) {
+            added = reduceLoopInduction(cfg, &loops[l], &tempTypes);
+        }
+
+        freeNameTable(&tempTypes);
+        freeLoops(loops, loopCount);
+        freeCFG(cfg);
+        if (added == 0) {
+            break;
+        }
+        end += added;
+    }
+
+    reduceOperators(start, end);
+    return end;
+}
+
+#endif
@@ -31,6 +31,9 @@ typedef struct Symbol {
     int* paramsIds;
     bool isParam;
     bool hasReturn;
+    int slot; // load / store index in the assembly, -1 for functions
+    bool isGlobalSlot; // in the global frame instead of the frame of its function
+    char* quadName; // name in the quads, <name>.<n> when an earlier declaration used the name
 } Symbol;
 
 Symbol symbolTable[MAX_SYMBOLS];
@@ -40,8 +43,11 @@ int snapshotCount = 0; // Tracks number of snapshots
 int blockIdx = -1; 
 int lastFunctionIdx = -1; 
 int insideFunctionIdx = -1;
+int globalSlotCount = 0;
+int frameSlotCount = 0; // slots used so far by the function being parsed
 char error_msg[256];
 static int g_snapshot_id_counter = 0;  // Only for snapshots
+int quadNameCounter = 0; // the .<n> of the quad names, the inliner numbers its copies after them
 
 typedef struct ArgList {
     char** types;
@@ -62,7 +68,8 @@ void updateSnapshot(Symbol* symbol) {
             strcmp(symbolTableSnapshot[i].name, symbol->name) == 0 &&
             symbolTableSnapshot[i].symbolLine == symbol->symbolLine &&
             strcmp(symbolTableSnapshot[i].dataType, symbol->dataType) == 0 &&
-            symbolTableSnapshot[i].scope == symbol->scope) {
+            symbolTableSnapshot[i].scope == symbol->scope &&
+            strcmp(symbolTableSnapshot[i].quadName, symbol->quadName) == 0) {
                 printf("name is %s",symbolTableSnapshot[i].name);
             // Exact match found - don't add duplicate
             return;
@@ -80,6 +87,7 @@ void updateSnapshot(Symbol* symbol) {
     symbolTableSnapshot[snapshotCount].name = strdup(symbol->name);
     symbolTableSnapshot[snapshotCount].type = strdup(symbol->type);
     symbolTableSnapshot[snapshotCount].dataType = strdup(symbol->dataType);
+    symbolTableSnapshot[snapshotCount].quadName = strdup(symbol->quadName);
     symbolTableSnapshot[snapshotCount].scope = symbol->scope;
     symbolTableSnapshot[snapshotCount].isInitialized = symbol->isInitialized;
     symbolTableSnapshot[snapshotCount].nodeValue = symbol->nodeValue;
@@ -159,6 +167,7 @@ void exitScope(int lineNumber) {
             free(symbolTable[i].name);
             free(symbolTable[i].type);
             free(symbolTable[i].dataType);
+            free(symbolTable[i].quadName);
             symbolTable[i].id = -1;
         }
     }
@@ -237,32 +246,103 @@ void initParams(int functionIdx) {
     }
 }
 
-int lookup(char *name) {
+// params stay in the table after their function for its calls, only the ones of the function being parsed are in scope
+bool isParamInScope(int id) {
+    if (insideFunctionIdx < 0) {
+        return false;
+    }
+    for (int p = 0; p < symbolTable[insideFunctionIdx].paramCount; p++) {
+        if (symbolTable[insideFunctionIdx].paramsIds[p] == id) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// the symbol the name refers to in the current scope, -1 when there is none
+int findSymbol(char *name) {
     int currentScope = blockIdx;
     while( currentScope >= 0) {
+        int found = -1;
         for (int i = 0; i < MAX_SYMBOLS; i++) {
-            int equalScope = currentScope;
-            if(symbolTable[i].id != -1 && (symbolTable[i].isParam || symbolTable[i].isForLoop)) {
-                equalScope += 1;
+            if (symbolTable[i].id == -1 || strcmp(symbolTable[i].name, name) != 0) {
+                continue;
             }
-
-            if (symbolTable[i].id != -1 && symbolTable[i].scope == equalScope && strcmp(symbolTable[i].name, name) == 0) {
-                printf("Found symbol: %s, id: %i\n", name, symbolTable[i].id);
-                return symbolTable[i].id;
+            if (symbolTable[i].isParam && !isParamInScope(i)) {
+                continue;
+            }
+            // params and for loop vars belong to the block after them, they shadow the names of this scope
+            if ((symbolTable[i].isParam || symbolTable[i].isForLoop) && symbolTable[i].scope == currentScope + 1) {
+                found = i;
+                break;
             }
+            if (!symbolTable[i].isParam && !symbolTable[i].isForLoop && symbolTable[i].scope == currentScope && found == -1) {
+                found = i;
+            }
+        }
+        if (found != -1) {
+            return symbolTable[found].id;
         }
         currentScope--;
     }
+    return -1;
+}
+
+int lookup(char *name) {
+    int id = findSymbol(name);
+    if (id != -1) {
+        printf("Found symbol: %s, id: %i\n", name, id);
+        return id;
+    }
     customError("Variable %s is not defined", name);
     exit(1);
 }
 
+// the name the quads use for the variable in the current scope
+char* quadNameOf(char *name) {
+    int id = findSymbol(name);
+    return id == -1 ? name : symbolTable[id].quadName;
+}
+
+// the live symbol with this quad name, -1 when there is none
+int lookupQuadName(char* quadName) {
+    for (int i = 0; i < MAX_SYMBOLS; i++) {
+        if (symbolTable[i].id != -1 && strcmp(symbolTable[i].quadName, quadName) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// shadowing declarations, locals named like a global and params of different functions get distinct quad names
+char* newQuadName(char *name) {
+    for (int i = 0; i < snapshotCount; i++) {
+        if (symbolTableSnapshot[i].id != -1 && strcmp(symbolTableSnapshot[i].type, "func") != 0 &&
+            strcmp(symbolTableSnapshot[i].name, name) == 0) {
+            char* quadName = (char*)malloc(strlen(name) + 16);
+            sprintf(quadName, "%s.%d", name, ++quadNameCounter);
+            return quadName;
+        }
+    }
+    return strdup(name);
+}
+
 void setVarUsed(char *name) {
     int idx = lookup(name);
     symbolTable[idx].isUsed = true;
     updateSnapshot(&symbolTable[idx]);
 }
 
+// every declaration gets a slot of its own, so shadowed names never share one
+int reserveSlot(bool* isGlobal) {
+    *isGlobal = insideFunctionIdx == -1;
+    return *isGlobal ? globalSlotCount++ : frameSlotCount++;
+}
+
+void assignSlot(int id) {
+    symbolTable[id].slot = reserveSlot(&symbolTable[id].isGlobalSlot);
+}
+
 char* getSymbolDataType(char *name) {
     int id = lookup(name);
     if (id < 0 || id >= MAX_SYMBOLS || symbolTable[id].id == -1) {
@@ -272,7 +352,8 @@ char* getSymbolDataType(char *name) {
     return symbolTable[id].dataType;
 }
 
-int insertSymbol(char *name, char* type, char* dataType, bool isInitialized, bool isParam, bool isForLoop, int lineNumber) {
+// a NULL quadName gives the declaration a quad name of its own
+int insertSymbol(char *name, char* type, char* dataType, bool isInitialized, bool isParam, bool isForLoop, char* quadName, int lineNumber) {
     printf("Adding symbol: %s, type: %s, dataType: %s, at line: %i\n", name, type, dataType, lineNumber);
 
     if (isSymbolInSameScope(name)) {
@@ -288,6 +369,11 @@ int insertSymbol(char *name, char* type, char* dataType, bool isInitialized, boo
             symbolTable[i].type = strdup(type);
             symbolTable[i].dataType = strdup(dataType);
             symbolTable[i].symbolLine = lineNumber;
+            if (strcmp(type, "func") == 0) {
+                symbolTable[i].quadName = strdup(name);
+            } else {
+                symbolTable[i].quadName = quadName != NULL ? strdup(quadName) : newQuadName(name);
+            }
 
             if(isParam || isForLoop) {
                 symbolTable[i].scope = blockIdx + 1;
@@ -307,16 +393,21 @@ int insertSymbol(char *name, char* type, char* dataType, bool isInitialized, boo
             symbolTable[i].isParam = isParam;
             symbolTable[i].isInitialized = isInitialized;
             symbolTable[i].paramCount = 0;
+            symbolTable[i].slot = -1;
+            symbolTable[i].isGlobalSlot = false;
             
             if (strcmp(type, "func") == 0) {
                 lastFunctionIdx = i;
                 insideFunctionIdx = i;
+                frameSlotCount = 0;
                 initParams(lastFunctionIdx);
                 if (strcmp(dataType, "void") == 0) {
                     symbolTable[i].hasReturn = true;
                 } else {
                     symbolTable[i].hasReturn = false;
                 }
+            } else if (!isForLoop) {
+                assignSlot(i);
             }
             updateSnapshot(&symbolTable[i]);            
             return i;
@@ -328,12 +419,12 @@ int insertSymbol(char *name, char* type, char* dataType, bool isInitialized, boo
 }
 
 void insertParam(char *name, char* type, char* dataType, bool isInitialized, Node* node, int lineNumber) {
-    int paramIdx = insertSymbol(name, type, dataType, isInitialized, true, false, lineNumber);
+    int paramIdx = insertSymbol(name, type, dataType, isInitialized, true, false, NULL, lineNumber);
     symbolTable[paramIdx].nodeValue = node;
 }
 
 void insertVarConst (char *name, char* type, char* dataType, bool isInitialized, int lineNumber) {
-     insertSymbol(name, type, dataType, isInitialized, false, false, lineNumber);
+     insertSymbol(name, type, dataType, isInitialized, false, false, NULL, lineNumber);
    
 }
 
@@ -344,12 +435,14 @@ void insertFunc(char *name, char* type, char* dataType, int lineNumber) {
             return;
         }
     }
-    insertSymbol(name, type, dataType, false, false, false, lineNumber);
+    insertSymbol(name, type, dataType, false, false, false, NULL, lineNumber);
     
 }
 
 void insertForLoopVar(char *name, char* type, char* dataType, int lineNumber) {
+    int outerIdx = -1;
     if(dataType == NULL){
+        outerIdx = lookup(name);
         dataType = getSymbolDataType(name);
         if(strcmp(dataType, "int") != 0){
             customError("For loop variable %s must be of type int", name);
@@ -357,7 +450,17 @@ void insertForLoopVar(char *name, char* type, char* dataType, int lineNumber) {
         }
     }
     
-    insertSymbol(name, type, dataType, true, false, true, lineNumber);
+    // for (i = 0; ...) keeps counting in the i declared outside the loop
+    int id = insertSymbol(name, type, dataType, true, false, true, outerIdx != -1 ? symbolTable[outerIdx].quadName : NULL, lineNumber);
+    if (id == -1) {
+        return;
+    }
+    if (outerIdx != -1) {
+        symbolTable[id].slot = symbolTable[outerIdx].slot;
+        symbolTable[id].isGlobalSlot = symbolTable[outerIdx].isGlobalSlot;
+    } else {
+        assignSlot(id);
+    }
 }
 
 void validateNotConst(char *name) {
@@ -488,12 +591,55 @@ void printParms(){
     }
     printf("End of parameters\n");
 }
+// true when the quad name is the one of a variable declared at global scope
+bool isGlobalSymbol(char* name) {
+    for (int i = 0; i < snapshotCount; i++) {
+        if (symbolTableSnapshot[i].id != -1 && symbolTableSnapshot[i].scope == 0 &&
+            strcmp(symbolTableSnapshot[i].type, "func") != 0 &&
+            strcmp(symbolTableSnapshot[i].quadName, name) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// data type of the variable with this quad name, NULL for temps, @ret and unknown names
+char* getSymbolTypeByName(char* name) {
+    for (int i = 0; i < snapshotCount; i++) {
+        if (symbolTableSnapshot[i].id != -1 && strcmp(symbolTableSnapshot[i].type, "func") != 0 &&
+            strcmp(symbolTableSnapshot[i].quadName, name) == 0) {
+            return symbolTableSnapshot[i].dataType;
+        }
+    }
+    // inlined copies of locals are named <quad name>.<copy>
+    char base[256];
+    snprintf(base, sizeof(base), "%s", name);
+    char* suffix = strrchr(base, '.');
+    if (suffix == NULL) {
+        return NULL;
+    }
+    *suffix = '\0';
+    return getSymbolTypeByName(base);
+}
+
+// declared return type of a function, NULL when there is no such function
+char* getFunctionReturnType(char* name) {
+    for (int i = 0; i < snapshotCount; i++) {
+        if (symbolTableSnapshot[i].id != -1 && strcmp(symbolTableSnapshot[i].type, "func") == 0 &&
+            strcmp(symbolTableSnapshot[i].name, name) == 0) {
+            return symbolTableSnapshot[i].dataType;
+        }
+    }
+    return NULL;
+}
+
 void cleanupSymbolTableSnapshot() {
     for (int i = 0; i < snapshotCount; i++) {
         if (symbolTableSnapshot[i].id != -1) {
             free(symbolTableSnapshot[i].name);
             free(symbolTableSnapshot[i].type);
             free(symbolTableSnapshot[i].dataType);
+            free(symbolTableSnapshot[i].quadName);
             if (symbolTableSnapshot[i].paramCount > 0) {
                 free(symbolTableSnapshot[i].paramsIds);
             }
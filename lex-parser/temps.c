@@ -0,0 +1,120 @@
+#ifndef __TEMPS_C__
+#define __TEMPS_C__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "cfg.c"
+#include "liveness.c"
+
+/*
+    Temp recycling. newTemp() never reuses a name, so after the passes
+    every region is renamed to its own 0t0, 0t1, ... where temps whose
+    live intervals don't overlap share a name. The number of names a
+    region ends up with is the most temps it has live at once, which is
+    what a backend has to reserve in the frame.
+    Runs last, the register allocator is better off with the short
+    intervals of the original temps.
+*/
+
+int recycledTempsBefore = 0;
+int recycledTempsAfter = 0;
+
+// gives every temp of the region a slot, returns how many slots were used
+int assignTempSlots(Liveness* live, int* slot) {
+    int* order = (int*)malloc((live->varCount + 1) * sizeof(int));
+    int count = 0;
+    for (int v = 0; v < live->varCount; v++) {
+        slot[v] = -1;
+        if (isTempName(live->varNames[v]) && live->intervalStart[v] != -1) {
+            order[count++] = v;
+        }
+    }
+    // by interval start, temps are mostly created in order already
+    for (int i = 1; i < count; i++) {
+        int v = order[i];
+        int j = i - 1;
+        while (j >= 0 && live->intervalStart[order[j]] > live->intervalStart[v]) {
+            order[j + 1] = order[j];
+            j--;
+        }
+        order[j + 1] = v;
+    }
+
+    // slotEnd[s]: where the temp holding slot s dies, a slot is free again after that
+    int* slotEnd = (int*)malloc((count + 1) * sizeof(int));
+    int slotCount = 0;
+    for (int n = 0; n < count; n++) {
+        int v = order[n];
+        int chosen = -1;
+        for (int s = 0; s < slotCount && chosen == -1; s++) {
+            if (slotEnd[s] < live->intervalStart[v]) {
+                chosen = s;
+            }
+        }
+        if (chosen == -1) {
+            chosen = slotCount++;
+        }
+        slot[v] = chosen;
+        slotEnd[chosen] = live->intervalEnd[v];
+    }
+
+    free(slotEnd);
+    free(order);
+    return slotCount;
+}
+
+void renameTempOperand(char** field, Liveness* live, int* slot) {
+    int v = liveVar(live, *field);
+    if (v == -1 || slot[v] == -1) {
+        return;
+    }
+    char name[16];
+    snprintf(name, sizeof(name), "0t%d", slot[v]);
+    free(*field);
+    *field = strdup(name);
+}
+
+void recycleTemps() {
+    int start = 0;
+    while (start < quadCount) {
+        int end = regionEnd(start);
+        CFG* cfg = buildCFG(start, end);
+        if (!cfg->valid) {
+            freeCFG(cfg);
+            start = end;
+            continue;
+        }
+
+        Liveness* live = computeLiveness(cfg);
+        int* slot = (int*)malloc((live->varCount + 1) * sizeof(int));
+        int slotCount = assignTempSlots(live, slot);
+        int tempCount = 0;
+        for (int v = 0; v < live->varCount; v++) {
+            tempCount += slot[v] != -1;
+        }
+
+        for (int i = start; i < end; i++) {
+            Quad* quad = &quadList[i];
+            renameTempOperand(&quad->arg1, live, slot);
+            renameTempOperand(&quad->arg2, live, slot);
+            renameTempOperand(&quad->result, live, slot);
+        }
+        if (tempCount > 0) {
+            printf("Temps: %s has at most %d of its %d temps live at once\n",
+                   quadList[start].function ? quadList[start].function : "global code", slotCount, tempCount);
+        }
+        recycledTempsBefore += tempCount;
+        recycledTempsAfter += slotCount;
+
+        free(slot);
+        freeLiveness(live);
+        freeCFG(cfg);
+        start = end;
+    }
+    printf("Temp recycling: %d temps -> %d temp slots\n", recycledTempsBefore, recycledTempsAfter);
+}
+
+#endif
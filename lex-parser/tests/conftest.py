@@ -1,6 +1,7 @@
 import pytest
 import subprocess
 import os
+import re
 
 # Directory paths
 INPUT_DIR = os.path.normpath("inputs")
@@ -53,6 +54,41 @@ def collect_test_cases():
     
     return test_cases
 
+def program_output(stdout):
+    """What the program printed when it ran, or all of stdout when it wasn't run."""
+    # the parser trace doesn't end its last line, so the marker can come after it
+    match = re.search(r"---- (?:run|interpret) ----\n(.*?)^---- end ----$", stdout, re.S | re.M)
+    return match.group(1).strip() if match else stdout.strip()
+
+def build_and_run(category):
+    """Build the x86.s or program.c just written with gcc and run it, returns its stdout."""
+    program = os.path.abspath("program")
+    if category == "x86":
+        command = ["gcc", "x86.s", "-o", program]
+    else:
+        command = ["gcc", "-O2", "program.c", "-o", program, "-lm"]
+    build = subprocess.run(command, text=True, capture_output=True)
+    assert build.returncode == 0, f"gcc failed on the {category} output:\n{build.stderr}"
+    run = subprocess.run([program], text=True, capture_output=True, timeout=5)
+    return run.stdout.strip()
+
+def expected_reports(input_file):
+    """The '# expect: <text>' comments of an input, lines its compilation has to report."""
+    with open(input_file, "r", encoding="utf-8") as f:
+        return [line.split(":", 1)[1].strip() for line in f if line.startswith("# expect:")]
+
+def register_form():
+    """The registers.txt written by -R."""
+    with open("registers.txt", "r", encoding="utf-8") as f:
+        return f.read()
+
+def folded_stacks():
+    """The lines of the profile.folded written by --profile, or None when it wasn't written."""
+    if not os.path.exists("profile.folded"):
+        return None
+    with open("profile.folded", "r", encoding="utf-8") as f:
+        return f.read().splitlines()
+
 @pytest.mark.parametrize(
     "input_file,expected_output_file,expected_exit_code",
     collect_test_cases()
@@ -72,9 +108,26 @@ def test_program(input_file, expected_output_file, expected_exit_code, executabl
 
     assert os.path.exists(executable_path), f"Executable {executable_path} not found"
 
+    # Inputs under optimizer/ are compiled with the optimizer passes and register allocation on and interpreted before and after the passes,
+    # inputs under vm/ are also run,
+    # inputs under interpreter/ are interpreted before and after the optimizer passes, inputs under x86/ also write x86.s,
+    # inputs under c/ also write program.c, inputs under bytecode/ are run from the assembly.bc written for them,
+    # inputs under fusion/ are run from an assembly.bc written with superinstructions, inputs under register/ are run on the quads,
+    # inputs under jit/ are run with their hot functions compiled to machine code, inputs under profile/ are run with the profiler on
+    category = os.path.basename(os.path.dirname(input_file))
+    categoryFlags = {"optimizer": ["-O", "-R", "--interpret"], "vm": ["--run"], "interpreter": ["-O", "--interpret"], "x86": ["--x86"], "c": ["--c"],
+                     "bytecode": ["--bytecode", "--run"], "fusion": ["--fuse", "--bytecode", "--run"],
+                     "register": ["-O", "--run", "--engine", "register"], "jit": ["--jit", "--run"],
+                     "profile": ["--profile", "--run"]}
+    flags = categoryFlags.get(category, [])
+
+    # profile.folded is checked after the run, one written for an earlier input must not pass for it
+    if category == "profile" and os.path.exists("profile.folded"):
+        os.remove("profile.folded")
+
     try:
         process = subprocess.run(
-            [executable_path, input_file],
+            [executable_path, *flags, input_file],
             text=True,
             capture_output=True,
             timeout=5,
@@ -96,9 +149,30 @@ def test_program(input_file, expected_output_file, expected_exit_code, executabl
         f"Stderr: {process.stderr}"
     )
 
+    # the passes an input is written for have to report their work, output alone passes when they do nothing
+    for report in expected_reports(input_file):
+        assert report in process.stdout, f"Expected '{report}' to be reported for {input_file}"
+
+    # every line of profile.folded is a call stack from the global code and the instructions run in it,
+    # a deep one has a (deeper) frame in place of the frames in its middle
+    if category == "profile" and expected_exit_code == 0:
+        stacks = folded_stacks()
+        assert stacks, f"--profile wrote no profile.folded for {input_file}"
+        for line in stacks:
+            assert re.fullmatch(r"\(global\)(;\w+)*(;\(deeper\);\w+)? \d+", line), f"Bad profile.folded line: {line}"
+        assert any(";" in line for line in stacks), f"profile.folded has no call stacks for {input_file}"
+
+    # return values live in rv in the register form, an inlined return writes it there too
+    if category == "optimizer" and expected_exit_code == 0:
+        assert "@ret" not in register_form(), f"registers.txt reads or writes @ret in memory for {input_file}"
+
+    # runtime outputs are checked on what the program printed, inputs under x86/ and c/ are built and run for it
     if check_output:
         if expected_exit_code == 0:
-            actual_output = process.stdout.strip()
+            if category in ("x86", "c"):
+                actual_output = build_and_run(category)
+            else:
+                actual_output = program_output(process.stdout)
             assert actual_output == expected_output, (
                 f"Output mismatch!\nInput: {input_file}\n"
                 f"Expected:\n{expected_output}\nGot:\n{actual_output}"
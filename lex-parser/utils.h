@@ -14,6 +14,9 @@ FileHandler quadFileHandler = {NULL, NULL};
 FileHandler assemblyFileHandler = {NULL, NULL};
 FileHandler warningFileHandler = {NULL, NULL};
 FileHandler syntaxErrorsFileHandler = {NULL, NULL};
+FileHandler registerFileHandler = {NULL, NULL}; // only opened with -R
+FileHandler x86FileHandler = {NULL, NULL}; // only opened with --x86
+FileHandler cFileHandler = {NULL, NULL}; // only opened with --c
 
 FILE* createFile(char* path) {
     FILE* file = fopen(path, "w");
@@ -51,6 +54,9 @@ void cleanUpFiles() {
     closeFile(&assemblyFileHandler);
     closeFile(&warningFileHandler);
     closeFile(&syntaxErrorsFileHandler);
+    closeFile(&registerFileHandler);
+    closeFile(&x86FileHandler);
+    closeFile(&cFileHandler);
 }
 
 void customError(char* format, ...) {
@@ -65,6 +71,82 @@ void customError(char* format, ...) {
 }
 
 
+/*
+    Open addressing map from names to indexes, used by the optimizer passes
+    where linear scans over thousands of temps get too slow
+*/
+typedef struct NameTable {
+    char** keys;
+    int* values;
+    int capacity;
+    int count;
+} NameTable;
+
+unsigned int hashName(char* name) {
+    unsigned int hash = 5381;
+    while (*name) {
+        hash = hash * 33 + (unsigned char)*name++;
+    }
+    return hash;
+}
+
+void initNameTable(NameTable* table) {
+    table->capacity = 64;
+    table->count = 0;
+    table->keys = (char**)calloc(table->capacity, sizeof(char*));
+    table->values = (int*)malloc(table->capacity * sizeof(int));
+}
+
+int findName(NameTable* table, char* name) {
+    unsigned int i = hashName(name) & (table->capacity - 1);
+    while (table->keys[i] != NULL) {
+        if (strcmp(table->keys[i], name) == 0) {
+            return table->values[i];
+        }
+        i = (i + 1) & (table->capacity - 1);
+    }
+    return -1;
+}
+
+void putName(NameTable* table, char* name, int value) {
+    if ((table->count + 1) * 2 > table->capacity) {
+        NameTable bigger;
+        bigger.capacity = table->capacity * 2;
+        bigger.count = 0;
+        bigger.keys = (char**)calloc(bigger.capacity, sizeof(char*));
+        bigger.values = (int*)malloc(bigger.capacity * sizeof(int));
+        for (int i = 0; i < table->capacity; i++) {
+            if (table->keys[i] != NULL) {
+                putName(&bigger, table->keys[i], table->values[i]);
+                free(table->keys[i]);
+            }
+        }
+        free(table->keys);
+        free(table->values);
+        *table = bigger;
+    }
+
+    unsigned int i = hashName(name) & (table->capacity - 1);
+    while (table->keys[i] != NULL) {
+        if (strcmp(table->keys[i], name) == 0) {
+            table->values[i] = value;
+            return;
+        }
+        i = (i + 1) & (table->capacity - 1);
+    }
+    table->keys[i] = strdup(name);
+    table->values[i] = value;
+    table->count++;
+}
+
+void freeNameTable(NameTable* table) {
+    for (int i = 0; i < table->capacity; i++) {
+        free(table->keys[i]);
+    }
+    free(table->keys);
+    free(table->values);
+}
+
 Node* createNode(char* dataType, char* type) {
     Node* node = (Node*)malloc(sizeof(Node));
     if (node == NULL) {
@@ -111,4 +193,89 @@ Node* createStringNode(char* sValue) {
     node->sValue = strdup(sValue);
     return node;
 }
+
+/*
+    Case constants of a switch, collected while the cases are parsed so the
+    dispatch code can be placed in front of them once the switch is closed
+*/
+#define SWITCH_LINEAR_MAX_CASES 3 // smaller switches just compare case by case
+#define SWITCH_TABLE_MAX_RANGE 1024
+
+typedef struct SwitchCases {
+    int* values;
+    char** constants; // the case value as written in the code
+    int* labels;
+    int count;
+    int defaultLabel; // -1 when there is no default
+} SwitchCases;
+
+void addSwitchCase(SwitchCases* cases, Node* value, char* constant, int label) {
+    cases->values = (int*)realloc(cases->values, (cases->count + 1) * sizeof(int));
+    cases->constants = (char**)realloc(cases->constants, (cases->count + 1) * sizeof(char*));
+    cases->labels = (int*)realloc(cases->labels, (cases->count + 1) * sizeof(int));
+
+    int key = value->iValue;
+    if (strcmp(value->dataType, "char") == 0) {
+        key = value->cValue;
+    } else if (strcmp(value->dataType, "bool") == 0) {
+        key = value->bValue;
+    }
+    cases->values[cases->count] = key;
+    cases->constants[cases->count] = strdup(constant);
+    cases->labels[cases->count] = label;
+    cases->count++;
+}
+
+// sorts the cases by value, a repeated value keeps the case written first like the compare chain did
+void sortSwitchCases(SwitchCases* cases) {
+    for (int i = 1; i < cases->count; i++) {
+        int value = cases->values[i];
+        char* constant = cases->constants[i];
+        int label = cases->labels[i];
+        int j = i - 1;
+        while (j >= 0 && cases->values[j] > value) {
+            cases->values[j + 1] = cases->values[j];
+            cases->constants[j + 1] = cases->constants[j];
+            cases->labels[j + 1] = cases->labels[j];
+            j--;
+        }
+        cases->values[j + 1] = value;
+        cases->constants[j + 1] = constant;
+        cases->labels[j + 1] = label;
+    }
+
+    int count = 0;
+    for (int i = 0; i < cases->count; i++) {
+        if (count > 0 && cases->values[count - 1] == cases->values[i]) {
+            free(cases->constants[i]);
+            continue;
+        }
+        cases->values[count] = cases->values[i];
+        cases->constants[count] = cases->constants[i];
+        cases->labels[count] = cases->labels[i];
+        count++;
+    }
+    cases->count = count;
+}
+
+// int, char and bool switches with at least half of their value range used get a jump table
+bool useSwitchTable(SwitchCases* cases, char* dataType) {
+    bool isIntLike = strcmp(dataType, "int") == 0 || strcmp(dataType, "char") == 0 || strcmp(dataType, "bool") == 0;
+    if (!isIntLike || cases->count <= SWITCH_LINEAR_MAX_CASES) {
+        return false;
+    }
+    long long range = (long long)cases->values[cases->count - 1] - cases->values[0] + 1;
+    return range <= SWITCH_TABLE_MAX_RANGE && range <= 2LL * cases->count;
+}
+
+void freeSwitchCases(SwitchCases* cases) {
+    for (int i = 0; i < cases->count; i++) {
+        free(cases->constants[i]);
+    }
+    free(cases->values);
+    free(cases->constants);
+    free(cases->labels);
+    memset(cases, 0, sizeof(SwitchCases));
+}
+
 #endif // UTILS_H
\ No newline at end of file
@@ -0,0 +1,426 @@
+#ifndef __VALUES_C__
+#define __VALUES_C__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "folding.c"
+
+/*
+    A value is one NaN-boxed 64 bit word. A float is its own IEEE double.
+    The other types are quiet NaNs with the top 14 bits set (VALUE_BOXED),
+    the 2 bits under them give the type and the low 48 bits the payload:
+    an int, bool or char in the low 32, or a string (see the strings
+    below). A float op never leaves one of those NaNs
+    behind, a NaN result is stored as VALUE_NAN with its sign kept. So the
+    stack and the frames move 8 bytes per value and scalars never allocate.
+*/
+typedef uint64_t Value;
+
+#define VALUE_BOXED 0x7FFC000000000000ull
+#define VALUE_BOX_MASK 0xFFFC000000000000ull
+#define VALUE_NAN 0x7FF8000000000000ull
+#define VALUE_PAYLOAD 0x0000FFFFFFFFFFFFull
+#define VALUE_TAG_SHIFT 48
+
+// the type bits of a boxed value, in the order of "ibcs"
+enum { VALUE_INT, VALUE_BOOL, VALUE_CHAR, VALUE_STRING };
+
+static inline bool isBoxed(Value value) {
+    return (value & VALUE_BOX_MASK) == VALUE_BOXED;
+}
+
+// 'i' int, 'f' float, 'b' bool, 'c' char, 's' string
+static inline char valueType(Value value) {
+    return isBoxed(value) ? "ibcs"[(value >> VALUE_TAG_SHIFT) & 3] : 'f';
+}
+
+static inline bool isIntValue(Value value) {
+    return value >> VALUE_TAG_SHIFT == (VALUE_BOXED | (uint64_t)VALUE_INT << VALUE_TAG_SHIFT) >> VALUE_TAG_SHIFT;
+}
+
+// int, bool and char
+static inline int asInt(Value value) {
+    return (int)(uint32_t)value;
+}
+
+static inline double asFloat(Value value) {
+    double f;
+    memcpy(&f, &value, sizeof(f));
+    return f;
+}
+
+static inline Value boxTagged(int tag, uint64_t payload) {
+    return VALUE_BOXED | (uint64_t)tag << VALUE_TAG_SHIFT | payload;
+}
+
+static inline Value boxInt(int i) {
+    return boxTagged(VALUE_INT, (uint32_t)i);
+}
+
+static inline Value boxBool(bool b) {
+    return boxTagged(VALUE_BOOL, b);
+}
+
+
+static inline Value boxFloat(double f) {
+    Value value;
+    memcpy(&value, &f, sizeof(value));
+    if (f != f) {
+        return (value & 1ull << 63) | VALUE_NAN; // -nan still prints as -nan
+    }
+    return value;
+}
+
+// an int, bool or char
+static inline Value boxScalar(char type, int i) {
+    return boxTagged(type == 'b' ? VALUE_BOOL : type == 'c' ? VALUE_CHAR : VALUE_INT, (uint32_t)i);
+}
+
+/*--------------------------------------------------------------------------*/
+/* Strings */
+/*--------------------------------------------------------------------------*/
+
+/*
+    A string of up to SMALL_STRING_MAX chars is kept in the payload itself:
+    bit 0 set, the length in bits 1 to 3 and the chars from bit 8. A longer
+    one points at a VMString (malloc keeps bit 0 clear):
+        literals        interned once in a table, live until the process ends
+        flat            the chars follow the header in the same block
+        rope            left + right of a sconcat, flattened in place the
+                        first time it is printed or compared. The ropes down
+                        its right side end where it ends, they point into
+                        its text and are flat from then on too
+    sconcat copies results shorter than ROPE_MIN_LENGTH and makes a rope
+    otherwise, so a loop growing a string no longer copies it every time.
+    Runtime strings are all on one list: when they take more than
+    stringHeap.threshold bytes the engine hands its roots to collectStrings,
+    which marks what they reach and frees the rest.
+*/
+
+#define SMALL_STRING_MAX 5
+#define ROPE_MIN_LENGTH 32
+#ifndef STRING_COLLECT_START
+#define STRING_COLLECT_START (1 << 20) // bytes
+#endif
+
+typedef struct VMString {
+    struct VMString* next; // the list of runtime strings
+    int length;
+    bool literal;
+    bool marked;
+    Value left, right; // of a rope that isn't flattened yet
+    char* text; // NULL while a rope
+    struct VMString* owner; // the rope whose text this one ends, kept alive with it
+    char chars[]; // the text of a flat string or a literal
+} VMString;
+
+typedef struct StringHeap {
+    VMString* objects;
+    long long bytes; // of the runtime strings alive
+    long long threshold;
+    VMString** interned; // open addressing on the text
+    int internedCount;
+    int internedCapacity;
+    long long concatenations, ropes, flattened, collections, freedBytes;
+} StringHeap;
+
+StringHeap stringHeap = {NULL, 0, STRING_COLLECT_START, NULL, 0, 0, 0, 0, 0, 0, 0};
+
+static inline bool isSmallString(Value value) {
+    return value & 1;
+}
+
+static inline VMString* asStringObject(Value value) {
+    return (VMString*)(uintptr_t)(value & VALUE_PAYLOAD);
+}
+
+static inline Value boxStringObject(VMString* string) {
+    return boxTagged(VALUE_STRING, (uintptr_t)string);
+}
+
+static inline size_t stringLength(Value value) {
+    return isSmallString(value) ? (size_t)((value >> 1) & 7) : (size_t)asStringObject(value)->length;
+}
+
+Value smallString(const char* chars, int length) {
+    uint64_t payload = 1 | (uint64_t)length << 1;
+    for (int i = 0; i < length; i++) {
+        payload |= (uint64_t)(unsigned char)chars[i] << (8 + 8 * i);
+    }
+    return boxTagged(VALUE_STRING, payload);
+}
+
+VMString* allocateString(int length, int chars) {
+    VMString* string = (VMString*)malloc(sizeof(VMString) + chars);
+    string->next = NULL;
+    string->length = length;
+    string->literal = false;
+    string->marked = false;
+    string->left = string->right = 0;
+    string->text = chars > 0 ? string->chars : NULL;
+    string->owner = NULL;
+    return string;
+}
+
+// a runtime string, on the list of the collector
+VMString* newRuntimeString(int length, int chars) {
+    VMString* string = allocateString(length, chars);
+    string->next = stringHeap.objects;
+    stringHeap.objects = string;
+    stringHeap.bytes += sizeof(VMString) + chars;
+    return string;
+}
+
+Value newString(const char* chars, int length) {
+    if (length <= SMALL_STRING_MAX) {
+        return smallString(chars, length);
+    }
+    VMString* string = newRuntimeString(length, length + 1);
+    memcpy(string->chars, chars, length);
+    string->chars[length] = '\0';
+    return boxStringObject(string);
+}
+
+unsigned hashString(const char* text) {
+    unsigned hash = 2166136261u;
+    for (; *text != '\0'; text++) {
+        hash = (hash ^ (unsigned char)*text) * 16777619u;
+    }
+    return hash;
+}
+
+// the one value of a literal, equal literals compare equal without looking at the text
+Value internString(const char* text) {
+    int length = strlen(text);
+    if (length <= SMALL_STRING_MAX) {
+        return smallString(text, length);
+    }
+    if (2 * (stringHeap.internedCount + 1) > stringHeap.internedCapacity) {
+        int capacity = stringHeap.internedCapacity == 0 ? 64 : stringHeap.internedCapacity * 2;
+        VMString** table = (VMString**)calloc(capacity, sizeof(VMString*));
+        for (int i = 0; i < stringHeap.internedCapacity; i++) {
+            VMString* string = stringHeap.interned[i];
+            if (string != NULL) {
+                unsigned slot = hashString(string->chars) & (capacity - 1);
+                while (table[slot] != NULL) {
+                    slot = (slot + 1) & (capacity - 1);
+                }
+                table[slot] = string;
+            }
+        }
+        free(stringHeap.interned);
+        stringHeap.interned = table;
+        stringHeap.internedCapacity = capacity;
+    }
+    unsigned slot = hashString(text) & (stringHeap.internedCapacity - 1);
+    for (; stringHeap.interned[slot] != NULL; slot = (slot + 1) & (stringHeap.internedCapacity - 1)) {
+        if (strcmp(stringHeap.interned[slot]->chars, text) == 0) {
+            return boxStringObject(stringHeap.interned[slot]);
+        }
+    }
+    VMString* string = allocateString(length, length + 1);
+    string->literal = true;
+    memcpy(string->chars, text, length + 1);
+    stringHeap.interned[slot] = string;
+    stringHeap.internedCount++;
+    return boxStringObject(string);
+}
+
+// copies the chars of a rope left to right, without recursing on its depth
+void flattenString(VMString* rope) {
+    char* text = (char*)malloc(rope->length + 1);
+    int capacity = 64;
+    int count = 0;
+    Value* work = (Value*)malloc(capacity * sizeof(Value));
+    work[count++] = rope->right;
+    work[count++] = rope->left;
+    int at = 0;
+    while (count > 0) {
+        Value part = work[--count];
+        if (isSmallString(part)) {
+            for (size_t i = 0; i < stringLength(part); i++) {
+                text[at++] = (char)(part >> (8 + 8 * i));
+            }
+            continue;
+        }
+        VMString* string = asStringObject(part);
+        if (string->text != NULL) {
+            memcpy(text + at, string->text, string->length);
+            at += string->length;
+            continue;
+        }
+        if (count + 2 > capacity) {
+            capacity *= 2;
+            work = (Value*)realloc(work, capacity * sizeof(Value));
+        }
+        work[count++] = string->right;
+        work[count++] = string->left;
+    }
+    free(work);
+    text[at] = '\0';
+    Value right = rope->right;
+    rope->text = text;
+    rope->left = rope->right = 0;
+    // s = s + "ab" printed every time flattens each rope over the text of the one before
+    while (!isSmallString(right) && asStringObject(right)->text == NULL) {
+        VMString* part = asStringObject(right);
+        right = part->right;
+        part->text = text + rope->length - part->length;
+        part->left = part->right = 0;
+        part->owner = rope;
+    }
+    stringHeap.bytes += rope->length + 1;
+    stringHeap.flattened++;
+}
+
+// the text of a string, a small one is unpacked into buffer (SMALL_STRING_MAX + 1 chars)
+const char* stringChars(Value value, char* buffer) {
+    if (isSmallString(value)) {
+        int length = stringLength(value);
+        for (int i = 0; i < length; i++) {
+            buffer[i] = (char)(value >> (8 + 8 * i));
+        }
+        buffer[length] = '\0';
+        return buffer;
+    }
+    VMString* string = asStringObject(value);
+    if (string->text == NULL) {
+        flattenString(string);
+    }
+    return string->text;
+}
+
+Value concatStrings(Value a, Value b) {
+    int length = stringLength(a) + stringLength(b);
+    stringHeap.concatenations++;
+    if (length >= ROPE_MIN_LENGTH) {
+        VMString* rope = newRuntimeString(length, 0);
+        rope->left = a;
+        rope->right = b;
+        stringHeap.ropes++;
+        return boxStringObject(rope);
+    }
+    char left[SMALL_STRING_MAX + 1], right[SMALL_STRING_MAX + 1];
+    char text[ROPE_MIN_LENGTH];
+    int leftLength = stringLength(a);
+    memcpy(text, stringChars(a, left), leftLength);
+    memcpy(text + leftLength, stringChars(b, right), length - leftLength);
+    return newString(text, length);
+}
+
+int compareStrings(Value a, Value b) {
+    if (a == b) {
+        return 0;
+    }
+    char left[SMALL_STRING_MAX + 1], right[SMALL_STRING_MAX + 1];
+    return strcmp(stringChars(a, left), stringChars(b, right));
+}
+
+static inline bool stringCollectionDue() {
+    return stringHeap.bytes > stringHeap.threshold;
+}
+
+void freeRuntimeString(VMString* string) {
+    long long bytes = sizeof(VMString);
+    if (string->text == string->chars) {
+        bytes += string->length + 1;
+    } else if (string->text != NULL && string->owner == NULL) {
+        bytes += string->length + 1; // a flattened rope
+        free(string->text);
+    }
+    stringHeap.bytes -= bytes;
+    stringHeap.freedBytes += bytes;
+    free(string);
+}
+
+typedef struct StringMarks {
+    VMString** items;
+    int count;
+    int capacity;
+} StringMarks;
+
+// the runtime string of value is marked the first time it is reached, and its parts looked at later
+void markString(StringMarks* marks, Value value) {
+    if (valueType(value) != 's' || isSmallString(value)) {
+        return;
+    }
+    VMString* string = asStringObject(value);
+    if (string->literal || string->marked) {
+        return;
+    }
+    string->marked = true;
+    if (marks->count == marks->capacity) {
+        marks->capacity *= 2;
+        marks->items = (VMString**)realloc(marks->items, marks->capacity * sizeof(VMString*));
+    }
+    marks->items[marks->count++] = string;
+}
+
+// rangeCount pairs of [begin, end) of values, everything they don't reach is freed
+void collectStrings(Value** roots, int rangeCount) {
+    StringMarks marks = {(VMString**)malloc(256 * sizeof(VMString*)), 0, 256};
+    for (int r = 0; r < rangeCount; r++) {
+        for (Value* slot = roots[2 * r]; slot < roots[2 * r + 1]; slot++) {
+            markString(&marks, *slot);
+            while (marks.count > 0) {
+                VMString* string = marks.items[--marks.count];
+                if (string->text == NULL) {
+                    markString(&marks, string->left);
+                    markString(&marks, string->right);
+                } else if (string->owner != NULL) {
+                    markString(&marks, boxStringObject(string->owner));
+                }
+            }
+        }
+    }
+    free(marks.items);
+    VMString** link = &stringHeap.objects;
+    while (*link != NULL) {
+        VMString* string = *link;
+        if (string->marked) {
+            string->marked = false;
+            link = &string->next;
+        } else {
+            *link = string->next;
+            freeRuntimeString(string);
+        }
+    }
+    stringHeap.collections++;
+    stringHeap.threshold = stringHeap.bytes * 2 > STRING_COLLECT_START ? stringHeap.bytes * 2 : STRING_COLLECT_START;
+}
+
+// the end of a run, no runtime string outlives it
+void releaseStrings() {
+    while (stringHeap.objects != NULL) {
+        VMString* string = stringHeap.objects;
+        stringHeap.objects = string->next;
+        freeRuntimeString(string);
+    }
+    stringHeap.bytes = 0;
+    stringHeap.threshold = STRING_COLLECT_START;
+}
+
+void reportStrings() {
+    printf("Strings: %lld concatenations (%lld ropes, %lld flattened), %lld collections freed %lld bytes, %d literals interned\n",
+           stringHeap.concatenations, stringHeap.ropes, stringHeap.flattened,
+           stringHeap.collections, stringHeap.freedBytes, stringHeap.internedCount);
+}
+
+// a literal of the assembly or the quads, its string goes to the table of literals
+Value constantValue(ConstValue constant) {
+    if (constant.kind == 'f') {
+        return boxFloat(constant.fValue);
+    }
+    if (constant.kind == 's') {
+        Value value = internString(constant.sValue);
+        freeConstValue(&constant);
+        return value;
+    }
+    return boxScalar(constant.kind, constant.iValue);
+}
+
+#endif
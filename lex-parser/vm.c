@@ -0,0 +1,963 @@
+#ifndef __VM_C__
+#define __VM_C__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+
+#include "folding.c"
+#include "values.c"
+
+/*
+    Stack VM running the assembly (--run). The lines are loaded once into
+    an array of instructions: literals go to a constant pool and labels to
+    instruction indexes, so nothing is looked up by name while the program runs.
+        load N / store N        slot N of the frame of the running function
+        gload N / gstore N      slot N of the globals
+        call func_X             keeps the return address and the frame, jumps to func_X
+        enter P N               the P args on top of the stack become the first of the N slots of the new frame
+        ret / retv              drops the frame and goes back to the caller, retv keeps the value on top
+        tailcall P func_X       moves the P args over the frame and jumps, func_X returns to our caller
+        jtab N L / jtarget L    pops an index, jumps to the index-th jtarget, or to L when out of range
+        pop                     drops the top of the stack
+        iadd, flt, sconcat ...  typed by the compiler (i int, char and bool, f float, s string),
+                                i2f converts the int side of a mixed operation, so the ops never look at the tags
+    With --fuse common sequences run as one superinstruction (fusion.c).
+    Frames live on the value stack under the values the function pushes.
+    Global code runs first, then main is called (its params set to 0) and
+    the program stops when it returns.
+*/
+
+#define VM_STACK_SIZE (1 << 20)
+#define VM_MAX_CALLS (1 << 16)
+
+bool runEnabled = false;
+bool fusionEnabled = false; // --fuse, see fusion.c
+bool jitEnabled = false; // --jit, see jit.c
+bool profileEnabled = false; // --profile, see profile.c
+
+// add to minus are the untyped operations of the quads, the assembly has the typed ones after shr,
+// the ones after halt are the superinstructions of fusion.c and never written in the assembly
+typedef enum VMOp {
+    VM_PUSH_CONST, VM_DROP,
+    VM_LOAD, VM_STORE, VM_GLOAD, VM_GSTORE,
+    VM_ADD, VM_SUB, VM_MUL, VM_DIV, VM_MOD,
+    VM_LT, VM_GT, VM_LE, VM_GE, VM_EQ, VM_NE,
+    VM_AND, VM_OR, VM_NOT, VM_MINUS,
+    VM_BIT_NOT, VM_BIT_AND, VM_BIT_OR, VM_XOR, VM_SHL, VM_SHR,
+    VM_IADD, VM_ISUB, VM_IMUL, VM_IDIV, VM_IMOD,
+    VM_ILT, VM_IGT, VM_ILE, VM_IGE, VM_IEQ, VM_INE,
+    VM_FADD, VM_FSUB, VM_FMUL, VM_FDIV, VM_FMOD,
+    VM_FLT, VM_FGT, VM_FLE, VM_FGE, VM_FEQ, VM_FNE,
+    VM_SLT, VM_SGT, VM_SLE, VM_SGE, VM_SEQ, VM_SNE,
+    VM_SCONCAT, VM_I2F, VM_INOT, VM_FNOT, VM_INEG, VM_FNEG,
+    VM_PRINT, VM_JMP, VM_JF, VM_JTAB, VM_JTARGET,
+    VM_CALL, VM_ENTER, VM_RET, VM_RETV, VM_TAILCALL, VM_HALT,
+    VM_ADD3, VM_ADD_CONST, VM_SUB_CONST, VM_SET_CONST, VM_LOAD2,
+    VM_JLT_CONST, VM_JGT_CONST, VM_JLE_CONST, VM_JGE_CONST, VM_JEQ_CONST, VM_JNE_CONST,
+    VM_JLT, VM_JGT, VM_JLE, VM_JGE, VM_JEQ, VM_JNE,
+    VM_PROFILE, // only in the dispatch of a --profile run
+    VM_OP_COUNT
+} VMOp;
+
+// as written in the assembly
+const char* vmOpNames[VM_OP_COUNT] = {
+    "push", "pop",
+    "load", "store", "gload", "gstore",
+    "add", "sub", "mul", "div", "mod",
+    "lt", "gt", "le", "ge", "eq", "ne",
+    "and", "or", "not", "minus",
+    "bit_not", "bit_and", "bit_or", "xor", "shl", "shr",
+    "iadd", "isub", "imul", "idiv", "imod",
+    "ilt", "igt", "ile", "ige", "ieq", "ine",
+    "fadd", "fsub", "fmul", "fdiv", "fmod",
+    "flt", "fgt", "fle", "fge", "feq", "fne",
+    "slt", "sgt", "sle", "sge", "seq", "sne",
+    "sconcat", "i2f", "inot", "fnot", "ineg", "fneg",
+    "print", "jmp", "jf", "jtab", "jtarget",
+    "call", "enter", "ret", "retv", "tailcall", "halt",
+    "add3", "add_const", "sub_const", "set_const", "load2",
+    "jlt_const", "jgt_const", "jle_const", "jge_const", "jeq_const", "jne_const",
+    "jlt", "jgt", "jle", "jge", "jeq", "jne",
+    "profile"
+};
+
+typedef struct Instruction {
+    int op;
+    int a; // constant, slot, jump target or param count of an enter
+    int b; // jtab: the fallback target, enter: the frame size, tailcall: the param count
+} Instruction;
+
+typedef struct VMProgram {
+    Instruction* code;
+    int count;
+    Value* constants;
+    int constantCount;
+    int globalCount;
+    // kept for the bytecode file and the disassembler
+    char** labelNames;
+    int* labelOffsets;
+    int labelCount;
+    int* labelRefs; // per instruction, the label a jump or call was written with or -1
+    int entryStart; // the call to main made by the loader
+    int entryCount;
+    void* mapping; // code and labelRefs point into it when loaded from a bytecode file
+    size_t mappingSize;
+} VMProgram;
+
+/*--------------------------------------------------------------------------*/
+/* Loader */
+/*--------------------------------------------------------------------------*/
+
+int vmConstant(VMProgram* program, Value value) {
+    program->constants = (Value*)realloc(program->constants, (program->constantCount + 1) * sizeof(Value));
+    program->constants[program->constantCount] = value;
+    return program->constantCount++;
+}
+
+void vmEmit(VMProgram* program, int op, int a, int b) {
+    program->code[program->count].op = op;
+    program->code[program->count].a = a;
+    program->code[program->count].b = b;
+    program->labelRefs[program->count] = -1;
+    program->count++;
+}
+
+int vmLabel(VMProgram* program, char* name, int offset) {
+    program->labelNames = (char**)realloc(program->labelNames, (program->labelCount + 1) * sizeof(char*));
+    program->labelOffsets = (int*)realloc(program->labelOffsets, (program->labelCount + 1) * sizeof(int));
+    program->labelNames[program->labelCount] = strdup(name);
+    program->labelOffsets[program->labelCount] = offset;
+    return program->labelCount++;
+}
+
+bool isLabelLine(char* line) {
+    int length = strcspn(line, "\n");
+    return line[0] != '\t' && length > 1 && line[length - 1] == ':';
+}
+
+// the line without its tab and newline, split into op and operand (everything after the first space)
+void splitAssemblyLine(char* line, char* op, char* operand) {
+    while (*line == '\t') {
+        line++;
+    }
+    int length = strcspn(line, "\n");
+    char* space = memchr(line, ' ', length);
+    int opLength = space ? space - line : length;
+    snprintf(op, 32, "%.*s", opLength, line);
+    if (space) {
+        snprintf(operand, 512, "%.*s", length - opLength - 1, space + 1);
+    } else {
+        operand[0] = '\0';
+    }
+}
+
+int vmOpByName(char* name) {
+    for (int op = VM_ADD; op < VM_OP_COUNT; op++) {
+        if (strcmp(vmOpNames[op], name) == 0) {
+            return op;
+        }
+    }
+    return -1;
+}
+
+// main is called without arguments, its params start as 0
+int mainParamCount(char** lines, int count) {
+    for (int i = 0; i + 1 < count; i++) {
+        if (strcmp(lines[i], "func_main:\n") == 0 && strncmp(lines[i + 1], "\tenter ", 7) == 0) {
+            return atoi(lines[i + 1] + 7);
+        }
+    }
+    return 0;
+}
+
+// a slot number, -1 when the operand isn't one
+int vmSlot(char* operand) {
+    if (operand[0] == '\0' || strspn(operand, "0123456789") != strlen(operand)) {
+        return -1;
+    }
+    return atoi(operand);
+}
+
+void unmapBytecode(VMProgram* program);
+void fuseVMProgram(VMProgram* program);
+struct VMJit;
+struct VMJit* createVMJit(VMProgram* program);
+bool jitCanEnter(struct VMJit* jit, int pc, Value* sp, Value* fp, Value* stackEnd);
+int jitRun(struct VMJit* jit, int pc, Value** sp, Value* fp, Value* globals, long long* steps);
+void freeVMJit(struct VMJit* jit);
+void reportVMJit(long long executed, long long native);
+struct VMProfile;
+struct VMProfile* createVMProfile(VMProgram* program);
+static inline void profileInstruction(struct VMProfile* profile, int pc);
+void finishVMProfile(struct VMProfile* profile);
+void reportVMProfile(struct VMProfile* profile, long long executed);
+void freeVMProfile(struct VMProfile* profile);
+
+void freeVMProgram(VMProgram* program) {
+    for (int l = 0; l < program->labelCount; l++) {
+        free(program->labelNames[l]);
+    }
+    free(program->labelNames);
+    free(program->labelOffsets);
+    free(program->constants);
+    if (program->mapping != NULL) {
+        unmapBytecode(program);
+    } else {
+        free(program->code);
+        free(program->labelRefs);
+    }
+    free(program);
+}
+
+VMProgram* loadVMProgram(char** lines, int lineCount) {
+    VMProgram* program = (VMProgram*)calloc(1, sizeof(VMProgram));
+    NameTable labels;
+    initNameTable(&labels);
+
+    // first pass: instruction index of every label, the call to main goes in front of the first function
+    int count = 0;
+    bool hasEntry = false;
+    int mainParams = mainParamCount(lines, lineCount);
+    for (int i = 0; i < lineCount; i++) {
+        if (isLabelLine(lines[i])) {
+            if (!hasEntry && strncmp(lines[i], "func_", 5) == 0) {
+                count += mainParams + 2;
+                hasEntry = true;
+            }
+            char label[256];
+            snprintf(label, sizeof(label), "%.*s", (int)strcspn(lines[i], ":"), lines[i]);
+            putName(&labels, label, vmLabel(program, label, count));
+            continue;
+        }
+        count++;
+    }
+    program->code = (Instruction*)malloc((count + 4) * sizeof(Instruction));
+    program->labelRefs = (int*)malloc((count + 4) * sizeof(int));
+
+    bool ok = true;
+    hasEntry = false;
+    int frameSize = 0; // slots of the function being loaded, global code has none
+    for (int i = 0; i < lineCount && ok; i++) {
+        char op[32];
+        char operand[512];
+        if (isLabelLine(lines[i])) {
+            if (!hasEntry && strncmp(lines[i], "func_", 5) == 0) {
+                Value zero = boxInt(0);
+                program->entryStart = program->count;
+                for (int p = 0; p < mainParams; p++) {
+                    vmEmit(program, VM_PUSH_CONST, vmConstant(program, zero), 0);
+                }
+                int mainLabel = findName(&labels, "func_main");
+                if (mainLabel == -1) {
+                    fprintf(stderr, "VM: the program has no main function\n");
+                    hasEntry = true;
+                    ok = false;
+                    break;
+                }
+                vmEmit(program, VM_CALL, program->labelOffsets[mainLabel], 0);
+                program->labelRefs[program->count - 1] = mainLabel;
+                vmEmit(program, VM_HALT, 0, 0);
+                program->entryCount = program->count - program->entryStart;
+                hasEntry = true;
+            }
+            continue;
+        }
+        splitAssemblyLine(lines[i], op, operand);
+
+        if (strcmp(op, "push") == 0) {
+            ConstValue constant;
+            if (!parseConstValue(operand, &constant)) {
+                fprintf(stderr, "VM: bad operand %s\n", operand);
+                ok = false;
+                continue;
+            }
+            vmEmit(program, VM_PUSH_CONST, vmConstant(program, constantValue(constant)), 0);
+        } else if (strcmp(op, "pop") == 0 && operand[0] == '\0') {
+            vmEmit(program, VM_DROP, 0, 0);
+        } else if (strcmp(op, "load") == 0 || strcmp(op, "store") == 0
+                   || strcmp(op, "gload") == 0 || strcmp(op, "gstore") == 0) {
+            bool isGlobal = op[0] == 'g';
+            int slot = vmSlot(operand);
+            if (slot == -1 || (!isGlobal && slot >= frameSize)) {
+                fprintf(stderr, "VM: bad slot in %s %s\n", op, operand);
+                ok = false;
+                continue;
+            }
+            if (isGlobal && slot >= program->globalCount) {
+                program->globalCount = slot + 1;
+            }
+            bool isLoad = op[isGlobal] == 'l';
+            vmEmit(program, isGlobal ? (isLoad ? VM_GLOAD : VM_GSTORE) : (isLoad ? VM_LOAD : VM_STORE), slot, 0);
+        } else if (strcmp(op, "enter") == 0) {
+            int params = 0;
+            if (sscanf(operand, "%d %d", &params, &frameSize) != 2 || params < 0 || params > frameSize) {
+                fprintf(stderr, "VM: bad frame in enter %s\n", operand);
+                ok = false;
+                continue;
+            }
+            vmEmit(program, VM_ENTER, params, frameSize);
+        } else if (strcmp(op, "jmp") == 0 || strcmp(op, "jf") == 0 || strcmp(op, "jtarget") == 0
+                   || strcmp(op, "jtab") == 0 || strcmp(op, "call") == 0 || strcmp(op, "tailcall") == 0) {
+            char* label = strrchr(operand, ' ') ? strrchr(operand, ' ') + 1 : operand;
+            int index = findName(&labels, label);
+            if (index == -1) {
+                fprintf(stderr, "VM: undefined label %s\n", label);
+                ok = false;
+                continue;
+            }
+            int target = program->labelOffsets[index];
+            if (strcmp(op, "jtab") == 0) {
+                vmEmit(program, VM_JTAB, atoi(operand), target);
+            } else if (strcmp(op, "tailcall") == 0) {
+                vmEmit(program, VM_TAILCALL, target, atoi(operand));
+            } else {
+                vmEmit(program, vmOpByName(op), target, 0);
+            }
+            program->labelRefs[program->count - 1] = index;
+        } else {
+            int code = vmOpByName(op);
+            if (code == -1 || operand[0] != '\0' || (code >= VM_ADD && code <= VM_MINUS) || code > VM_HALT) {
+                fprintf(stderr, "VM: unknown instruction %s\n", op);
+                ok = false;
+            } else {
+                vmEmit(program, code, 0, 0);
+            }
+        }
+    }
+    vmEmit(program, VM_HALT, 0, 0);
+
+    freeNameTable(&labels);
+    if (!ok || !hasEntry) {
+        if (!hasEntry) {
+            fprintf(stderr, "VM: the program has no functions to run\n");
+        }
+        freeVMProgram(program);
+        return NULL;
+    }
+    if (fusionEnabled) {
+        fuseVMProgram(program);
+    }
+    return program;
+}
+
+/*--------------------------------------------------------------------------*/
+/* Execution */
+/*--------------------------------------------------------------------------*/
+
+bool vmError(VMProgram* program, int pc, char* format, ...) {
+    char message[256];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+    fprintf(stderr, "Runtime error: %s (instruction %d, %s)\n", message, pc, vmOpNames[program->code[pc].op]);
+    return false;
+}
+
+bool isTruthy(Value value) {
+    if (!isBoxed(value)) {
+        return asFloat(value) != 0;
+    }
+    if (valueType(value) == 's') {
+        return stringLength(value) != 0;
+    }
+    return asInt(value) != 0;
+}
+
+double valueAsFloat(Value value) {
+    return isBoxed(value) ? asInt(value) : asFloat(value);
+}
+
+void printValue(Value value) {
+    switch (valueType(value)) {
+        case 'f': printf("%g\n", asFloat(value)); break;
+        case 'b': printf("%s\n", asInt(value) ? "true" : "false"); break;
+        case 'c': printf("%c\n", asInt(value)); break;
+        case 's': {
+            char buffer[SMALL_STRING_MAX + 1];
+            printf("%s\n", stringChars(value, buffer));
+            break;
+        }
+        default: printf("%d\n", asInt(value)); break;
+    }
+}
+
+char* valueAsString(Value value) {
+    char* str = (char*)malloc(64);
+    switch (valueType(value)) {
+        case 'f': snprintf(str, 64, "%g", asFloat(value)); break;
+        case 'b': snprintf(str, 64, "%s", asInt(value) ? "true" : "false"); break;
+        case 'c': snprintf(str, 64, "%c", asInt(value)); break;
+        default: snprintf(str, 64, "%d", asInt(value)); break;
+    }
+    return str;
+}
+
+// strings are only concatenated (add) and compared
+bool stringOperation(int op, Value a, Value b, Value* result) {
+    Value* sides[] = {&a, &b};
+    for (int i = 0; i < 2; i++) {
+        if (valueType(*sides[i]) != 's') {
+            char* text = valueAsString(*sides[i]);
+            *sides[i] = newString(text, strlen(text));
+            free(text);
+        }
+    }
+    if (op == VM_ADD) {
+        *result = concatStrings(a, b);
+    } else if (op >= VM_LT && op <= VM_NE) {
+        int order = compareStrings(a, b);
+        bool results[] = {order < 0, order > 0, order <= 0, order >= 0, order == 0, order != 0};
+        *result = boxBool(results[op - VM_LT]);
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// the slow path of the binary ops: anything that isn't int with int, returns the error or NULL
+char* binaryOperation(int op, Value a, Value b, Value* result) {
+    if (valueType(a) == 's' || valueType(b) == 's') {
+        return stringOperation(op, a, b, result) ? NULL : "bad operands for strings";
+    }
+    bool isFloat = !isBoxed(a) || !isBoxed(b);
+    if (op >= VM_BIT_AND && op <= VM_SHR && isFloat) {
+        return "bitwise operation on a float";
+    }
+    if (op == VM_AND || op == VM_OR) {
+        *result = boxBool(op == VM_AND ? isTruthy(a) && isTruthy(b) : isTruthy(a) || isTruthy(b));
+        return NULL;
+    }
+    if (!isFloat) {
+        // bools and chars take part as ints
+        int x = asInt(a);
+        int y = asInt(b);
+        if ((op == VM_DIV || op == VM_MOD) && y == 0) {
+            return "division by zero";
+        }
+        if ((op == VM_DIV || op == VM_MOD) && y == -1) {
+            // INT_MIN / -1 traps, it wraps like the other int ops
+            *result = boxInt(op == VM_DIV ? (int)(0u - (unsigned)x) : 0);
+            return NULL;
+        }
+        switch (op) {
+            case VM_ADD: *result = boxInt((int)((unsigned)x + (unsigned)y)); return NULL;
+            case VM_SUB: *result = boxInt((int)((unsigned)x - (unsigned)y)); return NULL;
+            case VM_MUL: *result = boxInt((int)((unsigned)x * (unsigned)y)); return NULL;
+            case VM_DIV: *result = boxInt(x / y); return NULL;
+            case VM_MOD: *result = boxInt(x % y); return NULL;
+            case VM_BIT_AND: *result = boxInt(x & y); return NULL;
+            case VM_BIT_OR: *result = boxInt(x | y); return NULL;
+            case VM_XOR: *result = boxInt(x ^ y); return NULL;
+            case VM_SHL: *result = boxInt((int)((unsigned)x << (y & 31))); return NULL; // counts masked like x86 shifts
+            case VM_SHR: *result = boxInt(x >> (y & 31)); return NULL;
+            case VM_LT: *result = boxBool(x < y); return NULL;
+            case VM_GT: *result = boxBool(x > y); return NULL;
+            case VM_LE: *result = boxBool(x <= y); return NULL;
+            case VM_GE: *result = boxBool(x >= y); return NULL;
+            case VM_EQ: *result = boxBool(x == y); return NULL;
+            default: *result = boxBool(x != y); return NULL;
+        }
+    }
+
+    double x = valueAsFloat(a);
+    double y = valueAsFloat(b);
+    switch (op) {
+        case VM_ADD: *result = boxFloat(x + y); return NULL;
+        case VM_SUB: *result = boxFloat(x - y); return NULL;
+        case VM_MUL: *result = boxFloat(x * y); return NULL;
+        case VM_DIV: *result = boxFloat(x / y); return NULL;
+        case VM_MOD: *result = boxFloat(fmod(x, y)); return NULL;
+        case VM_LT: *result = boxBool(x < y); return NULL;
+        case VM_GT: *result = boxBool(x > y); return NULL;
+        case VM_LE: *result = boxBool(x <= y); return NULL;
+        case VM_GE: *result = boxBool(x >= y); return NULL;
+        case VM_EQ: *result = boxBool(x == y); return NULL;
+        default: *result = boxBool(x != y); return NULL;
+    }
+}
+
+typedef struct VMCall {
+    int returnPc;
+    Value* base;
+} VMCall;
+
+/*
+    Dispatch. Built with GCC or clang the code is threaded before it runs:
+    every instruction becomes the address of the code running its op
+    (labels as values) next to its operands, and each op jumps straight to
+    the next one's. Built with -DVM_SWITCH_DISPATCH, or by another compiler,
+    the loop goes through a switch on the op instead. The handlers are the
+    same code for both, VM_CASE starts one and VM_NEXT goes to the next.
+*/
+#if defined(__GNUC__) && !defined(VM_SWITCH_DISPATCH)
+#define VM_THREADED
+#endif
+
+#ifdef VM_THREADED
+typedef struct ThreadedInstruction {
+    void* handler;
+    int a;
+    int b;
+} ThreadedInstruction;
+typedef ThreadedInstruction VMDispatched;
+#define VM_CASE(op) do_##op:
+#define VM_NEXT() { in = &threaded[pc]; steps++; goto *in->handler; }
+const char* vmDispatch = "threaded";
+#else
+typedef Instruction VMDispatched;
+#define VM_CASE(op) case op:
+#define VM_NEXT() continue
+const char* vmDispatch = "switch";
+#endif
+
+#define VM_FAIL(message) { ok = vmError(program, pc, message); goto done; }
+#define VM_NEED(n) if (sp - stack < (n)) VM_FAIL("stack underflow")
+#define VM_ROOM() if (sp == stackEnd) VM_FAIL("stack overflow")
+#define VM_ROOM_FOR(n) if (stackEnd - sp < (n)) VM_FAIL("stack overflow")
+// the typed operations trust the compiler: both operands have the type the op is for
+#define VM_INT_OP(box, expression) \
+    VM_NEED(2); \
+    { int x = asInt(sp[-2]); int y = asInt(sp[-1]); sp[-2] = box(expression); } \
+    sp--; pc++; VM_NEXT();
+#define VM_FLOAT_OP(box, expression) \
+    VM_NEED(2); \
+    { double x = asFloat(sp[-2]); double y = asFloat(sp[-1]); sp[-2] = box(expression); } \
+    sp--; pc++; VM_NEXT();
+#define VM_STRING_OP(expression) \
+    VM_NEED(2); \
+    { int order = compareStrings(sp[-2], sp[-1]); sp[-2] = boxBool(expression); } \
+    sp--; pc++; VM_NEXT();
+// a superinstruction stands for the instructions from pc on, which stay in the code after it
+// and give it its operands: in[1].a is the operand of the second one and so on
+#define VM_FUSED_JUMP(right, jumps) \
+    VM_ROOM_FOR(2); \
+    { int x = asInt(fp[in->a]); int y = (right); pc = (jumps) ? in[3].a : pc + 4; } \
+    fused += 3; VM_NEXT();
+
+long long vmNativeInstructions = 0; // of the last run, by the JIT
+
+// the stack and the globals of the running program, with the top of the stack the roots of the strings
+Value* vmStack = NULL;
+Value* vmGlobals = NULL;
+int vmGlobalCount = 0;
+
+void collectVMStrings(Value* sp) {
+    Value* roots[] = {vmStack, sp, vmGlobals, vmGlobals + vmGlobalCount};
+    collectStrings(roots, 2);
+}
+
+// executed counts the instructions, dispatched the jumps from one op to the next
+bool runVMProgram(VMProgram* program, struct VMProfile* profile, long long* executed, long long* dispatched) {
+    Value* stack = (Value*)malloc(VM_STACK_SIZE * sizeof(Value));
+    Value* stackEnd = stack + VM_STACK_SIZE;
+    Value* sp = stack; // next free entry
+    Value* fp = stack; // first slot of the running function
+    Value* globals = (Value*)malloc((program->globalCount + 1) * sizeof(Value));
+    for (int g = 0; g < program->globalCount; g++) {
+        globals[g] = boxInt(0);
+    }
+    vmStack = stack;
+    vmGlobals = globals;
+    vmGlobalCount = program->globalCount;
+    VMCall* calls = (VMCall*)malloc(VM_MAX_CALLS * sizeof(VMCall));
+    int callCount = 0;
+    Instruction* code = program->code;
+    Value* constants = program->constants;
+    long long steps = 0;
+    long long fused = 0; // instructions run inside a superinstruction after its first
+    long long nativeSteps = 0; // instructions run as machine code
+    struct VMJit* jit = jitEnabled && profile == NULL ? createVMJit(program) : NULL;
+    bool ok = true;
+    int pc = 0;
+    VMDispatched* in;
+
+#ifdef VM_THREADED
+    // the untyped ops of the quads have no handler, the loader never lets them in
+    static void* handlers[VM_OP_COUNT] = {
+        [VM_PUSH_CONST] = &&do_VM_PUSH_CONST, [VM_DROP] = &&do_VM_DROP, [VM_LOAD] = &&do_VM_LOAD,
+        [VM_STORE] = &&do_VM_STORE, [VM_GLOAD] = &&do_VM_GLOAD, [VM_GSTORE] = &&do_VM_GSTORE,
+        [VM_BIT_NOT] = &&do_VM_BIT_NOT, [VM_BIT_AND] = &&do_VM_BIT_AND, [VM_BIT_OR] = &&do_VM_BIT_OR,
+        [VM_XOR] = &&do_VM_XOR, [VM_SHL] = &&do_VM_SHL, [VM_SHR] = &&do_VM_SHR, [VM_IADD] = &&do_VM_IADD,
+        [VM_ISUB] = &&do_VM_ISUB, [VM_IMUL] = &&do_VM_IMUL, [VM_IDIV] = &&do_VM_IDIV, [VM_IMOD] = &&do_VM_IMOD,
+        [VM_ILT] = &&do_VM_ILT, [VM_IGT] = &&do_VM_IGT, [VM_ILE] = &&do_VM_ILE, [VM_IGE] = &&do_VM_IGE,
+        [VM_IEQ] = &&do_VM_IEQ, [VM_INE] = &&do_VM_INE, [VM_FADD] = &&do_VM_FADD, [VM_FSUB] = &&do_VM_FSUB,
+        [VM_FMUL] = &&do_VM_FMUL, [VM_FDIV] = &&do_VM_FDIV, [VM_FMOD] = &&do_VM_FMOD, [VM_FLT] = &&do_VM_FLT,
+        [VM_FGT] = &&do_VM_FGT, [VM_FLE] = &&do_VM_FLE, [VM_FGE] = &&do_VM_FGE, [VM_FEQ] = &&do_VM_FEQ,
+        [VM_FNE] = &&do_VM_FNE, [VM_SLT] = &&do_VM_SLT, [VM_SGT] = &&do_VM_SGT, [VM_SLE] = &&do_VM_SLE,
+        [VM_SGE] = &&do_VM_SGE, [VM_SEQ] = &&do_VM_SEQ, [VM_SNE] = &&do_VM_SNE, [VM_SCONCAT] = &&do_VM_SCONCAT,
+        [VM_I2F] = &&do_VM_I2F, [VM_INOT] = &&do_VM_INOT, [VM_FNOT] = &&do_VM_FNOT, [VM_INEG] = &&do_VM_INEG,
+        [VM_FNEG] = &&do_VM_FNEG, [VM_PRINT] = &&do_VM_PRINT, [VM_JMP] = &&do_VM_JMP, [VM_JF] = &&do_VM_JF,
+        [VM_JTAB] = &&do_VM_JTAB, [VM_JTARGET] = &&do_VM_JTARGET, [VM_CALL] = &&do_VM_CALL,
+        [VM_ENTER] = &&do_VM_ENTER, [VM_RET] = &&do_VM_RET, [VM_RETV] = &&do_VM_RETV,
+        [VM_TAILCALL] = &&do_VM_TAILCALL, [VM_HALT] = &&do_VM_HALT, [VM_ADD3] = &&do_VM_ADD3,
+        [VM_ADD_CONST] = &&do_VM_ADD_CONST, [VM_SUB_CONST] = &&do_VM_SUB_CONST, [VM_SET_CONST] = &&do_VM_SET_CONST,
+        [VM_LOAD2] = &&do_VM_LOAD2, [VM_JLT_CONST] = &&do_VM_JLT_CONST, [VM_JGT_CONST] = &&do_VM_JGT_CONST,
+        [VM_JLE_CONST] = &&do_VM_JLE_CONST, [VM_JGE_CONST] = &&do_VM_JGE_CONST, [VM_JEQ_CONST] = &&do_VM_JEQ_CONST,
+        [VM_JNE_CONST] = &&do_VM_JNE_CONST, [VM_JLT] = &&do_VM_JLT, [VM_JGT] = &&do_VM_JGT, [VM_JLE] = &&do_VM_JLE,
+        [VM_JGE] = &&do_VM_JGE, [VM_JEQ] = &&do_VM_JEQ, [VM_JNE] = &&do_VM_JNE, [VM_PROFILE] = &&do_VM_PROFILE
+    };
+    ThreadedInstruction* threaded = (ThreadedInstruction*)malloc(program->count * sizeof(ThreadedInstruction));
+    for (int i = 0; i < program->count; i++) {
+        threaded[i].handler = handlers[code[i].op] != NULL ? handlers[code[i].op] : &&do_unknown;
+        threaded[i].a = code[i].a;
+        threaded[i].b = code[i].b;
+    }
+    // --profile: every instruction goes to the profile handler, which goes on to the real one
+    void** profiled = NULL;
+    if (profile != NULL) {
+        profiled = (void**)malloc(program->count * sizeof(void*));
+        for (int i = 0; i < program->count; i++) {
+            profiled[i] = threaded[i].handler;
+            threaded[i].handler = &&do_VM_PROFILE;
+        }
+    }
+    VM_NEXT();
+#else
+    // --profile: the loop dispatches on a copy of the code where every op is profile
+    Instruction* dispatch = code;
+    if (profile != NULL) {
+        dispatch = (Instruction*)malloc(program->count * sizeof(Instruction));
+        memcpy(dispatch, code, program->count * sizeof(Instruction));
+        for (int i = 0; i < program->count; i++) {
+            dispatch[i].op = VM_PROFILE;
+        }
+    }
+    int op;
+    for (;;) {
+        in = &dispatch[pc];
+        steps++;
+        op = in->op;
+    dispatch_op:
+        switch (op) {
+#endif
+        VM_CASE(VM_PUSH_CONST)
+            VM_ROOM();
+            *sp++ = constants[in->a];
+            pc++;
+            VM_NEXT();
+        VM_CASE(VM_LOAD)
+            VM_ROOM();
+            *sp++ = fp[in->a];
+            pc++;
+            VM_NEXT();
+        VM_CASE(VM_STORE)
+            VM_NEED(1);
+            fp[in->a] = *--sp;
+            pc++;
+            VM_NEXT();
+        VM_CASE(VM_GLOAD)
+            VM_ROOM();
+            *sp++ = globals[in->a];
+            pc++;
+            VM_NEXT();
+        VM_CASE(VM_GSTORE)
+            VM_NEED(1);
+            globals[in->a] = *--sp;
+            pc++;
+            VM_NEXT();
+        VM_CASE(VM_DROP)
+            VM_NEED(1);
+            sp--;
+            pc++;
+            VM_NEXT();
+        VM_CASE(VM_IADD) VM_INT_OP(boxInt, (int)((unsigned)x + (unsigned)y));
+        VM_CASE(VM_ISUB) VM_INT_OP(boxInt, (int)((unsigned)x - (unsigned)y));
+        VM_CASE(VM_IMUL) VM_INT_OP(boxInt, (int)((unsigned)x * (unsigned)y));
+        VM_CASE(VM_IDIV) VM_CASE(VM_IMOD)
+            VM_NEED(2);
+            if (asInt(sp[-1]) == 0) {
+                VM_FAIL("division by zero");
+            }
+            if (asInt(sp[-1]) == -1) { // INT_MIN / -1 traps
+                sp[-2] = boxInt(code[pc].op == VM_IDIV ? (int)(0u - (unsigned)asInt(sp[-2])) : 0);
+            } else {
+                sp[-2] = boxInt(code[pc].op == VM_IDIV ? asInt(sp[-2]) / asInt(sp[-1]) : asInt(sp[-2]) % asInt(sp[-1]));
+            }
+            sp--;
+            pc++;
+            VM_NEXT();
+        VM_CASE(VM_ILT) VM_INT_OP(boxBool, x < y);
+        VM_CASE(VM_IGT) VM_INT_OP(boxBool, x > y);
+        VM_CASE(VM_ILE) VM_INT_OP(boxBool, x <= y);
+        VM_CASE(VM_IGE) VM_INT_OP(boxBool, x >= y);
+        VM_CASE(VM_IEQ) VM_INT_OP(boxBool, x == y);
+        VM_CASE(VM_INE) VM_INT_OP(boxBool, x != y);
+        VM_CASE(VM_BIT_AND) VM_INT_OP(boxInt, x & y);
+        VM_CASE(VM_BIT_OR) VM_INT_OP(boxInt, x | y);
+        VM_CASE(VM_XOR) VM_INT_OP(boxInt, x ^ y);
+        VM_CASE(VM_SHL) VM_INT_OP(boxInt, (int)((unsigned)x << (y & 31)));
+        VM_CASE(VM_SHR) VM_INT_OP(boxInt, x >> (y & 31));
+        VM_CASE(VM_FADD) VM_FLOAT_OP(boxFloat, x + y);
+        VM_CASE(VM_FSUB) VM_FLOAT_OP(boxFloat, x - y);
+        VM_CASE(VM_FMUL) VM_FLOAT_OP(boxFloat, x * y);
+        VM_CASE(VM_FDIV) VM_FLOAT_OP(boxFloat, x / y);
+        VM_CASE(VM_FMOD) VM_FLOAT_OP(boxFloat, fmod(x, y));
+        VM_CASE(VM_FLT) VM_FLOAT_OP(boxBool, x < y);
+        VM_CASE(VM_FGT) VM_FLOAT_OP(boxBool, x > y);
+        VM_CASE(VM_FLE) VM_FLOAT_OP(boxBool, x <= y);
+        VM_CASE(VM_FGE) VM_FLOAT_OP(boxBool, x >= y);
+        VM_CASE(VM_FEQ) VM_FLOAT_OP(boxBool, x == y);
+        VM_CASE(VM_FNE) VM_FLOAT_OP(boxBool, x != y);
+        VM_CASE(VM_SLT) VM_STRING_OP(order < 0);
+        VM_CASE(VM_SGT) VM_STRING_OP(order > 0);
+        VM_CASE(VM_SLE) VM_STRING_OP(order <= 0);
+        VM_CASE(VM_SGE) VM_STRING_OP(order >= 0);
+        VM_CASE(VM_SEQ) VM_STRING_OP(order == 0);
+        VM_CASE(VM_SNE) VM_STRING_OP(order != 0);
+        VM_CASE(VM_SCONCAT) {
+            VM_NEED(2);
+            sp[-2] = concatStrings(sp[-2], sp[-1]);
+            sp--;
+            if (stringCollectionDue()) {
+                collectVMStrings(sp);
+            }
+            pc++;
+            VM_NEXT();
+        }
+        VM_CASE(VM_I2F)
+            VM_NEED(1);
+            sp[-1] = boxFloat(asInt(sp[-1]));
+            pc++;
+            VM_NEXT();
+        VM_CASE(VM_INOT)
+            VM_NEED(1);
+            sp[-1] = boxBool(!asInt(sp[-1]));
+            pc++;
+            VM_NEXT();
+        VM_CASE(VM_FNOT)
+            VM_NEED(1);
+            sp[-1] = boxBool(asFloat(sp[-1]) == 0);
+            pc++;
+            VM_NEXT();
+        VM_CASE(VM_INEG)
+            VM_NEED(1);
+            sp[-1] = boxInt((int)(0u - (unsigned)asInt(sp[-1])));
+            pc++;
+            VM_NEXT();
+        VM_CASE(VM_FNEG)
+            VM_NEED(1);
+            sp[-1] ^= 1ull << 63; // the sign bit, VALUE_NAN becomes a NaN that isn't boxed either
+            pc++;
+            VM_NEXT();
+        VM_CASE(VM_BIT_NOT)
+            VM_NEED(1);
+            sp[-1] = boxInt(~asInt(sp[-1]));
+            pc++;
+            VM_NEXT();
+        VM_CASE(VM_PRINT)
+            VM_NEED(1);
+            printValue(*--sp);
+            pc++;
+            VM_NEXT();
+        VM_CASE(VM_JMP)
+            if (jit != NULL && in->a < pc && jitCanEnter(jit, in->a, sp, fp, stackEnd)) {
+                pc = in->a;
+                goto native;
+            }
+            pc = in->a;
+            VM_NEXT();
+        VM_CASE(VM_JF)
+            VM_NEED(1);
+            pc = isTruthy(*--sp) ? pc + 1 : in->a;
+            VM_NEXT();
+        VM_CASE(VM_JTAB) {
+            VM_NEED(1);
+            Value index = *--sp;
+            pc = isBoxed(index) && asInt(index) >= 0 && asInt(index) < in->a ? code[pc + 1 + asInt(index)].a : in->b;
+            VM_NEXT();
+        }
+        VM_CASE(VM_JTARGET)
+            pc++;
+            VM_NEXT();
+        VM_CASE(VM_CALL)
+            if (callCount == VM_MAX_CALLS) {
+                VM_FAIL("call stack overflow");
+            }
+            calls[callCount].returnPc = pc + 1;
+            calls[callCount].base = fp;
+            callCount++;
+            pc = in->a;
+            VM_NEXT();
+        VM_CASE(VM_ENTER)
+            VM_NEED(in->a);
+            if (stackEnd - sp < in->b - in->a) {
+                VM_FAIL("stack overflow");
+            }
+            fp = sp - in->a;
+            for (; sp < fp + in->b; sp++) {
+                *sp = 0; // all bits clear, the float 0.0: a local reads 0, 0.0 or false before it is stored
+            }
+            pc++;
+            if (jit != NULL && jitCanEnter(jit, pc, sp, fp, stackEnd)) {
+                goto native;
+            }
+            VM_NEXT();
+        VM_CASE(VM_RET) VM_CASE(VM_RETV) {
+            if (callCount == 0 || (code[pc].op == VM_RETV && sp == fp)) {
+                VM_FAIL(callCount == 0 ? "return without a call" : "no value to return");
+            }
+            if (code[pc].op == VM_RETV) {
+                *fp = sp[-1];
+                sp = fp + 1;
+            } else {
+                sp = fp;
+            }
+            callCount--;
+            fp = calls[callCount].base;
+            pc = calls[callCount].returnPc;
+            if (jit != NULL && jitCanEnter(jit, pc, sp, fp, stackEnd)) {
+                goto native;
+            }
+            VM_NEXT();
+        }
+        VM_CASE(VM_TAILCALL)
+            VM_NEED(in->b);
+            memmove(fp, sp - in->b, in->b * sizeof(Value));
+            sp = fp + in->b;
+            pc = in->a;
+            VM_NEXT();
+        VM_CASE(VM_HALT)
+            goto done;
+        VM_CASE(VM_ADD3) // load a, load b, iadd, store c
+            VM_ROOM_FOR(2);
+            fp[in[3].a] = boxInt((int)((unsigned)asInt(fp[in->a]) + (unsigned)asInt(fp[in[1].a])));
+            pc += 4;
+            fused += 3;
+            VM_NEXT();
+        VM_CASE(VM_ADD_CONST) VM_CASE(VM_SUB_CONST) { // load a, push k, iadd or isub, store c
+            VM_ROOM_FOR(2);
+            unsigned x = asInt(fp[in->a]);
+            unsigned y = asInt(constants[in[1].a]);
+            fp[in[3].a] = boxInt((int)(code[pc].op == VM_ADD_CONST ? x + y : x - y));
+            pc += 4;
+            fused += 3;
+            VM_NEXT();
+        }
+        VM_CASE(VM_SET_CONST) // push k, store a
+            VM_ROOM();
+            fp[in[1].a] = constants[in->a];
+            pc += 2;
+            fused++;
+            VM_NEXT();
+        VM_CASE(VM_LOAD2) // load a, load b
+            VM_ROOM_FOR(2);
+            sp[0] = fp[in->a];
+            sp[1] = fp[in[1].a];
+            sp += 2;
+            pc += 2;
+            fused++;
+            VM_NEXT();
+        // load a, push k or load b, a comparison, jf: named for when they jump, jge comes from ilt
+        VM_CASE(VM_JLT_CONST) VM_FUSED_JUMP(asInt(constants[in[1].a]), x < y);
+        VM_CASE(VM_JGT_CONST) VM_FUSED_JUMP(asInt(constants[in[1].a]), x > y);
+        VM_CASE(VM_JLE_CONST) VM_FUSED_JUMP(asInt(constants[in[1].a]), x <= y);
+        VM_CASE(VM_JGE_CONST) VM_FUSED_JUMP(asInt(constants[in[1].a]), x >= y);
+        VM_CASE(VM_JEQ_CONST) VM_FUSED_JUMP(asInt(constants[in[1].a]), x == y);
+        VM_CASE(VM_JNE_CONST) VM_FUSED_JUMP(asInt(constants[in[1].a]), x != y);
+        VM_CASE(VM_JLT) VM_FUSED_JUMP(asInt(fp[in[1].a]), x < y);
+        VM_CASE(VM_JGT) VM_FUSED_JUMP(asInt(fp[in[1].a]), x > y);
+        VM_CASE(VM_JLE) VM_FUSED_JUMP(asInt(fp[in[1].a]), x <= y);
+        VM_CASE(VM_JGE) VM_FUSED_JUMP(asInt(fp[in[1].a]), x >= y);
+        VM_CASE(VM_JEQ) VM_FUSED_JUMP(asInt(fp[in[1].a]), x == y);
+        VM_CASE(VM_JNE) VM_FUSED_JUMP(asInt(fp[in[1].a]), x != y);
+        VM_CASE(VM_PROFILE)
+            profileInstruction(profile, pc);
+#ifdef VM_THREADED
+            goto *profiled[pc];
+#else
+            op = code[pc].op;
+            goto dispatch_op;
+#endif
+        // the hot code of the running function, until it calls, returns or fails, see jit.c
+        native:
+            pc = jitRun(jit, pc, &sp, fp, globals, &nativeSteps);
+            VM_NEXT();
+#ifdef VM_THREADED
+        do_unknown:
+#else
+        default:
+#endif
+            VM_FAIL("unknown instruction");
+#ifndef VM_THREADED
+        }
+    }
+#endif
+
+done:
+#ifdef VM_THREADED
+    free(threaded);
+    free(profiled);
+#else
+    if (dispatch != code) {
+        free(dispatch);
+    }
+#endif
+    if (profile != NULL) {
+        finishVMProfile(profile);
+    }
+    fflush(stdout);
+    if (jit != NULL) {
+        freeVMJit(jit);
+    }
+    releaseStrings();
+    free(calls);
+    free(globals);
+    free(stack);
+    vmNativeInstructions = nativeSteps;
+    *executed = steps + fused + nativeSteps;
+    *dispatched = steps;
+    return ok;
+}
+
+// runs and frees the program, false on a runtime error
+bool runVMProgramTimed(VMProgram* program) {
+    struct timespec start, end;
+    long long executed = 0;
+    long long dispatched = 0;
+    printf("---- run ----\n");
+    fflush(stdout);
+    struct VMProfile* profile = profileEnabled ? createVMProfile(program) : NULL;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    bool ok = runVMProgram(program, profile, &executed, &dispatched);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("---- end ----\n");
+    printf("VM: %lld instructions (%d loaded, %s dispatch) in %.3f s, %.1f M instructions/s\n",
+           executed, program->count, vmDispatch, seconds, seconds > 0 ? executed / seconds / 1e6 : 0.0);
+    long long interpreted = executed - vmNativeInstructions;
+    if (dispatched < interpreted) {
+        printf("Fusion: %lld dispatches for %lld instructions, %.1f%% fewer\n",
+               dispatched, interpreted, 100.0 * (interpreted - dispatched) / interpreted);
+    }
+    if (jitEnabled) {
+        reportVMJit(executed, vmNativeInstructions);
+    }
+    if (stringHeap.concatenations > 0) {
+        reportStrings();
+    }
+    if (profile != NULL) {
+        reportVMProfile(profile, executed);
+        freeVMProfile(profile);
+    }
+    freeVMProgram(program);
+    return ok;
+}
+
+// loads and runs the assembly in memory, false on a load or runtime error
+bool runAssembly() {
+    VMProgram* program = loadVMProgram(assemblyLines, assemblyLineCount);
+    if (program == NULL) {
+        return false;
+    }
+    return runVMProgramTimed(program);
+}
+
+#endif
@@ -0,0 +1,725 @@
+#ifndef __X86_C__
+#define __X86_C__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include <stdint.h>
+
+#include "cfg.c"
+#include "folding.c"
+#include "vm.c"
+
+/*
+    x86-64 backend (--x86). Lowers the quads to GNU assembler for Linux
+    (System V) in x86.s, which gcc assembles and links:
+        gcc x86.s -o program
+    Every local, param and temp of a function has an 8 byte slot in its
+    frame, globals are g_<name> in .bss. Variables have the type of their
+    symbol, temps and @ret the type of what was last stored in them. ints
+    are 32 bit like in C, floats are doubles.
+    Args are pushed on the machine stack converted to the param types and
+    read by the callee above its return address, values come back in rax.
+    print, string + and float % go through a small runtime at the end of
+    the file built on printf, puts and malloc.
+*/
+
+bool x86Enabled = false;
+int x86Instructions = 0;
+int x86JumpTables = 0;
+int x86Divisions = 0; // labels around the idivl skipped for a -1 divisor
+
+typedef struct X86Callee {
+    char* name; // func_<name>, as used by the call
+    int paramCount;
+    char* paramTypes; // in declaration order
+    char returnType;
+} X86Callee;
+
+typedef struct X86Frame {
+    NameTable slots;
+    int slotCount;
+    NameTable types; // temps, @ret and variables without a single symbol type
+    char returnType;
+    int popParams; // pop_params emitted so far
+} X86Frame;
+
+X86Callee* x86Callees = NULL;
+int x86CalleeCount = 0;
+NameTable x86Strings; // literal -> .LS<n>
+NameTable x86Globals;
+
+void emitX86(char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    vfprintf(x86FileHandler.filePointer, format, args);
+    va_end(args);
+    x86Instructions += format[0] == '\t';
+}
+
+char x86TypeOf(char* dataType) {
+    if (dataType == NULL) {
+        return 0;
+    }
+    if (strcmp(dataType, "float") == 0) return 'f';
+    if (strcmp(dataType, "bool") == 0) return 'b';
+    if (strcmp(dataType, "char") == 0) return 'c';
+    if (strcmp(dataType, "string") == 0) return 's';
+    if (strcmp(dataType, "void") == 0) return 'v';
+    return 'i';
+}
+
+bool isX86Global(char* name) {
+    return isVarOperand(name) && strcmp(name, "@ret") != 0 && isGlobalSymbol(name);
+}
+
+// type of the variable's symbol, 0 for temps, @ret and names with several types
+char x86DeclaredType(char* name) {
+    if (isTempName(name) || strcmp(name, "@ret") == 0) {
+        return 0;
+    }
+    return x86TypeOf(getSymbolTypeByName(name));
+}
+
+// the types table holds what was last stored in temps and @ret
+char quadOperandType(NameTable* types, char* name) {
+    ConstValue constant;
+    if (strcmp(name, "_") == 0) {
+        return 'v';
+    }
+    if (parseConstValue(name, &constant)) {
+        char kind = constant.kind;
+        freeConstValue(&constant);
+        return kind;
+    }
+    char declared = x86DeclaredType(name);
+    if (declared) {
+        return declared;
+    }
+    int type = findName(types, name);
+    return type == -1 ? 'i' : (char)type;
+}
+
+char x86OperandType(X86Frame* frame, char* name) {
+    return quadOperandType(&frame->types, name);
+}
+
+X86Callee* findX86Callee(char* name) {
+    for (int c = 0; c < x86CalleeCount; c++) {
+        if (strcmp(x86Callees[c].name, name) == 0) {
+            return &x86Callees[c];
+        }
+    }
+    return NULL;
+}
+
+void collectX86Callees() {
+    for (int i = 0; i < quadCount; i++) {
+        if (strcmp(quadList[i].op, "func_label") != 0) {
+            continue;
+        }
+        x86Callees = (X86Callee*)realloc(x86Callees, (x86CalleeCount + 1) * sizeof(X86Callee));
+        X86Callee* callee = &x86Callees[x86CalleeCount++];
+        callee->name = (char*)malloc(strlen(quadList[i].arg1) + 6);
+        sprintf(callee->name, "func_%s", quadList[i].arg1);
+        char returnType = x86TypeOf(getFunctionReturnType(quadList[i].arg1));
+        callee->returnType = returnType ? returnType : 'v';
+        callee->paramCount = 0;
+        while (i + 1 + callee->paramCount < quadCount
+               && strcmp(quadList[i + 1 + callee->paramCount].op, "pop_param") == 0) {
+            callee->paramCount++;
+        }
+        // the last param is popped first
+        callee->paramTypes = (char*)malloc(callee->paramCount + 1);
+        for (int p = 0; p < callee->paramCount; p++) {
+            char type = x86DeclaredType(quadList[i + callee->paramCount - p].arg1);
+            callee->paramTypes[p] = type ? type : 'i';
+        }
+    }
+}
+
+void freeX86Callees() {
+    for (int c = 0; c < x86CalleeCount; c++) {
+        free(x86Callees[c].name);
+        free(x86Callees[c].paramTypes);
+    }
+    free(x86Callees);
+    x86Callees = NULL;
+    x86CalleeCount = 0;
+}
+
+/*--------------------------------------------------------------------------*/
+/* Operands */
+/*--------------------------------------------------------------------------*/
+
+// where a variable lives, a local gets the next free slot of the frame the first time
+void x86Location(X86Frame* frame, char* name, char* location) {
+    if (isX86Global(name)) {
+        if (findName(&x86Globals, name) == -1) {
+            putName(&x86Globals, name, x86Globals.count);
+        }
+        sprintf(location, "g_%s(%%rip)", name);
+        return;
+    }
+    int slot = findName(&frame->slots, name);
+    if (slot == -1) {
+        slot = frame->slotCount++;
+        putName(&frame->slots, name, slot);
+    }
+    sprintf(location, "-%d(%%rbp)", 8 * (slot + 1));
+}
+
+// the bits of the operand into a 64 bit register
+void x86LoadRaw(X86Frame* frame, char* name, char* reg) {
+    ConstValue constant;
+    if (parseConstValue(name, &constant)) {
+        if (constant.kind == 'f') {
+            double value = strtod(name, NULL);
+            int64_t bits;
+            memcpy(&bits, &value, sizeof(bits));
+            emitX86("\tmovabsq $%lld, %%%s\n", (long long)bits, reg);
+        } else if (constant.kind == 's') {
+            int index = findName(&x86Strings, name);
+            if (index == -1) {
+                index = x86Strings.count;
+                putName(&x86Strings, name, index);
+            }
+            emitX86("\tleaq .LS%d(%%rip), %%%s\n", index, reg);
+        } else {
+            emitX86("\tmovq $%d, %%%s\n", constant.iValue, reg);
+        }
+        freeConstValue(&constant);
+        return;
+    }
+    char location[300];
+    x86Location(frame, name, location);
+    emitX86("\tmovq %s, %%%s\n", location, reg);
+}
+
+// converts the value in rax, xmm15 is the scratch register
+void x86Convert(char from, char to) {
+    if (to == 'f' && from != 'f') {
+        emitX86("\tcvtsi2sdq %%rax, %%xmm15\n");
+        emitX86("\tmovq %%xmm15, %%rax\n");
+    } else if (to != 'f' && from == 'f') {
+        emitX86("\tmovq %%rax, %%xmm15\n");
+        emitX86("\tcvttsd2siq %%xmm15, %%rax\n");
+        emitX86("\tmovslq %%eax, %%rax\n");
+    }
+}
+
+void x86LoadConverted(X86Frame* frame, char* name, char type) {
+    x86LoadRaw(frame, name, "rax");
+    x86Convert(x86OperandType(frame, name), type);
+}
+
+// stores rax holding a value of the given type, converted to the variable's own type
+void x86StoreResult(X86Frame* frame, char* name, char type) {
+    char declared = x86DeclaredType(name);
+    if (declared) {
+        x86Convert(type, declared);
+    } else {
+        putName(&frame->types, name, type);
+    }
+    char location[300];
+    x86Location(frame, name, location);
+    emitX86("\tmovq %%rax, %s\n", location);
+}
+
+/*--------------------------------------------------------------------------*/
+/* Quads */
+/*--------------------------------------------------------------------------*/
+
+void x86SetFlag(char* set) {
+    emitX86("\t%s %%al\n", set);
+    emitX86("\tmovzbq %%al, %%rax\n");
+}
+
+char* x86IntCompare(int op) {
+    const char* sets[] = {"setl", "setg", "setle", "setge", "sete", "setne"};
+    return (char*)sets[op - VM_LT];
+}
+
+// a NaN operand sets ZF, PF and CF, so lt and le compare the other way round and eq and ne also read PF
+void x86FloatCompare(int op) {
+    switch (op) {
+        case VM_LT: emitX86("\tucomisd %%xmm0, %%xmm1\n\tseta %%al\n"); break;
+        case VM_GT: emitX86("\tucomisd %%xmm1, %%xmm0\n\tseta %%al\n"); break;
+        case VM_LE: emitX86("\tucomisd %%xmm0, %%xmm1\n\tsetae %%al\n"); break;
+        case VM_GE: emitX86("\tucomisd %%xmm1, %%xmm0\n\tsetae %%al\n"); break;
+        case VM_EQ: emitX86("\tucomisd %%xmm1, %%xmm0\n\tsete %%al\n\tsetnp %%dl\n\tandb %%dl, %%al\n"); break;
+        default: emitX86("\tucomisd %%xmm1, %%xmm0\n\tsetne %%al\n\tsetp %%dl\n\torb %%dl, %%al\n"); break;
+    }
+    emitX86("\tmovzbq %%al, %%rax\n");
+}
+
+// a float in reg becomes 1 unless it equals 0.0, so -0.0 is false and NaN is true as on the VM
+void x86FloatTruth(char* reg, char* low) {
+    emitX86("\tmovq %%%s, %%xmm0\n", reg);
+    emitX86("\txorpd %%xmm1, %%xmm1\n");
+    emitX86("\tucomisd %%xmm1, %%xmm0\n");
+    emitX86("\tsetne %%%s\n\tsetp %%dl\n\torb %%dl, %%%s\n", low, low);
+    emitX86("\tmovzbq %%%s, %%%s\n", low, reg);
+}
+
+void x86Binary(X86Frame* frame, Quad* quad, int op) {
+    char left = x86OperandType(frame, quad->arg1);
+    char right = x86OperandType(frame, quad->arg2);
+    bool compare = op >= VM_LT && op <= VM_NE;
+
+    if (left == 's' || right == 's') {
+        x86LoadRaw(frame, quad->arg2, "rsi");
+        x86LoadRaw(frame, quad->arg1, "rdi");
+        if (op == VM_ADD) {
+            emitX86("\tcall rt_concat\n");
+            x86StoreResult(frame, quad->result, 's');
+        } else {
+            emitX86("\tcall rt_strcmp\n");
+            emitX86("\tcmpl $0, %%eax\n");
+            x86SetFlag(x86IntCompare(op));
+            x86StoreResult(frame, quad->result, 'b');
+        }
+        return;
+    }
+
+    if ((left == 'f' || right == 'f') && op <= VM_NE) {
+        x86LoadConverted(frame, quad->arg2, 'f');
+        emitX86("\tmovq %%rax, %%xmm1\n");
+        x86LoadConverted(frame, quad->arg1, 'f');
+        emitX86("\tmovq %%rax, %%xmm0\n");
+        if (compare) {
+            x86FloatCompare(op);
+            x86StoreResult(frame, quad->result, 'b');
+            return;
+        }
+        switch (op) {
+            case VM_ADD: emitX86("\taddsd %%xmm1, %%xmm0\n"); break;
+            case VM_SUB: emitX86("\tsubsd %%xmm1, %%xmm0\n"); break;
+            case VM_MUL: emitX86("\tmulsd %%xmm1, %%xmm0\n"); break;
+            case VM_DIV: emitX86("\tdivsd %%xmm1, %%xmm0\n"); break;
+            default: emitX86("\tcall rt_fmod\n"); break;
+        }
+        emitX86("\tmovq %%xmm0, %%rax\n");
+        x86StoreResult(frame, quad->result, 'f');
+        return;
+    }
+
+    x86LoadRaw(frame, quad->arg2, "rcx");
+    x86LoadRaw(frame, quad->arg1, "rax");
+    if (compare) {
+        emitX86("\tcmpl %%ecx, %%eax\n");
+        x86SetFlag(x86IntCompare(op));
+        x86StoreResult(frame, quad->result, 'b');
+        return;
+    }
+    if (op == VM_AND || op == VM_OR) {
+        if (left == 'f') {
+            x86FloatTruth("rax", "al");
+        }
+        if (right == 'f') {
+            x86FloatTruth("rcx", "cl");
+        }
+        emitX86("\ttestq %%rax, %%rax\n");
+        emitX86("\tsetne %%al\n");
+        emitX86("\ttestq %%rcx, %%rcx\n");
+        emitX86("\tsetne %%cl\n");
+        emitX86("\t%s %%cl, %%al\n", op == VM_AND ? "andb" : "orb");
+        emitX86("\tmovzbq %%al, %%rax\n");
+        x86StoreResult(frame, quad->result, 'b');
+        return;
+    }
+    switch (op) {
+        case VM_ADD: emitX86("\taddl %%ecx, %%eax\n"); break;
+        case VM_SUB: emitX86("\tsubl %%ecx, %%eax\n"); break;
+        case VM_MUL: emitX86("\timull %%ecx, %%eax\n"); break;
+        case VM_DIV:
+        case VM_MOD:
+        {
+            // idivl traps on INT_MIN / -1, a -1 divisor negates instead and leaves no remainder
+            int division = x86Divisions++;
+            emitX86("\ttestl %%ecx, %%ecx\n");
+            emitX86("\tjz rt_div_zero\n");
+            emitX86("\tcmpl $-1, %%ecx\n");
+            emitX86("\tjne .LDIV%d\n", division);
+            emitX86(op == VM_MOD ? "\txorl %%eax, %%eax\n" : "\tnegl %%eax\n");
+            emitX86("\tjmp .LDIVEND%d\n", division);
+            emitX86(".LDIV%d:\n", division);
+            emitX86("\tcltd\n");
+            emitX86("\tidivl %%ecx\n");
+            if (op == VM_MOD) {
+                emitX86("\tmovl %%edx, %%eax\n");
+            }
+            emitX86(".LDIVEND%d:\n", division);
+            break;
+        }
+        case VM_BIT_AND: emitX86("\tandl %%ecx, %%eax\n"); break;
+        case VM_BIT_OR: emitX86("\torl %%ecx, %%eax\n"); break;
+        case VM_XOR: emitX86("\txorl %%ecx, %%eax\n"); break;
+        case VM_SHL: emitX86("\tsall %%cl, %%eax\n"); break;
+        default: emitX86("\tsarl %%cl, %%eax\n"); break;
+    }
+    emitX86("\tmovslq %%eax, %%rax\n");
+    x86StoreResult(frame, quad->result, 'i');
+}
+
+void x86Unary(X86Frame* frame, Quad* quad) {
+    char type = x86OperandType(frame, quad->arg1);
+    x86LoadRaw(frame, quad->arg1, "rax");
+    if (strcmp(quad->op, "not") == 0) {
+        if (type == 'f') {
+            x86FloatTruth("rax", "al");
+        }
+        emitX86("\ttestq %%rax, %%rax\n");
+        x86SetFlag("sete");
+        x86StoreResult(frame, quad->result, 'b');
+    } else if (strcmp(quad->op, "minus") == 0 && type == 'f') {
+        emitX86("\tbtcq $63, %%rax\n");
+        x86StoreResult(frame, quad->result, 'f');
+    } else {
+        emitX86("\t%s %%eax\n", strcmp(quad->op, "minus") == 0 ? "negl" : "notl");
+        emitX86("\tmovslq %%eax, %%rax\n");
+        x86StoreResult(frame, quad->result, 'i');
+    }
+}
+
+void x86Print(X86Frame* frame, char* operand) {
+    char type = x86OperandType(frame, operand);
+    if (type == 'f') {
+        x86LoadRaw(frame, operand, "rax");
+        emitX86("\tmovq %%rax, %%xmm0\n");
+        emitX86("\tcall rt_print_float\n");
+        return;
+    }
+    x86LoadRaw(frame, operand, "rdi");
+    switch (type) {
+        case 'b': emitX86("\tcall rt_print_bool\n"); break;
+        case 'c': emitX86("\tcall rt_print_char\n"); break;
+        case 's': emitX86("\tcall rt_print_string\n"); break;
+        default: emitX86("\tcall rt_print_int\n"); break;
+    }
+}
+
+// the jump table goes to .rodata, entries are offsets from the table so it needs no relocations
+void x86JumpTable(X86Frame* frame, int index) {
+    Quad* quad = &quadList[index];
+    int count = atoi(quad->arg2);
+    int table = x86JumpTables++;
+    x86LoadRaw(frame, quad->arg1, "rax");
+    emitX86("\tcmpq $%d, %%rax\n", count);
+    emitX86("\tjae .L%s\n", quad->result);
+    emitX86("\tleaq .LJT%d(%%rip), %%rdx\n", table);
+    emitX86("\tmovslq (%%rdx,%%rax,4), %%rax\n");
+    emitX86("\taddq %%rdx, %%rax\n");
+    emitX86("\tjmp *%%rax\n");
+    emitX86("\t.section .rodata\n");
+    emitX86("\t.align 4\n");
+    emitX86(".LJT%d:\n", table);
+    for (int t = 1; t <= count && index + t < quadCount; t++) {
+        emitX86("\t.long .L%s - .LJT%d\n", quadList[index + t].result, table);
+    }
+    emitX86("\t.text\n");
+}
+
+void x86Quad(X86Frame* frame, int index, char* pushTypes) {
+    Quad* quad = &quadList[index];
+    int op = vmOpByName(quad->op);
+
+    if (op >= VM_ADD && op <= VM_SHR && op != VM_NOT && op != VM_MINUS && op != VM_BIT_NOT) {
+        x86Binary(frame, quad, op);
+    } else if (op == VM_NOT || op == VM_MINUS || op == VM_BIT_NOT) {
+        x86Unary(frame, quad);
+    } else if (strcmp(quad->op, "assign") == 0) {
+        char type = x86OperandType(frame, quad->arg1);
+        x86LoadRaw(frame, quad->arg1, "rax");
+        x86StoreResult(frame, quad->result, type);
+    } else if (isCondJumpQuad(quad)) {
+        x86LoadRaw(frame, quad->arg1, "rax");
+        if (x86OperandType(frame, quad->arg1) == 'f') {
+            x86FloatTruth("rax", "al");
+        }
+        emitX86("\ttestq %%rax, %%rax\n");
+        emitX86("\tjz .L%s\n", quad->result);
+    } else if (isCallQuad(quad)) {
+        X86Callee* callee = findX86Callee(quad->result);
+        emitX86("\tcall f_%s\n", quad->result + 5);
+        if (callee != NULL && callee->paramCount > 0) {
+            emitX86("\taddq $%d, %%rsp\n", 8 * callee->paramCount);
+        }
+        x86StoreResult(frame, "@ret", callee != NULL ? callee->returnType : 'i');
+    } else if (isJumpQuad(quad)) {
+        emitX86("\tjmp .L%s\n", quad->result);
+    } else if (isLabelQuad(quad)) {
+        emitX86(".L%s:\n", quad->result);
+    } else if (strcmp(quad->op, "return") == 0) {
+        if (strcmp(quad->result, "_") != 0 && frame->returnType != 'v') {
+            x86LoadConverted(frame, quad->result, frame->returnType);
+        }
+        emitX86("\tleave\n");
+        emitX86("\tret\n");
+    } else if (strcmp(quad->op, "push") == 0 || strcmp(quad->op, "push_const") == 0) {
+        char type = pushTypes[index] ? pushTypes[index] : x86OperandType(frame, quad->arg1);
+        x86LoadConverted(frame, quad->arg1, type);
+        emitX86("\tpushq %%rax\n");
+    } else if (strcmp(quad->op, "pop_param") == 0) {
+        // the last arg is right above the return address
+        emitX86("\tmovq %d(%%rbp), %%rax\n", 16 + 8 * frame->popParams++);
+        x86StoreResult(frame, quad->arg1, x86OperandType(frame, quad->arg1));
+    } else if (strcmp(quad->op, "print") == 0) {
+        x86Print(frame, quad->arg1);
+    } else if (strcmp(quad->op, "jtab") == 0) {
+        x86JumpTable(frame, index);
+    }
+    // jtarget is part of the table, func_label and nop emit nothing
+}
+
+/*--------------------------------------------------------------------------*/
+/* Functions */
+/*--------------------------------------------------------------------------*/
+
+bool hasX86LabelResult(Quad* quad) {
+    return isLabelQuad(quad) || isJumpQuad(quad) || isCondJumpQuad(quad) || isTableJumpQuad(quad)
+        || isCallQuad(quad);
+}
+
+// gives every push the type of the param it is for
+void typeX86Pushes(int start, int end, char* pushTypes) {
+    int* pushes = (int*)malloc((end - start + 1) * sizeof(int));
+    int pushCount = 0;
+    for (int i = start; i < end; i++) {
+        Quad* quad = &quadList[i];
+        if (strcmp(quad->op, "push") == 0 || strcmp(quad->op, "push_const") == 0) {
+            pushes[pushCount++] = i;
+        } else if (isCallQuad(quad)) {
+            X86Callee* callee = findX86Callee(quad->result);
+            if (callee == NULL || pushCount < callee->paramCount) {
+                pushCount = 0;
+                continue;
+            }
+            pushCount -= callee->paramCount;
+            for (int p = 0; p < callee->paramCount; p++) {
+                pushTypes[pushes[pushCount + p]] = callee->paramTypes[p];
+            }
+        }
+    }
+    free(pushes);
+}
+
+// gives every local of the quads a slot
+void prepareX86Frame(X86Frame* frame, int start, int end, char* pushTypes) {
+    char location[300];
+    for (int i = start; i < end; i++) {
+        Quad* quad = &quadList[i];
+        char* operands[] = {quad->arg1, quad->arg2, hasX86LabelResult(quad) ? "_" : quad->result};
+        for (int o = 0; o < 3; o++) {
+            if (isVarOperand(operands[o]) && strcmp(quad->op, "func_label") != 0) {
+                x86Location(frame, operands[o], location);
+            }
+        }
+    }
+    typeX86Pushes(start, end, pushTypes);
+}
+
+void initX86Frame(X86Frame* frame, char returnType) {
+    initNameTable(&frame->slots);
+    initNameTable(&frame->types);
+    frame->slotCount = 0;
+    frame->returnType = returnType;
+    frame->popParams = 0;
+}
+
+void freeX86Frame(X86Frame* frame) {
+    freeNameTable(&frame->slots);
+    freeNameTable(&frame->types);
+}
+
+// frame of 8 byte slots, zeroed like the variables of the VM
+void x86Prologue(char* label, X86Frame* frame) {
+    int size = (8 * frame->slotCount + 15) / 16 * 16;
+    emitX86("%s:\n", label);
+    emitX86("\tpushq %%rbp\n");
+    emitX86("\tmovq %%rsp, %%rbp\n");
+    if (size > 0) {
+        emitX86("\tsubq $%d, %%rsp\n", size);
+        emitX86("\tmovq %%rsp, %%rdi\n");
+        emitX86("\tmovl $%d, %%ecx\n", size / 8);
+        emitX86("\txorl %%eax, %%eax\n");
+        emitX86("\trep stosq\n");
+    }
+}
+
+void x86Function(int start, int end, char* pushTypes) {
+    char name[300];
+    snprintf(name, sizeof(name), "func_%s", quadList[start].arg1);
+    X86Callee* callee = findX86Callee(name);
+
+    X86Frame frame;
+    initX86Frame(&frame, callee->returnType);
+    prepareX86Frame(&frame, start, end, pushTypes);
+    snprintf(name, sizeof(name), "f_%s", quadList[start].arg1);
+    x86Prologue(name, &frame);
+    for (int i = start + 1; i < end; i++) {
+        x86Quad(&frame, i, pushTypes);
+    }
+    emitX86("\tleave\n");
+    emitX86("\tret\n");
+    freeX86Frame(&frame);
+}
+
+// global code runs in main before func_main is called, main's params are 0
+void x86Main(char* pushTypes) {
+    X86Frame frame;
+    initX86Frame(&frame, 'v');
+    for (int start = 0; start < quadCount; start = regionEnd(start)) {
+        if (quadList[start].function == NULL) {
+            prepareX86Frame(&frame, start, regionEnd(start), pushTypes);
+        }
+    }
+
+    emitX86("\t.globl main\n");
+    x86Prologue("main", &frame);
+    for (int i = 0; i < quadCount; i++) {
+        if (quadList[i].function == NULL) {
+            x86Quad(&frame, i, pushTypes);
+        }
+    }
+    X86Callee* callee = findX86Callee("func_main");
+    for (int p = 0; p < callee->paramCount; p++) {
+        emitX86("\tpushq $0\n");
+    }
+    emitX86("\tcall f_main\n");
+    emitX86("\txorl %%eax, %%eax\n");
+    emitX86("\tleave\n");
+    emitX86("\tret\n");
+    freeX86Frame(&frame);
+}
+
+void x86Runtime() {
+    emitX86("\n# runtime, each entry realigns the stack for libc\n");
+    emitX86("\t.section .rodata\n");
+    emitX86(".LRT_int:\n\t.string \"%%d\\n\"\n");
+    emitX86(".LRT_float:\n\t.string \"%%g\\n\"\n");
+    emitX86(".LRT_char:\n\t.string \"%%c\\n\"\n");
+    emitX86(".LRT_true:\n\t.string \"true\"\n");
+    emitX86(".LRT_false:\n\t.string \"false\"\n");
+    emitX86(".LRT_div:\n\t.ascii \"Runtime error: division by zero\\n\"\n");
+    emitX86(".LRT_div_end:\n");
+    emitX86("\t.text\n");
+
+    const char* formats[] = {"rt_print_int", ".LRT_int", "rt_print_char", ".LRT_char", NULL};
+    for (int f = 0; formats[f] != NULL; f += 2) {
+        emitX86("%s:\n", formats[f]);
+        emitX86("\tpushq %%rbp\n\tmovq %%rsp, %%rbp\n\tandq $-16, %%rsp\n");
+        emitX86("\tmovl %%edi, %%esi\n");
+        emitX86("\tleaq %s(%%rip), %%rdi\n", formats[f + 1]);
+        emitX86("\txorl %%eax, %%eax\n");
+        emitX86("\tcall printf@PLT\n\tleave\n\tret\n");
+    }
+    emitX86("rt_print_float:\n");
+    emitX86("\tpushq %%rbp\n\tmovq %%rsp, %%rbp\n\tandq $-16, %%rsp\n");
+    emitX86("\tleaq .LRT_float(%%rip), %%rdi\n");
+    emitX86("\tmovl $1, %%eax\n");
+    emitX86("\tcall printf@PLT\n\tleave\n\tret\n");
+    emitX86("rt_print_bool:\n");
+    emitX86("\tleaq .LRT_true(%%rip), %%rax\n");
+    emitX86("\tleaq .LRT_false(%%rip), %%rdx\n");
+    emitX86("\ttestq %%rdi, %%rdi\n");
+    emitX86("\tcmovz %%rdx, %%rax\n");
+    emitX86("\tmovq %%rax, %%rdi\n");
+    // falls through to print the word
+    emitX86("rt_print_string:\n");
+    emitX86("\tpushq %%rbp\n\tmovq %%rsp, %%rbp\n\tandq $-16, %%rsp\n");
+    emitX86("\tcall puts@PLT\n\tleave\n\tret\n");
+    emitX86("rt_strcmp:\n");
+    emitX86("\tpushq %%rbp\n\tmovq %%rsp, %%rbp\n\tandq $-16, %%rsp\n");
+    emitX86("\tcall strcmp@PLT\n\tleave\n\tret\n");
+
+    // rdi + rsi into a new string
+    emitX86("rt_concat:\n");
+    emitX86("\tpushq %%rbp\n\tmovq %%rsp, %%rbp\n");
+    emitX86("\tpushq %%rbx\n\tpushq %%r12\n\tpushq %%r13\n\tpushq %%r14\n");
+    emitX86("\tmovq %%rdi, %%rbx\n\tmovq %%rsi, %%r12\n");
+    emitX86("\tcall strlen@PLT\n\tmovq %%rax, %%r13\n");
+    emitX86("\tmovq %%r12, %%rdi\n\tcall strlen@PLT\n\tmovq %%rax, %%r14\n");
+    emitX86("\tleaq 1(%%r13,%%r14), %%rdi\n\tcall malloc@PLT\n");
+    emitX86("\tmovq %%rax, %%rdi\n\tmovq %%rbx, %%rsi\n\tmovq %%rax, %%rbx\n\tmovq %%r13, %%rdx\n");
+    emitX86("\tcall memcpy@PLT\n");
+    emitX86("\tleaq (%%rbx,%%r13), %%rdi\n\tmovq %%r12, %%rsi\n\tleaq 1(%%r14), %%rdx\n");
+    emitX86("\tcall memcpy@PLT\n");
+    emitX86("\tmovq %%rbx, %%rax\n");
+    emitX86("\tmovq -8(%%rbp), %%rbx\n\tmovq -16(%%rbp), %%r12\n\tmovq -24(%%rbp), %%r13\n\tmovq -32(%%rbp), %%r14\n");
+    emitX86("\tleave\n\tret\n");
+
+    // xmm0 % xmm1 with the x87 partial remainder, like fmod
+    emitX86("rt_fmod:\n");
+    emitX86("\tsubq $24, %%rsp\n");
+    emitX86("\tmovsd %%xmm1, (%%rsp)\n\tmovsd %%xmm0, 8(%%rsp)\n");
+    emitX86("\tfldl (%%rsp)\n\tfldl 8(%%rsp)\n");
+    emitX86("1:\n\tfprem\n\tfnstsw %%ax\n\ttestw $0x400, %%ax\n\tjnz 1b\n");
+    emitX86("\tfstpl 8(%%rsp)\n\tfstp %%st(0)\n");
+    emitX86("\tmovsd 8(%%rsp), %%xmm0\n");
+    emitX86("\taddq $24, %%rsp\n\tret\n");
+
+    emitX86("rt_div_zero:\n");
+    emitX86("\tandq $-16, %%rsp\n");
+    emitX86("\tmovl $2, %%edi\n");
+    emitX86("\tleaq .LRT_div(%%rip), %%rsi\n");
+    emitX86("\tmovl $.LRT_div_end - .LRT_div, %%edx\n");
+    emitX86("\tcall write@PLT\n");
+    emitX86("\tmovl $1, %%edi\n");
+    emitX86("\tcall exit@PLT\n");
+}
+
+void x86Data() {
+    emitX86("\n\t.section .rodata\n");
+    for (int i = 0; i < x86Strings.capacity; i++) {
+        if (x86Strings.keys[i] != NULL) {
+            emitX86(".LS%d:\n\t.string %s\n", x86Strings.values[i], x86Strings.keys[i]);
+        }
+    }
+    emitX86("\t.bss\n");
+    emitX86("\t.align 8\n");
+    for (int i = 0; i < x86Globals.capacity; i++) {
+        if (x86Globals.keys[i] != NULL) {
+            emitX86("g_%s:\n\t.zero 8\n", x86Globals.keys[i]);
+        }
+    }
+    emitX86("\t.section .note.GNU-stack,\"\",@progbits\n");
+}
+
+void writeX86() {
+    setFilePath(&x86FileHandler, "x86.s");
+    initNameTable(&x86Strings);
+    initNameTable(&x86Globals);
+    collectX86Callees();
+    if (findX86Callee("func_main") == NULL) {
+        fprintf(stderr, "x86: the program has no main function\n");
+        freeX86Callees();
+        freeNameTable(&x86Strings);
+        freeNameTable(&x86Globals);
+        return;
+    }
+
+    char* pushTypes = (char*)calloc(quadCount + 1, 1);
+    emitX86("\t.text\n");
+    x86Main(pushTypes);
+    int functions = 0;
+    for (int start = 0; start < quadCount; start = regionEnd(start)) {
+        if (strcmp(quadList[start].op, "func_label") == 0) {
+            x86Function(start, regionEnd(start), pushTypes);
+            functions++;
+        }
+    }
+    x86Runtime();
+    x86Data();
+    printf("x86: %d functions, %d instructions, %d jump tables written to x86.s\n",
+           functions, x86Instructions, x86JumpTables);
+
+    free(pushTypes);
+    freeX86Callees();
+    freeNameTable(&x86Strings);
+    freeNameTable(&x86Globals);
+}
+
+#endif